@@ -0,0 +1,250 @@
+#include "camera-calibration.h"
+#include "options.h"
+#include "log.h"
+#include "util.h"
+
+#include <vector>
+#include <sstream>
+#include <math.h>
+
+#define PI (3.14159265f)
+
+CameraCalibration::CameraCalibration(const std::string &s) :
+    width(0), height(0), yaw(0.0f), pitch(0.0f), roll(0.0f), fov(90.0f)
+{
+    std::vector<std::string> elems;
+
+    Util::split(s, ':', elems, Util::SplitModeNormal);
+
+    for (std::vector<std::string>::const_iterator iter = elems.begin();
+         iter != elems.end();
+         iter++) {
+        std::vector<std::string> opt;
+
+        Util::split(*iter, '=', opt, Util::SplitModeNormal);
+        if (opt.size() == 2) {
+            if (opt[0] == "file")
+                file = opt[1];
+            else if (opt[0] == "size")
+                Options::parse_size(opt[1], width, height);
+            else if (opt[0] == "yaw")
+                yaw = Util::fromString<float>(opt[1]);
+            else if (opt[0] == "pitch")
+                pitch = Util::fromString<float>(opt[1]);
+            else if (opt[0] == "roll")
+                roll = Util::fromString<float>(opt[1]);
+            else if (opt[0] == "fov")
+                fov = Util::fromString<float>(opt[1]);
+        } else
+            Log::info("Warning: ignoring invalid option string '%s' "
+                      "in camera description\n",
+                      iter->c_str());
+    }
+}
+
+DualFisheyeCalibration::DualFisheyeCalibration(const std::string &s) :
+    fov(190.0f), front_x(0.25f), front_y(0.5f),
+    back_x(0.75f), back_y(0.5f), radius(0.25f)
+{
+    std::vector<std::string> elems;
+
+    Util::split(s, ':', elems, Util::SplitModeNormal);
+
+    for (std::vector<std::string>::const_iterator iter = elems.begin();
+         iter != elems.end();
+         iter++) {
+        std::vector<std::string> opt;
+
+        Util::split(*iter, '=', opt, Util::SplitModeNormal);
+        if (opt.size() == 2) {
+            if (opt[0] == "fov")
+                fov = Util::fromString<float>(opt[1]);
+            else if (opt[0] == "cx0")
+                front_x = Util::fromString<float>(opt[1]);
+            else if (opt[0] == "cy0")
+                front_y = Util::fromString<float>(opt[1]);
+            else if (opt[0] == "cx1")
+                back_x = Util::fromString<float>(opt[1]);
+            else if (opt[0] == "cy1")
+                back_y = Util::fromString<float>(opt[1]);
+            else if (opt[0] == "radius")
+                radius = Util::fromString<float>(opt[1]);
+        } else
+            Log::info("Warning: ignoring invalid option string '%s' "
+                      "in fisheye description\n",
+                      iter->c_str());
+    }
+}
+
+/* Multiplies two row-major 3x3 matrices: out = a * b */
+static void multiply3(const float *a, const float *b, float *out)
+{
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 3; c++) {
+            out[r * 3 + c] = a[r * 3 + 0] * b[0 * 3 + c] +
+                             a[r * 3 + 1] * b[1 * 3 + c] +
+                             a[r * 3 + 2] * b[2 * 3 + c];
+        }
+    }
+}
+
+/*
+ * Gets the rotation from panorama space into the space of a camera with the
+ * given orientation (in degrees), +Z being the optical axis.
+ */
+static void camera_rotation(float yaw, float pitch, float roll, float *rotation)
+{
+    float y = yaw * PI / 180.0f;
+    float p = pitch * PI / 180.0f;
+    float r = roll * PI / 180.0f;
+
+    const float ry[9] = {
+        cosf(y),  0.0f, sinf(y),
+        0.0f,     1.0f, 0.0f,
+        -sinf(y), 0.0f, cosf(y)
+    };
+    const float rx[9] = {
+        1.0f, 0.0f,    0.0f,
+        0.0f, cosf(p), -sinf(p),
+        0.0f, sinf(p), cosf(p)
+    };
+    const float rz[9] = {
+        cosf(r), -sinf(r), 0.0f,
+        sinf(r), cosf(r),  0.0f,
+        0.0f,    0.0f,     1.0f
+    };
+
+    // Orientation of the camera in panorama space
+    float tmp[9];
+    float m[9];
+    multiply3(ry, rx, tmp);
+    multiply3(tmp, rz, m);
+
+    // The camera axes in panorama space are the columns of m (the
+    // forward axis being -Z); they form the rows of the inverse rotation.
+    for (int c = 0; c < 3; c++) {
+        rotation[c * 3 + 0] = m[c * 3 + 0];
+        rotation[c * 3 + 1] = m[c * 3 + 1];
+        rotation[c * 3 + 2] = -m[c * 3 + 2];
+    }
+}
+
+void CameraCalibration::rotation(float *rotation) const
+{
+    camera_rotation(yaw, pitch, roll, rotation);
+}
+
+void CameraCalibration::focal(float *focal) const
+{
+    float f = 0.5f / tanf(fov * PI / 360.0f);
+
+    focal[0] = f;
+    focal[1] = height > 0 ? f * width / height : f;
+}
+
+LensCalibration::LensCalibration(const std::string &s) :
+    width(0), height(0), fx(0.0f), fy(0.0f), cx(0.0f), cy(0.0f),
+    fov(180.0f), yaw(0.0f), pitch(0.0f), roll(0.0f)
+{
+    std::vector<std::string> elems;
+
+    k[0] = k[1] = k[2] = k[3] = 0.0f;
+
+    Util::split(s, ':', elems, Util::SplitModeNormal);
+
+    for (std::vector<std::string>::const_iterator iter = elems.begin();
+         iter != elems.end();
+         iter++) {
+        std::vector<std::string> opt;
+
+        Util::split(*iter, '=', opt, Util::SplitModeNormal);
+        if (opt.size() == 2) {
+            if (opt[0] == "size")
+                Options::parse_size(opt[1], width, height);
+            else if (opt[0] == "fx")
+                fx = Util::fromString<float>(opt[1]);
+            else if (opt[0] == "fy")
+                fy = Util::fromString<float>(opt[1]);
+            else if (opt[0] == "cx")
+                cx = Util::fromString<float>(opt[1]);
+            else if (opt[0] == "cy")
+                cy = Util::fromString<float>(opt[1]);
+            else if (opt[0] == "k1")
+                k[0] = Util::fromString<float>(opt[1]);
+            else if (opt[0] == "k2")
+                k[1] = Util::fromString<float>(opt[1]);
+            else if (opt[0] == "k3")
+                k[2] = Util::fromString<float>(opt[1]);
+            else if (opt[0] == "k4")
+                k[3] = Util::fromString<float>(opt[1]);
+            else if (opt[0] == "fov")
+                fov = Util::fromString<float>(opt[1]);
+            else if (opt[0] == "yaw")
+                yaw = Util::fromString<float>(opt[1]);
+            else if (opt[0] == "pitch")
+                pitch = Util::fromString<float>(opt[1]);
+            else if (opt[0] == "roll")
+                roll = Util::fromString<float>(opt[1]);
+        } else
+            Log::info("Warning: ignoring invalid option string '%s' "
+                      "in lens description\n",
+                      iter->c_str());
+    }
+
+    // Default to a centered equidistant lens spanning the image height
+    if (cx == 0.0f && cy == 0.0f) {
+        cx = width / 2.0f;
+        cy = height / 2.0f;
+    }
+    if (fx == 0.0f)
+        fx = height / (fov * PI / 180.0f);
+    if (fy == 0.0f)
+        fy = fx;
+}
+
+void LensCalibration::rotation(float *rotation) const
+{
+    camera_rotation(yaw, pitch, roll, rotation);
+}
+
+bool LensCalibration::project(const float *d, float &u, float &v) const
+{
+    float len = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+    float theta = acosf(d[2] / len);
+    float limit = fov * PI / 360.0f;
+    bool seen = theta <= limit;
+
+    if (!seen)
+        theta = limit;
+
+    float t2 = theta * theta;
+    float theta_d = theta * (1.0f + t2 * (k[0] + t2 * (k[1] + t2 * (k[2] + t2 * k[3]))));
+    float r = sqrtf(d[0] * d[0] + d[1] * d[1]);
+    float cos_phi = r > 0.0f ? d[0] / r : 1.0f;
+    float sin_phi = r > 0.0f ? d[1] / r : 0.0f;
+
+    u = (fx * theta_d * cos_phi + cx) / width;
+    v = (-fy * theta_d * sin_phi + cy) / height;
+
+    if (u < 0.0f || u > 1.0f || v < 0.0f || v > 1.0f) {
+        u = u < 0.0f ? 0.0f : (u > 1.0f ? 1.0f : u);
+        v = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+        seen = false;
+    }
+
+    return seen;
+}
+
+std::string LensCalibration::id() const
+{
+    std::stringstream ss;
+
+    ss.precision(9);
+    ss << "size=" << width << "x" << height
+       << ":fx=" << fx << ":fy=" << fy << ":cx=" << cx << ":cy=" << cy
+       << ":k1=" << k[0] << ":k2=" << k[1] << ":k3=" << k[2] << ":k4=" << k[3]
+       << ":fov=" << fov << ":yaw=" << yaw << ":pitch=" << pitch
+       << ":roll=" << roll;
+
+    return ss.str();
+}
@@ -0,0 +1,140 @@
+#ifndef CAMERA_CALIBRATION_H_
+#define CAMERA_CALIBRATION_H_
+
+#include <string>
+
+/**
+ * Placement and lens of one camera of a stitching rig.
+ *
+ * The camera is modelled as a pinhole with the given horizontal field of
+ * view. At yaw = pitch = roll = 0 it looks down the -Z axis of the
+ * panorama sphere with +Y up.
+ */
+class CameraCalibration
+{
+public:
+    CameraCalibration():
+        width(0), height(0), yaw(0.0f), pitch(0.0f), roll(0.0f), fov(90.0f) {}
+    /**
+     * Parses a 'file=PATH:size=WxH(:opt=val)*' description.
+     */
+    CameraCalibration(const std::string &s);
+
+    /**
+     * Gets the rotation from panorama space into camera space.
+     *
+     * @param rotation the 9 element column-major matrix to fill
+     */
+    void rotation(float *rotation) const;
+
+    /**
+     * Gets the focal lengths in units of the image width and height.
+     *
+     * @param focal the 2 element vector to fill
+     */
+    void focal(float *focal) const;
+
+    std::string file;
+    int width;
+    int height;
+    float yaw;
+    float pitch;
+    float roll;
+    float fov;
+};
+
+/**
+ * Lenses of a dual-fisheye 360 degree camera.
+ *
+ * Both lens circles are stored side by side in one image. The front lens
+ * looks down the -Z axis of the panorama sphere, the back lens down +Z.
+ * The lenses are modelled as equidistant fisheyes, i.e. the distance from
+ * the circle center grows linearly with the angle from the optical axis.
+ * Centers and radius are given as fractions of the image width (and
+ * height for the vertical center).
+ */
+class DualFisheyeCalibration
+{
+public:
+    DualFisheyeCalibration():
+        fov(190.0f), front_x(0.25f), front_y(0.5f),
+        back_x(0.75f), back_y(0.5f), radius(0.25f) {}
+    /**
+     * Parses a '(opt=val)(:opt=val)*' description with the options fov,
+     * cx0, cy0 (front center), cx1, cy1 (back center) and radius.
+     */
+    DualFisheyeCalibration(const std::string &s);
+
+    float fov;
+    float front_x;
+    float front_y;
+    float back_x;
+    float back_y;
+    float radius;
+};
+
+/**
+ * An arbitrary lens, described by the polynomial fisheye model used by
+ * common calibration tools:
+ *
+ *   theta_d = theta * (1 + k1 theta^2 + k2 theta^4 + k3 theta^6 + k4 theta^8)
+ *   x = fx * theta_d * cos(phi) + cx,  y = -fy * theta_d * sin(phi) + cy
+ *
+ * with theta the angle from the optical axis and (x, y) in pixels of the
+ * width x height source image. Orientation follows CameraCalibration, fov
+ * limits the angle the lens covers.
+ */
+class LensCalibration
+{
+public:
+    LensCalibration():
+        width(0), height(0), fx(0.0f), fy(0.0f), cx(0.0f), cy(0.0f),
+        fov(180.0f), yaw(0.0f), pitch(0.0f), roll(0.0f)
+    {
+        k[0] = k[1] = k[2] = k[3] = 0.0f;
+    }
+    /**
+     * Parses a 'size=WxH(:opt=val)*' description with the options fx, fy,
+     * cx, cy, k1, k2, k3, k4, fov, yaw, pitch and roll.
+     */
+    LensCalibration(const std::string &s);
+
+    /**
+     * Gets the rotation from panorama space into lens space.
+     *
+     * @param rotation the 9 element column-major matrix to fill
+     */
+    void rotation(float *rotation) const;
+
+    /**
+     * Projects a lens space direction into the source image. Directions
+     * the lens doesn't see get the closest point on the rim of the image
+     * circle or the image.
+     *
+     * @param d the direction, +Z being the optical axis
+     * @param u the horizontal image coordinate in [0, 1]
+     * @param v the vertical image coordinate in [0, 1]
+     *
+     * @return whether the direction is seen by the lens
+     */
+    bool project(const float *d, float &u, float &v) const;
+
+    /**
+     * Gets a string that uniquely identifies the calibration.
+     */
+    std::string id() const;
+
+    int width;
+    int height;
+    float fx;
+    float fy;
+    float cx;
+    float cy;
+    float k[4];
+    float fov;
+    float yaw;
+    float pitch;
+    float roll;
+};
+
+#endif /* CAMERA_CALIBRATION_H_ */
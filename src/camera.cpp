@@ -0,0 +1,142 @@
+#include "camera.h"
+
+#include <math.h>
+
+#define PI (3.14159265f)
+
+static const float projection[16] = {
+    167.81992,   0.0,       0.0,        0.0,
+    0.0,         167.81992, 0.0,        0.0,
+    0.0,         0.0,       -202.01006, -200.0,
+    0.025592538, 0.0,       -1.0050251, 0.0
+};
+
+/* Multiplies two column-major 4x4 matrices: out = a * b */
+static void multiply(const float *a, const float *b, float *out)
+{
+    for (int c = 0; c < 4; c++) {
+        for (int r = 0; r < 4; r++) {
+            float v = 0.0f;
+            for (int k = 0; k < 4; k++)
+                v += a[k * 4 + r] * b[c * 4 + k];
+            out[c * 4 + r] = v;
+        }
+    }
+}
+
+/* Inverts a column-major 4x4 matrix by cofactor expansion */
+static bool invert(const float *m, float *out)
+{
+    float inv[16];
+
+    inv[0] = m[5] * m[10] * m[15] - m[5] * m[11] * m[14] - m[9] * m[6] * m[15] +
+             m[9] * m[7] * m[14] + m[13] * m[6] * m[11] - m[13] * m[7] * m[10];
+    inv[4] = -m[4] * m[10] * m[15] + m[4] * m[11] * m[14] + m[8] * m[6] * m[15] -
+             m[8] * m[7] * m[14] - m[12] * m[6] * m[11] + m[12] * m[7] * m[10];
+    inv[8] = m[4] * m[9] * m[15] - m[4] * m[11] * m[13] - m[8] * m[5] * m[15] +
+             m[8] * m[7] * m[13] + m[12] * m[5] * m[11] - m[12] * m[7] * m[9];
+    inv[12] = -m[4] * m[9] * m[14] + m[4] * m[10] * m[13] + m[8] * m[5] * m[14] -
+              m[8] * m[6] * m[13] - m[12] * m[5] * m[10] + m[12] * m[6] * m[9];
+    inv[1] = -m[1] * m[10] * m[15] + m[1] * m[11] * m[14] + m[9] * m[2] * m[15] -
+             m[9] * m[3] * m[14] - m[13] * m[2] * m[11] + m[13] * m[3] * m[10];
+    inv[5] = m[0] * m[10] * m[15] - m[0] * m[11] * m[14] - m[8] * m[2] * m[15] +
+             m[8] * m[3] * m[14] + m[12] * m[2] * m[11] - m[12] * m[3] * m[10];
+    inv[9] = -m[0] * m[9] * m[15] + m[0] * m[11] * m[13] + m[8] * m[1] * m[15] -
+             m[8] * m[3] * m[13] - m[12] * m[1] * m[11] + m[12] * m[3] * m[9];
+    inv[13] = m[0] * m[9] * m[14] - m[0] * m[10] * m[13] - m[8] * m[1] * m[14] +
+              m[8] * m[2] * m[13] + m[12] * m[1] * m[10] - m[12] * m[2] * m[9];
+    inv[2] = m[1] * m[6] * m[15] - m[1] * m[7] * m[14] - m[5] * m[2] * m[15] +
+             m[5] * m[3] * m[14] + m[13] * m[2] * m[7] - m[13] * m[3] * m[6];
+    inv[6] = -m[0] * m[6] * m[15] + m[0] * m[7] * m[14] + m[4] * m[2] * m[15] -
+             m[4] * m[3] * m[14] - m[12] * m[2] * m[7] + m[12] * m[3] * m[6];
+    inv[10] = m[0] * m[5] * m[15] - m[0] * m[7] * m[13] - m[4] * m[1] * m[15] +
+              m[4] * m[3] * m[13] + m[12] * m[1] * m[7] - m[12] * m[3] * m[5];
+    inv[14] = -m[0] * m[5] * m[14] + m[0] * m[6] * m[13] + m[4] * m[1] * m[14] -
+              m[4] * m[2] * m[13] - m[12] * m[1] * m[6] + m[12] * m[2] * m[5];
+    inv[3] = -m[1] * m[6] * m[11] + m[1] * m[7] * m[10] + m[5] * m[2] * m[11] -
+             m[5] * m[3] * m[10] - m[9] * m[2] * m[7] + m[9] * m[3] * m[6];
+    inv[7] = m[0] * m[6] * m[11] - m[0] * m[7] * m[10] - m[4] * m[2] * m[11] +
+             m[4] * m[3] * m[10] + m[8] * m[2] * m[7] - m[8] * m[3] * m[6];
+    inv[11] = -m[0] * m[5] * m[11] + m[0] * m[7] * m[9] + m[4] * m[1] * m[11] -
+              m[4] * m[3] * m[9] - m[8] * m[1] * m[7] + m[8] * m[3] * m[5];
+    inv[15] = m[0] * m[5] * m[10] - m[0] * m[6] * m[9] - m[4] * m[1] * m[10] +
+              m[4] * m[2] * m[9] + m[8] * m[1] * m[6] - m[8] * m[2] * m[5];
+
+    float det = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
+    if (det == 0.0f)
+        return false;
+
+    for (int i = 0; i < 16; i++)
+        out[i] = inv[i] / det;
+
+    return true;
+}
+
+/* Maps a point in normalized device coordinates back through @inv */
+static void unproject(const float *inv, float x, float y, float z, float *out)
+{
+    float p[4];
+
+    for (int r = 0; r < 4; r++)
+        p[r] = inv[r] * x + inv[4 + r] * y + inv[8 + r] * z + inv[12 + r];
+
+    for (int r = 0; r < 3; r++)
+        out[r] = p[r] / p[3];
+}
+
+void Camera::ray(float x, float y, float *direction) const
+{
+    float m[16];
+    float inv[16];
+    float near[3];
+    float far[3];
+
+    mvp(m);
+    if (!invert(m, inv)) {
+        direction[0] = 0.0f;
+        direction[1] = 0.0f;
+        direction[2] = -1.0f;
+        return;
+    }
+
+    // Two points in front of the camera on the line of sight through the
+    // point; the projection has its far plane at a depth of about 1.005
+    unproject(inv, x, y, 0.6f, near);
+    unproject(inv, x, y, 1.0f, far);
+
+    float len = 0.0f;
+    for (int i = 0; i < 3; i++) {
+        direction[i] = far[i] - near[i];
+        len += direction[i] * direction[i];
+    }
+
+    len = sqrtf(len);
+    for (int i = 0; i < 3; i++)
+        direction[i] /= len;
+}
+
+void Camera::mvp(float *mvp) const
+{
+    float y = yaw_ * PI / 180.0f;
+    float p = pitch_ * PI / 180.0f;
+
+    // Rotation around the vertical (second) axis of the sphere
+    const float yaw_rotation[16] = {
+        cosf(y), 0.0f, -sinf(y), 0.0f,
+        0.0f,    1.0f, 0.0f,     0.0f,
+        sinf(y), 0.0f, cosf(y),  0.0f,
+        0.0f,    0.0f, 0.0f,     1.0f
+    };
+
+    // Rotation around the horizontal axis
+    const float pitch_rotation[16] = {
+        1.0f, 0.0f,     0.0f,    0.0f,
+        0.0f, cosf(p),  sinf(p), 0.0f,
+        0.0f, -sinf(p), cosf(p), 0.0f,
+        0.0f, 0.0f,     0.0f,    1.0f
+    };
+
+    float view[16];
+    multiply(pitch_rotation, yaw_rotation, view);
+    multiply(projection, view, mvp);
+}
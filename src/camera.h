@@ -0,0 +1,53 @@
+#ifndef CAMERA_H_
+#define CAMERA_H_
+
+/**
+ * A view from the center of the panorama sphere.
+ *
+ * The camera combines the fixed projection used by the renderer with a
+ * rotation, so that every output can look in its own direction.
+ */
+class Camera
+{
+public:
+    Camera() : yaw_(0.0f), pitch_(0.0f) {}
+    Camera(float yaw, float pitch) : yaw_(yaw), pitch_(pitch) {}
+
+    /**
+     * Sets the horizontal viewing angle.
+     *
+     * @param degrees the rotation around the vertical axis
+     */
+    void yaw(float degrees) { yaw_ = degrees; }
+    float yaw() const { return yaw_; }
+
+    /**
+     * Sets the vertical viewing angle.
+     *
+     * @param degrees the rotation around the horizontal axis
+     */
+    void pitch(float degrees) { pitch_ = degrees; }
+    float pitch() const { return pitch_; }
+
+    /**
+     * Gets the model-view-projection matrix for the current view.
+     *
+     * @param mvp the 16 element column-major matrix to fill
+     */
+    void mvp(float *mvp) const;
+
+    /**
+     * Gets the direction the camera sees at a point of the output.
+     *
+     * @param x the horizontal position in normalized device coordinates
+     * @param y the vertical position in normalized device coordinates
+     * @param direction the 3 element unit vector to fill
+     */
+    void ray(float x, float y, float *direction) const;
+
+private:
+    float yaw_;
+    float pitch_;
+};
+
+#endif /* CAMERA_H_ */
@@ -1,11 +1,64 @@
 #include "canvas-generic.h"
 #include "native-state.h"
 #include "gl-state.h"
+#include "gl-state-cache.h"
 #include "log.h"
 #include "util.h"
 
 #include <fstream>
 #include <sstream>
+#include <algorithm>
+#include <time.h>
+
+/* Share of the refresh period the GPU may spend on a frame */
+static const double GPU_BUDGET = 0.75;
+
+/* Stretches the rendered part of the scene texture over the output */
+static const char upsample_vertex_shader[] =
+    "attribute vec2 position;\n"
+    "uniform vec2 scale;\n"
+    "varying vec2 texcoord;\n"
+    "void main() {\n"
+    "    texcoord = (position * 0.5 + 0.5) * scale;\n"
+    "    gl_Position = vec4(position, 0.0, 1.0);\n"
+    "}\n";
+
+static const char upsample_fragment_shader[] =
+    "precision mediump float;\n"
+    "uniform sampler2D scene;\n"
+    "uniform vec2 limit;\n"
+    "varying vec2 texcoord;\n"
+    "void main() {\n"
+    "    gl_FragColor = texture2D(scene, min(texcoord, limit));\n"
+    "}\n";
+
+static double now_seconds()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static GLuint compile_shader(GLenum type, const char *source)
+{
+    GLuint shader = glCreateShader(type);
+    GLint compiled = 0;
+
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    if (!compiled) {
+        char log[512];
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        Log::error("CanvasGeneric: Could not compile shader: %s\n", log);
+        glDeleteShader(shader);
+        return 0;
+    }
+
+    return shader;
+}
 
 /******************
  * Public methods *
@@ -24,6 +77,7 @@ bool CanvasGeneric::init()
 bool CanvasGeneric::reset()
 {
     release_fbo();
+    release_scaling();
 
     if (!gl_state_.reset())
         return false;
@@ -43,6 +97,9 @@ bool CanvasGeneric::reset()
 
     glViewport(0, 0, width_, height_);
 
+    if (scaling())
+        scaling_.resize(native_state_.outputs());
+
     glEnable(GL_DEPTH_TEST);
     glDepthFunc(GL_LEQUAL);
     glEnable(GL_CULL_FACE);
@@ -63,13 +120,33 @@ void CanvasGeneric::clear()
 {
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     glClearDepthf(1.0f);
+
+    /* only the part of the scene texture the output renders to */
+    if (scaling()) {
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(0, 0, render_width_, render_height_);
+    }
+
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    if (scaling())
+        glDisable(GL_SCISSOR_TEST);
 }
 
-void CanvasGeneric::update()
+bool CanvasGeneric::update()
 {
+    if (scaling()) {
+        end_frame_timing();
+        upsample();
+    }
+
     gl_state_.swap();
-    native_state_.flip();
+    bool flipped = native_state_.flip();
+
+    if (scaling())
+        finish_frame_timing();
+
+    return flipped;
 }
 
 void CanvasGeneric::print_info()
@@ -121,6 +198,70 @@ void CanvasGeneric::resize(int width, int height)
     glViewport(0, 0, width_, height_);
 }
 
+unsigned int CanvasGeneric::outputs()
+{
+    return native_state_.outputs();
+}
+
+bool CanvasGeneric::select_output(unsigned int output)
+{
+    if (output >= native_state_.outputs())
+        return false;
+
+    NativeState::WindowProperties properties;
+
+    native_state_.select_output(output);
+    native_window_ = native_state_.window(properties);
+    width_ = properties.width;
+    height_ = properties.height;
+    current_output_ = output;
+
+    if (!do_make_current())
+        return false;
+
+    if (scaling()) {
+        /* finished measurements may change the scale of this frame */
+        begin_frame_timing();
+
+        float scale = scaling_[output].scaler.scale();
+        render_width_ = std::max(1, static_cast<int>(width_ * scale + 0.5f));
+        render_height_ = std::max(1, static_cast<int>(height_ * scale + 0.5f));
+        glViewport(0, 0, render_width_, render_height_);
+    } else {
+        glViewport(0, 0, width_, height_);
+    }
+
+    return true;
+}
+
+void CanvasGeneric::output_size(unsigned int output, int &width, int &height)
+{
+    native_state_.output_size(output, width, height);
+}
+
+bool CanvasGeneric::output_ready(unsigned int output)
+{
+    return native_state_.output_ready(output);
+}
+
+void CanvasGeneric::wait_for_output(const std::vector<bool> &outputs, int fd, double timeout)
+{
+    native_state_.wait_for_output(outputs, fd, timeout);
+}
+
+float CanvasGeneric::render_scale(unsigned int output)
+{
+    if (!scaling() || output >= scaling_.size())
+        return 1.0f;
+
+    return scaling_[output].scaler.scale();
+}
+
+unsigned int CanvasGeneric::dropped_frames(unsigned int output)
+{
+    return native_state_.dropped_frames(output);
+}
+
 unsigned int CanvasGeneric::fbo()
 {
     return fbo_;
@@ -187,7 +328,8 @@ bool CanvasGeneric::resize_no_viewport(int width, int height)
                               width_, height_);
     }
 
-    if (depth_renderbuffer_) {
+    /* the depth buffer of the scene texture is sized by ensure_fbo() */
+    if (depth_renderbuffer_ && !color_texture_) {
         glBindRenderbuffer(GL_RENDERBUFFER, depth_renderbuffer_);
         glRenderbufferStorage(GL_RENDERBUFFER, gl_depth_format_,
                               width_, height_);
@@ -207,7 +349,7 @@ bool CanvasGeneric::do_make_current()
 
     gl_state_.init_gl_extensions();
 
-    if (offscreen_) {
+    if (offscreen_ || scaling()) {
         if (!ensure_fbo())
             return false;
 
@@ -291,26 +433,70 @@ bool CanvasGeneric::ensure_fbo()
             return false;
 
         /* Create a texture for the color attachment  */
-        glGenRenderbuffers(1, &color_renderbuffer_);
-        glBindRenderbuffer(GL_RENDERBUFFER, color_renderbuffer_);
-        glRenderbufferStorage(GL_RENDERBUFFER, gl_color_format_,
-                              width_, height_);
+        if (scaling()) {
+            /* scaled up to the output, so it has to be sampled */
+            glGenTextures(1, &color_texture_);
+            GLStateCache::bind_texture(GL_TEXTURE_2D, color_texture_);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        } else {
+            glGenRenderbuffers(1, &color_renderbuffer_);
+            glBindRenderbuffer(GL_RENDERBUFFER, color_renderbuffer_);
+            glRenderbufferStorage(GL_RENDERBUFFER, gl_color_format_,
+                                  width_, height_);
+        }
 
         /* Create a renderbuffer for the depth attachment */
         glGenRenderbuffers(1, &depth_renderbuffer_);
         glBindRenderbuffer(GL_RENDERBUFFER, depth_renderbuffer_);
-        glRenderbufferStorage(GL_RENDERBUFFER, gl_depth_format_,
-                              width_, height_);
+        if (!scaling()) {
+            glRenderbufferStorage(GL_RENDERBUFFER, gl_depth_format_,
+                                  width_, height_);
+        }
 
         /* Create a FBO and set it up */
         glGenFramebuffers(1, &fbo_);
         glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
-        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-                                  GL_RENDERBUFFER, color_renderbuffer_);
+        if (color_texture_) {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                   GL_TEXTURE_2D, color_texture_, 0);
+        } else {
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                      GL_RENDERBUFFER, color_renderbuffer_);
+        }
         glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
                                   GL_RENDERBUFFER, depth_renderbuffer_);
     }
 
+    /*
+     * All outputs render their scene into the same texture, so it grows
+     * to the largest of them. Every output uses the lower left part of it
+     * it needs at its current scale.
+     */
+    if (color_texture_ && (width_ > fbo_width_ || height_ > fbo_height_)) {
+        fbo_width_ = std::max(width_, fbo_width_);
+        fbo_height_ = std::max(height_, fbo_height_);
+
+        GLStateCache::bind_texture(GL_TEXTURE_2D, color_texture_);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, fbo_width_, fbo_height_, 0,
+                     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glBindRenderbuffer(GL_RENDERBUFFER, depth_renderbuffer_);
+        glRenderbufferStorage(GL_RENDERBUFFER, gl_depth_format_,
+                              fbo_width_, fbo_height_);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            Log::error("CanvasGeneric: Incomplete %dx%d scene framebuffer\n",
+                       fbo_width_, fbo_height_);
+            return false;
+        }
+
+        Log::debug("Scene texture for dynamic resolution: %dx%d\n",
+                   fbo_width_, fbo_height_);
+    }
+
     return true;
 }
 
@@ -328,11 +514,182 @@ void CanvasGeneric::release_fbo()
         glDeleteRenderbuffers(1, &depth_renderbuffer_);
         depth_renderbuffer_ = 0;
     }
+    if (color_texture_) {
+        GLStateCache::delete_texture(color_texture_);
+        color_texture_ = 0;
+    }
 
+    fbo_width_ = 0;
+    fbo_height_ = 0;
     gl_color_format_ = 0;
     gl_depth_format_ = 0;
 }
 
+bool CanvasGeneric::scaling()
+{
+    return dynamic_resolution_ && !offscreen_;
+}
+
+/*
+ * The GPU time of an output's frame is measured with a timer query around
+ * its scene rendering. The results are read back a few frames later, when
+ * they are available, so measuring never stalls the pipeline. Without
+ * GL_EXT_disjoint_timer_query, the CPU time up to the end of the swap
+ * stands in for it, as eglSwapBuffers() blocks once the GPU falls behind.
+ */
+void CanvasGeneric::begin_frame_timing()
+{
+    OutputScaling &s = scaling_[current_output_];
+    double budget = native_state_.refresh_period(current_output_) * GPU_BUDGET;
+
+    s.active = false;
+
+    if (!GLExtensions::BeginQuery) {
+        s.cpu_start = now_seconds();
+        return;
+    }
+
+    if (!s.queries[0])
+        GLExtensions::GenQueries(TIMER_QUERIES, s.queries);
+
+    /* reading the disjoint state also clears it */
+    GLint disjoint = 0;
+    glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+
+    while (s.pending > 0) {
+        unsigned int q = (s.next + TIMER_QUERIES - s.pending) % TIMER_QUERIES;
+        GLuint available = 0;
+        GLuint64 elapsed = 0;
+
+        GLExtensions::GetQueryObjectuiv(s.queries[q], GL_QUERY_RESULT_AVAILABLE_EXT,
+                                        &available);
+        if (!available)
+            break;
+
+        GLExtensions::GetQueryObjectui64v(s.queries[q], GL_QUERY_RESULT_EXT, &elapsed);
+        s.pending--;
+
+        /* e.g. a GPU clock change makes the results meaningless */
+        if (!disjoint)
+            s.scaler.frame_time(elapsed / 1000000000.0, s.query_scale[q], budget);
+    }
+
+    /* this frame goes unmeasured if all queries are still in flight */
+    if (s.pending == TIMER_QUERIES)
+        return;
+
+    s.query_scale[s.next] = s.scaler.scale();
+    GLExtensions::BeginQuery(GL_TIME_ELAPSED_EXT, s.queries[s.next]);
+    s.active = true;
+}
+
+void CanvasGeneric::end_frame_timing()
+{
+    OutputScaling &s = scaling_[current_output_];
+
+    if (!s.active)
+        return;
+
+    GLExtensions::EndQuery(GL_TIME_ELAPSED_EXT);
+    s.next = (s.next + 1) % TIMER_QUERIES;
+    s.pending++;
+    s.active = false;
+}
+
+void CanvasGeneric::finish_frame_timing()
+{
+    OutputScaling &s = scaling_[current_output_];
+
+    if (GLExtensions::BeginQuery)
+        return;
+
+    double budget = native_state_.refresh_period(current_output_) * GPU_BUDGET;
+    s.scaler.frame_time(now_seconds() - s.cpu_start, s.scaler.scale(), budget);
+}
+
+bool CanvasGeneric::ensure_upsample_program()
+{
+    if (upsample_program_)
+        return true;
+
+    GLuint vertex = compile_shader(GL_VERTEX_SHADER, upsample_vertex_shader);
+    GLuint fragment = compile_shader(GL_FRAGMENT_SHADER, upsample_fragment_shader);
+    GLint linked = 0;
+
+    if (!vertex || !fragment) {
+        glDeleteShader(vertex);
+        glDeleteShader(fragment);
+        return false;
+    }
+
+    upsample_program_ = glCreateProgram();
+    glAttachShader(upsample_program_, vertex);
+    glAttachShader(upsample_program_, fragment);
+    glBindAttribLocation(upsample_program_, 0, "position");
+    glLinkProgram(upsample_program_);
+    glDeleteShader(vertex);
+    glDeleteShader(fragment);
+
+    glGetProgramiv(upsample_program_, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        Log::error("CanvasGeneric: Could not link the upsampling program\n");
+        GLStateCache::delete_program(upsample_program_);
+        upsample_program_ = 0;
+        return false;
+    }
+
+    upsample_scale_ = glGetUniformLocation(upsample_program_, "scale");
+    upsample_limit_ = glGetUniformLocation(upsample_program_, "limit");
+
+    return true;
+}
+
+void CanvasGeneric::upsample()
+{
+    static const GLfloat quad[] = {
+        -1.0f, -1.0f,  1.0f, -1.0f,  -1.0f, 1.0f,  1.0f, 1.0f
+    };
+
+    if (!ensure_upsample_program())
+        return;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, width_, height_);
+    glDisable(GL_DEPTH_TEST);
+
+    GLStateCache::use_program(upsample_program_);
+    GLStateCache::uniform2f(upsample_scale_,
+                            static_cast<float>(render_width_) / fbo_width_,
+                            static_cast<float>(render_height_) / fbo_height_);
+    /* keep bilinear filtering from reaching past the rendered part */
+    GLStateCache::uniform2f(upsample_limit_,
+                            (render_width_ - 0.5f) / fbo_width_,
+                            (render_height_ - 0.5f) / fbo_height_);
+
+    GLStateCache::active_texture(GL_TEXTURE0);
+    GLStateCache::bind_texture(GL_TEXTURE_2D, color_texture_);
+    GLStateCache::vertex_attrib_pointer(0, 2, GL_FLOAT, GL_FALSE, 0, quad);
+    GLStateCache::enable_vertex_attrib_array(0);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    GLStateCache::disable_vertex_attrib_array(0);
+
+    glEnable(GL_DEPTH_TEST);
+}
+
+void CanvasGeneric::release_scaling()
+{
+    if (upsample_program_) {
+        GLStateCache::delete_program(upsample_program_);
+        upsample_program_ = 0;
+    }
+
+    for (unsigned int o = 0; o < scaling_.size(); o++) {
+        if (scaling_[o].queries[0] && GLExtensions::DeleteQueries)
+            GLExtensions::DeleteQueries(TIMER_QUERIES, scaling_[o].queries);
+    }
+    scaling_.clear();
+}
+
 const char * CanvasGeneric::get_gl_format_str(GLenum f)
 {
     const char *str;
@@ -2,6 +2,9 @@
 #define CANVAS_GENERIC_H_
 
 #include "canvas.h"
+#include "resolution-scaler.h"
+
+#include <vector>
 
 class GLState;
 class NativeState;
@@ -14,27 +17,71 @@ public:
         : Canvas(width, height),
           native_state_(native_state), gl_state_(gl_state),
           gl_color_format_(0), gl_depth_format_(0),
-          color_renderbuffer_(0), depth_renderbuffer_(0), fbo_(0) {}
+          color_renderbuffer_(0), depth_renderbuffer_(0), fbo_(0),
+          color_texture_(0), fbo_width_(0), fbo_height_(0),
+          render_width_(0), render_height_(0), upsample_program_(0), upsample_scale_(-1),
+          upsample_limit_(-1),           current_output_(0) {}
 
     bool init();
     bool reset();
     void visible(bool visible);
     void clear();
-    void update();
+    bool update();
     void print_info();
     Pixel read_pixel(int x, int y);
     void write_to_file(std::string &filename);
     bool should_quit();
     void resize(int width, int height);
+    unsigned int outputs();
+    bool select_output(unsigned int output);
+    void output_size(unsigned int output, int &width, int &height);
+    bool output_ready(unsigned int output);
+    void wait_for_output(const std::vector<bool> &outputs, int fd = -1, double timeout = -1.0);
+    float render_scale(unsigned int output);
+    unsigned int dropped_frames(unsigned int output);
     unsigned int fbo();
 
 private:
+    /* Timer queries in flight per output before results are read back */
+    static const unsigned int TIMER_QUERIES = 3;
+
+    /*
+     * The render scale of an output and the GPU time measurements that
+     * drive it.
+     */
+    struct OutputScaling
+    {
+        OutputScaling() : next(0), pending(0), active(false), cpu_start(0.0)
+        {
+            for (unsigned int i = 0; i < TIMER_QUERIES; i++) {
+                queries[i] = 0;
+                query_scale[i] = 1.0f;
+            }
+        }
+
+        ResolutionScaler scaler;
+        GLuint queries[TIMER_QUERIES];
+        float query_scale[TIMER_QUERIES];
+        // Next query to issue and the number issued but not read back
+        unsigned int next;
+        unsigned int pending;
+        bool active;
+        double cpu_start;
+    };
+
     bool supports_gl2();
     bool resize_no_viewport(int width, int height);
     bool do_make_current();
     bool ensure_gl_formats();
     bool ensure_fbo();
     void release_fbo();
+    bool scaling();
+    void begin_frame_timing();
+    void end_frame_timing();
+    void finish_frame_timing();
+    bool ensure_upsample_program();
+    void upsample();
+    void release_scaling();
     const char *get_gl_format_str(GLenum f);
 
     NativeState& native_state_;
@@ -45,6 +92,18 @@ private:
     GLuint color_renderbuffer_;
     GLuint depth_renderbuffer_;
     GLuint fbo_;
+    // Dynamic resolution: the scene texture, its size and the part of it
+    // the current output renders to
+    GLuint color_texture_;
+    int fbo_width_;
+    int fbo_height_;
+    int render_width_;
+    int render_height_;
+    GLuint upsample_program_;
+    GLint upsample_scale_;
+    GLint upsample_limit_;
+    unsigned int current_output_;
+    std::vector<OutputScaling> scaling_;
 };
 
 #endif /* CANVAS_GENERIC_H_ */
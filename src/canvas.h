@@ -6,6 +6,7 @@
 
 #include <stdint.h>
 #include <string>
+#include <vector>
 #include <stdio.h>
 #include <cmath>
 
@@ -104,8 +105,11 @@ public:
      * with the latest canvas contents.
      *
      * This method should be implemented in derived classes.
+     *
+     * @return whether the contents are going to be shown; if not, the
+     *         output keeps showing what it did and should be drawn again
      */
-    virtual void update() {}
+    virtual bool update() { return true; }
 
     /**
      * Prints information about the canvas.
@@ -167,6 +171,98 @@ public:
      */
     virtual void resize(int width, int height) { static_cast<void>(width); static_cast<void>(height); }
 
+    /**
+     * Gets the number of outputs (displays) the canvas can render to.
+     *
+     * This method should be implemented in derived classes.
+     *
+     * @return the number of outputs
+     */
+    virtual unsigned int outputs() { return 1; }
+
+    /**
+     * Makes an output the target of GL operations and of update().
+     *
+     * The canvas dimensions change to those of the selected output.
+     *
+     * This method should be implemented in derived classes.
+     *
+     * @param output the index of the output
+     *
+     * @return whether the output could be selected
+     */
+    virtual bool select_output(unsigned int output) { return output == 0; }
+
+    /**
+     * Gets the size of an output, which select_output() would give the
+     * canvas, without selecting it.
+     *
+     * This method should be implemented in derived classes.
+     *
+     * @param output the index of the output
+     * @param width the width in pixels
+     * @param height the height in pixels
+     */
+    virtual void output_size(unsigned int output, int &width, int &height)
+    {
+        static_cast<void>(output);
+        width = width_;
+        height = height_;
+    }
+
+    /**
+     * Whether an output can accept a new frame, i.e. it has no update
+     * still waiting to be presented.
+     *
+     * This method should be implemented in derived classes.
+     *
+     * @param output the index of the output
+     *
+     * @return true if the output is ready, false otherwise
+     */
+    virtual bool output_ready(unsigned int output) { static_cast<void>(output); return true; }
+
+    /**
+     * Waits until at least one of the given outputs can accept a new frame.
+     * Also returns once @fd becomes readable or @timeout has passed, so a
+     * caller with nothing to draw sleeps until something changes.
+     *
+     * This method should be implemented in derived classes.
+     *
+     * @param outputs whether to wait for each output
+     * @param fd a file descriptor to wake up for, or -1
+     * @param timeout the longest wait in seconds, or negative for no limit
+     */
+    virtual void wait_for_output(const std::vector<bool> &outputs, int fd = -1,
+                                 double timeout = -1.0)
+    {
+        static_cast<void>(outputs); static_cast<void>(fd); static_cast<void>(timeout);
+    }
+
+    /**
+     * Gets the fraction of an output's resolution the scene is rendered at
+     * before it is scaled up to the output.
+     *
+     * This method should be implemented in derived classes.
+     *
+     * @param output the index of the output
+     *
+     * @return the render scale, 1.0 for full resolution
+     */
+    virtual float render_scale(unsigned int output) { static_cast<void>(output); return 1.0f; }
+
+    /**
+     * Gets the number of frames of an output that were not on screen by
+     * the vblank they were rendered for.
+     *
+     * This method should be implemented in derived classes.
+     *
+     * @param output the index of the output
+     *
+     * @return the number of dropped frames since the canvas was created
+     */
+    virtual unsigned int dropped_frames(unsigned int output) { static_cast<void>(output); return 0; }
+
     /**
      * Gets the FBO associated with the canvas.
      *
@@ -206,6 +302,14 @@ public:
      */
     void offscreen(bool offscreen) { offscreen_ = offscreen; }
 
+    /**
+     * Sets whether the render resolution of each output should follow its
+     * GPU frame time. Ignored for off-screen canvases.
+     *
+     * This takes effect after the next init()/reset().
+     */
+    void dynamic_resolution(bool dynamic) { dynamic_resolution_ = dynamic; }
+
     /**
      * Sets the preferred visual configuration.
      *
@@ -215,11 +319,13 @@ public:
 
 protected:
     Canvas(int width, int height) :
-        width_(width), height_(height), offscreen_(false) {}
+        width_(width), height_(height), offscreen_(false),
+        dynamic_resolution_(false) {}
 
     int width_;
     int height_;
     bool offscreen_;
+    bool dynamic_resolution_;
     GLVisualConfig visual_config_;
 };
 
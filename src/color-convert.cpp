@@ -0,0 +1,337 @@
+#include "color-convert.h"
+#include "util.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define COLOR_CONVERT_X86
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(__aarch64__)
+#include <arm_neon.h>
+#define COLOR_CONVERT_NEON
+#endif
+
+/* Converts the pixels of a row, returns how many it did */
+typedef int (*RowKernel)(const uint8_t *y, const uint8_t *uv, uint8_t *rgba, int width);
+
+/* The rows kernels leave over are done by yuv_to_rgba() */
+static int row_scalar(const uint8_t *, const uint8_t *, uint8_t *, int)
+{
+    return 0;
+}
+
+/*
+ * The x86 kernels do the arithmetic of yuv_to_rgba() in 32 bits with
+ * pmaddwd, on pairs of words of the luma and one chroma difference:
+ *   r = 298 * (y - 16) + 409 * e + 128
+ *   g = 298 * (y - 16) - 100 * d - 208 * e + 128
+ *   b = 298 * (y - 16) + 516 * d + 128
+ */
+#ifdef COLOR_CONVERT_X86
+
+/* The factors of a pair of words, as one 32 bit lane */
+static inline int word_pair(int low, int high)
+{
+    return static_cast<int>((static_cast<uint32_t>(high) << 16) | (static_cast<uint32_t>(low) & 0xffff));
+}
+
+__attribute__((target("sse2")))
+static int row_sse2(const uint8_t *y, const uint8_t *uv, uint8_t *rgba, int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lumaOffset = _mm_set1_epi16(16);
+    const __m128i chromaOffset = _mm_set1_epi16(128);
+    const __m128i bytes = _mm_set1_epi32(0xff);
+    const __m128i rounding = _mm_set1_epi32(128);
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i red = _mm_set1_epi32(word_pair(298, 409));
+    const __m128i greenD = _mm_set1_epi32(word_pair(298, -100));
+    const __m128i greenE = _mm_set1_epi32(word_pair(-208, 128));
+    const __m128i blue = _mm_set1_epi32(word_pair(298, 516));
+    const __m128i byteMax = _mm_set1_epi16(255);
+    const __m128i alpha = _mm_set1_epi16(static_cast<short>(0xff00));
+    int x = 0;
+
+    // Eight pixels and four chroma pairs at a time
+    for (; x + 8 <= width; x += 8) {
+        __m128i luma = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(y + x)), zero);
+        __m128i pairs = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *)(uv + x)), zero);
+        __m128i u = _mm_and_si128(pairs, bytes);
+        __m128i v = _mm_srli_epi32(pairs, 8);
+
+        // Every chroma sample covers two pixels
+        __m128i yd = _mm_sub_epi16(luma, lumaOffset);
+        __m128i d = _mm_sub_epi16(_mm_or_si128(u, _mm_slli_epi32(u, 16)), chromaOffset);
+        __m128i e = _mm_sub_epi16(_mm_or_si128(v, _mm_slli_epi32(v, 16)), chromaOffset);
+
+        __m128i ydLo = _mm_unpacklo_epi16(yd, d), ydHi = _mm_unpackhi_epi16(yd, d);
+        __m128i yeLo = _mm_unpacklo_epi16(yd, e), yeHi = _mm_unpackhi_epi16(yd, e);
+        __m128i eLo = _mm_unpacklo_epi16(e, one), eHi = _mm_unpackhi_epi16(e, one);
+
+        __m128i r = _mm_packs_epi32(
+                _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yeLo, red), rounding), 8),
+                _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yeHi, red), rounding), 8));
+        __m128i g = _mm_packs_epi32(
+                _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(ydLo, greenD),
+                                             _mm_madd_epi16(eLo, greenE)), 8),
+                _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(ydHi, greenD),
+                                             _mm_madd_epi16(eHi, greenE)), 8));
+        __m128i b = _mm_packs_epi32(
+                _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(ydLo, blue), rounding), 8),
+                _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(ydHi, blue), rounding), 8));
+
+        r = _mm_min_epi16(_mm_max_epi16(r, zero), byteMax);
+        g = _mm_min_epi16(_mm_max_epi16(g, zero), byteMax);
+        b = _mm_min_epi16(_mm_max_epi16(b, zero), byteMax);
+
+        __m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+        __m128i ba = _mm_or_si128(b, alpha);
+        _mm_storeu_si128((__m128i *)(rgba + x * 4), _mm_unpacklo_epi16(rg, ba));
+        _mm_storeu_si128((__m128i *)(rgba + x * 4 + 16), _mm_unpackhi_epi16(rg, ba));
+    }
+
+    return x;
+}
+
+__attribute__((target("avx2")))
+static int row_avx2(const uint8_t *y, const uint8_t *uv, uint8_t *rgba, int width)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i lumaOffset = _mm256_set1_epi16(16);
+    const __m256i chromaOffset = _mm256_set1_epi16(128);
+    const __m256i bytes = _mm256_set1_epi32(0xff);
+    const __m256i rounding = _mm256_set1_epi32(128);
+    const __m256i one = _mm256_set1_epi16(1);
+    const __m256i red = _mm256_set1_epi32(word_pair(298, 409));
+    const __m256i greenD = _mm256_set1_epi32(word_pair(298, -100));
+    const __m256i greenE = _mm256_set1_epi32(word_pair(-208, 128));
+    const __m256i blue = _mm256_set1_epi32(word_pair(298, 516));
+    const __m256i byteMax = _mm256_set1_epi16(255);
+    const __m256i alpha = _mm256_set1_epi16(static_cast<short>(0xff00));
+    int x = 0;
+
+    // Sixteen pixels and eight chroma pairs at a time. The unpacks work
+    // within 128 bit lanes, the packs put the pixels back in order.
+    for (; x + 16 <= width; x += 16) {
+        __m256i luma = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(y + x)));
+        __m256i pairs = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(uv + x)));
+        __m256i u = _mm256_and_si256(pairs, bytes);
+        __m256i v = _mm256_srli_epi32(pairs, 8);
+
+        __m256i yd = _mm256_sub_epi16(luma, lumaOffset);
+        __m256i d = _mm256_sub_epi16(_mm256_or_si256(u, _mm256_slli_epi32(u, 16)), chromaOffset);
+        __m256i e = _mm256_sub_epi16(_mm256_or_si256(v, _mm256_slli_epi32(v, 16)), chromaOffset);
+
+        __m256i ydLo = _mm256_unpacklo_epi16(yd, d), ydHi = _mm256_unpackhi_epi16(yd, d);
+        __m256i yeLo = _mm256_unpacklo_epi16(yd, e), yeHi = _mm256_unpackhi_epi16(yd, e);
+        __m256i eLo = _mm256_unpacklo_epi16(e, one), eHi = _mm256_unpackhi_epi16(e, one);
+
+        __m256i r = _mm256_packs_epi32(
+                _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(yeLo, red), rounding), 8),
+                _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(yeHi, red), rounding), 8));
+        __m256i g = _mm256_packs_epi32(
+                _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(ydLo, greenD),
+                                                   _mm256_madd_epi16(eLo, greenE)), 8),
+                _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(ydHi, greenD),
+                                                   _mm256_madd_epi16(eHi, greenE)), 8));
+        __m256i b = _mm256_packs_epi32(
+                _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(ydLo, blue), rounding), 8),
+                _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(ydHi, blue), rounding), 8));
+
+        r = _mm256_min_epi16(_mm256_max_epi16(r, zero), byteMax);
+        g = _mm256_min_epi16(_mm256_max_epi16(g, zero), byteMax);
+        b = _mm256_min_epi16(_mm256_max_epi16(b, zero), byteMax);
+
+        __m256i rg = _mm256_or_si256(r, _mm256_slli_epi16(g, 8));
+        __m256i ba = _mm256_or_si256(b, alpha);
+        // Pixels 0-3 and 8-11, and 4-7 and 12-15
+        __m256i lo = _mm256_unpacklo_epi16(rg, ba);
+        __m256i hi = _mm256_unpackhi_epi16(rg, ba);
+        _mm256_storeu_si256((__m256i *)(rgba + x * 4), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i *)(rgba + x * 4 + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+
+    return x;
+}
+
+#endif /* COLOR_CONVERT_X86 */
+
+#ifdef COLOR_CONVERT_NEON
+
+/* One channel of eight pixels: (298 * (y - 16) + cd * d + ce * e + 128) >> 8 */
+static inline uint8x8_t neon_channel(int16x8_t yd, int16x8_t d, int16x8_t e,
+                                     int16_t cd, int16_t ce)
+{
+    int32x4_t lo = vmull_n_s16(vget_low_s16(yd), 298);
+    int32x4_t hi = vmull_n_s16(vget_high_s16(yd), 298);
+
+    lo = vmlal_n_s16(vmlal_n_s16(lo, vget_low_s16(d), cd), vget_low_s16(e), ce);
+    hi = vmlal_n_s16(vmlal_n_s16(hi, vget_high_s16(d), cd), vget_high_s16(e), ce);
+
+    // Rounds as the scalar code does, then saturates to bytes
+    int16x8_t sum = vcombine_s16(vshrn_n_s32(vaddq_s32(lo, vdupq_n_s32(128)), 8),
+                                 vshrn_n_s32(vaddq_s32(hi, vdupq_n_s32(128)), 8));
+
+    return vqmovun_s16(sum);
+}
+
+static int row_neon(const uint8_t *y, const uint8_t *uv, uint8_t *rgba, int width)
+{
+    int x = 0;
+
+    // Sixteen pixels and eight chroma pairs at a time
+    for (; x + 16 <= width; x += 16) {
+        uint8x16_t luma = vld1q_u8(y + x);
+        uint8x8x2_t chroma = vld2_u8(uv + x);
+        // Every chroma sample covers two pixels
+        uint8x8x2_t u = vzip_u8(chroma.val[0], chroma.val[0]);
+        uint8x8x2_t v = vzip_u8(chroma.val[1], chroma.val[1]);
+
+        for (int half = 0; half < 2; half++) {
+            uint8x8_t l = half ? vget_high_u8(luma) : vget_low_u8(luma);
+            int16x8_t yd = vreinterpretq_s16_u16(vsubl_u8(l, vdup_n_u8(16)));
+            int16x8_t d = vreinterpretq_s16_u16(vsubl_u8(u.val[half], vdup_n_u8(128)));
+            int16x8_t e = vreinterpretq_s16_u16(vsubl_u8(v.val[half], vdup_n_u8(128)));
+            uint8x8x4_t out;
+
+            out.val[0] = neon_channel(yd, d, e, 0, 409);
+            out.val[1] = neon_channel(yd, d, e, -100, -208);
+            out.val[2] = neon_channel(yd, d, e, 516, 0);
+            out.val[3] = vdup_n_u8(255);
+            vst4_u8(rgba + (x + half * 8) * 4, out);
+        }
+    }
+
+    return x;
+}
+
+#endif /* COLOR_CONVERT_NEON */
+
+static RowKernel row_kernel(ColorKernel kernel)
+{
+    switch (kernel) {
+#ifdef COLOR_CONVERT_X86
+    case COLOR_KERNEL_SSE2:
+        return row_sse2;
+    case COLOR_KERNEL_AVX2:
+        return row_avx2;
+#endif
+#ifdef COLOR_CONVERT_NEON
+    case COLOR_KERNEL_NEON:
+        return row_neon;
+#endif
+    default:
+        return row_scalar;
+    }
+}
+
+bool color_kernel_supported(ColorKernel kernel)
+{
+    switch (kernel) {
+    case COLOR_KERNEL_SCALAR:
+        return true;
+#ifdef COLOR_CONVERT_X86
+    case COLOR_KERNEL_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case COLOR_KERNEL_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+#ifdef COLOR_CONVERT_NEON
+    case COLOR_KERNEL_NEON:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+/* The last, and so widest, kernel the CPU supports */
+static ColorKernel pick_kernel()
+{
+    ColorKernel kernel = COLOR_KERNEL_SCALAR;
+
+    for (int k = COLOR_KERNEL_SCALAR + 1; k < COLOR_KERNEL_COUNT; k++) {
+        if (color_kernel_supported(static_cast<ColorKernel>(k)))
+            kernel = static_cast<ColorKernel>(k);
+    }
+
+    return kernel;
+}
+
+ColorKernel color_kernel()
+{
+    static const ColorKernel best = pick_kernel();
+
+    return best;
+}
+
+const char *color_kernel_name(ColorKernel kernel)
+{
+    static const char *names[COLOR_KERNEL_COUNT] = { "scalar", "sse2", "avx2", "neon" };
+
+    return kernel < COLOR_KERNEL_COUNT ? names[kernel] : "unknown";
+}
+
+void nv12_to_rgba_with(ColorKernel kernel, const uint8_t *y, int y_stride,
+                       const uint8_t *uv, int uv_stride, uint8_t *rgba, int rgba_stride,
+                       int width, int height)
+{
+    RowKernel convert = row_kernel(kernel);
+
+    for (int row = 0; row < height; row++) {
+        const uint8_t *ys = y + static_cast<size_t>(row) * y_stride;
+        const uint8_t *uvs = uv + static_cast<size_t>(row / 2) * uv_stride;
+        uint8_t *out = rgba + static_cast<size_t>(row) * rgba_stride;
+
+        for (int x = convert(ys, uvs, out, width); x < width; x++)
+            yuv_to_rgba(ys[x], uvs[x & ~1], uvs[x | 1], out + x * 4);
+    }
+}
+
+void nv12_to_rgba(const uint8_t *y, int y_stride, const uint8_t *uv, int uv_stride,
+                  uint8_t *rgba, int rgba_stride, int width, int height)
+{
+    nv12_to_rgba_with(color_kernel(), y, y_stride, uv, uv_stride, rgba, rgba_stride,
+                      width, height);
+}
+
+void nv12_to_rgba_parallel(const uint8_t *y, int y_stride, const uint8_t *uv, int uv_stride,
+                           uint8_t *rgba, int rgba_stride, int width, int height)
+{
+    ColorKernel kernel = color_kernel();
+
+    // Bands of row pairs, which share their chroma row
+    Util::parallel_for((height + 1) / 2, [&](unsigned int begin, unsigned int end) {
+        int first = begin * 2;
+        int rows = end * 2 < static_cast<unsigned int>(height) ? end * 2 - first : height - first;
+
+        nv12_to_rgba_with(kernel, y + static_cast<size_t>(first) * y_stride, y_stride,
+                          uv + static_cast<size_t>(begin) * uv_stride, uv_stride,
+                          rgba + static_cast<size_t>(first) * rgba_stride, rgba_stride,
+                          width, rows);
+    });
+}
+
+void yuv_to_rgb_matrix(ColorMatrix colors, bool full_range, float matrix[9], float offset[3])
+{
+    // Luma weights of red and blue, green takes the rest
+    float kr = colors == COLOR_BT709 ? 0.2126f : 0.299f;
+    float kb = colors == COLOR_BT709 ? 0.0722f : 0.114f;
+    float kg = 1.0f - kr - kb;
+    float ys = full_range ? 1.0f : 255.0f / 219.0f;
+    float cs = full_range ? 1.0f : 255.0f / 224.0f;
+
+    offset[0] = full_range ? 0.0f : 16.0f / 255.0f;
+    offset[1] = 128.0f / 255.0f;
+    offset[2] = 128.0f / 255.0f;
+
+    // Columns are the contributions of Y, U and V
+    matrix[0] = ys;
+    matrix[1] = ys;
+    matrix[2] = ys;
+    matrix[3] = 0.0f;
+    matrix[4] = -cs * 2.0f * kb * (1.0f - kb) / kg;
+    matrix[5] = cs * 2.0f * (1.0f - kb);
+    matrix[6] = cs * 2.0f * (1.0f - kr);
+    matrix[7] = -cs * 2.0f * kr * (1.0f - kr) / kg;
+    matrix[8] = 0.0f;
+}
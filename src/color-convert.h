@@ -0,0 +1,117 @@
+#ifndef COLOR_CONVERT_H_
+#define COLOR_CONVERT_H_
+
+#include <stdint.h>
+
+/*
+ * Conversion of NV12 images to RGBA on the CPU, for image data that is not
+ * sampled through the GPU's YUV import, like the tiles of virtual textures.
+ * Colors are BT.601 limited range, matching what EGL imports NV12 as by
+ * default.
+ *
+ * Images are converted by SSE2, AVX2 or NEON kernels where the CPU has
+ * them, picked when the first image is converted. All kernels produce the
+ * same bytes as yuv_to_rgba().
+ */
+
+static inline uint8_t color_clamp(int v)
+{
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+/**
+ * Converts a single pixel.
+ *
+ * @param y the luma sample
+ * @param u the Cb sample
+ * @param v the Cr sample
+ * @param rgba the four bytes to fill
+ */
+static inline void yuv_to_rgba(int y, int u, int v, uint8_t *rgba)
+{
+    int c = 298 * (y - 16) + 128;
+    int d = u - 128;
+    int e = v - 128;
+
+    rgba[0] = color_clamp((c + 409 * e) >> 8);
+    rgba[1] = color_clamp((c - 100 * d - 208 * e) >> 8);
+    rgba[2] = color_clamp((c + 516 * d) >> 8);
+    rgba[3] = 255;
+}
+
+/**
+ * Converts an NV12 image to RGBA.
+ *
+ * @param y the luma plane
+ * @param y_stride the bytes between two rows of the luma plane
+ * @param uv the interleaved chroma plane at half resolution
+ * @param uv_stride the bytes between two rows of the chroma plane
+ * @param rgba the image to fill
+ * @param rgba_stride the bytes between two rows of @rgba
+ * @param width the width of the image in pixels
+ * @param height the height of the image in pixels
+ */
+void nv12_to_rgba(const uint8_t *y, int y_stride, const uint8_t *uv, int uv_stride,
+                  uint8_t *rgba, int rgba_stride, int width, int height);
+
+/**
+ * Converts an NV12 image to RGBA in bands of rows on all CPUs, for
+ * whole images. Takes the same parameters as nv12_to_rgba().
+ */
+void nv12_to_rgba_parallel(const uint8_t *y, int y_stride, const uint8_t *uv, int uv_stride,
+                           uint8_t *rgba, int rgba_stride, int width, int height);
+
+/* The conversion kernels */
+enum ColorKernel
+{
+    COLOR_KERNEL_SCALAR,
+    COLOR_KERNEL_SSE2,
+    COLOR_KERNEL_AVX2,
+    COLOR_KERNEL_NEON,
+    COLOR_KERNEL_COUNT
+};
+
+/**
+ * Gets the fastest kernel the CPU supports, which nv12_to_rgba() uses.
+ */
+ColorKernel color_kernel();
+
+/**
+ * Gets whether the CPU and the build support a kernel.
+ */
+bool color_kernel_supported(ColorKernel kernel);
+
+/**
+ * Gets the name of a kernel, for messages.
+ */
+const char *color_kernel_name(ColorKernel kernel);
+
+/**
+ * Converts an NV12 image with a given kernel, for comparing them. Takes
+ * the parameters of nv12_to_rgba() after the kernel, which must be
+ * supported.
+ */
+void nv12_to_rgba_with(ColorKernel kernel, const uint8_t *y, int y_stride,
+                       const uint8_t *uv, int uv_stride, uint8_t *rgba, int rgba_stride,
+                       int width, int height);
+
+/* The YUV encodings the GPU conversion of planar frames handles */
+enum ColorMatrix
+{
+    COLOR_BT601,
+    COLOR_BT709
+};
+
+/**
+ * Gets the conversion of normalized YUV samples to RGB,
+ * rgb = matrix * (yuv - offset).
+ *
+ * @param colors the matrix the image was encoded with
+ * @param full_range whether the samples use all of 0-255 rather than
+ *                   the 16-235 (luma) and 16-240 (chroma) of video
+ * @param matrix the 3x3 matrix to fill, in column-major order as GL takes it
+ * @param offset the offsets to fill
+ */
+void yuv_to_rgb_matrix(ColorMatrix colors, bool full_range, float matrix[9], float offset[3]);
+
+#endif /* COLOR_CONVERT_H_ */
@@ -0,0 +1,239 @@
+#include "compressed-texture.h"
+#include "gl-state-cache.h"
+#include "log.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <utility>
+
+static const uint8_t ktx_identifier[12] = KTX_IDENTIFIER;
+
+static const char *format_name(uint32_t format)
+{
+    if ((format >= KTX_ASTC_RGBA_FIRST && format <= KTX_ASTC_RGBA_LAST) ||
+        (format >= KTX_ASTC_SRGB8_ALPHA8_FIRST && format <= KTX_ASTC_SRGB8_ALPHA8_LAST))
+        return "ASTC";
+    if (format == KTX_ETC1_RGB8)
+        return "ETC1";
+
+    return "ETC2";
+}
+
+CompressedTexture::CompressedTexture(const std::string &path) :
+    path_(path),
+    data_(0),
+    size_(0),
+    header_(0)
+{
+}
+
+CompressedTexture::~CompressedTexture()
+{
+    if (data_)
+        munmap(const_cast<uint8_t *>(data_), size_);
+}
+
+bool CompressedTexture::probe(const std::string &path)
+{
+    uint8_t identifier[sizeof(ktx_identifier)];
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    bool ktx = read(fd, identifier, sizeof(identifier)) == sizeof(identifier) &&
+               !memcmp(identifier, ktx_identifier, sizeof(identifier));
+    close(fd);
+
+    return ktx;
+}
+
+bool CompressedTexture::load()
+{
+    struct stat st;
+
+    int fd = open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        Log::error("Open source file '%s' failed\n", path_.c_str());
+        return false;
+    }
+
+    if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(struct ktx_header)) {
+        Log::error("'%s' is not a KTX file\n", path_.c_str());
+        close(fd);
+        return false;
+    }
+
+    size_t size = st.st_size;
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        Log::error("Failed to map '%s'\n", path_.c_str());
+        return false;
+    }
+
+    // Every byte is read once, in order, by the upload
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    data_ = static_cast<const uint8_t *>(data);
+    size_ = size;
+    header_ = reinterpret_cast<const struct ktx_header *>(data_);
+
+    if (!validate()) {
+        Log::error("'%s' is not a compressed 2D texture\n", path_.c_str());
+        header_ = 0;
+        levels_.clear();
+        return false;
+    }
+
+    Log::debug("Compressed panorama '%s': %ux%u %s, %u levels\n", path_.c_str(),
+               header_->pixel_width, header_->pixel_height,
+               format_name(header_->gl_internal_format),
+               static_cast<unsigned int>(levels_.size()));
+
+    return true;
+}
+
+bool CompressedTexture::upload(GlTexture *texture) const
+{
+    GLint max_size = 0;
+    GlTexture tex;
+
+    if (!header_)
+        return false;
+
+    if (!supported()) {
+        Log::error("The GPU can't sample %s textures (format 0x%x)\n",
+                   format_name(header_->gl_internal_format), header_->gl_internal_format);
+        return false;
+    }
+
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+    if (header_->pixel_width > static_cast<GLuint>(max_size) ||
+        header_->pixel_height > static_cast<GLuint>(max_size)) {
+        Log::error("%ux%u is larger than the textures of the GPU (%d), use --tiled\n",
+                   header_->pixel_width, header_->pixel_height, max_size);
+        return false;
+    }
+
+    // GLES2 has no mipmaps for other than power of two sizes without OES_texture_npot
+    unsigned int w = header_->pixel_width;
+    unsigned int h = header_->pixel_height;
+    unsigned int levels = levels_.size();
+    if (((w & (w - 1)) || (h & (h - 1))) && !GLExtensions::support("GL_OES_texture_npot"))
+        levels = 1;
+
+    GLStateCache::bind_texture(GL_TEXTURE_2D, tex.generate());
+
+    // A texture whose mip chain stops before 1x1 is incomplete with a
+    // mipmap filter and samples as black, so those only use the base level
+    bool mipmapped = false;
+    for (unsigned int l = 0; l < levels; l++) {
+        glCompressedTexImage2D(GL_TEXTURE_2D, l, header_->gl_internal_format,
+                               w, h, 0, levels_[l].size, levels_[l].data);
+        mipmapped = l > 0 && w == 1 && h == 1;
+        w = w > 1 ? w / 2 : 1;
+        h = h > 1 ? h / 2 : 1;
+    }
+
+    if (glGetError() != GL_NO_ERROR) {
+        Log::error("Failed to upload '%s'\n", path_.c_str());
+        return false;
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    mipmapped ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    *texture = std::move(tex);
+
+    return true;
+}
+
+/*******************
+ * Private methods *
+ *******************/
+
+/*
+ * Checks that the file holds exactly one 2D image in a known block format,
+ * and that every mip level it claims has the size its dimensions need.
+ */
+bool CompressedTexture::validate()
+{
+    const struct ktx_header &h = *header_;
+    uint32_t block_width, block_height, block_bytes;
+
+    if (memcmp(h.identifier, ktx_identifier, sizeof(ktx_identifier)) ||
+        h.endianness != KTX_ENDIANNESS)
+        return false;
+
+    if (h.gl_type != 0 || h.gl_format != 0 ||
+        !ktx_block_layout(h.gl_internal_format, &block_width, &block_height, &block_bytes)) {
+        Log::error("Only ETC and ASTC compressed textures are supported\n");
+        return false;
+    }
+
+    if (!h.pixel_width || !h.pixel_height || h.pixel_depth > 1 ||
+        h.number_of_array_elements > 1 || h.number_of_faces != 1)
+        return false;
+
+    // Zero levels asks for mipmaps to be generated, which compressed formats can't
+    unsigned int levels = h.number_of_mipmap_levels;
+    if (!levels || levels > 32)
+        return false;
+
+    uint64_t offset = static_cast<uint64_t>(sizeof(struct ktx_header)) + h.bytes_of_key_value_data;
+    uint32_t w = h.pixel_width;
+    uint32_t hgt = h.pixel_height;
+
+    for (unsigned int l = 0; l < levels; l++) {
+        uint64_t blocks = static_cast<uint64_t>((w + block_width - 1) / block_width) *
+                          ((hgt + block_height - 1) / block_height);
+        uint32_t image_size;
+
+        if (offset + sizeof(image_size) > size_)
+            return false;
+        memcpy(&image_size, data_ + offset, sizeof(image_size));
+        offset += sizeof(image_size);
+
+        if (image_size != blocks * block_bytes || offset + image_size > size_)
+            return false;
+
+        Level level = { data_ + offset, image_size };
+        levels_.push_back(level);
+
+        offset += (image_size + 3) & ~3u;
+        w = w > 1 ? w / 2 : 1;
+        hgt = hgt > 1 ? hgt / 2 : 1;
+    }
+
+    return true;
+}
+
+/*
+ * Whether the current context lists the format among those it can sample,
+ * which covers both core GLES3 formats and extensions.
+ */
+bool CompressedTexture::supported() const
+{
+    GLint count = 0;
+
+    glGetIntegerv(GL_NUM_COMPRESSED_TEXTURE_FORMATS, &count);
+    if (count <= 0)
+        return false;
+
+    std::vector<GLint> formats(count);
+    glGetIntegerv(GL_COMPRESSED_TEXTURE_FORMATS, &formats[0]);
+
+    for (unsigned int i = 0; i < formats.size(); i++) {
+        if (static_cast<uint32_t>(formats[i]) == header_->gl_internal_format)
+            return true;
+    }
+
+    return false;
+}
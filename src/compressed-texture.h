@@ -0,0 +1,71 @@
+#ifndef COMPRESSED_TEXTURE_H_
+#define COMPRESSED_TEXTURE_H_
+
+#include "gl-handles.h"
+#include "ktx-file.h"
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+
+/**
+ * A still panorama that was compressed into a GPU texture format (ETC2,
+ * ASTC) offline and is stored in a KTX file (see ktx-file.h).
+ *
+ * The blocks are handed to GL as they are, straight from the mapped file:
+ * nothing is decoded or converted on the CPU, and the texture takes a
+ * fraction of the memory and bandwidth of the NV12 image.
+ */
+class CompressedTexture
+{
+public:
+    CompressedTexture(const std::string &path);
+    ~CompressedTexture();
+
+    /**
+     * Whether a file is a KTX file.
+     *
+     * @param path the file to check
+     *
+     * @return true if the file starts like a KTX file
+     */
+    static bool probe(const std::string &path);
+
+    /**
+     * Maps the file and checks that it holds a single compressed 2D image
+     * with complete mip levels.
+     *
+     * @return whether the file can be uploaded
+     */
+    bool load();
+
+    /**
+     * Creates a GL_TEXTURE_2D with the mip levels of the file. The current
+     * context must support the format.
+     *
+     * @param texture the created texture
+     *
+     * @return whether the texture could be created
+     */
+    bool upload(GlTexture *texture) const;
+
+    unsigned int width() const { return header_ ? header_->pixel_width : 0; }
+    unsigned int height() const { return header_ ? header_->pixel_height : 0; }
+
+private:
+    struct Level {
+        const uint8_t *data;
+        uint32_t size;
+    };
+
+    bool validate();
+    bool supported() const;
+
+    std::string path_;
+    const uint8_t *data_;
+    size_t size_;
+    const struct ktx_header *header_;
+    std::vector<Level> levels_;
+};
+
+#endif /* COMPRESSED_TEXTURE_H_ */
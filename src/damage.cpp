@@ -0,0 +1,55 @@
+#include "damage.h"
+
+Damage::Damage(unsigned int outputs) :
+    outputs_(outputs)
+{
+    // Nothing has been drawn yet
+    for (unsigned int o = 0; o < outputs_.size(); o++) {
+        outputs_[o].dirty = true;
+        outputs_[o].yaw = 0.0f;
+        outputs_[o].pitch = 0.0f;
+    }
+}
+
+void Damage::frame()
+{
+    for (unsigned int o = 0; o < outputs_.size(); o++)
+        outputs_[o].dirty = true;
+}
+
+void Damage::output(unsigned int output)
+{
+    if (output < outputs_.size())
+        outputs_[output].dirty = true;
+}
+
+bool Damage::dirty(unsigned int output, const Camera &camera) const
+{
+    if (output >= outputs_.size())
+        return false;
+
+    const Output &o = outputs_[output];
+
+    return o.dirty || o.yaw != camera.yaw() || o.pitch != camera.pitch();
+}
+
+void Damage::drawn(unsigned int output, const Camera &camera)
+{
+    if (output >= outputs_.size())
+        return;
+
+    Output &o = outputs_[output];
+    o.dirty = false;
+    o.yaw = camera.yaw();
+    o.pitch = camera.pitch();
+}
+
+std::vector<bool> Damage::dirty(const std::vector<Camera> &cameras) const
+{
+    std::vector<bool> outputs(outputs_.size(), false);
+
+    for (unsigned int o = 0; o < outputs_.size() && o < cameras.size(); o++)
+        outputs[o] = dirty(o, cameras[o]);
+
+    return outputs;
+}
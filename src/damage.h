@@ -0,0 +1,57 @@
+#ifndef DAMAGE_H_
+#define DAMAGE_H_
+
+#include <vector>
+#include "camera.h"
+
+/**
+ * Tracks which outputs show something out of date.
+ *
+ * An output has to be drawn again when a new frame arrives, when its
+ * camera moved since it was last drawn, or when what it shows is still
+ * being refined, like the tiles of a virtual texture that stream in.
+ * Outputs that are up to date are neither drawn nor flipped, so a still
+ * panorama costs no GPU time once every output shows it.
+ */
+class Damage
+{
+public:
+    Damage(unsigned int outputs);
+
+    /**
+     * Marks all outputs as out of date, e.g. for a new frame.
+     */
+    void frame();
+
+    /**
+     * Marks an output as out of date.
+     */
+    void output(unsigned int output);
+
+    /**
+     * Gets whether an output has to be drawn to show @camera.
+     */
+    bool dirty(unsigned int output, const Camera &camera) const;
+
+    /**
+     * Records that an output was drawn with @camera.
+     */
+    void drawn(unsigned int output, const Camera &camera);
+
+    /**
+     * Gets the outputs that have to be drawn to show @cameras.
+     */
+    std::vector<bool> dirty(const std::vector<Camera> &cameras) const;
+
+private:
+    struct Output
+    {
+        bool dirty;
+        float yaw;
+        float pitch;
+    };
+
+    std::vector<Output> outputs_;
+};
+
+#endif /* DAMAGE_H_ */
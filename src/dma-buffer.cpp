@@ -1,101 +1,265 @@
 #include "dma-buffer.h"
 #include "log.h"
+#include "trace.h"
 
 #include <string.h>
 #include <unistd.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
-#include <drm.h>
+#include <linux/dma-buf.h>
+#include <drm_fourcc.h>
 #include <xf86drm.h>
-#include <xf86drmMode.h>
+#include <gbm.h>
+#include <utility>
 
-DmaBufferManager::DmaBufferManager(int drm_fd)
+bool DmaBufferMapping::map(const DmaBuffer &buffer)
+{
+    unmap();
+
+    uint32_t fourcc = buffer.fourcc ? buffer.fourcc : DRM_FORMAT_NV12;
+    if (fourcc != DRM_FORMAT_NV12 ||
+        (buffer.has_modifier && buffer.modifier != DRM_FORMAT_MOD_LINEAR)) {
+        Log::error("Only linear NV12 buffers can be mapped\n");
+        return false;
+    }
+
+    // Defaults as for the EGL import: packed rows, UV right after Y
+    _y_stride = buffer.stride ? buffer.stride : buffer.width;
+    _uv_stride = buffer.uv_stride ? buffer.uv_stride : _y_stride;
+    size_t uvOffset = buffer.uv_stride ? buffer.uv_offset : buffer.offset + _y_stride * buffer.height;
+    int uvFd = buffer.uv_fd >= 0 ? buffer.uv_fd : buffer.dma_fd;
+
+    _y = mapPlane(buffer.dma_fd, buffer.offset);
+    _uv = _y ? mapPlane(uvFd, uvOffset) : NULL;
+    if (!_uv) {
+        unmap();
+        return false;
+    }
+
+    return true;
+}
+
+void DmaBufferMapping::unmap()
+{
+    for (int i = 0; i < _count; i++) {
+        struct dma_buf_sync sync;
+
+        sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ;
+        ioctl(_maps[i].fd, DMA_BUF_IOCTL_SYNC, &sync);
+        munmap(_maps[i].data, _maps[i].size);
+    }
+
+    _count = 0;
+    _y = NULL;
+    _uv = NULL;
+}
+
+const uint8_t *DmaBufferMapping::mapPlane(int fd, size_t offset)
+{
+    for (int i = 0; i < _count; i++) {
+        if (_maps[i].fd == fd)
+            return offset < _maps[i].size ? _maps[i].data + offset : NULL;
+    }
+
+    // The size of a dma-buf is where it ends
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (size <= 0 || offset >= static_cast<size_t>(size)) {
+        Log::error("Failed to get the size of dma-buf %d\n", fd);
+        return NULL;
+    }
+
+    void *data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        Log::error("Failed to map dma-buf %d\n", fd);
+        return NULL;
+    }
+
+    struct dma_buf_sync sync;
+    sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ;
+    ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+
+    Map &map = _maps[_count++];
+    map.fd = fd;
+    map.data = static_cast<uint8_t *>(data);
+    map.size = size;
+
+    return map.data + offset;
+}
+
+DmaBufferManager::DmaBufferManager(int drm_fd, int render_fd)
 {
     _drm_fd = drm_fd;
+    _gbm = NULL;
+
+    if (render_fd >= 0) {
+        _gbm = gbm_create_device(render_fd);
+        if (!_gbm)
+            Log::debug("Failed to use the render node, using dumb buffers\n");
+    }
 }
 
 DmaBufferManager::~DmaBufferManager()
 {
+    // The pooled buffer objects need the device
+    _pool.clear();
+
+    if (_gbm)
+        gbm_device_destroy(_gbm);
 }
 
-bool DmaBufferManager::createDmaBuffer(int width, int height, int bpp, void *data, DmaBuffer *buffer)
+bool DmaBufferManager::createDmaBuffer(int width, int height, int bpp, const void *data, DmaBuffer *buffer)
 {
-    struct drm_mode_create_dumb create_arg;
-    struct drm_mode_map_dumb map_arg;
-    void *map;
-    int ret;
+    // The image is stored as rows of 8-bit samples, e.g. Y then UV for NV12
+    int rows = height * bpp / 8;
+    bool pooled = false;
 
-    if (_drm_fd <= 0) {
-        Log::error("init drm state first\n");
-        return false;
+    *buffer = DmaBuffer();
+
+    for (unsigned int i = 0; i < _pool.size(); i++) {
+        if (_pool[i].width == width && _pool[i].rows == rows) {
+            *buffer = std::move(_pool[i].buffer);
+            _pool.erase(_pool.begin() + i);
+            pooled = true;
+            break;
+        }
     }
 
-    /* alloc */
-    memset(&create_arg, 0, sizeof(create_arg));
-    create_arg.bpp = bpp;
-    create_arg.width = width;
-    create_arg.height = height;
-    ret = drmIoctl(_drm_fd, DRM_IOCTL_MODE_CREATE_DUMB, &create_arg);
-    if (ret) {
-        Log::error("failed to create dumb buffer\n");
-        return false;
+    // Render nodes that can't allocate R8 buffers leave it to dumb buffers
+    // on the KMS device, as before there were render nodes
+    if (!pooled && !(_gbm && allocateGbmBuffer(width, rows, buffer))) {
+        if (_drm_fd <= 0) {
+            Log::error("init drm state first\n");
+            return false;
+        }
+        if (!allocateDumbBuffer(width, rows, buffer))
+            return false;
     }
 
     buffer->width = width;
     buffer->height = height;
-    buffer->handle = create_arg.handle;
-
-    /* mmap */
-    memset(&map_arg, 0, sizeof(map_arg));
-    map_arg.handle = create_arg.handle;
-    ret = drmIoctl(_drm_fd, DRM_IOCTL_MODE_MAP_DUMB, &map_arg);
-    if (ret) {
-        Log::error("failed to map dumb buffer\n");
-        return false;
-    }
+    buffer->offset = 0;
 
-    map = mmap(0, create_arg.size, PROT_READ | PROT_WRITE, MAP_SHARED, _drm_fd, map_arg.offset);
-    if (map == MAP_FAILED) {
-        Log::error("failed to map data\n");
+    if (buffer->bo ? !fillGbmBuffer(width, rows, data, buffer)
+                   : !fillDumbBuffer(width, rows, data, buffer)) {
+        *buffer = DmaBuffer();
         return false;
     }
 
-    // copy an image data.
-    memcpy(map, data, strlen((char*)data));
-
-    /* unmap */
-    munmap(map, create_arg.size);
-
-    /* export dma-buffer */
-    exportDmaBuffer(buffer);
-
     return true;
 }
 
 bool DmaBufferManager::exportDmaBuffer(DmaBuffer *buffer)
 {
+    int fd = -1;
     int ret;
 
-    ret = drmPrimeHandleToFD(_drm_fd, buffer->handle, 0, &buffer->dma_fd);
+    ret = drmPrimeHandleToFD(_drm_fd, buffer->handle, DRM_CLOEXEC, &fd);
     if (ret != 0) {
         Log::error("failed to export gem bo handler\n");
         return false;
     }
 
+    buffer->owned_fd.reset(fd);
+    buffer->dma_fd = fd;
+
     return true;
 }
 
 bool DmaBufferManager::destoryDmaBuffer(DmaBuffer *buffer)
 {
-    struct drm_mode_destroy_dumb arg;
-    int ret;
+    // Only buffers of this manager can be reused
+    if (buffer->owned_fd && (buffer->dumb || buffer->bo) && _pool.size() < POOL_SIZE) {
+        Pooled pooled;
+        pooled.width = buffer->dumb ? buffer->dumb.width() : gbm_bo_get_width(buffer->bo.get());
+        pooled.rows = buffer->dumb ? buffer->dumb.height() : gbm_bo_get_height(buffer->bo.get());
+        pooled.buffer = std::move(*buffer);
+        _pool.push_back(std::move(pooled));
+    }
+
+    *buffer = DmaBuffer();
+
+    return true;
+}
+
+/*******************
+ * Private methods *
+ *******************/
+
+bool DmaBufferManager::allocateDumbBuffer(int width, int rows, DmaBuffer *buffer)
+{
+    if (!buffer->dumb.create(_drm_fd, width, rows, 8))
+        return false;
+
+    buffer->handle = buffer->dumb.handle();
+    buffer->stride = buffer->dumb.pitch();
+
+    /* export dma-buffer */
+    return exportDmaBuffer(buffer);
+}
+
+bool DmaBufferManager::allocateGbmBuffer(int width, int rows, DmaBuffer *buffer)
+{
+    GbmBo bo(gbm_bo_create(_gbm, width, rows, GBM_FORMAT_R8, GBM_BO_USE_LINEAR));
+    if (!bo) {
+        Log::debug("failed to create gbm buffer, using a dumb buffer\n");
+        return false;
+    }
+
+    int fd = gbm_bo_get_fd(bo.get());
+    if (fd < 0) {
+        Log::debug("failed to export gbm buffer, using a dumb buffer\n");
+        return false;
+    }
+
+    buffer->owned_fd.reset(fd);
+    buffer->dma_fd = fd;
+    buffer->handle = 0;
+    buffer->stride = gbm_bo_get_stride(bo.get());
+    buffer->bo = std::move(bo);
+
+    return true;
+}
 
-    memset(&arg, 0, sizeof(arg));
-    arg.handle = buffer->handle;
-    ret = drmIoctl(_drm_fd, DRM_IOCTL_MODE_DESTROY_DUMB, &arg);
-    if (ret) {
-        Log::error("failed to destroy dumb buffer\n");
+bool DmaBufferManager::fillDumbBuffer(int width, int rows, const void *data, DmaBuffer *buffer)
+{
+    char *map = static_cast<char *>(buffer->dumb.map());
+    if (!map)
         return false;
+
+    // copy an image data, row by row as the pitch may be padded.
+    {
+        TRACE_SCOPE("dma-buf fill");
+        for (int row = 0; row < rows; row++)
+            memcpy(map + row * buffer->stride, (const char*)data + row * width, width);
     }
 
+    /* unmap */
+    munmap(map, buffer->dumb.size());
+
+    return true;
+}
+
+bool DmaBufferManager::fillGbmBuffer(int width, int rows, const void *data, DmaBuffer *buffer)
+{
+    uint32_t map_stride;
+    void *map_data = NULL;
+    char *map;
+
+    map = (char*) gbm_bo_map(buffer->bo.get(), 0, 0, width, rows, GBM_BO_TRANSFER_WRITE,
+                             &map_stride, &map_data);
+    if (!map) {
+        Log::error("failed to map gbm buffer\n");
+        return false;
+    }
+
+    // copy an image data, the mapping may use a different pitch than the buffer.
+    {
+        TRACE_SCOPE("dma-buf fill");
+        for (int row = 0; row < rows; row++)
+            memcpy(map + row * map_stride, (const char*)data + row * width, width);
+    }
+
+    gbm_bo_unmap(buffer->bo.get(), map_data);
+
     return true;
 }
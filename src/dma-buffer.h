@@ -2,9 +2,19 @@
 #define DMA_BUFFER_H_
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+#include "handles.h"
+
+struct gbm_device;
 
 struct DmaBuffer
 {
+    DmaBuffer() :
+        width(0), height(0), dma_fd(-1), offset(0), stride(0), handle(0),
+        fourcc(0), modifier(0), has_modifier(false), uv_fd(-1), uv_offset(0),
+        uv_stride(0) {}
+
     int width;
     int height;
 
@@ -12,20 +22,106 @@ struct DmaBuffer
     size_t offset;
     size_t stride;
     unsigned handle;
+
+    // DRM fourcc of the buffer, 0 for NV12
+    uint32_t fourcc;
+    // Explicit format modifier, only used if has_modifier is set
+    uint64_t modifier;
+    bool has_modifier;
+
+    // Second plane of two-plane formats. Without a uv_stride it follows
+    // the first plane in the same dma-buf with the same pitch; a uv_fd
+    // of -1 also means the first plane's dma-buf.
+    int uv_fd;
+    size_t uv_offset;
+    size_t uv_stride;
+
+    // What the buffer owns and releases with it: the dma-bufs of its
+    // planes and the memory behind them. Buffers that only describe the
+    // memory of someone else, e.g. a capture device, leave them empty.
+    UniqueFd owned_fd;
+    UniqueFd owned_uv_fd;
+    DumbBuffer dumb;
+    // Set if the buffer was allocated on a render node
+    GbmBo bo;
+};
+
+// Read-only CPU view of the planes of a linear NV12 DmaBuffer. Access is
+// bracketed with DMA_BUF_IOCTL_SYNC, so the exporter keeps the view
+// coherent while it is mapped.
+class DmaBufferMapping
+{
+public:
+    DmaBufferMapping() : _count(0), _y(NULL), _uv(NULL), _y_stride(0), _uv_stride(0) {}
+    ~DmaBufferMapping() { unmap(); }
+
+    bool map(const DmaBuffer &buffer);
+    void unmap();
+
+    const uint8_t *y() const { return _y; }
+    const uint8_t *uv() const { return _uv; }
+    size_t y_stride() const { return _y_stride; }
+    size_t uv_stride() const { return _uv_stride; }
+
+private:
+    DmaBufferMapping(const DmaBufferMapping &) = delete;
+    DmaBufferMapping &operator=(const DmaBufferMapping &) = delete;
+
+    // The dma-bufs of the planes, once if they share one
+    struct Map
+    {
+        int fd;
+        uint8_t *data;
+        size_t size;
+    };
+
+    const uint8_t *mapPlane(int fd, size_t offset);
+
+    Map _maps[2];
+    int _count;
+    const uint8_t *_y;
+    const uint8_t *_uv;
+    size_t _y_stride;
+    size_t _uv_stride;
 };
 
 class DmaBufferManager
 {
 public:
-    DmaBufferManager(int drm_fd);
+    // Buffers are allocated on the render node if one is given, and as
+    // dumb buffers on the KMS device otherwise.
+    DmaBufferManager(int drm_fd, int render_fd = -1);
     ~DmaBufferManager();
 
-    bool createDmaBuffer(int width, int height, int bpp, void *data, DmaBuffer *buffer);
+    // Allocates a linear buffer for an image with @bpp bits per pixel in
+    // rows of @width bytes (12 for NV12) and copies the tightly packed
+    // @data into it. A buffer of the same size that was given back with
+    // destoryDmaBuffer() is reused rather than allocated.
+    bool createDmaBuffer(int width, int height, int bpp, const void *data, DmaBuffer *buffer);
     bool exportDmaBuffer(DmaBuffer *buffer);
+    // Gives the memory of a buffer back for reuse, the buffer is empty
+    // afterwards. Buffers beyond the pool size are released.
     bool destoryDmaBuffer(DmaBuffer *buffer);
 
 private:
+    // Buffers kept for reuse by destoryDmaBuffer()
+    static const unsigned int POOL_SIZE = 4;
+
+    struct Pooled
+    {
+        int width;
+        int rows;
+        DmaBuffer buffer;
+    };
+
+    bool allocateDumbBuffer(int width, int rows, DmaBuffer *buffer);
+    bool allocateGbmBuffer(int width, int rows, DmaBuffer *buffer);
+    bool fillDumbBuffer(int width, int rows, const void *data, DmaBuffer *buffer);
+    bool fillGbmBuffer(int width, int rows, const void *data, DmaBuffer *buffer);
+
     int _drm_fd;
+    struct gbm_device *_gbm;
+    std::vector<Pooled> _pool;
 };
 
 #endif // DMA_BUFFER_H_
@@ -1,22 +1,30 @@
 #include "egl-render.h"
+#include "camera.h"
+#include "gl-headers.h"
+#include "warp-lut.h"
+#include "program-cache.h"
+#include "gl-state-cache.h"
+#include "virtual-texture.h"
+#include "trace.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 #include <drm_fourcc.h>
 #include <unistd.h>
+#include <time.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/dma-buf.h>
+#include <sstream>
+#include <utility>
+#include <vector>
 
 #define PI (3.14159265f)
 #define SPHERE_SIZE 63
 int dotNumber = SPHERE_SIZE * 6 + (SPHERE_SIZE - 2) * 6 * SPHERE_SIZE;
 
-float mvpMat[16] = {
-    167.81992,   0.0,       0.0,        0.0,
-    0.0,         167.81992, 0.0,        0.0,
-    0.0,         0.0,       -202.01006, -200.0,
-    0.025592538, 0.0,       -1.0050251, 0.0
-};
-
 static const char gVertexShader[] =
         "attribute vec3 position;\n"
         "attribute vec2 texCoords;\n"
@@ -38,19 +46,198 @@ static const char gFragmentShader[] =
         "    gl_FragColor.rgb = gl_FragColor.rgb;\n"
         "}\n\n";
 
+static const char gDirectionVertexShader[] =
+        "attribute vec3 position;\n"
+        "uniform mat4 uMvp;\n"
+        "varying vec3 outDirection;\n"
+        "\nvoid main(void) {\n"
+        "    outDirection = position;\n"
+        "    gl_Position = uMvp * vec4(position,1.0);\n"
+        "	 gl_Position = gl_Position.xyzz;\n"
+        "}\n\n";
+
+static const char gFisheyeFragmentShader[] =
+        "#extension GL_OES_EGL_image_external : require\n"
+        "precision mediump float;\n\n"
+        "varying vec3 outDirection;\n"
+        "uniform samplerExternalOES texture;\n"
+        "uniform vec2 frontCenter;\n"
+        "uniform vec2 backCenter;\n"
+        "uniform vec2 radius;\n"
+        "uniform float halfFov;\n"
+        "uniform float seam;\n"
+        "\nvec2 fisheye(vec3 d, vec2 center) {\n"
+        "    float theta = acos(clamp(d.z, -1.0, 1.0));\n"
+        "    float len = max(length(d.xy), 0.00001);\n"
+        "    return center + vec2(d.x, -d.y) / len * (theta / halfFov) * radius;\n"
+        "}\n"
+        "\nvoid main(void) {\n"
+        "    vec3 d = normalize(outDirection);\n"
+        "    float theta = acos(clamp(-d.z, -1.0, 1.0));\n"
+        "    float front = clamp((1.57079633 + seam - theta) / (2.0 * seam), 0.0, 1.0);\n"
+        "    vec4 color = vec4(0.0);\n"
+        "    if (front > 0.0)\n"
+        "        color += front * texture2D(texture, fisheye(vec3(d.x, d.y, -d.z), frontCenter));\n"
+        "    if (front < 1.0)\n"
+        "        color += (1.0 - front) * texture2D(texture, fisheye(vec3(-d.x, d.y, d.z), backCenter));\n"
+        "    gl_FragColor = color;\n"
+        "}\n\n";
+
+/*
+ * The warp table holds (u, v, seen) per texel, filtered bilinearly: half
+ * floats by the GPU, 12-bit coordinates packed into RGBA8 by hand from
+ * four nearest texels, as the packing doesn't survive filtering. Unseen
+ * directions carry the coordinates of the rim, so only the filtered
+ * visibility decides where the image ends. The coordinates need more than
+ * mediump precision.
+ */
+static const char gWarpFragmentShader[] =
+        "#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+        "precision highp float;\n"
+        "#else\n"
+        "precision mediump float;\n"
+        "#endif\n\n"
+        "varying vec2 outTexCoords;\n"
+        "uniform samplerExternalOES texture;\n"
+        "uniform sampler2D lut;\n"
+        "#ifdef LUT_PACKED\n"
+        "uniform vec2 lutSize;\n"
+        "\nvec3 lutTexel(vec2 p) {\n"
+        "    vec4 t = floor(texture2D(lut, p / lutSize) * 255.0 + 0.5);\n"
+        "    float ulo = floor(t.b / 16.0);\n"
+        "    vec2 uv = vec2(t.r * 16.0 + ulo, t.g * 16.0 + t.b - ulo * 16.0) / 4095.0;\n"
+        "    return vec3(uv, t.a / 255.0);\n"
+        "}\n"
+        "\nvec3 lutSample(vec2 coords) {\n"
+        "    vec2 p = coords * lutSize - 0.5;\n"
+        "    vec2 f = fract(p);\n"
+        "    vec2 base = floor(p) + 0.5;\n"
+        "    return mix(mix(lutTexel(base), lutTexel(base + vec2(1.0, 0.0)), f.x),\n"
+        "               mix(lutTexel(base + vec2(0.0, 1.0)), lutTexel(base + vec2(1.0, 1.0)), f.x),\n"
+        "               f.y);\n"
+        "}\n"
+        "#else\n"
+        "\nvec3 lutSample(vec2 coords) {\n"
+        "    vec3 t = texture2D(lut, coords).rgb;\n"
+        "    return vec3(t.rg + 0.5, t.b);\n"
+        "}\n"
+        "#endif\n"
+        "\nvoid main(void) {\n"
+        "    vec3 w = lutSample(outTexCoords);\n"
+        "    gl_FragColor = w.z > 0.5 ? texture2D(texture, w.xy) : vec4(0.0, 0.0, 0.0, 1.0);\n"
+        "}\n\n";
+
+/* Stills that were compressed offline are plain 2D textures */
+static const char gStillFragmentShader[] =
+        "precision mediump float;\n\n"
+        "varying vec2 outTexCoords;\n"
+        "uniform sampler2D texture;\n"
+        "\nvoid main(void) {\n"
+        "    gl_FragColor = texture2D(texture, outTexCoords);\n"
+        "}\n\n";
+
+/*
+ * Samples a virtual texture: the indirection texel of the level 0 tile
+ * holds the atlas slot and level of the tile to show there. Image pixel
+ * coordinates need more than mediump precision for large panoramas.
+ */
+static const char gVirtualFragmentShader[] =
+        "#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+        "precision highp float;\n"
+        "#else\n"
+        "precision mediump float;\n"
+        "#endif\n\n"
+        "varying vec2 outTexCoords;\n"
+        "uniform sampler2D indirection;\n"
+        "uniform sampler2D atlas;\n"
+        "uniform vec2 imageSize;\n"
+        "uniform vec2 grid;\n"
+        "uniform float tileSize;\n"
+        "uniform float tileBorder;\n"
+        "uniform float slotSize;\n"
+        "uniform float atlasSize;\n"
+        "\nvoid main(void) {\n"
+        "    vec2 pixel = outTexCoords * imageSize;\n"
+        "    vec2 tile0 = min(floor(pixel / tileSize), grid - 1.0);\n"
+        "    vec4 entry = floor(texture2D(indirection, (tile0 + 0.5) / grid) * 255.0 + 0.5);\n"
+        "    float scale = exp2(entry.b);\n"
+        "    vec2 inTile = pixel / scale - floor(tile0 / scale) * tileSize;\n"
+        "    vec2 coord = entry.rg * slotSize + tileBorder + inTile;\n"
+        "    gl_FragColor = texture2D(atlas, coord / atlasSize);\n"
+        "}\n\n";
+
+static const char gPlanarFragmentShader[] =
+        "precision mediump float;\n\n"
+        "varying vec2 outTexCoords;\n"
+        "uniform sampler2D yTexture;\n"
+        "uniform sampler2D uvTexture;\n"
+        "uniform vec4 uSelect;\n"
+        "uniform vec4 vSelect;\n"
+        "uniform mat3 yuvToRgb;\n"
+        "uniform vec3 yuvOffset;\n"
+        "\nvoid main(void) {\n"
+        "    vec4 chroma = texture2D(uvTexture, outTexCoords);\n"
+        "    vec3 yuv = vec3(texture2D(yTexture, outTexCoords).r,\n"
+        "                    dot(chroma, uSelect), dot(chroma, vSelect));\n"
+        "    gl_FragColor = vec4(yuvToRgb * (yuv - yuvOffset), 1.0);\n"
+        "}\n\n";
+
+/* Width of the band at the image borders over which cameras are blended */
+#define STITCH_FEATHER 0.1
+
 GLfloat* textureCoords = 0;
 GLfloat* vertices = 0;
 GLushort* indices = 0;
 
-GLuint gTextureProgram = 0;
+GlProgram gTextureProgram;
 GLuint gvTexturePositionHandle = 0;
 GLuint gvTextureTexCoordsHandle = 0;
 GLuint gvTextureSamplerHandle = 0;
 GLuint uTextureCoordMatrix = 0;
 
+GlProgram gStitchProgram;
+GLuint gvStitchPositionHandle = 0;
+GLuint uStitchMvpMatrix = 0;
+GLuint gStitchTextures[STITCH_MAX_CAMERAS];
+unsigned int gStitchCameras = 0;
+
+GlProgram gFisheyeProgram;
+GLuint gvFisheyePositionHandle = 0;
+GLuint uFisheyeMvpMatrix = 0;
+
+GlProgram gWarpProgram;
+GLuint gvWarpPositionHandle = 0;
+GLuint gvWarpTexCoordsHandle = 0;
+GLuint uWarpMvpMatrix = 0;
+GlTexture gWarpLutTexture;
+
+GlProgram gStillProgram;
+GLuint gvStillPositionHandle = 0;
+GLuint gvStillTexCoordsHandle = 0;
+GLuint uStillMvpMatrix = 0;
+
+GlProgram gPlanarProgram;
+GLuint gvPlanarPositionHandle = 0;
+GLuint gvPlanarTexCoordsHandle = 0;
+GLuint uPlanarMvpMatrix = 0;
+GLuint uPlanarUSelect = 0;
+GLuint uPlanarVSelect = 0;
+
+// How YUV frames are converted, by EGL imports and the planar shader
+ColorMatrix gYuvColors = COLOR_BT601;
+bool gYuvFullRange = false;
+
+GlProgram gVirtualProgram;
+GLuint gvVirtualPositionHandle = 0;
+GLuint gvVirtualTexCoordsHandle = 0;
+GLuint uVirtualMvpMatrix = 0;
+
 PFNEGLCREATEIMAGEKHRPROC eglCreateImageKHRProc;
 PFNEGLDESTROYIMAGEKHRPROC eglDestroyImageKHRProc;
 PFNGLEGLIMAGETARGETTEXTURE2DOESPROC glEGLImageTargetTexture2DOESProc;
+PFNEGLCREATESYNCKHRPROC eglCreateSyncKHRProc;
+PFNEGLDESTROYSYNCKHRPROC eglDestroySyncKHRProc;
+PFNEGLCLIENTWAITSYNCKHRPROC eglClientWaitSyncKHRProc;
 
 static EGLImageKHR eglCreateImageKHR(EGLDisplay dpy, EGLContext ctx, EGLenum target,
                                      EGLClientBuffer buffer, const EGLint *attrib_list)
@@ -78,6 +265,33 @@ static void eglEGLImageTargetTexture2DOES(GLenum target, GLeglImageOES image)
     return glEGLImageTargetTexture2DOESProc(target, image);
 }
 
+static EGLSyncKHR eglCreateSyncKHR(EGLDisplay dpy, EGLenum type, const EGLint *attrib_list)
+{
+    if (!eglCreateSyncKHRProc)
+        eglCreateSyncKHRProc = (PFNEGLCREATESYNCKHRPROC)eglGetProcAddress("eglCreateSyncKHR");
+
+    if (!eglCreateSyncKHRProc)
+        return EGL_NO_SYNC_KHR;
+
+    return eglCreateSyncKHRProc(dpy, type, attrib_list);
+}
+
+static EGLBoolean eglDestroySyncKHR(EGLDisplay dpy, EGLSyncKHR sync)
+{
+    if (!eglDestroySyncKHRProc)
+        eglDestroySyncKHRProc = (PFNEGLDESTROYSYNCKHRPROC)eglGetProcAddress("eglDestroySyncKHR");
+
+    return eglDestroySyncKHRProc(dpy, sync);
+}
+
+static EGLint eglClientWaitSyncKHR(EGLDisplay dpy, EGLSyncKHR sync, EGLint flags, EGLTimeKHR timeout)
+{
+    if (!eglClientWaitSyncKHRProc)
+        eglClientWaitSyncKHRProc = (PFNEGLCLIENTWAITSYNCKHRPROC)eglGetProcAddress("eglClientWaitSyncKHR");
+
+    return eglClientWaitSyncKHRProc(dpy, sync, flags, timeout);
+}
+
 static GLuint egl_load_shader(GLenum shaderType, const char *pSource)
 {
     GLint compiled = 0;
@@ -109,20 +323,39 @@ static GLuint egl_load_shader(GLenum shaderType, const char *pSource)
     return shader;
 }
 
+static double egl_now_ms()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
 static GLuint egl_create_program(const char *pVertexSource, const char *pFragmentSource)
 {
     GLuint vertexShader = 0;
     GLuint pixelShader = 0;
     GLuint program = 0;
     GLint linkStatus = GL_FALSE;
+    double start = egl_now_ms();
+
+    // Skip compiling and linking if the driver's binary is cached
+    program = ProgramCache::load(pVertexSource, pFragmentSource);
+    if (program) {
+        ProgramCache::account(true, egl_now_ms() - start);
+        return program;
+    }
 
     vertexShader = egl_load_shader(GL_VERTEX_SHADER, pVertexSource);
     if (!vertexShader)
         return 0;
 
     pixelShader = egl_load_shader(GL_FRAGMENT_SHADER, pFragmentSource);
-    if (!pixelShader)
+    if (!pixelShader) {
+        glDeleteShader(vertexShader);
         return 0;
+    }
 
     program = glCreateProgram();
     if (program) {
@@ -149,6 +382,11 @@ static GLuint egl_create_program(const char *pVertexSource, const char *pFragmen
     glDeleteShader(vertexShader);
     glDeleteShader(pixelShader);
 
+    if (program) {
+        ProgramCache::save(program, pVertexSource, pFragmentSource);
+        ProgramCache::account(false, egl_now_ms() - start);
+    }
+
     return program;
 }
 
@@ -224,39 +462,78 @@ bool egl_setup_graphics(void)
     if (!vertices)
         egl_general_sphere(SPHERE_SIZE, 1.0, &vertices, &textureCoords, &indices);
 
-    if (gTextureProgram > 0) {
-        glDeleteProgram(gTextureProgram);
-        gTextureProgram = 0;
-    }
+    // The program is shared by every output and every frame
+    if (gTextureProgram)
+        return true;
 
-    gTextureProgram = egl_create_program(gVertexShader, gFragmentShader);
+    gTextureProgram.reset(egl_create_program(gVertexShader, gFragmentShader));
     if (!gTextureProgram)
         return false;
 
-    gvTexturePositionHandle = glGetAttribLocation(gTextureProgram, "position");
-    gvTextureTexCoordsHandle = glGetAttribLocation(gTextureProgram, "texCoords");
-    gvTextureSamplerHandle = glGetUniformLocation(gTextureProgram, "texture");
-    uTextureCoordMatrix = glGetUniformLocation(gTextureProgram, "uMvp");
+    gvTexturePositionHandle = glGetAttribLocation(gTextureProgram.get(), "position");
+    gvTextureTexCoordsHandle = glGetAttribLocation(gTextureProgram.get(), "texCoords");
+    gvTextureSamplerHandle = glGetUniformLocation(gTextureProgram.get(), "texture");
+    uTextureCoordMatrix = glGetUniformLocation(gTextureProgram.get(), "uMvp");
 
     return true;
 }
 
-bool egl_get_image_for_dma_buffer(struct DmaBuffer *buf, EGLImageKHR *outImage)
+static bool egl_two_plane_format(uint32_t fourcc)
 {
+    return fourcc == DRM_FORMAT_NV12 || fourcc == DRM_FORMAT_NV21 ||
+           fourcc == DRM_FORMAT_NV16 || fourcc == DRM_FORMAT_NV61;
+}
+
+bool egl_get_image_for_dma_buffer(const struct DmaBuffer *buf, EglImage *outImage)
+{
+    TRACE_SCOPE("import");
     EGLImageKHR image;
-    // NV12 for example.
-    EGLint attr[] = {
-        EGL_LINUX_DRM_FOURCC_EXT, DRM_FORMAT_NV12,
-        EGL_WIDTH, buf->width,
-        EGL_HEIGHT, buf->height,
-        EGL_DMA_BUF_PLANE0_FD_EXT, buf->dma_fd,
-        EGL_DMA_BUF_PLANE0_OFFSET_EXT, 0,
-        EGL_DMA_BUF_PLANE0_PITCH_EXT, buf->width,
-        EGL_DMA_BUF_PLANE1_FD_EXT, buf->dma_fd,
-        EGL_DMA_BUF_PLANE1_OFFSET_EXT, buf->width * buf->height,
-        EGL_DMA_BUF_PLANE1_PITCH_EXT, buf->width,
-        EGL_NONE
-    };
+    uint32_t fourcc = buf->fourcc ? buf->fourcc : DRM_FORMAT_NV12;
+    // Buffers without an explicit pitch are tightly packed
+    EGLint pitch = buf->stride ? buf->stride : buf->width;
+    EGLint offset = buf->offset;
+    EGLint attr[40];
+    int n = 0;
+
+    attr[n++] = EGL_LINUX_DRM_FOURCC_EXT; attr[n++] = fourcc;
+    attr[n++] = EGL_WIDTH; attr[n++] = buf->width;
+    attr[n++] = EGL_HEIGHT; attr[n++] = buf->height;
+    attr[n++] = EGL_DMA_BUF_PLANE0_FD_EXT; attr[n++] = buf->dma_fd;
+    attr[n++] = EGL_DMA_BUF_PLANE0_OFFSET_EXT; attr[n++] = offset;
+    attr[n++] = EGL_DMA_BUF_PLANE0_PITCH_EXT; attr[n++] = pitch;
+#ifdef EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT
+    if (buf->has_modifier) {
+        attr[n++] = EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT;
+        attr[n++] = (EGLint)(buf->modifier & 0xffffffff);
+        attr[n++] = EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT;
+        attr[n++] = (EGLint)(buf->modifier >> 32);
+    }
+#endif
+
+    // NV12 for example, by default with the UV plane right after the Y plane.
+    if (egl_two_plane_format(fourcc)) {
+        attr[n++] = EGL_DMA_BUF_PLANE1_FD_EXT;
+        attr[n++] = buf->uv_fd >= 0 ? buf->uv_fd : buf->dma_fd;
+        attr[n++] = EGL_DMA_BUF_PLANE1_OFFSET_EXT;
+        attr[n++] = buf->uv_stride ? buf->uv_offset : offset + pitch * buf->height;
+        attr[n++] = EGL_DMA_BUF_PLANE1_PITCH_EXT;
+        attr[n++] = buf->uv_stride ? buf->uv_stride : pitch;
+#ifdef EGL_DMA_BUF_PLANE1_MODIFIER_LO_EXT
+        if (buf->has_modifier) {
+            attr[n++] = EGL_DMA_BUF_PLANE1_MODIFIER_LO_EXT;
+            attr[n++] = (EGLint)(buf->modifier & 0xffffffff);
+            attr[n++] = EGL_DMA_BUF_PLANE1_MODIFIER_HI_EXT;
+            attr[n++] = (EGLint)(buf->modifier >> 32);
+        }
+#endif
+#ifdef EGL_YUV_COLOR_SPACE_HINT_EXT
+        attr[n++] = EGL_YUV_COLOR_SPACE_HINT_EXT;
+        attr[n++] = gYuvColors == COLOR_BT709 ? EGL_ITU_REC709_EXT : EGL_ITU_REC601_EXT;
+        attr[n++] = EGL_SAMPLE_RANGE_HINT_EXT;
+        attr[n++] = gYuvFullRange ? EGL_YUV_FULL_RANGE_EXT : EGL_YUV_NARROW_RANGE_EXT;
+#endif
+    }
+    attr[n++] = EGL_NONE;
 
     image = eglCreateImageKHR(eglGetCurrentDisplay(), EGL_NO_CONTEXT,
                               EGL_LINUX_DMA_BUF_EXT, (EGLClientBuffer)0,
@@ -266,21 +543,46 @@ bool egl_get_image_for_dma_buffer(struct DmaBuffer *buf, EGLImageKHR *outImage)
         return false;
     }
 
-    *outImage = image;
+    outImage->reset(image);
 
     return true;
 }
 
-bool egl_texture_for_image(EGLImageKHR image, GLuint *outTex)
+void egl_destroy_image(EGLImageKHR image)
+{
+    if (image && image != EGL_NO_IMAGE_KHR)
+        eglDestroyImageKHR(eglGetCurrentDisplay(), image);
+}
+
+EGLSyncKHR egl_create_fence(void)
+{
+    return eglCreateSyncKHR(eglGetCurrentDisplay(), EGL_SYNC_FENCE_KHR, NULL);
+}
+
+bool egl_fence_signaled(EGLSyncKHR fence)
 {
-    GLuint texture;
+    EGLint status = eglClientWaitSyncKHR(eglGetCurrentDisplay(), fence,
+                                         EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, 0);
+
+    // Treat errors as signaled, so buffers are never held forever
+    return status != EGL_TIMEOUT_EXPIRED_KHR;
+}
+
+void egl_destroy_fence(EGLSyncKHR fence)
+{
+    if (fence != EGL_NO_SYNC_KHR)
+        eglDestroySyncKHR(eglGetCurrentDisplay(), fence);
+}
+
+bool egl_texture_for_image(const EglImage &image, GlTexture *outTex)
+{
+    GlTexture texture;
     GLenum error;
 
-    glGenTextures(1, &texture);
-    glBindTexture(GL_TEXTURE_EXTERNAL_OES, texture);
+    GLStateCache::bind_texture(GL_TEXTURE_EXTERNAL_OES, texture.generate());
 
     // Set the image as level zero
-    eglEGLImageTargetTexture2DOES(GL_TEXTURE_EXTERNAL_OES, (GLeglImageOES) image);
+    eglEGLImageTargetTexture2DOES(GL_TEXTURE_EXTERNAL_OES, (GLeglImageOES) image.get());
     error = glGetError();
     if (error != GL_NO_ERROR)
         return false;
@@ -288,77 +590,682 @@ bool egl_texture_for_image(EGLImageKHR image, GLuint *outTex)
     glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    *outTex = texture;
+    *outTex = std::move(texture);
+
+    return true;
+}
+
+/*
+ * Imports one plane of @buf as an image of a single- or two-channel
+ * format, for sampling as a GL_TEXTURE_2D.
+ */
+static bool egl_plane_image(const struct DmaBuffer *buf, uint32_t fourcc, int width,
+                            int height, int fd, EGLint offset, EGLint pitch,
+                            EglImage *outImage)
+{
+    EGLint attr[20];
+    int n = 0;
+
+    attr[n++] = EGL_LINUX_DRM_FOURCC_EXT; attr[n++] = fourcc;
+    attr[n++] = EGL_WIDTH; attr[n++] = width;
+    attr[n++] = EGL_HEIGHT; attr[n++] = height;
+    attr[n++] = EGL_DMA_BUF_PLANE0_FD_EXT; attr[n++] = fd;
+    attr[n++] = EGL_DMA_BUF_PLANE0_OFFSET_EXT; attr[n++] = offset;
+    attr[n++] = EGL_DMA_BUF_PLANE0_PITCH_EXT; attr[n++] = pitch;
+#ifdef EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT
+    if (buf->has_modifier) {
+        attr[n++] = EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT;
+        attr[n++] = (EGLint)(buf->modifier & 0xffffffff);
+        attr[n++] = EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT;
+        attr[n++] = (EGLint)(buf->modifier >> 32);
+    }
+#endif
+    attr[n++] = EGL_NONE;
+
+    EGLImageKHR image = eglCreateImageKHR(eglGetCurrentDisplay(), EGL_NO_CONTEXT,
+                                          EGL_LINUX_DMA_BUF_EXT, (EGLClientBuffer)0,
+                                          attr);
+    if (!image || image == EGL_NO_IMAGE_KHR)
+        return false;
+
+    outImage->reset(image);
+
+    return true;
+}
+
+/* Creates a linearly filtered GL_TEXTURE_2D, with @image as level zero if given */
+static bool egl_plane_texture(const EglImage *image, GlTexture *outTex)
+{
+    GlTexture texture;
+
+    GLStateCache::bind_texture(GL_TEXTURE_2D, texture.generate());
+    if (image) {
+        eglEGLImageTargetTexture2DOES(GL_TEXTURE_2D, (GLeglImageOES) image->get());
+        if (glGetError() != GL_NO_ERROR)
+            return false;
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    *outTex = std::move(texture);
+
+    return true;
+}
+
+/*
+ * Copies @rows rows of @bytes from a plane of a dma-buf into the texture
+ * bound to GL_TEXTURE_2D. ES 2.0 can't unpack rows with padding, so
+ * padded planes go through a packed copy.
+ */
+static bool egl_upload_plane(int fd, size_t offset, size_t pitch, int width, int height,
+                             int bytes, GLenum format, bool allocate)
+{
+    size_t length = offset + pitch * height;
+    struct dma_buf_sync sync;
+
+    uint8_t *map = (uint8_t *) mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        return false;
+
+    // Let the exporter make the CPU view coherent
+    sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ;
+    ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+
+    const uint8_t *data = map + offset;
+    std::vector<uint8_t> packed;
+    size_t row = static_cast<size_t>(width) * bytes;
+    if (pitch != row) {
+        packed.resize(row * height);
+        for (int r = 0; r < height; r++)
+            memcpy(&packed[r * row], data + r * pitch, row);
+        data = &packed[0];
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if (allocate)
+        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+    else
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, GL_UNSIGNED_BYTE, data);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ;
+    ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+    munmap(map, length);
+
+    return glGetError() == GL_NO_ERROR;
+}
+
+bool egl_import_planes(const struct DmaBuffer *buf, YuvPlanes *planes)
+{
+    TRACE_SCOPE("import");
+    uint32_t fourcc = buf->fourcc ? buf->fourcc : DRM_FORMAT_NV12;
+    EGLint pitch = buf->stride ? buf->stride : buf->width;
+    EGLint offset = buf->offset;
+    int uvFd = buf->uv_fd >= 0 ? buf->uv_fd : buf->dma_fd;
+    EGLint uvOffset = buf->uv_stride ? buf->uv_offset : offset + pitch * buf->height;
+    EGLint uvPitch = buf->uv_stride ? buf->uv_stride : pitch;
+    // 4:2:2 formats have chroma for every row
+    bool fullHeight = fourcc == DRM_FORMAT_NV16 || fourcc == DRM_FORMAT_NV61;
+    int uvWidth = (buf->width + 1) / 2;
+    int uvHeight = fullHeight ? buf->height : (buf->height + 1) / 2;
+
+    if (!egl_two_plane_format(fourcc)) {
+        fprintf(stderr, "Only two-plane YUV frames can be sampled as planes\n");
+        return false;
+    }
+
+    *planes = YuvPlanes();
+    planes->swap_uv = fourcc == DRM_FORMAT_NV21 || fourcc == DRM_FORMAT_NV61;
+
+    // Zero-copy, if the driver imports the planes on their own
+    if (egl_plane_image(buf, DRM_FORMAT_R8, buf->width, buf->height, buf->dma_fd,
+                        offset, pitch, &planes->y_image) &&
+        egl_plane_image(buf, DRM_FORMAT_GR88, uvWidth, uvHeight, uvFd,
+                        uvOffset, uvPitch, &planes->uv_image) &&
+        egl_plane_texture(&planes->y_image, &planes->y) &&
+        egl_plane_texture(&planes->uv_image, &planes->uv))
+        return true;
+
+    *planes = YuvPlanes();
+    planes->swap_uv = fourcc == DRM_FORMAT_NV21 || fourcc == DRM_FORMAT_NV61;
+
+    // Otherwise copy them into luminance textures, which only works for linear buffers
+    if (buf->has_modifier && buf->modifier != DRM_FORMAT_MOD_LINEAR) {
+        fprintf(stderr, "Can't upload the planes of a tiled buffer\n");
+        return false;
+    }
+
+    planes->uploaded = true;
+    if (!egl_plane_texture(NULL, &planes->y) || !egl_plane_texture(NULL, &planes->uv))
+        return false;
+
+    return egl_refresh_planes(buf, planes, true);
+}
+
+bool egl_refresh_planes(const struct DmaBuffer *buf, YuvPlanes *planes, bool allocate)
+{
+    size_t pitch = buf->stride ? buf->stride : buf->width;
+    int uvFd = buf->uv_fd >= 0 ? buf->uv_fd : buf->dma_fd;
+    size_t uvOffset = buf->uv_stride ? buf->uv_offset : buf->offset + pitch * buf->height;
+    size_t uvPitch = buf->uv_stride ? buf->uv_stride : pitch;
+    uint32_t fourcc = buf->fourcc ? buf->fourcc : DRM_FORMAT_NV12;
+    bool fullHeight = fourcc == DRM_FORMAT_NV16 || fourcc == DRM_FORMAT_NV61;
+    int uvWidth = (buf->width + 1) / 2;
+    int uvHeight = fullHeight ? buf->height : (buf->height + 1) / 2;
+
+    // Imported planes always show what is in the buffer
+    if (!planes->uploaded)
+        return true;
+
+    TRACE_SCOPE("upload");
+
+    GLStateCache::bind_texture(GL_TEXTURE_2D, planes->y.get());
+    if (!egl_upload_plane(buf->dma_fd, buf->offset, pitch, buf->width, buf->height, 1,
+                          GL_LUMINANCE, allocate)) {
+        fprintf(stderr, "Failed to upload the Y plane\n");
+        return false;
+    }
+
+    GLStateCache::bind_texture(GL_TEXTURE_2D, planes->uv.get());
+    if (!egl_upload_plane(uvFd, uvOffset, uvPitch, uvWidth, uvHeight, 2,
+                          GL_LUMINANCE_ALPHA, allocate)) {
+        fprintf(stderr, "Failed to upload the UV plane\n");
+        return false;
+    }
+
+    return true;
+}
+
+void egl_set_yuv_colors(ColorMatrix colors, bool fullRange)
+{
+    gYuvColors = colors;
+    gYuvFullRange = fullRange;
+}
+
+bool egl_setup_planar(void)
+{
+    GLfloat matrix[9];
+    GLfloat offset[3];
+
+    if (!vertices)
+        egl_general_sphere(SPHERE_SIZE, 1.0, &vertices, &textureCoords, &indices);
+
+    if (!gPlanarProgram) {
+        gPlanarProgram.reset(egl_create_program(gVertexShader, gPlanarFragmentShader));
+        if (!gPlanarProgram)
+            return false;
+
+        gvPlanarPositionHandle = glGetAttribLocation(gPlanarProgram.get(), "position");
+        gvPlanarTexCoordsHandle = glGetAttribLocation(gPlanarProgram.get(), "texCoords");
+        uPlanarMvpMatrix = glGetUniformLocation(gPlanarProgram.get(), "uMvp");
+        uPlanarUSelect = glGetUniformLocation(gPlanarProgram.get(), "uSelect");
+        uPlanarVSelect = glGetUniformLocation(gPlanarProgram.get(), "vSelect");
+    }
+
+    yuv_to_rgb_matrix(gYuvColors, gYuvFullRange, matrix, offset);
+
+    GLStateCache::use_program(gPlanarProgram.get());
+    GLStateCache::uniform1i(glGetUniformLocation(gPlanarProgram.get(), "yTexture"), 0);
+    GLStateCache::uniform1i(glGetUniformLocation(gPlanarProgram.get(), "uvTexture"), 1);
+    GLStateCache::uniform_matrix3fv(glGetUniformLocation(gPlanarProgram.get(), "yuvToRgb"),
+                                    1, matrix);
+    GLStateCache::uniform3fv(glGetUniformLocation(gPlanarProgram.get(), "yuvOffset"), 1, offset);
+
+    return true;
+}
+
+bool egl_draw_planar(const YuvPlanes &planes, const GLfloat *mvp)
+{
+    /* imported GR88 chroma samples as (U, V, 0, 1), uploaded luminance-alpha as (U, U, U, V) */
+    static const GLfloat red[4] = { 1.0f, 0.0f, 0.0f, 0.0f };
+    static const GLfloat green[4] = { 0.0f, 1.0f, 0.0f, 0.0f };
+    static const GLfloat alpha[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+    const GLfloat *first = red;
+    const GLfloat *second = planes.uploaded ? alpha : green;
+
+    if (!gPlanarProgram)
+        return false;
+
+    GLStateCache::use_program(gPlanarProgram.get());
+    GLStateCache::uniform_matrix4fv(uPlanarMvpMatrix, 1, mvp);
+    GLStateCache::uniform4fv(uPlanarUSelect, 1, planes.swap_uv ? second : first);
+    GLStateCache::uniform4fv(uPlanarVSelect, 1, planes.swap_uv ? first : second);
+    GLStateCache::active_texture(GL_TEXTURE1);
+    GLStateCache::bind_texture(GL_TEXTURE_2D, planes.uv.get());
+    GLStateCache::active_texture(GL_TEXTURE0);
+    GLStateCache::bind_texture(GL_TEXTURE_2D, planes.y.get());
+
+    GLStateCache::vertex_attrib_pointer(gvPlanarPositionHandle, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GL_FLOAT), vertices);
+    GLStateCache::enable_vertex_attrib_array(gvPlanarPositionHandle);
+    GLStateCache::vertex_attrib_pointer(gvPlanarTexCoordsHandle, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GL_FLOAT), textureCoords);
+    GLStateCache::enable_vertex_attrib_array(gvPlanarTexCoordsHandle);
+    glDrawElements(GL_TRIANGLES, dotNumber, GL_UNSIGNED_SHORT, indices);
+
+    return true;
+}
+
+bool egl_draw_texture(GLuint texture, const GLfloat *mvp)
+{
+    if (!gTextureProgram)
+        return false;
 
     // Draw copied content on the screen.
-    glUseProgram(gTextureProgram);
-    glUniform1i(gvTextureSamplerHandle, 0);
-    glUniformMatrix4fv(uTextureCoordMatrix, 1, GL_FALSE, mvpMat);
-    glBindTexture(GL_TEXTURE_EXTERNAL_OES, texture);
-
-    glVertexAttribPointer(gvTexturePositionHandle, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GL_FLOAT), vertices);
-    glEnableVertexAttribArray(gvTexturePositionHandle);
-    glVertexAttribPointer(gvTextureTexCoordsHandle, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GL_FLOAT), textureCoords);
-    glEnableVertexAttribArray(gvTextureTexCoordsHandle);
+    GLStateCache::use_program(gTextureProgram.get());
+    GLStateCache::uniform1i(gvTextureSamplerHandle, 0);
+    GLStateCache::uniform_matrix4fv(uTextureCoordMatrix, 1, mvp);
+    GLStateCache::bind_texture(GL_TEXTURE_EXTERNAL_OES, texture);
+
+    GLStateCache::vertex_attrib_pointer(gvTexturePositionHandle, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GL_FLOAT), vertices);
+    GLStateCache::enable_vertex_attrib_array(gvTexturePositionHandle);
+    GLStateCache::vertex_attrib_pointer(gvTextureTexCoordsHandle, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GL_FLOAT), textureCoords);
+    GLStateCache::enable_vertex_attrib_array(gvTextureTexCoordsHandle);
     glDrawElements(GL_TRIANGLES, dotNumber, GL_UNSIGNED_SHORT, indices);
 
     return true;
 }
 
-bool egl_sample_buffer(struct DmaBuffer *buf)
+/*
+ * Builds the stitching fragment shader for @count cameras. Every camera
+ * gets its own sampler; the loop is unrolled since GLSL ES 1.0 can't index
+ * sampler arrays dynamically.
+ */
+static std::string egl_stitch_fragment_shader(unsigned int count)
 {
-    EGLImageKHR imageKHR;
-    GLuint gTexture;
-    bool result;
-    int ret;
+    std::stringstream ss;
 
-    result = false;
-    gTexture = 0;
+    ss << "#extension GL_OES_EGL_image_external : require\n"
+          "precision mediump float;\n\n"
+          "varying vec3 outDirection;\n"
+          "uniform mat3 cameraRotation[" << count << "];\n"
+          "uniform vec2 cameraFocal[" << count << "];\n";
+    for (unsigned int i = 0; i < count; i++)
+        ss << "uniform samplerExternalOES camera" << i << ";\n";
 
-    result = egl_setup_graphics();
-    if (!result) {
-        printf("Could not general sphere\n");
-        goto _destory;
+    ss << "\nvoid main(void) {\n"
+          "    vec3 dir = normalize(outDirection);\n"
+          "    vec4 color = vec4(0.0);\n"
+          "    float total = 0.0;\n"
+          "    vec3 d;\n"
+          "    vec2 uv;\n"
+          "    vec2 edge;\n"
+          "    float w;\n";
+    for (unsigned int i = 0; i < count; i++) {
+        ss << "    d = cameraRotation[" << i << "] * dir;\n"
+              "    if (d.z > 0.0) {\n"
+              "        uv = vec2(0.5, 0.5) + vec2(d.x, -d.y) / d.z * cameraFocal[" << i << "];\n"
+              "        edge = min(uv, vec2(1.0) - uv);\n"
+              "        w = clamp(min(edge.x, edge.y) / " << STITCH_FEATHER << ", 0.0, 1.0);\n"
+              "        if (w > 0.0) {\n"
+              "            color += w * texture2D(camera" << i << ", uv);\n"
+              "            total += w;\n"
+              "        }\n"
+              "    }\n";
     }
+    ss << "    gl_FragColor = total > 0.0 ? color / total : vec4(0.0, 0.0, 0.0, 1.0);\n"
+          "}\n\n";
 
-    result = false;
-    ret = egl_get_image_for_dma_buffer(buf, &imageKHR);
-    if (!ret) {
-        printf("Failed to create imageKHR.\n");
-        goto _destory;
+    return ss.str();
+}
+
+bool egl_setup_stitching(const CameraCalibration *cameras, const GLuint *textures,
+                         unsigned int count)
+{
+    GLint maxUnits = 0;
+    GLint usedUnits = 0;
+    unsigned int i;
+
+    if (count == 0 || count > STITCH_MAX_CAMERAS) {
+        fprintf(stderr, "Can't stitch %u cameras (at most %d)\n",
+                count, STITCH_MAX_CAMERAS);
+        return false;
     }
 
-    ret = egl_texture_for_image(imageKHR, &gTexture);
-    if (!ret) {
-        printf("Failed to glEGLImageTargetTexture2DOES().\n");
-        goto _destory;
+    // External images may need more than one unit each (e.g. one per plane)
+    glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &maxUnits);
+    for (i = 0; i < count; i++) {
+        GLint units = 1;
+        GLStateCache::bind_texture(GL_TEXTURE_EXTERNAL_OES, textures[i]);
+        glGetTexParameteriv(GL_TEXTURE_EXTERNAL_OES, GL_REQUIRED_TEXTURE_IMAGE_UNITS_OES, &units);
+        usedUnits += units;
     }
+    if (usedUnits > maxUnits) {
+        fprintf(stderr, "%u cameras need %d texture units, only %d available\n",
+                count, usedUnits, maxUnits);
+        return false;
+    }
+
+    if (!vertices)
+        egl_general_sphere(SPHERE_SIZE, 1.0, &vertices, &textureCoords, &indices);
 
-    result = true;
+    gStitchProgram.reset();
 
-_destory:
-    if (gTexture > 0)
-        glDeleteTextures(1, &gTexture);
+    std::string fragmentShader(egl_stitch_fragment_shader(count));
+    gStitchProgram.reset(egl_create_program(gDirectionVertexShader, fragmentShader.c_str()));
+    if (!gStitchProgram)
+        return false;
+
+    gvStitchPositionHandle = glGetAttribLocation(gStitchProgram.get(), "position");
+    uStitchMvpMatrix = glGetUniformLocation(gStitchProgram.get(), "uMvp");
 
-    if (gTextureProgram > 0) {
-        glDeleteProgram(gTextureProgram);
-        gTextureProgram = 0;
+    // The calibration doesn't change, so upload it once
+    GLfloat rotations[STITCH_MAX_CAMERAS * 9];
+    GLfloat focals[STITCH_MAX_CAMERAS * 2];
+    for (i = 0; i < count; i++) {
+        cameras[i].rotation(&rotations[i * 9]);
+        cameras[i].focal(&focals[i * 2]);
     }
 
-    if (imageKHR)
-        eglDestroyImageKHR(eglGetCurrentDisplay(), imageKHR);
+    GLStateCache::use_program(gStitchProgram.get());
+    GLStateCache::uniform_matrix3fv(glGetUniformLocation(gStitchProgram.get(), "cameraRotation"),
+                                    count, rotations);
+    GLStateCache::uniform2fv(glGetUniformLocation(gStitchProgram.get(), "cameraFocal"), count, focals);
+    for (i = 0; i < count; i++) {
+        std::stringstream name;
+        name << "camera" << i;
+        GLStateCache::uniform1i(glGetUniformLocation(gStitchProgram.get(), name.str().c_str()), i);
+        gStitchTextures[i] = textures[i];
+    }
+    gStitchCameras = count;
 
-    return result;
+    return true;
 }
 
-void egl_release(void)
-{    
-    if (gTextureProgram > 0) {
-        glDeleteProgram(gTextureProgram);
-        gTextureProgram = 0;
+bool egl_draw_stitched(const GLfloat *mvp)
+{
+    unsigned int i;
+
+    if (!gStitchProgram)
+        return false;
+
+    GLStateCache::use_program(gStitchProgram.get());
+    GLStateCache::uniform_matrix4fv(uStitchMvpMatrix, 1, mvp);
+    for (i = 0; i < gStitchCameras; i++) {
+        GLStateCache::active_texture(GL_TEXTURE0 + i);
+        GLStateCache::bind_texture(GL_TEXTURE_EXTERNAL_OES, gStitchTextures[i]);
+    }
+    GLStateCache::active_texture(GL_TEXTURE0);
+
+    GLStateCache::vertex_attrib_pointer(gvStitchPositionHandle, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GL_FLOAT), vertices);
+    GLStateCache::enable_vertex_attrib_array(gvStitchPositionHandle);
+    glDrawElements(GL_TRIANGLES, dotNumber, GL_UNSIGNED_SHORT, indices);
+
+    return true;
+}
+
+bool egl_setup_fisheye(const DualFisheyeCalibration &lens, int width, int height)
+{
+    float halfFov = lens.fov * PI / 360.0f;
+    // Both lenses see the band beyond 90 degrees, blend across it
+    float seam = halfFov - PI / 2.0f;
+
+    if (seam <= 0.0f) {
+        fprintf(stderr, "Dual-fisheye lenses need a field of view above 180 degrees\n");
+        return false;
+    }
+
+    if (!vertices)
+        egl_general_sphere(SPHERE_SIZE, 1.0, &vertices, &textureCoords, &indices);
+
+    gFisheyeProgram.reset();
+
+    gFisheyeProgram.reset(egl_create_program(gDirectionVertexShader, gFisheyeFragmentShader));
+    if (!gFisheyeProgram)
+        return false;
+
+    gvFisheyePositionHandle = glGetAttribLocation(gFisheyeProgram.get(), "position");
+    uFisheyeMvpMatrix = glGetUniformLocation(gFisheyeProgram.get(), "uMvp");
+
+    GLStateCache::use_program(gFisheyeProgram.get());
+    GLStateCache::uniform1i(glGetUniformLocation(gFisheyeProgram.get(), "texture"), 0);
+    GLStateCache::uniform2f(glGetUniformLocation(gFisheyeProgram.get(), "frontCenter"),
+                lens.front_x, lens.front_y);
+    GLStateCache::uniform2f(glGetUniformLocation(gFisheyeProgram.get(), "backCenter"),
+                lens.back_x, lens.back_y);
+    GLStateCache::uniform2f(glGetUniformLocation(gFisheyeProgram.get(), "radius"),
+                lens.radius, lens.radius * width / height);
+    GLStateCache::uniform1f(glGetUniformLocation(gFisheyeProgram.get(), "halfFov"), halfFov);
+    GLStateCache::uniform1f(glGetUniformLocation(gFisheyeProgram.get(), "seam"), seam);
+
+    return true;
+}
+
+bool egl_draw_fisheye(GLuint texture, const GLfloat *mvp)
+{
+    if (!gFisheyeProgram)
+        return false;
+
+    GLStateCache::use_program(gFisheyeProgram.get());
+    GLStateCache::uniform_matrix4fv(uFisheyeMvpMatrix, 1, mvp);
+    GLStateCache::bind_texture(GL_TEXTURE_EXTERNAL_OES, texture);
+
+    GLStateCache::vertex_attrib_pointer(gvFisheyePositionHandle, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GL_FLOAT), vertices);
+    GLStateCache::enable_vertex_attrib_array(gvFisheyePositionHandle);
+    glDrawElements(GL_TRIANGLES, dotNumber, GL_UNSIGNED_SHORT, indices);
+
+    return true;
+}
+
+bool egl_setup_warp(const WarpLut &lut)
+{
+    // The GPU filters half floats, if supported; otherwise the shader
+    // filters the packed table itself
+    bool half = GLExtensions::support("GL_OES_texture_half_float") &&
+                GLExtensions::support("GL_OES_texture_half_float_linear");
+    std::string fragmentShader("#extension GL_OES_EGL_image_external : require\n");
+
+    if (!vertices)
+        egl_general_sphere(SPHERE_SIZE, 1.0, &vertices, &textureCoords, &indices);
+
+    gWarpLutTexture.reset();
+
+    GLStateCache::bind_texture(GL_TEXTURE_2D, gWarpLutTexture.generate());
+
+    if (half) {
+        std::vector<uint16_t> texels;
+        lut.pack_half(texels);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, lut.width(), lut.height(),
+                     0, GL_RGBA, GL_HALF_FLOAT_OES, &texels[0]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    } else {
+        std::vector<uint8_t> texels;
+        lut.pack_rgba8(texels);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, lut.width(), lut.height(),
+                     0, GL_RGBA, GL_UNSIGNED_BYTE, &texels[0]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        fragmentShader += "#define LUT_PACKED\n";
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    if (glGetError() != GL_NO_ERROR) {
+        fprintf(stderr, "Failed to upload the warp table\n");
+        return false;
     }
 
+    gWarpProgram.reset();
+
+    fragmentShader += gWarpFragmentShader;
+    gWarpProgram.reset(egl_create_program(gVertexShader, fragmentShader.c_str()));
+    if (!gWarpProgram)
+        return false;
+
+    gvWarpPositionHandle = glGetAttribLocation(gWarpProgram.get(), "position");
+    gvWarpTexCoordsHandle = glGetAttribLocation(gWarpProgram.get(), "texCoords");
+    uWarpMvpMatrix = glGetUniformLocation(gWarpProgram.get(), "uMvp");
+
+    GLStateCache::use_program(gWarpProgram.get());
+    GLStateCache::uniform1i(glGetUniformLocation(gWarpProgram.get(), "texture"), 0);
+    GLStateCache::uniform1i(glGetUniformLocation(gWarpProgram.get(), "lut"), 1);
+    if (!half) {
+        GLStateCache::uniform2f(glGetUniformLocation(gWarpProgram.get(), "lutSize"),
+                                lut.width(), lut.height());
+    }
+
+    return true;
+}
+
+bool egl_draw_warp(GLuint texture, const GLfloat *mvp)
+{
+    if (!gWarpProgram)
+        return false;
+
+    GLStateCache::use_program(gWarpProgram.get());
+    GLStateCache::uniform_matrix4fv(uWarpMvpMatrix, 1, mvp);
+    GLStateCache::active_texture(GL_TEXTURE1);
+    GLStateCache::bind_texture(GL_TEXTURE_2D, gWarpLutTexture.get());
+    GLStateCache::active_texture(GL_TEXTURE0);
+    GLStateCache::bind_texture(GL_TEXTURE_EXTERNAL_OES, texture);
+
+    GLStateCache::vertex_attrib_pointer(gvWarpPositionHandle, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GL_FLOAT), vertices);
+    GLStateCache::enable_vertex_attrib_array(gvWarpPositionHandle);
+    GLStateCache::vertex_attrib_pointer(gvWarpTexCoordsHandle, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GL_FLOAT), textureCoords);
+    GLStateCache::enable_vertex_attrib_array(gvWarpTexCoordsHandle);
+    glDrawElements(GL_TRIANGLES, dotNumber, GL_UNSIGNED_SHORT, indices);
+
+    return true;
+}
+
+bool egl_setup_still(void)
+{
+    if (!vertices)
+        egl_general_sphere(SPHERE_SIZE, 1.0, &vertices, &textureCoords, &indices);
+
+    if (gStillProgram)
+        return true;
+
+    gStillProgram.reset(egl_create_program(gVertexShader, gStillFragmentShader));
+    if (!gStillProgram)
+        return false;
+
+    gvStillPositionHandle = glGetAttribLocation(gStillProgram.get(), "position");
+    gvStillTexCoordsHandle = glGetAttribLocation(gStillProgram.get(), "texCoords");
+    uStillMvpMatrix = glGetUniformLocation(gStillProgram.get(), "uMvp");
+
+    GLStateCache::use_program(gStillProgram.get());
+    GLStateCache::uniform1i(glGetUniformLocation(gStillProgram.get(), "texture"), 0);
+
+    return true;
+}
+
+bool egl_draw_still(GLuint texture, const GLfloat *mvp)
+{
+    if (!gStillProgram)
+        return false;
+
+    GLStateCache::use_program(gStillProgram.get());
+    GLStateCache::uniform_matrix4fv(uStillMvpMatrix, 1, mvp);
+    GLStateCache::bind_texture(GL_TEXTURE_2D, texture);
+
+    GLStateCache::vertex_attrib_pointer(gvStillPositionHandle, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GL_FLOAT), vertices);
+    GLStateCache::enable_vertex_attrib_array(gvStillPositionHandle);
+    GLStateCache::vertex_attrib_pointer(gvStillTexCoordsHandle, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GL_FLOAT), textureCoords);
+    GLStateCache::enable_vertex_attrib_array(gvStillTexCoordsHandle);
+    glDrawElements(GL_TRIANGLES, dotNumber, GL_UNSIGNED_SHORT, indices);
+
+    return true;
+}
+
+bool egl_setup_virtual_texture(const VirtualTexture &texture)
+{
+    if (!vertices)
+        egl_general_sphere(SPHERE_SIZE, 1.0, &vertices, &textureCoords, &indices);
+
+    if (!gVirtualProgram) {
+        gVirtualProgram.reset(egl_create_program(gVertexShader, gVirtualFragmentShader));
+        if (!gVirtualProgram)
+            return false;
+
+        gvVirtualPositionHandle = glGetAttribLocation(gVirtualProgram.get(), "position");
+        gvVirtualTexCoordsHandle = glGetAttribLocation(gVirtualProgram.get(), "texCoords");
+        uVirtualMvpMatrix = glGetUniformLocation(gVirtualProgram.get(), "uMvp");
+    }
+
+    // The layout of the image and the atlas is fixed
+    GLStateCache::use_program(gVirtualProgram.get());
+    GLStateCache::uniform1i(glGetUniformLocation(gVirtualProgram.get(), "indirection"), 1);
+    GLStateCache::uniform1i(glGetUniformLocation(gVirtualProgram.get(), "atlas"), 0);
+    GLStateCache::uniform2f(glGetUniformLocation(gVirtualProgram.get(), "imageSize"),
+                texture.source().width(), texture.source().height());
+    GLStateCache::uniform2f(glGetUniformLocation(gVirtualProgram.get(), "grid"),
+                texture.columns(), texture.rows());
+    GLStateCache::uniform1f(glGetUniformLocation(gVirtualProgram.get(), "tileSize"), TileSource::TILE_SIZE);
+    GLStateCache::uniform1f(glGetUniformLocation(gVirtualProgram.get(), "tileBorder"), TileSource::TILE_BORDER);
+    GLStateCache::uniform1f(glGetUniformLocation(gVirtualProgram.get(), "slotSize"), TileSource::TILE_SLOT);
+    GLStateCache::uniform1f(glGetUniformLocation(gVirtualProgram.get(), "atlasSize"), texture.atlas_size());
+
+    return true;
+}
+
+bool egl_draw_virtual_texture(const VirtualTexture &texture, const GLfloat *mvp)
+{
+    if (!gVirtualProgram)
+        return false;
+
+    GLStateCache::use_program(gVirtualProgram.get());
+    GLStateCache::uniform_matrix4fv(uVirtualMvpMatrix, 1, mvp);
+    GLStateCache::active_texture(GL_TEXTURE1);
+    GLStateCache::bind_texture(GL_TEXTURE_2D, texture.indirection());
+    GLStateCache::active_texture(GL_TEXTURE0);
+    GLStateCache::bind_texture(GL_TEXTURE_2D, texture.atlas());
+
+    GLStateCache::vertex_attrib_pointer(gvVirtualPositionHandle, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GL_FLOAT), vertices);
+    GLStateCache::enable_vertex_attrib_array(gvVirtualPositionHandle);
+    GLStateCache::vertex_attrib_pointer(gvVirtualTexCoordsHandle, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GL_FLOAT), textureCoords);
+    GLStateCache::enable_vertex_attrib_array(gvVirtualTexCoordsHandle);
+    glDrawElements(GL_TRIANGLES, dotNumber, GL_UNSIGNED_SHORT, indices);
+
+    return true;
+}
+
+bool egl_sample_buffer(const struct DmaBuffer *buf)
+{
+    EglImage image;
+    GlTexture texture;
+    Camera camera;
+    GLfloat mvp[16];
+
+    // The image and texture are released on every way out
+    if (!egl_setup_graphics()) {
+        printf("Could not general sphere\n");
+        return false;
+    }
+
+    if (!egl_get_image_for_dma_buffer(buf, &image)) {
+        printf("Failed to create imageKHR.\n");
+        return false;
+    }
+
+    if (!egl_texture_for_image(image, &texture)) {
+        printf("Failed to glEGLImageTargetTexture2DOES().\n");
+        return false;
+    }
+
+    camera.mvp(mvp);
+    egl_draw_texture(texture.get(), mvp);
+
+    return true;
+}
+
+void egl_release(void)
+{
+    gTextureProgram.reset();
+    gStitchProgram.reset();
+    gFisheyeProgram.reset();
+    gWarpProgram.reset();
+    gWarpLutTexture.reset();
+    gStillProgram.reset();
+    gVirtualProgram.reset();
+    gPlanarProgram.reset();
+
     free(textureCoords);
     free(vertices);
     free(indices);
+    textureCoords = NULL;
+    vertices = NULL;
+    indices = NULL;
 }
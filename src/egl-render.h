@@ -10,11 +10,61 @@
 #include <GLES2/gl2ext.h>
 
 #include "dma-buffer.h"
+#include "gl-handles.h"
+#include "camera-calibration.h"
+#include "color-convert.h"
+
+class WarpLut;
+class VirtualTexture;
+
+/* Upper bound of cameras a rig can be stitched from in one pass */
+#define STITCH_MAX_CAMERAS 8
+
+/*
+ * A two-plane YUV frame sampled as separate Y and UV textures, for drivers
+ * that can't import it for samplerExternalOES. The planes are imported as
+ * R8 and GR88 images where possible, and copied into luminance textures
+ * otherwise.
+ */
+struct YuvPlanes
+{
+    YuvPlanes() : uploaded(false), swap_uv(false) {}
+
+    EglImage y_image;
+    EglImage uv_image;
+    GlTexture y;
+    GlTexture uv;
+    // Copied rather than imported, so every new frame has to be uploaded
+    bool uploaded;
+    // V before U, as in NV21
+    bool swap_uv;
+};
 
 bool egl_setup_graphics (void);
-bool egl_get_image_for_dma_buffer (struct DmaBuffer *buf, EGLImageKHR *outImage);
-bool egl_texture_for_image (EGLImageKHR image, GLuint *outTex);
-bool egl_sample_buffer (struct DmaBuffer *buf);
+bool egl_get_image_for_dma_buffer (const struct DmaBuffer *buf, EglImage *outImage);
+void egl_destroy_image (EGLImageKHR image);
+EGLSyncKHR egl_create_fence (void);
+bool egl_fence_signaled (EGLSyncKHR fence);
+void egl_destroy_fence (EGLSyncKHR fence);
+bool egl_texture_for_image (const EglImage &image, GlTexture *outTex);
+bool egl_import_planes (const struct DmaBuffer *buf, YuvPlanes *planes);
+bool egl_refresh_planes (const struct DmaBuffer *buf, YuvPlanes *planes, bool allocate);
+void egl_set_yuv_colors (ColorMatrix colors, bool fullRange);
+bool egl_setup_planar (void);
+bool egl_draw_planar (const YuvPlanes &planes, const GLfloat *mvp);
+bool egl_draw_texture (GLuint texture, const GLfloat *mvp);
+bool egl_setup_stitching (const CameraCalibration *cameras, const GLuint *textures,
+                          unsigned int count);
+bool egl_draw_stitched (const GLfloat *mvp);
+bool egl_setup_fisheye (const DualFisheyeCalibration &lens, int width, int height);
+bool egl_draw_fisheye (GLuint texture, const GLfloat *mvp);
+bool egl_setup_warp (const WarpLut &lut);
+bool egl_draw_warp (GLuint texture, const GLfloat *mvp);
+bool egl_setup_still (void);
+bool egl_draw_still (GLuint texture, const GLfloat *mvp);
+bool egl_setup_virtual_texture (const VirtualTexture &texture);
+bool egl_draw_virtual_texture (const VirtualTexture &texture, const GLfloat *mvp);
+bool egl_sample_buffer (const struct DmaBuffer *buf);
 
 void egl_release (void);
 
@@ -0,0 +1,151 @@
+#include "frame-importer.h"
+#include "log.h"
+
+FrameImporter::~FrameImporter()
+{
+    // Nothing may sample the buffers once they are back with the source
+    glFinish();
+
+    for (unsigned int i = 0; i < retired_.size(); i++) {
+        egl_destroy_fence(retired_[i].fence);
+        source_.release(retired_[i].index);
+    }
+    egl_destroy_fence(current_fence_);
+    if (current_ >= 0)
+        source_.release(current_);
+}
+
+bool FrameImporter::update()
+{
+    bool updated = false;
+    int index = source_.acquire();
+
+    if (index >= 0 && import(index)) {
+        // The previous frame is released once its last draw has finished
+        if (current_ >= 0) {
+            Retired retired = { current_, current_fence_ };
+            retired_.push_back(retired);
+        }
+        current_ = index;
+        current_fence_ = EGL_NO_SYNC_KHR;
+        frames_++;
+        updated = true;
+    } else if (index >= 0) {
+        source_.release(index);
+    }
+
+    release_retired();
+
+    return updated;
+}
+
+GLuint FrameImporter::texture()
+{
+    return current_ >= 0 && !planar_ ? imports_[current_].texture.get() : 0;
+}
+
+const YuvPlanes *FrameImporter::planes()
+{
+    return current_ >= 0 && planar_ ? &imports_[current_].planes : NULL;
+}
+
+void FrameImporter::frame_drawn()
+{
+    if (current_ < 0)
+        return;
+
+    egl_destroy_fence(current_fence_);
+    current_fence_ = egl_create_fence();
+
+    // Without fence support, wait for the GPU right away
+    if (current_fence_ == EGL_NO_SYNC_KHR)
+        glFinish();
+}
+
+/*******************
+ * Private methods *
+ *******************/
+
+bool FrameImporter::import(int index)
+{
+    if (imports_.size() < source_.buffers())
+        imports_.resize(source_.buffers());
+
+    if (planar_)
+        return import_planes(index);
+
+    Import &imp = imports_[index];
+    unsigned int generation = source_.generation(index);
+    if (imp.texture && imp.generation == generation) {
+        reused_++;
+        return true;
+    }
+
+    // A different buffer took the index, the acquired buffer is not in use
+    imp.texture.reset();
+    imp.image.reset();
+    imp.generation = generation;
+
+    if (!egl_get_image_for_dma_buffer(source_.buffer(index), &imp.image) ||
+        !egl_texture_for_image(imp.image, &imp.texture)) {
+        imp.image.reset();
+        if (frames_ > 0) {
+            Log::error("Failed to import frame buffer %d\n", index);
+            return false;
+        }
+
+        // The driver can't sample the format at all, try the planes
+        Log::info("Frames can't be sampled as external textures, sampling their planes\n");
+        planar_ = true;
+        return import_planes(index);
+    }
+
+    Log::debug("Imported frame buffer %d\n", index);
+    imported_++;
+
+    return true;
+}
+
+bool FrameImporter::import_planes(int index)
+{
+    Import &imp = imports_[index];
+    unsigned int generation = source_.generation(index);
+    if (imp.planes.y && imp.generation == generation) {
+        // Copied planes still hold the contents of the last time around
+        if (!egl_refresh_planes(source_.buffer(index), &imp.planes, false)) {
+            Log::error("Failed to upload frame buffer %d\n", index);
+            return false;
+        }
+        reused_++;
+        return true;
+    }
+
+    imp.planes = YuvPlanes();
+    imp.generation = generation;
+
+    if (!egl_setup_planar() || !egl_import_planes(source_.buffer(index), &imp.planes)) {
+        Log::error("Failed to import the planes of frame buffer %d\n", index);
+        imp.planes = YuvPlanes();
+        return false;
+    }
+
+    Log::debug("Imported the planes of frame buffer %d\n", index);
+    imported_++;
+
+    return true;
+}
+
+void FrameImporter::release_retired()
+{
+    std::vector<Retired>::iterator iter = retired_.begin();
+
+    while (iter != retired_.end()) {
+        if (iter->fence == EGL_NO_SYNC_KHR || egl_fence_signaled(iter->fence)) {
+            egl_destroy_fence(iter->fence);
+            source_.release(iter->index);
+            iter = retired_.erase(iter);
+        } else {
+            iter++;
+        }
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef FRAME_IMPORTER_H_
+#define FRAME_IMPORTER_H_
+
+#include <vector>
+#include "egl-render.h"
+#include "frame-source.h"
+
+/**
+ * Imports the frames of a FrameSource for rendering.
+ *
+ * Every buffer of the source is imported once; its EGLImage and texture
+ * are cached by buffer index and reused whenever the buffer comes around
+ * again. A frame that has been replaced is only given back to the source
+ * once a fence placed after its last draw has signaled, so the producer
+ * never overwrites a buffer the GPU is still sampling.
+ *
+ * Frames are sampled through samplerExternalOES. If the driver can't
+ * import them that way, the importer switches to sampling their Y and UV
+ * planes as separate textures for the rest of the stream.
+ */
+class FrameImporter
+{
+public:
+    FrameImporter(FrameSource &source, bool planar = false) :
+        source_(source), current_(-1), current_fence_(EGL_NO_SYNC_KHR),
+        planar_(planar), frames_(0), imported_(0), reused_(0) {}
+    ~FrameImporter();
+
+    /**
+     * Picks up the newest frame of the source, if any, and gives frames
+     * the GPU is done with back to the source.
+     *
+     * @return whether a new frame became current
+     */
+    bool update();
+
+    /**
+     * Gets the texture of the current frame, or 0 if there is none yet.
+     */
+    GLuint texture();
+
+    /**
+     * Gets the planes of the current frame when frames are sampled as
+     * planes, or NULL.
+     */
+    const YuvPlanes *planes();
+
+    /**
+     * Marks the end of the draws that sample the current frame.
+     */
+    void frame_drawn();
+
+    /* Frames that became current, and how many of them had to be imported
+     * or reused the import of their buffer */
+    unsigned int frames() const { return frames_; }
+    unsigned int imported() const { return imported_; }
+    unsigned int reused() const { return reused_; }
+
+    /* Buffers of the source, and how many of them are held for drawing */
+    unsigned int buffers() const { return source_.buffers(); }
+    unsigned int held() const { return (current_ >= 0 ? 1 : 0) + retired_.size(); }
+
+private:
+    struct Import
+    {
+        Import() : generation(0) {}
+        EglImage image;
+        GlTexture texture;
+        YuvPlanes planes;
+        unsigned int generation;
+    };
+
+    struct Retired
+    {
+        int index;
+        EGLSyncKHR fence;
+    };
+
+    bool import(int index);
+    bool import_planes(int index);
+    void release_retired();
+
+    FrameSource &source_;
+    std::vector<Import> imports_;
+    std::vector<Retired> retired_;
+    int current_;
+    EGLSyncKHR current_fence_;
+    bool planar_;
+    unsigned int frames_;
+    unsigned int imported_;
+    unsigned int reused_;
+};
+
+#endif /* FRAME_IMPORTER_H_ */
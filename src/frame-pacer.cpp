@@ -0,0 +1,106 @@
+#include "frame-pacer.h"
+
+#include <math.h>
+
+/* Time kept in reserve on top of the measured frame time, in seconds */
+#define PACER_MARGIN 0.0015
+/* Shortest budget ever used, in seconds */
+#define PACER_MIN_BUDGET 0.002
+/* How fast the budget shrinks towards faster frame times */
+#define PACER_RELEASE 0.05
+/* How fast the measured refresh period follows the vblanks */
+#define PACER_PERIOD_RATE 0.1
+
+FramePacer::FramePacer() :
+    period_(1.0 / 60.0),
+    budget_(1.0 / 60.0),
+    last_vblank_(0.0),
+    last_sequence_(0),
+    have_vblank_(false),
+    started_(0.0),
+    target_(0.0),
+    missed_(0)
+{
+}
+
+void FramePacer::refresh(double hz)
+{
+    if (hz <= 0.0)
+        return;
+
+    period_ = 1.0 / hz;
+    // Start out safe, a whole frame, and let the measurements shrink it
+    budget_ = period_;
+}
+
+void FramePacer::vblank(unsigned int sequence, double time)
+{
+    if (have_vblank_ && sequence > last_sequence_ && time > last_vblank_) {
+        double period = (time - last_vblank_) / (sequence - last_sequence_);
+
+        // Ignore nonsense, e.g. after a mode set
+        if (period > period_ * 0.5 && period < period_ * 2.0)
+            period_ += (period - period_) * PACER_PERIOD_RATE;
+    }
+
+    // A frame that hit a later vblank than it aimed at missed its deadline
+    if (target_ > 0.0 && time > target_ + period_ * 0.5) {
+        missed_++;
+        budget_ = fmin(budget_ + period_ * 0.1, period_);
+    }
+
+    last_vblank_ = time;
+    last_sequence_ = sequence;
+    have_vblank_ = true;
+    target_ = 0.0;
+}
+
+double FramePacer::render_start(double now) const
+{
+    if (!have_vblank_)
+        return now;
+
+    return next_vblank(now) - budget_;
+}
+
+void FramePacer::render_started(double now)
+{
+    started_ = now;
+    target_ = have_vblank_ ? next_vblank(now) : 0.0;
+}
+
+void FramePacer::frame_submitted(double now)
+{
+    if (started_ <= 0.0)
+        return;
+
+    double sample = now - started_ + PACER_MARGIN;
+
+    // Grow at once, shrink slowly
+    if (sample > budget_)
+        budget_ = sample;
+    else
+        budget_ += (sample - budget_) * PACER_RELEASE;
+
+    budget_ = fmin(fmax(budget_, PACER_MIN_BUDGET), period_);
+    started_ = 0.0;
+}
+
+/*******************
+ * Private methods *
+ *******************/
+
+/*
+ * The first predicted vblank after the last one that is still ahead of
+ * @now. Rendering that starts late still aims at it, the adaptive budget
+ * makes up for it on later frames.
+ */
+double FramePacer::next_vblank(double now) const
+{
+    double frames = ceil((now - last_vblank_) / period_);
+
+    if (frames < 1.0)
+        frames = 1.0;
+
+    return last_vblank_ + frames * period_;
+}
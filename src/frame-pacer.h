@@ -0,0 +1,69 @@
+#ifndef FRAME_PACER_H_
+#define FRAME_PACER_H_
+
+/**
+ * Schedules the rendering of an output's frames as late as possible.
+ *
+ * The pacer follows the vblanks of the output through the timestamps and
+ * sequence numbers of its page flip events and predicts the next one.
+ * Rendering is delayed until just the render budget is left before it, so
+ * the frame shows the newest camera and image state when it is scanned
+ * out. The budget follows the measured frame times: it grows at once when
+ * a frame takes longer or a vblank is missed, and shrinks slowly while
+ * frames are fast.
+ *
+ * All times are CLOCK_MONOTONIC seconds, like the DRM event timestamps.
+ */
+class FramePacer
+{
+public:
+    FramePacer();
+
+    /**
+     * Sets the nominal refresh rate until vblanks have been measured.
+     */
+    void refresh(double hz);
+
+    /**
+     * Records a completed page flip.
+     *
+     * @param sequence the vblank sequence number of the flip
+     * @param time when the flip completed
+     */
+    void vblank(unsigned int sequence, double time);
+
+    /**
+     * Gets when rendering of the next frame should start. A time that is
+     * not after @now means right away.
+     */
+    double render_start(double now) const;
+
+    /**
+     * Records that rendering of a frame starts.
+     */
+    void render_started(double now);
+
+    /**
+     * Records that a frame was handed to the display.
+     */
+    void frame_submitted(double now);
+
+    double budget() const { return budget_; }
+    double period() const { return period_; }
+    unsigned int missed() const { return missed_; }
+
+private:
+    double next_vblank(double now) const;
+
+    double period_;
+    double budget_;
+    double last_vblank_;
+    unsigned int last_sequence_;
+    bool have_vblank_;
+    // When rendering of the current frame started, and the vblank it aims at
+    double started_;
+    double target_;
+    unsigned int missed_;
+};
+
+#endif /* FRAME_PACER_H_ */
@@ -0,0 +1,73 @@
+#ifndef FRAME_SOURCE_H_
+#define FRAME_SOURCE_H_
+
+#include "dma-buffer.h"
+
+/**
+ * A live source of frames in dma-buf backed buffers.
+ *
+ * The source owns a fixed set of buffers identified by their index. A
+ * buffer handed out by acquire() belongs to the renderer until it is given
+ * back with release(), which must only happen once the GPU no longer
+ * samples it.
+ */
+class FrameSource
+{
+public:
+    virtual ~FrameSource() {}
+
+    /**
+     * Opens the source and starts producing frames.
+     *
+     * @return whether the source is ready
+     */
+    virtual bool init() = 0;
+
+    /**
+     * Gets a file descriptor that becomes readable when a new frame is
+     * available, or -1 if there is none.
+     */
+    virtual int fd() = 0;
+
+    /**
+     * Takes the newest available frame. Older frames that were never
+     * acquired are returned to the source right away.
+     *
+     * @return the index of the frame's buffer, or -1 if there is no new frame
+     */
+    virtual int acquire() = 0;
+
+    /**
+     * Gives an acquired buffer back to the source.
+     *
+     * @param index the index of the buffer
+     */
+    virtual void release(int index) = 0;
+
+    /**
+     * Gets the number of buffers of the source.
+     */
+    virtual unsigned int buffers() = 0;
+
+    /**
+     * Gets the description of a buffer.
+     *
+     * @param index the index of the buffer
+     */
+    virtual DmaBuffer *buffer(int index) = 0;
+
+    /**
+     * Gets the generation of a buffer. It changes whenever the source
+     * puts a different buffer behind the index, which must then be
+     * imported again.
+     *
+     * @param index the index of the buffer
+     */
+    virtual unsigned int generation(int index)
+    {
+        static_cast<void>(index);
+        return 0;
+    }
+};
+
+#endif /* FRAME_SOURCE_H_ */
@@ -0,0 +1,34 @@
+#include "gl-handles.h"
+#include "egl-render.h"
+#include "gl-state-cache.h"
+
+void EglImage::reset(EGLImageKHR image)
+{
+    if (image_ != EGL_NO_IMAGE_KHR && image_ != image)
+        egl_destroy_image(image_);
+    image_ = image;
+}
+
+GLuint GlTexture::generate()
+{
+    GLuint texture = 0;
+
+    glGenTextures(1, &texture);
+    reset(texture);
+
+    return texture_;
+}
+
+void GlTexture::reset(GLuint texture)
+{
+    if (texture_ && texture_ != texture)
+        GLStateCache::delete_texture(texture_);
+    texture_ = texture;
+}
+
+void GlProgram::reset(GLuint program)
+{
+    if (program_ && program_ != program)
+        GLStateCache::delete_program(program_);
+    program_ = program;
+}
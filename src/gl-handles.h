@@ -0,0 +1,112 @@
+#ifndef GL_HANDLES_H_
+#define GL_HANDLES_H_
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include "gl-headers.h"
+
+/*
+ * Owning handles of EGL and GL objects, the counterparts of the ones in
+ * handles.h. They are released in the context that is current when the
+ * handle is destroyed or reset, so they must not outlive the context;
+ * handles with static storage are reset by egl_release().
+ */
+
+/**
+ * An EGLImage of the current display.
+ */
+class EglImage
+{
+public:
+    EglImage() : image_(EGL_NO_IMAGE_KHR) {}
+    explicit EglImage(EGLImageKHR image) : image_(image) {}
+    EglImage(EglImage &&other) : image_(other.image_) { other.image_ = EGL_NO_IMAGE_KHR; }
+    ~EglImage() { reset(); }
+
+    EglImage &operator=(EglImage &&other)
+    {
+        EGLImageKHR image = other.image_;
+        other.image_ = EGL_NO_IMAGE_KHR;
+        reset(image);
+        return *this;
+    }
+
+    EGLImageKHR get() const { return image_; }
+    explicit operator bool() const { return image_ != EGL_NO_IMAGE_KHR; }
+
+    void reset(EGLImageKHR image = EGL_NO_IMAGE_KHR);
+
+private:
+    EglImage(const EglImage &) = delete;
+    EglImage &operator=(const EglImage &) = delete;
+
+    EGLImageKHR image_;
+};
+
+/**
+ * A texture name.
+ */
+class GlTexture
+{
+public:
+    GlTexture() : texture_(0) {}
+    explicit GlTexture(GLuint texture) : texture_(texture) {}
+    GlTexture(GlTexture &&other) : texture_(other.texture_) { other.texture_ = 0; }
+    ~GlTexture() { reset(); }
+
+    GlTexture &operator=(GlTexture &&other)
+    {
+        GLuint texture = other.texture_;
+        other.texture_ = 0;
+        reset(texture);
+        return *this;
+    }
+
+    GLuint get() const { return texture_; }
+    explicit operator bool() const { return texture_ != 0; }
+
+    /**
+     * Generates a new texture name in place of the one held so far.
+     */
+    GLuint generate();
+    void reset(GLuint texture = 0);
+
+private:
+    GlTexture(const GlTexture &) = delete;
+    GlTexture &operator=(const GlTexture &) = delete;
+
+    GLuint texture_;
+};
+
+/**
+ * A linked program.
+ */
+class GlProgram
+{
+public:
+    GlProgram() : program_(0) {}
+    explicit GlProgram(GLuint program) : program_(program) {}
+    GlProgram(GlProgram &&other) : program_(other.program_) { other.program_ = 0; }
+    ~GlProgram() { reset(); }
+
+    GlProgram &operator=(GlProgram &&other)
+    {
+        GLuint program = other.program_;
+        other.program_ = 0;
+        reset(program);
+        return *this;
+    }
+
+    GLuint get() const { return program_; }
+    explicit operator bool() const { return program_ != 0; }
+
+    void reset(GLuint program = 0);
+
+private:
+    GlProgram(const GlProgram &) = delete;
+    GlProgram &operator=(const GlProgram &) = delete;
+
+    GLuint program_;
+};
+
+#endif /* GL_HANDLES_H_ */
@@ -2,6 +2,12 @@
 
 void* (*GLExtensions::MapBuffer) (GLenum target, GLenum access) = 0;
 GLboolean (*GLExtensions::UnmapBuffer) (GLenum target) = 0;
+void (*GLExtensions::GenQueries) (GLsizei n, GLuint *ids) = 0;
+void (*GLExtensions::DeleteQueries) (GLsizei n, const GLuint *ids) = 0;
+void (*GLExtensions::BeginQuery) (GLenum target, GLuint id) = 0;
+void (*GLExtensions::EndQuery) (GLenum target) = 0;
+void (*GLExtensions::GetQueryObjectuiv) (GLuint id, GLenum pname, GLuint *params) = 0;
+void (*GLExtensions::GetQueryObjectui64v) (GLuint id, GLenum pname, GLuint64 *params) = 0;
 
 bool GLExtensions::support(const std::string &ext)
 {
@@ -14,10 +20,12 @@ bool GLExtensions::support(const std::string &ext)
     const size_t ext_size = ext.size();
     size_t pos = 0;
 
+    // Only accept whole names, not extensions that merely start with @ext
     while ((pos = ext_string.find(ext, pos)) != std::string::npos) {
         char c = ext_string[pos + ext_size];
-        if (c == ' ' || c == '\0')
+        if ((pos == 0 || ext_string[pos - 1] == ' ') && (c == ' ' || c == '\0'))
             break;
+        pos += ext_size;
     }
 
     return pos != std::string::npos;
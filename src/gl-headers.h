@@ -36,6 +36,14 @@ struct GLExtensions {
 
     static void* (*MapBuffer) (GLenum target, GLenum access);
     static GLboolean (*UnmapBuffer) (GLenum target);
+
+    // GL_EXT_disjoint_timer_query, null if unsupported
+    static void (*GenQueries) (GLsizei n, GLuint *ids);
+    static void (*DeleteQueries) (GLsizei n, const GLuint *ids);
+    static void (*BeginQuery) (GLenum target, GLuint id);
+    static void (*EndQuery) (GLenum target);
+    static void (*GetQueryObjectuiv) (GLuint id, GLenum pname, GLuint *params);
+    static void (*GetQueryObjectui64v) (GLuint id, GLenum pname, GLuint64 *params);
 };
 
 #endif
@@ -0,0 +1,283 @@
+#include "gl-state-cache.h"
+
+#include <string.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+/* Texture units and vertex attributes whose state is shadowed */
+#define STATE_CACHE_UNITS 16
+#define STATE_CACHE_ATTRIBS 16
+
+/* A value GL never reports, for state the cache doesn't know */
+static const GLuint UNKNOWN = 0xffffffff;
+
+struct AttribPointer
+{
+    GLint size;
+    GLenum type;
+    GLboolean normalized;
+    GLsizei stride;
+    const void *pointer;
+};
+
+static GLuint currentProgram = UNKNOWN;
+// A new context starts on the first unit
+static GLuint activeUnit = 0;
+static GLuint bound2D[STATE_CACHE_UNITS];
+static GLuint boundExternal[STATE_CACHE_UNITS];
+static AttribPointer attribPointers[STATE_CACHE_ATTRIBS];
+static bool attribPointerKnown[STATE_CACHE_ATTRIBS];
+static int attribEnabled[STATE_CACHE_ATTRIBS];
+// Values by program and location
+static std::unordered_map<uint64_t, std::vector<uint8_t> > uniforms;
+static bool initialized;
+
+static unsigned int issuedCalls;
+static unsigned int elidedCalls;
+static unsigned int frameIssued;
+static unsigned int frameElided;
+
+static void state_init()
+{
+    if (!initialized)
+        GLStateCache::invalidate();
+}
+
+/* Counts a call and tells whether it has to go to GL */
+static bool state_changed(bool changed)
+{
+    if (changed)
+        issuedCalls++;
+    else
+        elidedCalls++;
+
+    return changed;
+}
+
+/* The binding of @target on the active unit, or NULL if it isn't shadowed */
+static GLuint *state_binding(GLenum target)
+{
+    if (activeUnit >= STATE_CACHE_UNITS)
+        return NULL;
+    if (target == GL_TEXTURE_2D)
+        return &bound2D[activeUnit];
+    if (target == GL_TEXTURE_EXTERNAL_OES)
+        return &boundExternal[activeUnit];
+
+    return NULL;
+}
+
+/* Stores the value of a uniform of the program in use if it changed */
+static bool uniform_changed(GLint location, const void *data, size_t size)
+{
+    // GL ignores location -1
+    if (location < 0)
+        return state_changed(false);
+    if (currentProgram == UNKNOWN)
+        return state_changed(true);
+
+    uint64_t key = (static_cast<uint64_t>(currentProgram) << 32) | static_cast<uint32_t>(location);
+    std::vector<uint8_t> &stored = uniforms[key];
+    if (stored.size() == size && !memcmp(&stored[0], data, size))
+        return state_changed(false);
+
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    stored.assign(bytes, bytes + size);
+
+    return state_changed(true);
+}
+
+void GLStateCache::use_program(GLuint program)
+{
+    state_init();
+    if (state_changed(program != currentProgram)) {
+        glUseProgram(program);
+        currentProgram = program;
+    }
+}
+
+void GLStateCache::active_texture(GLenum unit)
+{
+    state_init();
+    if (state_changed(unit - GL_TEXTURE0 != activeUnit)) {
+        glActiveTexture(unit);
+        activeUnit = unit - GL_TEXTURE0;
+    }
+}
+
+void GLStateCache::bind_texture(GLenum target, GLuint texture)
+{
+    state_init();
+    GLuint *binding = state_binding(target);
+    if (state_changed(!binding || *binding != texture)) {
+        glBindTexture(target, texture);
+        if (binding)
+            *binding = texture;
+    }
+}
+
+void GLStateCache::uniform1i(GLint location, GLint value)
+{
+    if (uniform_changed(location, &value, sizeof(value)))
+        glUniform1i(location, value);
+}
+
+void GLStateCache::uniform1f(GLint location, GLfloat value)
+{
+    if (uniform_changed(location, &value, sizeof(value)))
+        glUniform1f(location, value);
+}
+
+void GLStateCache::uniform2f(GLint location, GLfloat x, GLfloat y)
+{
+    GLfloat values[2] = { x, y };
+
+    if (uniform_changed(location, values, sizeof(values)))
+        glUniform2f(location, x, y);
+}
+
+void GLStateCache::uniform2fv(GLint location, GLsizei count, const GLfloat *values)
+{
+    if (uniform_changed(location, values, count * 2 * sizeof(GLfloat)))
+        glUniform2fv(location, count, values);
+}
+
+void GLStateCache::uniform3fv(GLint location, GLsizei count, const GLfloat *values)
+{
+    if (uniform_changed(location, values, count * 3 * sizeof(GLfloat)))
+        glUniform3fv(location, count, values);
+}
+
+void GLStateCache::uniform4fv(GLint location, GLsizei count, const GLfloat *values)
+{
+    if (uniform_changed(location, values, count * 4 * sizeof(GLfloat)))
+        glUniform4fv(location, count, values);
+}
+
+void GLStateCache::uniform_matrix3fv(GLint location, GLsizei count, const GLfloat *values)
+{
+    if (uniform_changed(location, values, count * 9 * sizeof(GLfloat)))
+        glUniformMatrix3fv(location, count, GL_FALSE, values);
+}
+
+void GLStateCache::uniform_matrix4fv(GLint location, GLsizei count, const GLfloat *values)
+{
+    if (uniform_changed(location, values, count * 16 * sizeof(GLfloat)))
+        glUniformMatrix4fv(location, count, GL_FALSE, values);
+}
+
+void GLStateCache::vertex_attrib_pointer(GLuint index, GLint size, GLenum type,
+                                         GLboolean normalized, GLsizei stride,
+                                         const void *pointer)
+{
+    state_init();
+    if (index >= STATE_CACHE_ATTRIBS) {
+        state_changed(true);
+        glVertexAttribPointer(index, size, type, normalized, stride, pointer);
+        return;
+    }
+
+    AttribPointer &attrib = attribPointers[index];
+    bool changed = !attribPointerKnown[index] || attrib.size != size || attrib.type != type ||
+                   attrib.normalized != normalized || attrib.stride != stride ||
+                   attrib.pointer != pointer;
+    if (state_changed(changed)) {
+        glVertexAttribPointer(index, size, type, normalized, stride, pointer);
+        attrib.size = size;
+        attrib.type = type;
+        attrib.normalized = normalized;
+        attrib.stride = stride;
+        attrib.pointer = pointer;
+        attribPointerKnown[index] = true;
+    }
+}
+
+void GLStateCache::enable_vertex_attrib_array(GLuint index)
+{
+    state_init();
+    if (state_changed(index >= STATE_CACHE_ATTRIBS || attribEnabled[index] != 1)) {
+        glEnableVertexAttribArray(index);
+        if (index < STATE_CACHE_ATTRIBS)
+            attribEnabled[index] = 1;
+    }
+}
+
+void GLStateCache::disable_vertex_attrib_array(GLuint index)
+{
+    state_init();
+    if (state_changed(index >= STATE_CACHE_ATTRIBS || attribEnabled[index] != 0)) {
+        glDisableVertexAttribArray(index);
+        if (index < STATE_CACHE_ATTRIBS)
+            attribEnabled[index] = 0;
+    }
+}
+
+void GLStateCache::delete_texture(GLuint texture)
+{
+    state_init();
+    glDeleteTextures(1, &texture);
+
+    // Units that had it bound fall back to the default texture
+    for (unsigned int i = 0; i < STATE_CACHE_UNITS; i++) {
+        if (bound2D[i] == texture)
+            bound2D[i] = 0;
+        if (boundExternal[i] == texture)
+            boundExternal[i] = 0;
+    }
+}
+
+void GLStateCache::delete_program(GLuint program)
+{
+    state_init();
+    glDeleteProgram(program);
+
+    // The name may come back for a program with other uniforms
+    std::unordered_map<uint64_t, std::vector<uint8_t> >::iterator iter = uniforms.begin();
+    while (iter != uniforms.end()) {
+        if (iter->first >> 32 == program)
+            iter = uniforms.erase(iter);
+        else
+            iter++;
+    }
+    if (currentProgram == program)
+        currentProgram = UNKNOWN;
+}
+
+void GLStateCache::invalidate()
+{
+    currentProgram = UNKNOWN;
+    activeUnit = UNKNOWN;
+    for (unsigned int i = 0; i < STATE_CACHE_UNITS; i++) {
+        bound2D[i] = UNKNOWN;
+        boundExternal[i] = UNKNOWN;
+    }
+    for (unsigned int i = 0; i < STATE_CACHE_ATTRIBS; i++) {
+        attribPointerKnown[i] = false;
+        attribEnabled[i] = -1;
+    }
+    uniforms.clear();
+
+    // A fresh context starts on the first unit, it isn't known after that
+    if (!initialized)
+        activeUnit = 0;
+    initialized = true;
+}
+
+void GLStateCache::begin_frame()
+{
+    frameIssued = issuedCalls;
+    frameElided = elidedCalls;
+    issuedCalls = 0;
+    elidedCalls = 0;
+}
+
+unsigned int GLStateCache::issued()
+{
+    return frameIssued;
+}
+
+unsigned int GLStateCache::elided()
+{
+    return frameElided;
+}
@@ -0,0 +1,59 @@
+#ifndef GL_STATE_CACHE_H_
+#define GL_STATE_CACHE_H_
+
+#include "gl-headers.h"
+
+/**
+ * Shadow of the GL state that the renderer sets for every draw.
+ *
+ * Program, texture bindings, uniforms and vertex attribute arrays are set
+ * through the cache, which only calls GL when the value differs from what
+ * was set last, so drivers don't validate state that didn't change. The
+ * cache assumes it sees every change of that state on the one context it
+ * is used with; code that changes it directly must call invalidate().
+ * Textures and programs are deleted through the cache, as GL hands their
+ * names out again.
+ */
+struct GLStateCache {
+    static void use_program(GLuint program);
+    static void active_texture(GLenum unit);
+    static void bind_texture(GLenum target, GLuint texture);
+
+    /* Uniforms of the program in use */
+    static void uniform1i(GLint location, GLint value);
+    static void uniform1f(GLint location, GLfloat value);
+    static void uniform2f(GLint location, GLfloat x, GLfloat y);
+    static void uniform2fv(GLint location, GLsizei count, const GLfloat *values);
+    static void uniform3fv(GLint location, GLsizei count, const GLfloat *values);
+    static void uniform4fv(GLint location, GLsizei count, const GLfloat *values);
+    static void uniform_matrix3fv(GLint location, GLsizei count, const GLfloat *values);
+    static void uniform_matrix4fv(GLint location, GLsizei count, const GLfloat *values);
+
+    static void vertex_attrib_pointer(GLuint index, GLint size, GLenum type,
+                                      GLboolean normalized, GLsizei stride,
+                                      const void *pointer);
+    static void enable_vertex_attrib_array(GLuint index);
+    static void disable_vertex_attrib_array(GLuint index);
+
+    static void delete_texture(GLuint texture);
+    static void delete_program(GLuint program);
+
+    /**
+     * Forgets all state, the next call of every kind goes to GL.
+     */
+    static void invalidate();
+
+    /**
+     * Starts counting the calls of a new frame.
+     */
+    static void begin_frame();
+
+    /**
+     * Gets how many calls of the previous frame went to GL, and how many
+     * were skipped as redundant.
+     */
+    static unsigned int issued();
+    static unsigned int elided();
+};
+
+#endif /* GL_STATE_CACHE_H_ */
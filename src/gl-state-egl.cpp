@@ -2,6 +2,10 @@
 #include "log.h"
 #include "limits.h"
 #include "gl-headers.h"
+#include "util.h"
+#include "trace.h"
+#include <stdio.h>
+#include <string.h>
 #include <iomanip>
 #include <sstream>
 
@@ -156,13 +160,13 @@ EglConfig::EglConfig(EGLDisplay dpy, EGLConfig config) :
     }
 
     if (!badAttribVec.empty()) {
-        Log::error("Failed to get the following config attributes for config 0x%x:\n",
+        Log::debug("Failed to get the following config attributes for config 0x%x:\n",
                    config);
         for (vector<string>::const_iterator attribIt = badAttribVec.begin();
              attribIt != badAttribVec.end();
              attribIt++)
         {
-            Log::error("%s\n", attribIt->c_str());
+            Log::debug("%s\n", attribIt->c_str());
         }
     }
 }
@@ -232,19 +236,54 @@ bool GLStateEGL::init_display(void* native_display, GLVisualConfig& visual_confi
 
 bool GLStateEGL::init_surface(void* native_window)
 {
-    native_window_ = reinterpret_cast<EGLNativeWindowType>(native_window);
+    EGLNativeWindowType window = reinterpret_cast<EGLNativeWindowType>(native_window);
+
+    // Switch to the surface of an already known window, if any
+    if (window != native_window_) {
+        native_window_ = window;
+        egl_surface_ = 0;
+        for (vector<std::pair<EGLNativeWindowType, EGLSurface> >::const_iterator iter = egl_surfaces_.begin();
+             iter != egl_surfaces_.end();
+             iter++)
+        {
+            if (iter->first == window) {
+                egl_surface_ = iter->second;
+                break;
+            }
+        }
+    }
 
     return gotValidSurface();
 }
 
 void GLStateEGL::init_gl_extensions()
 {
+    // All outputs share the context, so this only needs doing once
+    if (gl_extensions_)
+        return;
+    gl_extensions_ = true;
+
     if (GLExtensions::support("GL_OES_mapbuffer")) {
         GLExtensions::MapBuffer =
                 reinterpret_cast<PFNGLMAPBUFFEROESPROC>(eglGetProcAddress("glMapBufferOES"));
         GLExtensions::UnmapBuffer =
                 reinterpret_cast<PFNGLUNMAPBUFFEROESPROC>(eglGetProcAddress("glUnmapBufferOES"));
     }
+
+    if (GLExtensions::support("GL_EXT_disjoint_timer_query")) {
+        GLExtensions::GenQueries =
+                reinterpret_cast<PFNGLGENQUERIESEXTPROC>(eglGetProcAddress("glGenQueriesEXT"));
+        GLExtensions::DeleteQueries =
+                reinterpret_cast<PFNGLDELETEQUERIESEXTPROC>(eglGetProcAddress("glDeleteQueriesEXT"));
+        GLExtensions::BeginQuery =
+                reinterpret_cast<PFNGLBEGINQUERYEXTPROC>(eglGetProcAddress("glBeginQueryEXT"));
+        GLExtensions::EndQuery =
+                reinterpret_cast<PFNGLENDQUERYEXTPROC>(eglGetProcAddress("glEndQueryEXT"));
+        GLExtensions::GetQueryObjectuiv =
+                reinterpret_cast<PFNGLGETQUERYOBJECTUIVEXTPROC>(eglGetProcAddress("glGetQueryObjectuivEXT"));
+        GLExtensions::GetQueryObjectui64v =
+                reinterpret_cast<PFNGLGETQUERYOBJECTUI64VEXTPROC>(eglGetProcAddress("glGetQueryObjectui64vEXT"));
+    }
 }
 
 bool GLStateEGL::valid()
@@ -261,7 +300,8 @@ bool GLStateEGL::valid()
     if (!gotValidContext())
         return false;
 
-    if (egl_context_ == eglGetCurrentContext())
+    if (egl_context_ == eglGetCurrentContext() &&
+        egl_surface_ == eglGetCurrentSurface(EGL_DRAW))
         return true;
 
     if (!eglMakeCurrent(egl_display_, egl_surface_, egl_surface_, egl_context_)) {
@@ -293,12 +333,15 @@ bool GLStateEGL::reset()
     }
 
     egl_context_ = 0;
+    gl_extensions_ = false;
 
     return true;
 }
 
 void GLStateEGL::swap()
 {
+    TRACE_SCOPE("swap");
+
     eglSwapBuffers(egl_display_, egl_surface_);
 }
 
@@ -372,26 +415,62 @@ void GLStateEGL::get_glvisualconfig(EGLConfig config, GLVisualConfig& visual_con
 
 EGLConfig GLStateEGL::select_best_config(std::vector<EGLConfig>& configs)
 {
+    const GLVisualConfig& target(requested_visual_config_);
+    const struct {
+        EGLint attrib;
+        int target;
+        int scale;
+    } components[] = {
+        { EGL_RED_SIZE, target.red, 4 },
+        { EGL_GREEN_SIZE, target.green, 4 },
+        { EGL_BLUE_SIZE, target.blue, 4 },
+        { EGL_ALPHA_SIZE, target.alpha, 4 },
+        { EGL_DEPTH_SIZE, target.depth, 1 },
+        { EGL_STENCIL_SIZE, target.stencil, 0 },
+        { EGL_BUFFER_SIZE, target.buffer, 1 },
+    };
+    const int num_components = sizeof(components) / sizeof(components[0]);
     int best_score(INT_MIN);
     EGLConfig best_config(0);
+    GLVisualConfig vc;
+
+    /*
+     * The most a component can still add to a score, assuming components
+     * are at most 32 bits wide like GLVisualConfig::match_score() does.
+     */
+    int max_remaining[num_components + 1];
+    max_remaining[num_components] = 0;
+    for (int i = num_components - 1; i >= 0; i--) {
+        int max_score = vc.score_component(32, components[i].target,
+                                           components[i].scale);
+        max_remaining[i] = max_remaining[i + 1] + (max_score > 32 ? max_score : 32);
+    }
 
     /*
      * Go through all the configs and choose the one with the best score,
-     * i.e., the one better matching the requested config.
+     * i.e., the one better matching the requested config. A config's
+     * components are queried one at a time, and the rest are skipped once
+     * the config can't beat the best one anymore.
      */
     for (std::vector<EGLConfig>::const_iterator iter = configs.begin();
          iter != configs.end();
          iter++)
     {
         const EGLConfig config(*iter);
-        GLVisualConfig vc;
-        int score;
+        int score(0);
+        int i;
 
-        get_glvisualconfig(config, vc);
+        for (i = 0; i < num_components; i++) {
+            if (best_config && score + max_remaining[i] <= best_score)
+                break;
 
-        score = vc.match_score(requested_visual_config_);
+            EGLint value(0);
+            eglGetConfigAttrib(egl_display_, config, components[i].attrib, &value);
+            score += vc.score_component(value, components[i].target,
+                                        components[i].scale);
+        }
 
-        if (score > best_score) {
+        if (i == num_components && score > best_score) {
             best_score = score;
             best_config = config;
         }
@@ -400,6 +479,117 @@ EGLConfig GLStateEGL::select_best_config(std::vector<EGLConfig>& configs)
     return best_config;
 }
 
+uint64_t GLStateEGL::config_cache_key(const EGLint *attribs)
+{
+    const EGLint strings[] = { EGL_VENDOR, EGL_VERSION, EGL_EXTENSIONS };
+    const GLVisualConfig& vc(requested_visual_config_);
+    const int visual[] = {
+        vc.red, vc.green, vc.blue, vc.alpha, vc.depth, vc.stencil, vc.buffer
+    };
+    uint64_t key;
+    size_t num_attribs(0);
+
+    while (attribs[num_attribs] != EGL_NONE)
+        num_attribs += 2;
+
+    key = Util::hash(attribs, num_attribs * sizeof(EGLint));
+    key = Util::hash(visual, sizeof(visual), key);
+    for (unsigned int i = 0; i < sizeof(strings) / sizeof(strings[0]); i++) {
+        const char *s = eglQueryString(egl_display_, strings[i]);
+        if (s)
+            key = Util::hash(s, strlen(s) + 1, key);
+    }
+
+    return key;
+}
+
+EGLConfig GLStateEGL::load_cached_config(uint64_t key)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "egl-config-%016llx",
+             static_cast<unsigned long long>(key));
+    string path(Util::cache_path(name));
+    if (path.empty())
+        return 0;
+
+    FILE *fp = fopen(path.c_str(), "r");
+    if (!fp)
+        return 0;
+
+    EGLint id(0);
+    bool ok = fscanf(fp, "%i", &id) == 1;
+    fclose(fp);
+    if (!ok)
+        return 0;
+
+    const EGLint id_attribs[] = {
+        EGL_CONFIG_ID, id,
+        EGL_NONE
+    };
+    EGLConfig config(0);
+    EGLint num_configs(0);
+    if (!eglChooseConfig(egl_display_, id_attribs, &config, 1, &num_configs) ||
+        num_configs != 1)
+        return 0;
+
+    // The other attributes are ignored when choosing by ID, check them here
+    EGLint surface_type(0);
+    EGLint renderable_type(0);
+    eglGetConfigAttrib(egl_display_, config, EGL_SURFACE_TYPE, &surface_type);
+    eglGetConfigAttrib(egl_display_, config, EGL_RENDERABLE_TYPE, &renderable_type);
+    if (!(surface_type & EGL_WINDOW_BIT) || !(renderable_type & EGL_OPENGL_ES2_BIT)) {
+        remove(path.c_str());
+        return 0;
+    }
+
+    return config;
+}
+
+void GLStateEGL::save_cached_config(uint64_t key, EGLConfig config)
+{
+    EGLint id(0);
+    if (!eglGetConfigAttrib(egl_display_, config, EGL_CONFIG_ID, &id))
+        return;
+
+    char name[64];
+    snprintf(name, sizeof(name), "egl-config-%016llx",
+             static_cast<unsigned long long>(key));
+    string path(Util::cache_path(name));
+    if (path.empty())
+        return;
+
+    FILE *fp = fopen(path.c_str(), "w");
+    if (!fp)
+        return;
+
+    fprintf(fp, "%#x\n", id);
+    fclose(fp);
+}
+
+void GLStateEGL::print_configs(std::vector<EGLConfig>& configs, EGLConfig best)
+{
+    // Print out the config information, and let the user know the decision
+    // about the "best" one with respect to the options.
+    unsigned int lineNumber(0);
+    EGLint best_id(0);
+    Log::debug("Got %u suitable EGLConfigs:\n", static_cast<unsigned int>(configs.size()));
+    for (vector<EGLConfig>::const_iterator configIt = configs.begin();
+         configIt != configs.end();
+         configIt++, lineNumber++)
+    {
+        EglConfig cfg(egl_display_, *configIt);
+        if (!(lineNumber % 32)) {
+            cfg.print_header();
+        }
+        cfg.print();
+        if (*configIt == best) {
+            best_id = cfg.configID();
+        }
+    }
+    Log::debug("\n");
+    Log::debug("Best EGLConfig ID: 0x%x\n", best_id);
+}
+
 bool GLStateEGL::gotValidConfig()
 {
     if (egl_config_)
@@ -418,6 +608,14 @@ bool GLStateEGL::gotValidConfig()
         EGL_NONE
     };
 
+    // A config chosen by an earlier run skips the search
+    uint64_t cache_key(config_cache_key(config_attribs));
+    egl_config_ = load_cached_config(cache_key);
+    if (egl_config_) {
+        Log::debug("Using the cached EGLConfig\n");
+        return true;
+    }
+
     // Find out how many configs match the attributes.
     EGLint num_configs(0);
     if (!eglChooseConfig(egl_display_, config_attribs, 0, 0, &num_configs)) {
@@ -443,34 +641,16 @@ bool GLStateEGL::gotValidConfig()
 
     // Select the best matching config
     egl_config_ = select_best_config(configs);
-
-    vector<EglConfig> configVec;
-    for (vector<EGLConfig>::const_iterator configIt = configs.begin();
-         configIt != configs.end();
-         configIt++)
-    {
-        EglConfig cfg(egl_display_, *configIt);
-        configVec.push_back(cfg);
-        if (*configIt == egl_config_) {
-            best_config_ = cfg;
-        }
+    if (!egl_config_) {
+        Log::error("No usable EGLConfig\n");
+        return false;
     }
 
-    // Print out the config information, and let the user know the decision
-    // about the "best" one with respect to the options.
-    unsigned int lineNumber(0);
-    Log::debug("Got %u suitable EGLConfigs:\n", num_configs);
-    for (vector<EglConfig>::const_iterator configIt = configVec.begin();
-         configIt != configVec.end();
-         configIt++, lineNumber++)
-    {
-        if (!(lineNumber % 32)) {
-            configIt->print_header();
-        }
-        configIt->print();
-    }
-    Log::debug("\n");
-    Log::debug("Best EGLConfig ID: 0x%x\n", best_config_.configID());
+    save_cached_config(cache_key, egl_config_);
+
+    // The full attribute table is only of interest when debugging
+    if (Log::debug_enabled())
+        print_configs(configs, egl_config_);
 
     return true;
 }
@@ -492,6 +672,8 @@ bool GLStateEGL::gotValidSurface()
         return false;
     }
 
+    egl_surfaces_.push_back(std::make_pair(native_window_, egl_surface_));
+
     return true;
 }
 
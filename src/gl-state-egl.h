@@ -2,6 +2,8 @@
 #define GL_STATE_EGL_H_
 
 #include <vector>
+#include <utility>
+#include <stdint.h>
 #include <EGL/egl.h>
 #include "gl-state.h"
 #include "gl-visual-config.h"
@@ -101,14 +103,20 @@ class GLStateEGL : public GLState
     EGLConfig egl_config_;
     EGLContext egl_context_;
     EGLSurface egl_surface_;
+    // Window surfaces created so far, one per native window (output)
+    std::vector<std::pair<EGLNativeWindowType, EGLSurface> > egl_surfaces_;
     GLVisualConfig requested_visual_config_;
-    EglConfig best_config_;
+    bool gl_extensions_;
     bool gotValidDisplay();
     bool gotValidConfig();
     bool gotValidSurface();
     bool gotValidContext();
     void get_glvisualconfig(EGLConfig config, GLVisualConfig& visual_config);
     EGLConfig select_best_config(std::vector<EGLConfig>& configs);
+    uint64_t config_cache_key(const EGLint *attribs);
+    EGLConfig load_cached_config(uint64_t key);
+    void save_cached_config(uint64_t key, EGLConfig config);
+    void print_configs(std::vector<EGLConfig>& configs, EGLConfig best);
 public:
     GLStateEGL() :
         native_display_(0),
@@ -116,7 +124,8 @@ public:
         egl_display_(0),
         egl_config_(0),
         egl_context_(0),
-        egl_surface_(0) {}
+        egl_surface_(0),
+        gl_extensions_(false) {}
 
     bool init_display(void* native_display, GLVisualConfig& config_pref);
     bool init_surface(void* native_window);
@@ -29,6 +29,18 @@ public:
      */
     int match_score(const GLVisualConfig &target) const;
 
+    /**
+     * How well a single component matches its target value, as summed up
+     * by match_score(). Allows scoring a config one component at a time.
+     *
+     * @param component the value of the component
+     * @param target the requested value
+     * @param scale how much a bit of difference weighs for the component
+     *
+     * @return the component's share of the match score
+     */
+    int score_component(int component, int target, int scale) const;
+
     int red;
     int green;
     int blue;
@@ -36,9 +48,6 @@ public:
     int depth;
     int stencil;
     int buffer;
-
-private:
-    int score_component(int component, int target, int scale) const;
 };
 
 #endif
@@ -0,0 +1,103 @@
+#include "handles.h"
+#include "log.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <drm.h>
+#include <xf86drm.h>
+#include <gbm.h>
+
+void UniqueFd::reset(int fd)
+{
+    if (fd_ >= 0 && fd_ != fd)
+        close(fd_);
+    fd_ = fd;
+}
+
+DumbBuffer &DumbBuffer::operator=(DumbBuffer &&other)
+{
+    if (this != &other) {
+        reset();
+        drm_fd_ = other.drm_fd_;
+        handle_ = other.handle_;
+        width_ = other.width_;
+        height_ = other.height_;
+        pitch_ = other.pitch_;
+        size_ = other.size_;
+        other.handle_ = 0;
+    }
+
+    return *this;
+}
+
+bool DumbBuffer::create(int drm_fd, uint32_t width, uint32_t height, uint32_t bpp)
+{
+    struct drm_mode_create_dumb create_arg;
+
+    reset();
+
+    memset(&create_arg, 0, sizeof(create_arg));
+    create_arg.bpp = bpp;
+    create_arg.width = width;
+    create_arg.height = height;
+    if (drmIoctl(drm_fd, DRM_IOCTL_MODE_CREATE_DUMB, &create_arg)) {
+        Log::error("failed to create dumb buffer\n");
+        return false;
+    }
+
+    drm_fd_ = drm_fd;
+    handle_ = create_arg.handle;
+    width_ = width;
+    height_ = height;
+    pitch_ = create_arg.pitch;
+    size_ = create_arg.size;
+
+    return true;
+}
+
+void *DumbBuffer::map()
+{
+    struct drm_mode_map_dumb map_arg;
+
+    memset(&map_arg, 0, sizeof(map_arg));
+    map_arg.handle = handle_;
+    if (drmIoctl(drm_fd_, DRM_IOCTL_MODE_MAP_DUMB, &map_arg)) {
+        Log::error("failed to map dumb buffer\n");
+        return NULL;
+    }
+
+    void *map = mmap(0, size_, PROT_READ | PROT_WRITE, MAP_SHARED, drm_fd_, map_arg.offset);
+    if (map == MAP_FAILED) {
+        Log::error("failed to map data\n");
+        return NULL;
+    }
+
+    return map;
+}
+
+void DumbBuffer::reset()
+{
+    struct drm_mode_destroy_dumb destroy_arg;
+
+    if (!handle_)
+        return;
+
+    memset(&destroy_arg, 0, sizeof(destroy_arg));
+    destroy_arg.handle = handle_;
+    if (drmIoctl(drm_fd_, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy_arg))
+        Log::error("failed to destroy dumb buffer\n");
+
+    handle_ = 0;
+    width_ = 0;
+    height_ = 0;
+    pitch_ = 0;
+    size_ = 0;
+}
+
+void GbmBo::reset(struct gbm_bo *bo)
+{
+    if (bo_ && bo_ != bo)
+        gbm_bo_destroy(bo_);
+    bo_ = bo;
+}
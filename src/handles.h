@@ -0,0 +1,146 @@
+#ifndef HANDLES_H_
+#define HANDLES_H_
+
+#include <stdint.h>
+
+struct gbm_bo;
+
+/*
+ * Owning handles of kernel and driver resources.
+ *
+ * Each handle releases what it holds when it is destroyed or reset, and
+ * can only be moved, so a resource has exactly one owner and can be kept
+ * in containers and pools without being released twice or never.
+ */
+
+/**
+ * A file descriptor, closed with the handle.
+ */
+class UniqueFd
+{
+public:
+    UniqueFd() : fd_(-1) {}
+    explicit UniqueFd(int fd) : fd_(fd) {}
+    UniqueFd(UniqueFd &&other) : fd_(other.release()) {}
+    ~UniqueFd() { reset(); }
+
+    UniqueFd &operator=(UniqueFd &&other)
+    {
+        reset(other.release());
+        return *this;
+    }
+
+    int get() const { return fd_; }
+    explicit operator bool() const { return fd_ >= 0; }
+
+    /**
+     * Closes the descriptor held so far and takes over @fd.
+     */
+    void reset(int fd = -1);
+
+    /**
+     * Gives up the descriptor without closing it.
+     */
+    int release()
+    {
+        int fd = fd_;
+        fd_ = -1;
+        return fd;
+    }
+
+private:
+    UniqueFd(const UniqueFd &) = delete;
+    UniqueFd &operator=(const UniqueFd &) = delete;
+
+    int fd_;
+};
+
+/**
+ * A dumb buffer of a KMS device, destroyed with the handle. The device
+ * must stay open for as long as the buffer exists.
+ */
+class DumbBuffer
+{
+public:
+    DumbBuffer() : drm_fd_(-1), handle_(0), width_(0), height_(0), pitch_(0), size_(0) {}
+    DumbBuffer(DumbBuffer &&other) :
+        drm_fd_(other.drm_fd_), handle_(other.handle_), width_(other.width_),
+        height_(other.height_), pitch_(other.pitch_), size_(other.size_)
+    {
+        other.handle_ = 0;
+    }
+    ~DumbBuffer() { reset(); }
+
+    DumbBuffer &operator=(DumbBuffer &&other);
+
+    /**
+     * Allocates a buffer of @height rows of @width pixels.
+     *
+     * @param drm_fd the KMS device to allocate on
+     * @param bpp the bits per pixel
+     *
+     * @return whether the buffer was allocated
+     */
+    bool create(int drm_fd, uint32_t width, uint32_t height, uint32_t bpp);
+
+    /**
+     * Maps the buffer for writing.
+     *
+     * @return the mapping of size() bytes, or NULL on failure
+     */
+    void *map();
+
+    void reset();
+
+    uint32_t handle() const { return handle_; }
+    uint32_t width() const { return width_; }
+    uint32_t height() const { return height_; }
+    uint32_t pitch() const { return pitch_; }
+    uint64_t size() const { return size_; }
+    explicit operator bool() const { return handle_ != 0; }
+
+private:
+    DumbBuffer(const DumbBuffer &) = delete;
+    DumbBuffer &operator=(const DumbBuffer &) = delete;
+
+    int drm_fd_;
+    uint32_t handle_;
+    uint32_t width_;
+    uint32_t height_;
+    uint32_t pitch_;
+    uint64_t size_;
+};
+
+/**
+ * A GBM buffer object, destroyed with the handle. The GBM device must
+ * outlive it.
+ */
+class GbmBo
+{
+public:
+    GbmBo() : bo_(0) {}
+    explicit GbmBo(struct gbm_bo *bo) : bo_(bo) {}
+    GbmBo(GbmBo &&other) : bo_(other.bo_) { other.bo_ = 0; }
+    ~GbmBo() { reset(); }
+
+    GbmBo &operator=(GbmBo &&other)
+    {
+        struct gbm_bo *bo = other.bo_;
+        other.bo_ = 0;
+        reset(bo);
+        return *this;
+    }
+
+    struct gbm_bo *get() const { return bo_; }
+    explicit operator bool() const { return bo_ != 0; }
+
+    void reset(struct gbm_bo *bo = 0);
+
+private:
+    GbmBo(const GbmBo &) = delete;
+    GbmBo &operator=(const GbmBo &) = delete;
+
+    struct gbm_bo *bo_;
+};
+
+#endif /* HANDLES_H_ */
@@ -0,0 +1,61 @@
+#ifndef INGEST_PROTOCOL_H_
+#define INGEST_PROTOCOL_H_
+
+#include <stdint.h>
+
+/*
+ * Messages of the dma-buf ingest socket.
+ *
+ * A producer connects to the SOCK_SEQPACKET Unix socket given with
+ * --ingest and sends one ingest_frame message per frame. The dma-buf fds
+ * of a buffer are attached with SCM_RIGHTS the first time the buffer is
+ * sent (or when a different buffer takes its id, which is only accepted
+ * once the old one was released); later frames in the same buffer are
+ * sent without fds. Once a frame is no longer on screen the buffer is
+ * handed back with an ingest_release message, and the producer must not
+ * write into it before that.
+ *
+ * Producers are separate programs, often written in C, that send the
+ * structures as raw bytes: their fields have fixed widths and the 64-bit
+ * ones sit at multiples of 8, so both ends agree on the layout.
+ */
+
+#define INGEST_MAGIC 0x504e4749 /* 'IGNP' */
+#define INGEST_VERSION 1
+
+/* Maximum number of planes and attached fds of a frame */
+#define INGEST_MAX_PLANES 2
+
+enum ingest_message_type {
+    INGEST_FRAME = 1,
+    INGEST_RELEASE = 2,
+};
+
+/* Producer to display: a new frame is in a buffer */
+struct ingest_frame {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t type;              /* INGEST_FRAME */
+    uint32_t buffer_id;         /* producer chosen id of the buffer */
+    uint32_t width;
+    uint32_t height;
+    uint32_t fourcc;            /* DRM fourcc, e.g. NV12 */
+    uint32_t num_planes;        /* 1 or 2 */
+    uint32_t num_fds;           /* attached fds, 0 or one per plane */
+    uint32_t offset[INGEST_MAX_PLANES];
+    uint32_t pitch[INGEST_MAX_PLANES];
+    uint64_t modifier;          /* DRM_FORMAT_MOD_INVALID if implicit */
+    uint64_t timestamp_ns;      /* CLOCK_MONOTONIC presentation time */
+};
+
+/* Display to producer: the buffer may be written again */
+struct ingest_release {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t type;              /* INGEST_RELEASE */
+    uint32_t buffer_id;
+    uint32_t reserved;
+    uint64_t timestamp_ns;      /* timestamp of the released frame */
+};
+
+#endif /* INGEST_PROTOCOL_H_ */
@@ -0,0 +1,299 @@
+#include "ingest-source.h"
+#include "log.h"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <drm_fourcc.h>
+
+IngestSource::~IngestSource()
+{
+    disconnect();
+
+    if (listen_fd_ >= 0) {
+        close(listen_fd_);
+        unlink(path_.c_str());
+    }
+}
+
+bool IngestSource::init()
+{
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path_.size() >= sizeof(addr.sun_path)) {
+        Log::error("Ingest socket path '%s' is too long\n", path_.c_str());
+        return false;
+    }
+    strcpy(addr.sun_path, path_.c_str());
+
+    listen_fd_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0) {
+        Log::error("Failed to create the ingest socket: %s\n", strerror(errno));
+        return false;
+    }
+
+    // A socket left behind by an earlier run would make bind() fail
+    unlink(path_.c_str());
+
+    if (bind(listen_fd_, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(listen_fd_, 1) < 0) {
+        Log::error("Failed to listen on %s: %s\n", path_.c_str(), strerror(errno));
+        close(listen_fd_);
+        listen_fd_ = -1;
+        return false;
+    }
+
+    Log::info("Waiting for frames on %s\n", path_.c_str());
+
+    return true;
+}
+
+int IngestSource::fd()
+{
+    return client_fd_ >= 0 ? client_fd_ : listen_fd_;
+}
+
+int IngestSource::acquire()
+{
+    if (client_fd_ < 0)
+        accept_client();
+
+    while (client_fd_ >= 0 && receive())
+        ;
+
+    int index = newest_;
+    newest_ = -1;
+    if (index >= 0)
+        slots_[index].held = true;
+
+    return index;
+}
+
+void IngestSource::release(int index)
+{
+    slots_[index].held = false;
+
+    // Buffers of a producer that went away have nobody to go back to
+    if (slots_[index].live)
+        send_release(index);
+}
+
+unsigned int IngestSource::buffers()
+{
+    return slots_.size();
+}
+
+DmaBuffer *IngestSource::buffer(int index)
+{
+    return &slots_[index].buffer;
+}
+
+unsigned int IngestSource::generation(int index)
+{
+    return slots_[index].generation;
+}
+
+/*******************
+ * Private methods *
+ *******************/
+
+void IngestSource::accept_client()
+{
+    client_fd_ = accept4(listen_fd_, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client_fd_ >= 0)
+        Log::info("Frame producer connected to %s\n", path_.c_str());
+}
+
+void IngestSource::disconnect()
+{
+    if (client_fd_ < 0)
+        return;
+
+    close(client_fd_);
+    client_fd_ = -1;
+    newest_ = -1;
+
+    for (unsigned int i = 0; i < slots_.size(); i++)
+        close_slot(slots_[i]);
+
+    Log::info("Frame producer disconnected from %s\n", path_.c_str());
+}
+
+/**
+ * Receives one message of the producer.
+ *
+ * @return whether there may be more messages to receive
+ */
+bool IngestSource::receive()
+{
+    ingest_frame frame;
+    char control[CMSG_SPACE(sizeof(int) * INGEST_MAX_PLANES)];
+    int fds[INGEST_MAX_PLANES];
+    unsigned int num_fds = 0;
+    struct iovec iov;
+    struct msghdr msg;
+    ssize_t len;
+
+    iov.iov_base = &frame;
+    iov.iov_len = sizeof(frame);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    len = recvmsg(client_fd_, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return false;
+    if (len <= 0) {
+        disconnect();
+        return false;
+    }
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        unsigned int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        int *data = (int *)CMSG_DATA(cmsg);
+        for (unsigned int i = 0; i < count; i++) {
+            if (num_fds < INGEST_MAX_PLANES)
+                fds[num_fds++] = data[i];
+            else
+                close(data[i]);
+        }
+    }
+
+    if (len != sizeof(frame) || frame.magic != INGEST_MAGIC ||
+        frame.version != INGEST_VERSION || frame.type != INGEST_FRAME ||
+        (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) || num_fds != frame.num_fds) {
+        Log::error("Dropped an invalid ingest message\n");
+        for (unsigned int i = 0; i < num_fds; i++)
+            close(fds[i]);
+        return true;
+    }
+
+    int index;
+    if (num_fds) {
+        index = define_slot(frame, fds, num_fds);
+    } else {
+        index = find_slot(frame.buffer_id);
+        if (index < 0)
+            Log::error("Frame in unknown ingest buffer %u\n", frame.buffer_id);
+    }
+    if (index < 0)
+        return true;
+
+    slots_[index].timestamp = frame.timestamp_ns;
+
+    // Only the newest frame is shown, an older one that was never acquired
+    // goes straight back to the producer
+    if (newest_ >= 0 && newest_ != index)
+        send_release(newest_);
+    newest_ = index;
+
+    return true;
+}
+
+int IngestSource::find_slot(uint32_t id)
+{
+    for (unsigned int i = 0; i < slots_.size(); i++) {
+        if (slots_[i].live && slots_[i].id == id)
+            return i;
+    }
+
+    return -1;
+}
+
+int IngestSource::define_slot(const ingest_frame &frame, int *fds, unsigned int num_fds)
+{
+    if (frame.width == 0 || frame.height == 0 || frame.num_planes == 0 ||
+        frame.num_planes > INGEST_MAX_PLANES ||
+        (num_fds != 1 && num_fds != frame.num_planes)) {
+        Log::error("Invalid layout of ingest buffer %u\n", frame.buffer_id);
+        for (unsigned int i = 0; i < num_fds; i++)
+            close(fds[i]);
+        return -1;
+    }
+
+    // A buffer that is sent again with fds replaces the old one of its id,
+    // unless the old one is still on screen
+    int index = find_slot(frame.buffer_id);
+    if (index >= 0 && slots_[index].held) {
+        Log::error("Ingest buffer %u was redefined before its release\n", frame.buffer_id);
+        for (unsigned int i = 0; i < num_fds; i++)
+            close(fds[i]);
+        return -1;
+    }
+    if (index < 0) {
+        for (unsigned int i = 0; i < slots_.size(); i++) {
+            if (!slots_[i].live && !slots_[i].held) {
+                index = i;
+                break;
+            }
+        }
+    }
+    if (index < 0) {
+        slots_.push_back(Slot());
+        index = slots_.size() - 1;
+    }
+
+    Slot &slot = slots_[index];
+    close_slot(slot);
+
+    DmaBuffer &buffer = slot.buffer;
+    buffer.width = frame.width;
+    buffer.height = frame.height;
+    buffer.fourcc = frame.fourcc;
+    buffer.owned_fd.reset(fds[0]);
+    buffer.dma_fd = fds[0];
+    buffer.offset = frame.offset[0];
+    buffer.stride = frame.pitch[0];
+    buffer.has_modifier = frame.modifier != DRM_FORMAT_MOD_INVALID;
+    buffer.modifier = frame.modifier;
+    if (frame.num_planes > 1) {
+        if (num_fds > 1) {
+            buffer.owned_uv_fd.reset(fds[1]);
+            buffer.uv_fd = fds[1];
+        }
+        buffer.uv_offset = frame.offset[1];
+        buffer.uv_stride = frame.pitch[1];
+    }
+
+    slot.id = frame.buffer_id;
+    slot.live = true;
+    slot.generation++;
+
+    Log::debug("Ingest buffer %u: %ux%u fourcc 0x%08x in slot %d\n",
+               frame.buffer_id, frame.width, frame.height, frame.fourcc, index);
+
+    return index;
+}
+
+void IngestSource::close_slot(Slot &slot)
+{
+    // Closes the dma-bufs the slot owns
+    slot.buffer = DmaBuffer();
+    slot.live = false;
+}
+
+void IngestSource::send_release(int index)
+{
+    ingest_release msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.magic = INGEST_MAGIC;
+    msg.version = INGEST_VERSION;
+    msg.type = INGEST_RELEASE;
+    msg.buffer_id = slots_[index].id;
+    msg.timestamp_ns = slots_[index].timestamp;
+
+    if (send(client_fd_, &msg, sizeof(msg), MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+        Log::debug("Failed to release ingest buffer %u: %s\n",
+                   msg.buffer_id, strerror(errno));
+}
@@ -0,0 +1,63 @@
+#ifndef INGEST_SOURCE_H_
+#define INGEST_SOURCE_H_
+
+#include "frame-source.h"
+#include "ingest-protocol.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * Receives frames of another process over a Unix socket.
+ *
+ * The producer passes its dma-bufs with SCM_RIGHTS as described in
+ * ingest-protocol.h, so decoded frames reach the GPU without a copy. One
+ * producer is served at a time; when it goes away the socket waits for
+ * the next one.
+ */
+class IngestSource : public FrameSource
+{
+public:
+    IngestSource(const std::string &path) :
+        path_(path), listen_fd_(-1), client_fd_(-1), newest_(-1) {}
+    ~IngestSource();
+
+    bool init();
+    int fd();
+    int acquire();
+    void release(int index);
+    unsigned int buffers();
+    DmaBuffer *buffer(int index);
+    unsigned int generation(int index);
+
+private:
+    struct Slot
+    {
+        Slot() : id(0), timestamp(0), generation(0), live(false), held(false) {}
+
+        DmaBuffer buffer;
+        uint32_t id;
+        uint64_t timestamp;
+        unsigned int generation;
+        // Belongs to the connected producer
+        bool live;
+        // Handed out by acquire() and not released yet
+        bool held;
+    };
+
+    void accept_client();
+    void disconnect();
+    bool receive();
+    int find_slot(uint32_t id);
+    int define_slot(const ingest_frame &frame, int *fds, unsigned int num_fds);
+    void close_slot(Slot &slot);
+    void send_release(int index);
+
+    std::string path_;
+    int listen_fd_;
+    int client_fd_;
+    std::vector<Slot> slots_;
+    int newest_;
+};
+
+#endif /* INGEST_SOURCE_H_ */
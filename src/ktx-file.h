@@ -0,0 +1,104 @@
+#ifndef KTX_FILE_H_
+#define KTX_FILE_H_
+
+#include <stdint.h>
+
+/*
+ * The parts of the KTX 1.1 file format that compressed panoramas use.
+ *
+ * A file starts with a ktx_header, followed by bytes_of_key_value_data of
+ * metadata and then, for every mip level from the largest down, a 32-bit
+ * image size and that many bytes of compressed blocks, padded to a
+ * multiple of 4. Only little-endian files of a single 2D image are
+ * accepted, which is what common encoders (including tools/pano-compress
+ * and astcenc) write.
+ *
+ * ktx_header mirrors the 64 bytes the specification puts at the start
+ * of the file word for word, and is read straight out of the mapped file.
+ */
+
+#define KTX_IDENTIFIER { 0xab, 0x4b, 0x54, 0x58, 0x20, 0x31, 0x31, 0xbb, 0x0d, 0x0a, 0x1a, 0x0a }
+#define KTX_ENDIANNESS 0x04030201
+
+/* The compressed formats a file may hold, as GL internal formats */
+#define KTX_ETC1_RGB8 0x8d64
+#define KTX_ETC2_RGB8 0x9274
+#define KTX_ETC2_SRGB8 0x9275
+#define KTX_ETC2_RGB8_PUNCHTHROUGH_ALPHA1 0x9276
+#define KTX_ETC2_SRGB8_PUNCHTHROUGH_ALPHA1 0x9277
+#define KTX_ETC2_RGBA8_EAC 0x9278
+#define KTX_ETC2_SRGB8_ALPHA8_EAC 0x9279
+#define KTX_ASTC_RGBA_FIRST 0x93b0 /* 4x4 up to 12x12 */
+#define KTX_ASTC_RGBA_LAST 0x93bd
+#define KTX_ASTC_SRGB8_ALPHA8_FIRST 0x93d0
+#define KTX_ASTC_SRGB8_ALPHA8_LAST 0x93dd
+
+struct ktx_header {
+    uint8_t identifier[12];
+    uint32_t endianness;              /* KTX_ENDIANNESS */
+    uint32_t gl_type;                 /* 0 for compressed data */
+    uint32_t gl_type_size;            /* 1 for compressed data */
+    uint32_t gl_format;               /* 0 for compressed data */
+    uint32_t gl_internal_format;      /* one of the formats above */
+    uint32_t gl_base_internal_format; /* GL_RGB or GL_RGBA */
+    uint32_t pixel_width;
+    uint32_t pixel_height;
+    uint32_t pixel_depth;             /* 0 for 2D textures */
+    uint32_t number_of_array_elements; /* 0 if not an array */
+    uint32_t number_of_faces;         /* 1 if not a cube map */
+    uint32_t number_of_mipmap_levels;
+    uint32_t bytes_of_key_value_data;
+};
+
+/**
+ * Gets the block layout of a compressed format.
+ *
+ * @param format the GL internal format
+ * @param width the width of a block in pixels
+ * @param height the height of a block in pixels
+ * @param bytes the size of a block in bytes
+ *
+ * @return 0 if the format is not one of the KTX_* formats, 1 otherwise
+ */
+static inline int ktx_block_layout(uint32_t format, uint32_t *width, uint32_t *height,
+                                   uint32_t *bytes)
+{
+    /* The ASTC footprints in the order of their formats */
+    static const uint8_t astc[][2] = {
+        { 4, 4 }, { 5, 4 }, { 5, 5 }, { 6, 5 }, { 6, 6 }, { 8, 5 }, { 8, 6 },
+        { 8, 8 }, { 10, 5 }, { 10, 6 }, { 10, 8 }, { 10, 10 }, { 12, 10 }, { 12, 12 },
+    };
+
+    if (format >= KTX_ASTC_RGBA_FIRST && format <= KTX_ASTC_RGBA_LAST) {
+        *width = astc[format - KTX_ASTC_RGBA_FIRST][0];
+        *height = astc[format - KTX_ASTC_RGBA_FIRST][1];
+        *bytes = 16;
+        return 1;
+    }
+    if (format >= KTX_ASTC_SRGB8_ALPHA8_FIRST && format <= KTX_ASTC_SRGB8_ALPHA8_LAST) {
+        *width = astc[format - KTX_ASTC_SRGB8_ALPHA8_FIRST][0];
+        *height = astc[format - KTX_ASTC_SRGB8_ALPHA8_FIRST][1];
+        *bytes = 16;
+        return 1;
+    }
+
+    *width = 4;
+    *height = 4;
+    switch (format) {
+    case KTX_ETC1_RGB8:
+    case KTX_ETC2_RGB8:
+    case KTX_ETC2_SRGB8:
+    case KTX_ETC2_RGB8_PUNCHTHROUGH_ALPHA1:
+    case KTX_ETC2_SRGB8_PUNCHTHROUGH_ALPHA1:
+        *bytes = 8;
+        return 1;
+    case KTX_ETC2_RGBA8_EAC:
+    case KTX_ETC2_SRGB8_ALPHA8_EAC:
+        *bytes = 16;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+#endif /* KTX_FILE_H_ */
@@ -2,10 +2,16 @@
 
 #include <unistd.h>
 #include <cstdio>
-#include <cstdarg>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
 #include <string>
-#include <sstream>
 #include <iostream>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
 
 using std::string;
 
@@ -20,24 +26,170 @@ static const string terminal_color_cyan("\033[36m");
 static const string terminal_color_yellow("\033[33m");
 static const string empty;
 
-static void print_prefixed_message(std::ostream& stream, const string& color, const string& prefix,
-                       const string& fmt, va_list ap)
+/* Messages the ring holds before new ones are dropped, a power of two */
+#define RING_SLOTS 256
+
+/* Bytes of string arguments a message can carry, longer ones are cut */
+#define RING_STRING_BYTES 512
+
+/* How long the writer sleeps when it may have missed a wake-up, in ms */
+#define WRITER_IDLE_MS 100
+
+/* A message as the emitting thread leaves it */
+struct Record
+{
+    int level;
+    const char *fmt;
+    unsigned int count;
+    Log::Arg args[Log::max_args];
+    char strings[RING_STRING_BYTES];
+};
+
+/*
+ * A bounded MPSC queue: every slot carries a sequence number that tells
+ * producers and the consumer whose turn it is, so producers only contend
+ * on one atomic counter and never wait for each other or the writer.
+ */
+struct Slot
 {
-    va_list aq;
+    std::atomic<unsigned int> sequence;
+    Record record;
+};
+
+static Slot ring[RING_SLOTS];
+static std::atomic<unsigned int> ring_head(0);
+static unsigned int ring_tail = 0;
+static std::atomic<unsigned int> ring_written(0);
+static std::atomic<unsigned int> ring_dropped(0);
+
+/*
+ * Whether messages may go into the ring, and how many producers are
+ * between checking that and publishing their message. stop() closes the
+ * admission and waits for those producers before the writer's last drain.
+ */
+static std::atomic<bool> ring_admitting(false);
+static std::atomic<unsigned int> ring_producers(0);
+
+static std::thread *writer = 0;
+static std::atomic<bool> writer_running(false);
+static std::atomic<bool> writer_sleeping(false);
+static std::mutex writer_mutex;
+static std::condition_variable writer_wake;
+
+static long long signed_value(const Log::Arg &arg)
+{
+    if (arg.type == Log::Arg::Double)
+        return static_cast<long long>(arg.value.d);
+
+    // Reinterpret the argument at its original width, as printf would
+    switch (arg.size) {
+    case 1: return static_cast<int8_t>(arg.value.u);
+    case 2: return static_cast<int16_t>(arg.value.u);
+    case 4: return static_cast<int32_t>(arg.value.u);
+    default: return arg.value.i;
+    }
+}
+
+static unsigned long long unsigned_value(const Log::Arg &arg)
+{
+    if (arg.type == Log::Arg::Double)
+        return static_cast<unsigned long long>(arg.value.d);
+
+    switch (arg.size) {
+    case 1: return static_cast<uint8_t>(arg.value.u);
+    case 2: return static_cast<uint16_t>(arg.value.u);
+    case 4: return static_cast<uint32_t>(arg.value.u);
+    default: return arg.value.u;
+    }
+}
+
+/*
+ * Formats a message from its stored arguments. Every conversion is handed
+ * to snprintf on its own, with its length modifier replaced by the one of
+ * the stored type, so the caller's modifiers don't matter.
+ */
+static void format_message(const Record &record, string &out)
+{
+    const char *p = record.fmt;
+    unsigned int next = 0;
+
+    out.clear();
+
+    while (*p) {
+        const char *start = p;
+        while (*p && *p != '%')
+            p++;
+        out.append(start, p - start);
+        if (!*p)
+            break;
 
-    /* Estimate message size */
-    va_copy(aq, ap);
-    int msg_size = vsnprintf(NULL, 0, fmt.c_str(), aq);
-    va_end(aq);
+        if (p[1] == '%') {
+            out += '%';
+            p += 2;
+            continue;
+        }
+
+        // The spec without its length modifier, '*' replaced by the argument
+        string spec("%");
+        for (p++; *p && strchr("-+ #0", *p); p++)
+            spec += *p;
+        for (; *p && (isdigit(*p) || *p == '.' || *p == '*'); p++) {
+            if (*p == '*') {
+                char width[16];
+                snprintf(width, sizeof(width), "%lld",
+                         next < record.count ? signed_value(record.args[next++]) : 0);
+                spec += width;
+            } else {
+                spec += *p;
+            }
+        }
+        while (*p && strchr("hlLqjzt", *p))
+            p++;
+        if (!*p)
+            break;
 
-    /* Create the buffer to hold the message */
-    char *buf = new char[msg_size + 1];
+        char conversion = *p++;
+        if (next >= record.count)
+            continue;
+
+        const Log::Arg &arg = record.args[next++];
+        char buf[512];
+        buf[0] = '\0';
+
+        switch (conversion) {
+        case 'd': case 'i':
+            snprintf(buf, sizeof(buf), (spec + "lld").c_str(), signed_value(arg));
+            break;
+        case 'u': case 'o': case 'x': case 'X':
+            snprintf(buf, sizeof(buf), (spec + "ll" + conversion).c_str(), unsigned_value(arg));
+            break;
+        case 'c':
+            snprintf(buf, sizeof(buf), (spec + "c").c_str(), static_cast<int>(signed_value(arg)));
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            snprintf(buf, sizeof(buf), (spec + conversion).c_str(),
+                     arg.type == Log::Arg::Double ? arg.value.d :
+                     static_cast<double>(signed_value(arg)));
+            break;
+        case 's':
+            snprintf(buf, sizeof(buf), (spec + "s").c_str(),
+                     arg.type == Log::Arg::String ? record.strings + arg.value.u : "");
+            break;
+        case 'p':
+            snprintf(buf, sizeof(buf), (spec + "p").c_str(),
+                     reinterpret_cast<void *>(static_cast<uintptr_t>(arg.value.u)));
+            break;
+        default:
+            break;
+        }
 
-    /* Store the message in the buffer */
-    va_copy(aq, ap);
-    vsnprintf(buf, msg_size + 1, fmt.c_str(), aq);
-    va_end(aq);
+        out += buf;
+    }
+}
 
+static void print_prefixed_message(std::ostream& stream, const string& color, const string& prefix,
+                       const string& msg)
+{
     /*
      * Print the message lines prefixed with the supplied prefix.
      * If the target stream is a terminal make the prefix colored.
@@ -54,84 +206,249 @@ static void print_prefixed_message(std::ostream& stream, const string& color, co
         linePrefix = start_color + prefix + end_color + colon;
     }
 
-    std::string line;
-    std::stringstream ss(buf);
+    size_t pos = 0;
+    while (pos < msg.size()) {
+        size_t end = msg.find('\n', pos);
+        size_t len = (end == string::npos ? msg.size() : end) - pos;
 
-    while (std::getline(ss, line)) {
         /*
          * If this line is a continuation of a previous log message
          * just print the line plainly.
          */
-        if (line[0] == Log::continuation_prefix[0]) {
-            stream << line.c_str() + 1;
+        if (len > 0 && msg[pos] == Log::continuation_prefix[0]) {
+            stream.write(msg.data() + pos + 1, len - 1);
         } else {
             /* Normal line, emit the prefix. */
-            stream << linePrefix << line;
+            stream << linePrefix;
+            stream.write(msg.data() + pos, len);
         }
 
         /* Only emit a newline if the original message has it. */
-        if (!(ss.rdstate() & std::stringstream::eofbit))
-            stream << std::endl;
+        if (end == string::npos)
+            break;
+        stream << '\n';
+        pos = end + 1;
     }
-
-    delete[] buf;
 }
 
-
-void Log::info(const char *fmt, ...)
+static void write_message(const Record &record, string &msg, bool debug,
+                          std::ostream *extra_out)
 {
     static const string infoprefix("Info");
-    const string& prefix(do_debug_ ? infoprefix : empty);
-    va_list ap;
-    va_start(ap, fmt);
-
+    static const string dbgprefix("Debug");
+    static const string errprefix("Error");
     static const string& infocolor(isatty(fileno(stdout)) ? terminal_color_cyan : empty);
-    const string& color(do_debug_ ? infocolor : empty);
-    print_prefixed_message(std::cout, color, prefix, fmt, ap);
+    static const string& dbgcolor(isatty(fileno(stdout)) ? terminal_color_yellow : empty);
+    static const string& errcolor(isatty(fileno(stderr)) ? terminal_color_red : empty);
+
+    format_message(record, msg);
 
-    if (extra_out_)
-        print_prefixed_message(*extra_out_, empty, prefix, fmt, ap);
+    const string *prefix;
+    const string *color;
+    std::ostream *stream = &std::cout;
 
-    va_end(ap);
+    if (record.level == LOG_LEVEL_ERROR) {
+        prefix = &errprefix;
+        color = &errcolor;
+        stream = &std::cerr;
+    } else if (record.level == LOG_LEVEL_DEBUG) {
+        prefix = &dbgprefix;
+        color = &dbgcolor;
+    } else {
+        prefix = debug ? &infoprefix : &empty;
+        color = debug ? &infocolor : &empty;
+    }
+
+    print_prefixed_message(*stream, *color, *prefix, msg);
+
+    if (extra_out)
+        print_prefixed_message(*extra_out, empty, *prefix, msg);
 }
 
-void Log::debug(const char *fmt, ...)
+/* Copies a message into @record, with its strings */
+static void fill_record(Record &record, int level, const char *fmt,
+                        const Log::Arg *args, unsigned int count)
 {
-    static const string dbgprefix("Debug");
-    if (!do_debug_)
-        return;
-    va_list ap;
-    va_start(ap, fmt);
+    size_t used = 0;
 
-    static const string& dbgcolor(isatty(fileno(stdout)) ? terminal_color_yellow : empty);
-    print_prefixed_message(std::cout, dbgcolor, dbgprefix, fmt, ap);
+    record.level = level;
+    record.fmt = fmt;
+    record.count = count;
+
+    for (unsigned int i = 0; i < count; i++) {
+        record.args[i] = args[i];
+        if (args[i].type != Log::Arg::String)
+            continue;
 
-    if (extra_out_)
-        print_prefixed_message(*extra_out_, empty, dbgprefix, fmt, ap);
+        // Strings rarely outlive the call, so they travel with the message
+        // The last byte stays an empty string for those that don't fit
+        const char *s = args[i].value.s ? args[i].value.s : "(null)";
+        if (used >= RING_STRING_BYTES - 1) {
+            record.args[i].value.u = RING_STRING_BYTES - 1;
+            continue;
+        }
 
-    va_end(ap);
+        size_t len = strnlen(s, RING_STRING_BYTES - 2 - used);
+        memcpy(record.strings + used, s, len);
+        record.strings[used + len] = '\0';
+        record.args[i].value.u = used;
+        used += len + 1;
+    }
+    record.strings[RING_STRING_BYTES - 1] = '\0';
 }
 
-void Log::error(const char *fmt, ...)
+void Log::init(const std::string& appname, bool do_debug, std::ostream *extra_out)
 {
-    static const string errprefix("Error");
-    va_list ap;
-    va_start(ap, fmt);
+    appname_ = appname;
+    do_debug_ = do_debug;
+    extra_out_ = extra_out;
 
-    static const string& errcolor(isatty(fileno(stderr)) ? terminal_color_red : empty);
-    print_prefixed_message(std::cerr, errcolor, errprefix, fmt, ap);
+    if (writer)
+        return;
 
-    if (extra_out_)
-        print_prefixed_message(*extra_out_, empty, errprefix, fmt, ap);
+    for (unsigned int i = 0; i < RING_SLOTS; i++)
+        ring[i].sequence.store(i, std::memory_order_relaxed);
 
-    va_end(ap);
+    writer_running = true;
+    writer = new std::thread(run_writer);
+    ring_admitting = true;
+    atexit(stop);
+}
+
+void Log::submit(int level, const char *fmt, const Arg *args, unsigned int count)
+{
+    // Until the writer runs, and once it stops, messages are written here
+    ring_producers.fetch_add(1);
+    if (!ring_admitting.load()) {
+        ring_producers.fetch_sub(1, std::memory_order_release);
+        Record record;
+        string msg;
+        fill_record(record, level, fmt, args, count);
+        write_message(record, msg, do_debug_, extra_out_);
+        return;
+    }
+
+    unsigned int pos = ring_head.load(std::memory_order_relaxed);
+    Slot *slot;
+
+    for (;;) {
+        slot = &ring[pos & (RING_SLOTS - 1)];
+        unsigned int sequence = slot->sequence.load(std::memory_order_acquire);
+        int diff = static_cast<int>(sequence - pos);
+
+        if (diff == 0) {
+            if (ring_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            // The writer is a full ring behind, don't wait for it
+            ring_dropped.fetch_add(1, std::memory_order_relaxed);
+            ring_producers.fetch_sub(1, std::memory_order_release);
+            return;
+        } else {
+            pos = ring_head.load(std::memory_order_relaxed);
+        }
+    }
+
+    fill_record(slot->record, level, fmt, args, count);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    ring_producers.fetch_sub(1, std::memory_order_release);
+
+    if (writer_sleeping.load(std::memory_order_acquire))
+        writer_wake.notify_one();
 }
 
 void Log::flush()
 {
+    unsigned int head = ring_head.load(std::memory_order_acquire);
+
+    // Messages that were taken but are still being filled in count as well
+    while (writer_running &&
+           static_cast<int>(ring_written.load(std::memory_order_acquire) - head) < 0) {
+        writer_wake.notify_one();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
     std::cout.flush();
     std::cerr.flush();
+}
+
+/*******************
+ * Private methods *
+ *******************/
+
+/*
+ * Writes the messages in the ring, in the order they were taken. Returns
+ * whether there were any.
+ */
+bool Log::drain()
+{
+    static string msg;
+    bool any = false;
+
+    for (;;) {
+        Slot &slot = ring[ring_tail & (RING_SLOTS - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != ring_tail + 1)
+            break;
+
+        write_message(slot.record, msg, do_debug_, extra_out_);
+        slot.sequence.store(ring_tail + RING_SLOTS, std::memory_order_release);
+        ring_tail++;
+        ring_written.store(ring_tail, std::memory_order_release);
+        any = true;
+    }
+
+    unsigned int dropped = ring_dropped.exchange(0, std::memory_order_relaxed);
+    if (dropped) {
+        Record record;
+        const Arg arg(dropped);
+        fill_record(record, LOG_LEVEL_ERROR, "%u log messages were dropped\n", &arg, 1);
+        write_message(record, msg, do_debug_, extra_out_);
+    }
+
+    if (any || dropped) {
+        std::cout.flush();
+        std::cerr.flush();
+        if (extra_out_)
+            extra_out_->flush();
+    }
+
+    return any;
+}
+
+void Log::run_writer()
+{
+    while (writer_running.load(std::memory_order_acquire)) {
+        if (drain())
+            continue;
+
+        // A producer that misses the flag is picked up after the timeout
+        std::unique_lock<std::mutex> lock(writer_mutex);
+        writer_sleeping.store(true, std::memory_order_release);
+        if (!drain())
+            writer_wake.wait_for(lock, std::chrono::milliseconds(WRITER_IDLE_MS));
+        writer_sleeping.store(false, std::memory_order_release);
+    }
+
+    drain();
+}
+
+/*
+ * Writes what is left at exit and lets later messages be written
+ * synchronously.
+ */
+void Log::stop()
+{
+    if (!writer)
+        return;
+
+    // Messages already admitted are published before the last drain
+    ring_admitting = false;
+    while (ring_producers.load(std::memory_order_acquire))
+        std::this_thread::yield();
 
-    if (extra_out_)
-        extra_out_->flush();
+    writer_running = false;
+    writer_wake.notify_one();
+    writer->join();
+    delete writer;
+    writer = 0;
 }
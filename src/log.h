@@ -3,31 +3,119 @@
 
 #include <string>
 #include <iostream>
+#include <type_traits>
+#include <stdint.h>
 
+// Message levels, in increasing severity
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_ERROR 2
+
+// Messages below this level are never formatted or queued, though their
+// arguments are still evaluated (e.g. -DLOG_MIN_LEVEL=1 for builds without
+// debug messages)
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+/*
+ * Messages are not formatted by the thread that emits them: the format
+ * string pointer and the raw arguments (strings are copied) go into a
+ * lock-free ring, and a background thread started by init() formats and
+ * writes them. The format must therefore be a string that lives for the
+ * whole program, like a literal. Messages are written synchronously
+ * before init() and after the program exits; if the ring is full they
+ * are dropped and counted rather than holding up the caller.
+ */
 class Log
 {
 public:
     static void init(const std::string& appname, bool do_debug = false,
-                     std::ostream *extra_out = 0)
+                     std::ostream *extra_out = 0);
+    // Emit an informational message
+    template<typename... Args>
+    static void info(const char *fmt, Args... args)
     {
-        appname_ = appname;
-        do_debug_ = do_debug;
-        extra_out_ = extra_out;
+        if (LOG_MIN_LEVEL <= LOG_LEVEL_INFO)
+            log(LOG_LEVEL_INFO, fmt, args...);
     }
-    // Emit an informational message
-    static void info(const char *fmt, ...);
     // Emit a debugging message
-    static void debug(const char *fmt, ...);
+    template<typename... Args>
+    static void debug(const char *fmt, Args... args)
+    {
+        if (debug_enabled())
+            log(LOG_LEVEL_DEBUG, fmt, args...);
+    }
     // Emit an error message
-    static void error(const char *fmt, ...);
-    // Explicit flush of the log buffer
+    template<typename... Args>
+    static void error(const char *fmt, Args... args)
+    {
+        log(LOG_LEVEL_ERROR, fmt, args...);
+    }
+    // Explicit flush of the log buffer, waits for the pending messages
     static void flush();
+    // Whether debug messages generate any output, to skip preparing them
+    static bool debug_enabled() { return LOG_MIN_LEVEL <= LOG_LEVEL_DEBUG && do_debug_; }
     // A prefix constant that informs the logging infrastructure that the log
     // message is a continuation of a previous log message to be put on the
     // same line.
     static const std::string continuation_prefix;
 
+    // The maximum number of arguments of a message
+    static const unsigned int max_args = 12;
+
+    // An argument as stored in the ring
+    struct Arg
+    {
+        enum Type { None, Signed, Unsigned, Double, String, Pointer };
+
+        Arg() : type(None), size(0) { value.u = 0; }
+        Arg(const char *s) : type(String), size(sizeof(s)) { value.s = s; }
+        Arg(char *s) : type(String), size(sizeof(s)) { value.s = s; }
+        template<typename T>
+        Arg(T *p) : type(Pointer), size(sizeof(p))
+        {
+            value.u = reinterpret_cast<uintptr_t>(p);
+        }
+        template<typename T>
+        Arg(T v) : size(sizeof(T))
+        {
+            store(v, std::integral_constant<bool, std::is_floating_point<T>::value>());
+        }
+
+        Type type;
+        unsigned int size;
+        union {
+            long long i;
+            unsigned long long u;
+            double d;
+            const char *s;
+        } value;
+
+    private:
+        template<typename T>
+        void store(T v, std::true_type) { type = Double; value.d = v; }
+        template<typename T>
+        void store(T v, std::false_type)
+        {
+            type = std::is_signed<T>::value ? Signed : Unsigned;
+            value.i = static_cast<long long>(v);
+        }
+    };
+
 private:
+    template<typename... Args>
+    static void log(int level, const char *fmt, Args... args)
+    {
+        static_assert(sizeof...(Args) <= max_args, "Too many arguments for a log message");
+        const Arg packed[sizeof...(Args) + 1] = { Arg(args)..., Arg() };
+        submit(level, fmt, packed, sizeof...(Args));
+    }
+    static void submit(int level, const char *fmt, const Arg *args, unsigned int count);
+    static bool drain();
+    static void run_writer();
+    static void stop();
+
     // A constant for identifying the log messages as originating from a
     // particular application.
     static std::string appname_;
@@ -1,61 +1,292 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <algorithm>
+#include <vector>
 
 #include "native-state-drm.h"
 #include "gl-state-egl.h"
 #include "canvas-generic.h"
 #include "dma-buffer.h"
 #include "egl-render.h"
+#include "camera.h"
+#include "camera-calibration.h"
+#include "warp-lut.h"
+#include "v4l2-source.h"
+#include "ingest-source.h"
+#include "frame-importer.h"
+#include "program-cache.h"
+#include "gl-state-cache.h"
+#include "nv12-tile-source.h"
+#include "panorama-tile-source.h"
+#include "virtual-texture.h"
+#include "compressed-texture.h"
+#include "metrics.h"
+#include "damage.h"
+#include "reference-renderer.h"
+#include "options.h"
+#include "trace.h"
 #include "log.h"
 
-bool setupGraphics(DmaBufferManager *manager)
+/* How long the panorama is displayed, in seconds */
+#define DISPLAY_TIME 30
+
+/* How often the frame rate of the outputs is reported, in seconds */
+#define STATS_INTERVAL 5
+
+/* How often frames the GPU may still read are checked while idle, in seconds */
+#define RETIRE_INTERVAL 0.005
+
+/* How often tiles on their way are checked for while idle, in seconds */
+#define TILE_INTERVAL 0.01
+
+/* An NV12 image imported for sampling, or a compressed still */
+struct ImageSource
+{
+    ImageSource() : compressed(false), planar(false) {}
+
+    DmaBuffer dma_buf;
+    EglImage image;
+    GlTexture texture;
+    // The Y and UV planes, for drivers that can't sample NV12 as a whole
+    YuvPlanes planes;
+    bool compressed;
+    bool planar;
+};
+
+static double now_seconds()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+bool setupSource(DmaBufferManager *manager, const std::string &path,
+                 int width, int height, ImageSource *source)
 {
     void *textureData;
-    DmaBuffer *dma_buf;
     bool ret;
     FILE *fp;
 
-    dma_buf = (struct DmaBuffer*) calloc(sizeof(struct DmaBuffer), 1);
-    textureData = malloc(1920 * 1080 * 3 / 2);
+    TRACE_SCOPE("load");
 
-    fp = fopen("/mnt/1920x1080_nv12.bin", "r");
+    source->compressed = false;
+    source->planar = false;
+    textureData = malloc(width * height * 3 / 2);
+
+    fp = fopen(path.c_str(), "r");
     if (fp == NULL) {
-        Log::error("Open source file failed\n");
+        Log::error("Open source file '%s' failed\n", path.c_str());
         ret = false;
         goto _exit_release;
     }
-    fread(textureData, 1920 * 1080 * 3 / 2, 1, fp);
+    fread(textureData, width * height * 3 / 2, 1, fp);
     fclose(fp);
 
-    if (!manager->createDmaBuffer(1920, 1080, 32, textureData, dma_buf)) {
+    if (!manager->createDmaBuffer(width, height, 12, textureData, &source->dma_buf)) {
         ret = false;
         goto _exit_release;
     }
 
-    if (!egl_sample_buffer(dma_buf)) {
-        ret = false;
+    /* import the image once, all outputs sample the same texture */
+    if (!Options::planar_yuv &&
+        egl_get_image_for_dma_buffer(&source->dma_buf, &source->image) &&
+        egl_texture_for_image(source->image, &source->texture)) {
+        ret = true;
         goto _exit_release;
     }
 
-    ret = true;
+    /* or its planes, if the driver can't sample it as an external texture */
+    if (!Options::planar_yuv)
+        Log::info("'%s' can't be sampled as an external texture, sampling its planes\n",
+                  path.c_str());
+    source->image.reset();
+    source->planar = true;
+    ret = egl_setup_planar() && egl_import_planes(&source->dma_buf, &source->planes);
 
 _exit_release:
-    free(dma_buf);
     free(textureData);
 
     return ret;
 }
 
+bool setupCompressedSource(const std::string &path, ImageSource *source)
+{
+    CompressedTexture still(path);
+
+    source->compressed = true;
+
+    // The blocks are in GL memory once uploaded, the mapping can go
+    return still.load() && still.upload(&source->texture);
+}
+
+bool setupProgram()
+{
+    if (!Options::fisheye.empty()) {
+        DualFisheyeCalibration lens(Options::fisheye);
+        return egl_setup_fisheye(lens, Options::width, Options::height);
+    }
+
+    if (!Options::warp.empty()) {
+        LensCalibration lens(Options::warp);
+        WarpLut lut(lens, Options::lut_width, Options::lut_height);
+        return lut.init() && egl_setup_warp(lut);
+    }
+
+    return egl_setup_graphics();
+}
+
+bool setupGraphics(DmaBufferManager *manager, std::vector<ImageSource> &sources)
+{
+    /* live frames are imported as they arrive */
+    if (!Options::v4l2.empty() || !Options::ingest.empty())
+        return setupProgram();
+
+    /* a single equirectangular, dual-fisheye or lens-warped panorama */
+    if (Options::cameras.empty()) {
+        sources.resize(1);
+
+        /* compressed offline, only sampled as equirectangular */
+        if (CompressedTexture::probe(Options::image)) {
+            if (!Options::fisheye.empty() || !Options::warp.empty()) {
+                Log::error("Compressed panoramas must be equirectangular\n");
+                return false;
+            }
+            return setupCompressedSource(Options::image, &sources[0]) && egl_setup_still();
+        }
+
+        if (!setupSource(manager, Options::image, Options::width, Options::height,
+                         &sources[0]))
+            return false;
+
+        /* planes are only sampled as equirectangular */
+        if (sources[0].planar) {
+            if (!Options::fisheye.empty() || !Options::warp.empty()) {
+                Log::error("Dewarping needs images that can be sampled as external textures\n");
+                return false;
+            }
+            return egl_setup_graphics();
+        }
+
+        return setupProgram();
+    }
+
+    /* or a camera rig that is stitched while rendering */
+    std::vector<CameraCalibration> cameras;
+    std::vector<GLuint> textures;
+
+    for (unsigned int i = 0; i < Options::cameras.size(); i++) {
+        CameraCalibration camera(Options::cameras[i]);
+        if (camera.file.empty() || camera.width <= 0 || camera.height <= 0) {
+            Log::error("Camera '%s' needs a file and a size\n",
+                       Options::cameras[i].c_str());
+            return false;
+        }
+
+        sources.push_back(ImageSource());
+        if (!setupSource(manager, camera.file, camera.width, camera.height,
+                         &sources.back()))
+            return false;
+        if (sources.back().planar) {
+            Log::error("Stitching needs images that can be sampled as external textures\n");
+            return false;
+        }
+
+        cameras.push_back(camera);
+        textures.push_back(sources.back().texture.get());
+    }
+
+    return egl_setup_stitching(&cameras[0], &textures[0], cameras.size());
+}
+
+/*
+ * Compares a grid of pixels of the frame just drawn with what the CPU
+ * reference renderer makes of the image. The GPU draws the sphere as
+ * triangles in mediump precision, so small differences are expected.
+ */
+void verifyOutput(CanvasGeneric &canvas, const ReferenceRenderer &reference,
+                  const GLfloat *mvp, unsigned int output)
+{
+    const int grid = 8;
+    const double tolerance = 16.0;
+    unsigned int close = 0;
+    double largest = 0.0;
+
+    for (int j = 0; j < grid; j++) {
+        for (int i = 0; i < grid; i++) {
+            int x = (2 * i + 1) * canvas.width() / (2 * grid);
+            int y = (2 * j + 1) * canvas.height() / (2 * grid);
+            uint8_t expected[4];
+
+            reference.pixel(mvp, canvas.width(), canvas.height(), x, y, expected);
+            Canvas::Pixel drawn = canvas.read_pixel(x, y);
+            double distance = drawn.distance_rgb(
+                    Canvas::Pixel(expected[0], expected[1], expected[2], expected[3]));
+
+            if (distance <= tolerance)
+                close++;
+            else
+                Log::debug("Output %u at %d,%d: drew %02x%02x%02x, expected %02x%02x%02x\n",
+                           output, x, y, drawn.r, drawn.g, drawn.b,
+                           expected[0], expected[1], expected[2]);
+            if (distance > largest)
+                largest = distance;
+        }
+    }
+
+    Log::info("Output %u: %u of %u pixels match the reference renderer, "
+              "largest difference %.1f\n", output, close, grid * grid, largest);
+}
+
+bool setupTiles(TileSource **source, VirtualTexture **texture)
+{
+    /* a tiled panorama container, or tiles cut from a raw image */
+    if (PanoramaTileSource::probe(Options::image))
+        *source = new PanoramaTileSource(Options::image);
+    else
+        *source = new Nv12TileSource(Options::image, Options::width, Options::height);
+    if (!(*source)->init())
+        return false;
+
+    *texture = new VirtualTexture(**source, static_cast<size_t>(Options::tile_budget) << 20);
+    if (!(*texture)->init())
+        return false;
+
+    return egl_setup_virtual_texture(**texture);
+}
+
 int main(int argc, char** argv)
 {
+    if (!Options::parse_args(argc, argv))
+        return 1;
+
+    if (Options::show_help) {
+        Options::print_help();
+        return 0;
+    }
+
     /* initialize Log class */
-    Log::init("gl2Imager", true);
+    Log::init("gl2Imager", Options::show_debug);
+
+    if ((!Options::trace.empty() || Options::trace_marker) &&
+        !Trace::init(Options::trace, Options::trace_marker))
+        return 1;
 
-    NativeStateDRM native_state;
+    NativeStateDRM native_state(Options::drm_device, ModePolicy(Options::mode),
+                                Options::vrr, Options::pacing,
+                                Options::scanout_width, Options::scanout_height,
+                                Options::render_node);
     GLStateEGL gl_state;
 
+    egl_set_yuv_colors(Options::yuv_matrix == "bt709" ? COLOR_BT709 : COLOR_BT601,
+                       Options::yuv_range == "full");
+
     CanvasGeneric canvas(native_state, gl_state);
+    canvas.dynamic_resolution(Options::dynamic_resolution);
     if (!canvas.init()) {
         Log::error("%s: Could not initialize canvas\n", __FUNCTION__);
         return 1;
@@ -64,14 +295,242 @@ int main(int argc, char** argv)
     canvas.print_info();
     canvas.visible(true);
 
-    DmaBufferManager bufferManager(native_state.get_fd());
-    /* renderer image and display for 30 seconds */
-    if (!setupGraphics(&bufferManager)) {
+    DmaBufferManager bufferManager(native_state.get_fd(), native_state.get_render_fd());
+    std::vector<ImageSource> sources;
+
+    /* a panorama of any size is streamed to the GPU in tiles */
+    TileSource *tileSource = NULL;
+    VirtualTexture *virtualTexture = NULL;
+
+    double setupStart = now_seconds();
+    bool tiled = Options::tiled || PanoramaTileSource::probe(Options::image);
+    bool setup = tiled ? setupTiles(&tileSource, &virtualTexture)
+                       : setupGraphics(&bufferManager, sources);
+    if (!setup) {
         Log::error("Could not set up graphics\n");
+        delete virtualTexture;
+        delete tileSource;
         return 1;
     }
-    canvas.update();
-    sleep(30);
+    Log::info("Set up graphics in %.1f ms\n", (now_seconds() - setupStart) * 1000.0);
+    ProgramCache::report();
+
+    /* a capture device or another process replaces the still image */
+    FrameSource *frameSource = NULL;
+    FrameImporter *importer = NULL;
+
+    if (!Options::v4l2.empty())
+        frameSource = new V4L2Source(Options::v4l2, Options::width, Options::height);
+    else if (!Options::ingest.empty())
+        frameSource = new IngestSource(Options::ingest);
+
+    if (frameSource) {
+        if (!frameSource->init()) {
+            Log::error("Could not start the frame source\n");
+            delete frameSource;
+            egl_release();
+            return 1;
+        }
+        importer = new FrameImporter(*frameSource, Options::planar_yuv);
+    }
+
+    /* every output looks into its own direction of the panorama */
+    std::vector<Camera> cameras(canvas.outputs());
+    for (unsigned int o = 0; o < cameras.size(); o++)
+        cameras[o].yaw(360.0f * o / cameras.size());
+
+    std::vector<unsigned int> frames(canvas.outputs(), 0);
+
+    Metrics *metrics = NULL;
+    if (!Options::metrics.empty()) {
+        metrics = new Metrics(canvas.outputs());
+        if (!metrics->init(Options::metrics)) {
+            delete metrics;
+            metrics = NULL;
+        }
+    }
+    bool still = !sources.empty() && sources[0].compressed;
+
+    /* the CPU renders what the first frame of every output should show */
+    DmaBufferMapping mapping;
+    ReferenceRenderer *reference = NULL;
+    std::vector<bool> verified(canvas.outputs(), false);
+    if (Options::verify) {
+        if (sources.empty() || still || importer || !Options::cameras.empty() ||
+            !Options::fisheye.empty() || !Options::warp.empty())
+            Log::info("Only equirectangular NV12 images can be verified\n");
+        else if (mapping.map(sources[0].dma_buf))
+            reference = new ReferenceRenderer(mapping.y(), mapping.y_stride(),
+                                              mapping.uv(), mapping.uv_stride(),
+                                              sources[0].dma_buf.width,
+                                              sources[0].dma_buf.height);
+    }
+
+    /* outputs are only drawn and flipped when what they show changed */
+    Damage damage(canvas.outputs());
+
+    /* renderer image and display for 30 seconds */
+    double start = now_seconds();
+    double statsStart = start;
+    while (!canvas.should_quit() && now_seconds() - start < DISPLAY_TIME) {
+        GLuint texture = 0;
+        const YuvPlanes *planes = NULL;
+        double now = now_seconds();
+
+        if (now - statsStart >= STATS_INTERVAL) {
+            for (unsigned int o = 0; o < frames.size(); o++) {
+                Log::info("Output %u: %.1f fps, render scale %.2f\n", o,
+                          frames[o] / (now - statsStart), canvas.render_scale(o));
+                frames[o] = 0;
+            }
+            if (virtualTexture) {
+                Log::info("Tiles: %u on the GPU, %u waiting\n",
+                          virtualTexture->resident(), virtualTexture->pending());
+            }
+            Log::debug("GL state calls of the last frame: %u issued, %u elided\n",
+                       GLStateCache::issued(), GLStateCache::elided());
+            statsStart = now;
+        }
+
+        if (importer) {
+            if (importer->update())
+                damage.frame();
+            texture = importer->texture();
+            planes = importer->planes();
+
+            /* nothing to show until the first frame has arrived */
+            if (!texture && !planes) {
+                struct pollfd pfd = { frameSource->fd(), POLLIN, 0 };
+                poll(&pfd, 1, 100);
+                continue;
+            }
+
+            if (planes && (!Options::fisheye.empty() || !Options::warp.empty())) {
+                Log::error("Dewarping needs frames that can be sampled as external textures\n");
+                break;
+            }
+        } else if (!sources.empty()) {
+            texture = sources[0].texture.get();
+            if (sources[0].planar)
+                planes = &sources[0].planes;
+        }
+
+        std::vector<bool> dirty = damage.dirty(cameras);
+        bool drawing = std::find(dirty.begin(), dirty.end(), true) != dirty.end();
+        bool drew = false;
+
+        /* the tiles of all outputs are requested and uploaded together,
+         * so no output's tiles are dropped for another's; tiles that
+         * arrived sharpen every output */
+        if (virtualTexture && (drawing || virtualTexture->pending())) {
+            virtualTexture->begin_frame();
+            for (unsigned int o = 0; o < cameras.size(); o++) {
+                int width, height;
+                canvas.output_size(o, width, height);
+                virtualTexture->view(cameras[o], width, height);
+            }
+            if (virtualTexture->update()) {
+                damage.frame();
+                dirty = damage.dirty(cameras);
+                drawing = true;
+            }
+        }
+
+        if (drawing)
+            GLStateCache::begin_frame();
+
+        for (unsigned int o = 0; o < canvas.outputs(); o++) {
+            GLfloat mvp[16];
+
+            /* a head that is up to date or still waiting for its flip is skipped */
+            if (!dirty[o] || !canvas.output_ready(o) || !canvas.select_output(o))
+                continue;
+
+            {
+                TRACE_SCOPE("draw");
+
+                canvas.clear();
+                cameras[o].mvp(mvp);
+                if (virtualTexture)
+                    egl_draw_virtual_texture(*virtualTexture, mvp);
+                else if (still)
+                    egl_draw_still(texture, mvp);
+                else if (planes)
+                    egl_draw_planar(*planes, mvp);
+                else if (!Options::cameras.empty())
+                    egl_draw_stitched(mvp);
+                else if (!Options::fisheye.empty())
+                    egl_draw_fisheye(texture, mvp);
+                else if (!Options::warp.empty())
+                    egl_draw_warp(texture, mvp);
+                else
+                    egl_draw_texture(texture, mvp);
+            }
+            if (reference && !verified[o] && canvas.render_scale(o) == 1.0f) {
+                verifyOutput(canvas, *reference, mvp, o);
+                verified[o] = true;
+            }
+            drew = true;
+            /* a frame that didn't make it to the screen is drawn again */
+            if (!canvas.update())
+                continue;
+            damage.drawn(o, cameras[o]);
+            frames[o]++;
+            if (metrics)
+                metrics->frame(o, now_seconds());
+        }
+
+        /* the frame goes back to its source once the GPU is done with it */
+        if (importer && drew)
+            importer->frame_drawn();
+
+        if (metrics && metrics->due(now)) {
+            struct metrics_page &values = metrics->values();
+
+            for (unsigned int o = 0; o < values.outputs; o++) {
+                values.output[o].dropped = canvas.dropped_frames(o);
+                values.output[o].render_scale = canvas.render_scale(o);
+            }
+            if (importer) {
+                values.frames_received = importer->frames();
+                values.imports = importer->imported();
+                values.import_reuses = importer->reused();
+                values.pool_buffers = importer->buffers();
+                values.pool_in_use = importer->held();
+            }
+            values.program_hits = ProgramCache::hits();
+            values.program_misses = ProgramCache::misses();
+            if (virtualTexture) {
+                values.tile_hits = virtualTexture->hits();
+                values.tile_misses = virtualTexture->misses();
+                values.tiles_resident = virtualTexture->resident();
+                values.tiles_capacity = virtualTexture->capacity();
+            }
+            metrics->publish(now);
+        }
+
+        /* with nothing to draw, sleep until a frame arrives or something is due */
+        double wake = std::min(statsStart + STATS_INTERVAL, start + DISPLAY_TIME);
+        if (metrics)
+            wake = std::min(wake, metrics->next_due());
+        if (importer && importer->held() > 1)
+            wake = std::min(wake, now_seconds() + RETIRE_INTERVAL);
+        if (virtualTexture && virtualTexture->pending())
+            wake = std::min(wake, now_seconds() + TILE_INTERVAL);
+        canvas.wait_for_output(damage.dirty(cameras), frameSource ? frameSource->fd() : -1,
+                               std::max(0.0, wake - now_seconds()));
+    }
+
+    delete reference;
+    mapping.unmap();
+    delete metrics;
+    delete importer;
+    delete frameSource;
+    delete virtualTexture;
+    delete tileSource;
+    // The textures and images go while the context is still current
+    sources.clear();
+    egl_release();
 
     return 0;
 }
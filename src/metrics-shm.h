@@ -0,0 +1,72 @@
+#ifndef METRICS_SHM_H_
+#define METRICS_SHM_H_
+
+#include <stdint.h>
+
+/*
+ * The live metrics page.
+ *
+ * With --metrics NAME the display publishes its metrics in the POSIX
+ * shared memory object "/NAME" (see shm_open(3)), which holds a single
+ * metrics_page. It is updated in place a few times a second and guarded
+ * by a sequence lock: the sequence is odd while an update is under way
+ * and advances by two with every update. A reader copies the page and
+ * retries until the sequence was even and unchanged before and after the
+ * copy:
+ *
+ *     do {
+ *         begin = __atomic_load_n(&page->sequence, __ATOMIC_ACQUIRE);
+ *         memcpy(&copy, page, sizeof(copy));
+ *         __atomic_thread_fence(__ATOMIC_ACQUIRE);
+ *         end = __atomic_load_n(&page->sequence, __ATOMIC_RELAXED);
+ *     } while ((begin & 1) || begin != end);
+ *
+ * Counters count from the start of the process; rates and percentiles
+ * cover the time since the previous update. The object is removed when
+ * the display exits.
+ *
+ * Agents map the page in processes of their own, possibly 32-bit ones
+ * built from C, so every field has a fixed width and the 64-bit fields
+ * sit at multiples of 8, padded with reserved words where needed.
+ */
+
+#define METRICS_MAGIC 0x5254454d /* 'METR' */
+#define METRICS_VERSION 1
+
+/* Outputs beyond this are not published */
+#define METRICS_MAX_OUTPUTS 8
+
+struct metrics_output {
+    uint64_t frames;            /* frames presented */
+    uint64_t dropped;           /* frames that missed their vblank */
+    double fps;
+    double frame_time_p50;      /* time between presented frames, in ms */
+    double frame_time_p90;
+    double frame_time_p99;
+    double frame_time_max;
+    double render_scale;        /* 1.0 unless --dynamic-resolution scales */
+};
+
+struct metrics_page {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sequence;          /* odd while the page is updated */
+    uint32_t outputs;           /* valid entries of output */
+    int32_t pid;                /* the publishing process */
+    uint32_t reserved;
+    double uptime;              /* seconds since the display started */
+    uint64_t frames_received;   /* frames of the live source */
+    uint64_t imports;           /* dma-buf imports of the live source */
+    uint64_t import_reuses;     /* frames whose buffer was already imported */
+    uint64_t program_hits;      /* shader programs loaded from the cache */
+    uint64_t program_misses;    /* shader programs compiled */
+    uint64_t tile_hits;         /* visible tiles that were on the GPU */
+    uint64_t tile_misses;       /* visible tiles that were still missing */
+    uint32_t pool_buffers;      /* buffers of the live source */
+    uint32_t pool_in_use;       /* of them held for drawing */
+    uint32_t tiles_resident;    /* tiles in the atlas */
+    uint32_t tiles_capacity;    /* tiles the atlas holds */
+    struct metrics_output output[METRICS_MAX_OUTPUTS];
+};
+
+#endif /* METRICS_SHM_H_ */
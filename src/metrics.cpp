@@ -0,0 +1,139 @@
+#include "metrics.h"
+#include "log.h"
+
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
+
+const double Metrics::INTERVAL = 0.5;
+const unsigned int Metrics::WINDOW;
+
+static double now_seconds()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+Metrics::Metrics(unsigned int outputs) :
+    page_(0),
+    outputs_(std::min(outputs, static_cast<unsigned int>(METRICS_MAX_OUTPUTS))),
+    sorted_(WINDOW),
+    start_(0.0),
+    published_(0.0)
+{
+    memset(&values_, 0, sizeof(values_));
+    for (unsigned int o = 0; o < outputs_.size(); o++)
+        outputs_[o].times.resize(WINDOW);
+}
+
+Metrics::~Metrics()
+{
+    if (page_) {
+        munmap(page_, sizeof(*page_));
+        shm_unlink(name_.c_str());
+    }
+}
+
+bool Metrics::init(const std::string &name)
+{
+    name_ = "/" + name;
+
+    int fd = shm_open(name_.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        Log::error("Failed to create the shared memory object '%s'\n", name_.c_str());
+        return false;
+    }
+
+    if (ftruncate(fd, sizeof(struct metrics_page)) < 0) {
+        Log::error("Failed to size the shared memory object '%s'\n", name_.c_str());
+        close(fd);
+        shm_unlink(name_.c_str());
+        return false;
+    }
+
+    void *page = mmap(NULL, sizeof(struct metrics_page), PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED) {
+        Log::error("Failed to map the shared memory object '%s'\n", name_.c_str());
+        shm_unlink(name_.c_str());
+        return false;
+    }
+
+    page_ = static_cast<struct metrics_page *>(page);
+    values_.magic = METRICS_MAGIC;
+    values_.version = METRICS_VERSION;
+    values_.outputs = outputs_.size();
+    values_.pid = getpid();
+    memcpy(page_, &values_, sizeof(values_));
+
+    start_ = now_seconds();
+    published_ = start_;
+
+    Log::debug("Publishing metrics in '%s'\n", name_.c_str());
+
+    return true;
+}
+
+void Metrics::frame(unsigned int output, double now)
+{
+    if (output >= outputs_.size())
+        return;
+
+    Output &o = outputs_[output];
+    if (o.last > 0.0)
+        o.times[o.count++ % WINDOW] = static_cast<float>((now - o.last) * 1000.0);
+    o.last = now;
+    o.frames++;
+}
+
+void Metrics::publish(double now)
+{
+    if (!page_)
+        return;
+
+    double elapsed = now - published_;
+
+    for (unsigned int i = 0; i < outputs_.size(); i++) {
+        Output &o = outputs_[i];
+        struct metrics_output &out = values_.output[i];
+        unsigned int n = std::min(o.count, WINDOW);
+
+        out.frames = o.frames;
+        out.fps = elapsed > 0.0 ? (o.frames - o.published_frames) / elapsed : 0.0;
+        o.published_frames = o.frames;
+
+        out.frame_time_p50 = 0.0;
+        out.frame_time_p90 = 0.0;
+        out.frame_time_p99 = 0.0;
+        out.frame_time_max = 0.0;
+        if (n > 0) {
+            std::copy(o.times.begin(), o.times.begin() + n, sorted_.begin());
+            std::sort(sorted_.begin(), sorted_.begin() + n);
+            out.frame_time_p50 = sorted_[(n - 1) * 50 / 100];
+            out.frame_time_p90 = sorted_[(n - 1) * 90 / 100];
+            out.frame_time_p99 = sorted_[(n - 1) * 99 / 100];
+            out.frame_time_max = sorted_[n - 1];
+        }
+        o.count = 0;
+    }
+    values_.uptime = now - start_;
+
+    // Readers retry while the sequence is odd or has changed under them
+    uint32_t sequence = page_->sequence;
+    __atomic_store_n(&page_->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    const size_t offset = offsetof(struct metrics_page, outputs);
+    memcpy(reinterpret_cast<char *>(page_) + offset,
+           reinterpret_cast<const char *>(&values_) + offset, sizeof(values_) - offset);
+    __atomic_store_n(&page_->sequence, sequence + 2, __ATOMIC_RELEASE);
+
+    published_ = now;
+}
@@ -0,0 +1,89 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include "metrics-shm.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * Publishes the live metrics of the display in shared memory (see
+ * metrics-shm.h).
+ *
+ * The segment is created and mapped by init(); after that, recording
+ * frames and publishing only touch memory, so the render loop takes no
+ * locks and makes no system calls for it. Counters are set on the page
+ * returned by values() right before publish().
+ */
+class Metrics
+{
+public:
+    Metrics(unsigned int outputs);
+    ~Metrics();
+
+    /**
+     * Creates the shared memory object.
+     *
+     * @param name the name of the object, without the leading '/'
+     *
+     * @return whether the metrics can be published
+     */
+    bool init(const std::string &name);
+
+    /**
+     * Records that an output presented a frame.
+     *
+     * @param output the index of the output
+     * @param now the current CLOCK_MONOTONIC time in seconds
+     */
+    void frame(unsigned int output, double now);
+
+    /**
+     * Whether it is time to publish again.
+     */
+    bool due(double now) const { return now - published_ >= INTERVAL; }
+
+    /**
+     * Gets when it is time to publish again.
+     */
+    double next_due() const { return published_ + INTERVAL; }
+
+    /**
+     * Gets the page to set the counters of the next publish() on.
+     */
+    struct metrics_page &values() { return values_; }
+
+    /**
+     * Computes the frame rates and frame times and publishes the page.
+     *
+     * @param now the current CLOCK_MONOTONIC time in seconds
+     */
+    void publish(double now);
+
+private:
+    /* Seconds between two updates of the page */
+    static const double INTERVAL;
+    /* Frame times kept per output for the percentiles */
+    static const unsigned int WINDOW = 512;
+
+    struct Output
+    {
+        Output() : last(0.0), count(0), frames(0), published_frames(0) {}
+
+        double last;
+        std::vector<float> times;
+        unsigned int count;
+        unsigned long long frames;
+        unsigned long long published_frames;
+    };
+
+    std::string name_;
+    struct metrics_page *page_;
+    struct metrics_page values_;
+    std::vector<Output> outputs_;
+    std::vector<float> sorted_;
+    double start_;
+    double published_;
+};
+
+#endif /* METRICS_H_ */
@@ -0,0 +1,195 @@
+#include "mode-policy.h"
+#include "options.h"
+#include "util.h"
+#include "log.h"
+
+#include <math.h>
+#include <vector>
+
+/* Refresh rates closer than this are considered equal, e.g. 59.94 and 60 */
+#define REFRESH_TOLERANCE 0.5
+
+static bool mode_usable(const drmModeModeInfo* mode)
+{
+    return !(mode->flags & (DRM_MODE_FLAG_INTERLACE | DRM_MODE_FLAG_DBLSCAN));
+}
+
+static unsigned int mode_area(const drmModeModeInfo* mode)
+{
+    return mode->hdisplay * mode->vdisplay;
+}
+
+ModePolicy::ModePolicy(const std::string &s) :
+    type_(Preferred), width_(0), height_(0), refresh_(0.0), valid_(true)
+{
+    if (s.empty() || s == "preferred") {
+        type_ = Preferred;
+    } else if (s == "largest") {
+        type_ = Largest;
+    } else if (s == "max-refresh") {
+        type_ = MaxRefresh;
+    } else if (s.compare(0, 4, "fps=") == 0) {
+        type_ = TargetFps;
+        refresh_ = Util::fromString<double>(s.substr(4));
+        valid_ = refresh_ > 0.0;
+    } else {
+        std::vector<std::string> elems;
+        Util::split(s, '@', elems, Util::SplitModeNormal);
+
+        type_ = Explicit;
+        valid_ = elems.size() <= 2 &&
+                 Options::parse_size(elems[0], width_, height_);
+        if (valid_ && elems.size() == 2) {
+            refresh_ = Util::fromString<double>(elems[1]);
+            valid_ = refresh_ > 0.0;
+        }
+    }
+}
+
+drmModeModeInfo* ModePolicy::select(drmModeConnector* connector) const
+{
+    drmModeModeInfo* mode(0);
+
+    switch (type_) {
+    case Preferred:
+        mode = select_preferred(connector);
+        break;
+    case Largest:
+        mode = select_largest(connector);
+        break;
+    case MaxRefresh:
+        mode = select_max_refresh(connector);
+        break;
+    case Explicit:
+        mode = select_explicit(connector);
+        break;
+    case TargetFps:
+        mode = select_target_fps(connector);
+        break;
+    }
+
+    // Never lose an output to a policy that doesn't fit its display
+    if (!mode && type_ != Preferred) {
+        Log::info("No mode of connector %u matches the mode policy, "
+                  "using the preferred mode\n", connector->connector_id);
+        mode = select_preferred(connector);
+    }
+
+    return mode;
+}
+
+double ModePolicy::refresh(const drmModeModeInfo* mode)
+{
+    double refresh;
+
+    if (!mode->htotal || !mode->vtotal)
+        return mode->vrefresh;
+
+    refresh = mode->clock * 1000.0 / (mode->htotal * mode->vtotal);
+    if (mode->flags & DRM_MODE_FLAG_INTERLACE)
+        refresh *= 2.0;
+    if (mode->flags & DRM_MODE_FLAG_DBLSCAN)
+        refresh /= 2.0;
+    if (mode->vscan > 1)
+        refresh /= mode->vscan;
+
+    return refresh;
+}
+
+/*******************
+ * Private methods *
+ *******************/
+
+drmModeModeInfo* ModePolicy::select_preferred(drmModeConnector* connector) const
+{
+    for (int m = 0; m < connector->count_modes; m++) {
+        drmModeModeInfo* mode = &connector->modes[m];
+        if ((mode->type & DRM_MODE_TYPE_PREFERRED) && mode_usable(mode))
+            return mode;
+    }
+
+    // Displays without a preferred mode get the largest one
+    return select_largest(connector);
+}
+
+drmModeModeInfo* ModePolicy::select_largest(drmModeConnector* connector) const
+{
+    drmModeModeInfo* best(0);
+
+    for (int m = 0; m < connector->count_modes; m++) {
+        drmModeModeInfo* mode = &connector->modes[m];
+        if (!mode_usable(mode))
+            continue;
+
+        if (!best || mode_area(mode) > mode_area(best) ||
+            (mode_area(mode) == mode_area(best) && refresh(mode) > refresh(best)))
+            best = mode;
+    }
+
+    return best;
+}
+
+drmModeModeInfo* ModePolicy::select_max_refresh(drmModeConnector* connector) const
+{
+    drmModeModeInfo* best(0);
+
+    for (int m = 0; m < connector->count_modes; m++) {
+        drmModeModeInfo* mode = &connector->modes[m];
+        if (!mode_usable(mode))
+            continue;
+
+        double diff = best ? refresh(mode) - refresh(best) : 0.0;
+        if (!best || diff > REFRESH_TOLERANCE ||
+            (fabs(diff) <= REFRESH_TOLERANCE && mode_area(mode) > mode_area(best)))
+            best = mode;
+    }
+
+    return best;
+}
+
+drmModeModeInfo* ModePolicy::select_explicit(drmModeConnector* connector) const
+{
+    drmModeModeInfo* best(0);
+
+    for (int m = 0; m < connector->count_modes; m++) {
+        drmModeModeInfo* mode = &connector->modes[m];
+        if (!mode_usable(mode) || mode->hdisplay != width_ || mode->vdisplay != height_)
+            continue;
+
+        // Without a requested rate take the preferred mode, else the fastest
+        if (refresh_ > 0.0) {
+            double diff = fabs(refresh(mode) - refresh_);
+            if (diff <= REFRESH_TOLERANCE &&
+                (!best || diff < fabs(refresh(best) - refresh_)))
+                best = mode;
+        } else if (!best || (mode->type & DRM_MODE_TYPE_PREFERRED) ||
+                   (!(best->type & DRM_MODE_TYPE_PREFERRED) &&
+                    refresh(mode) > refresh(best))) {
+            best = mode;
+        }
+    }
+
+    return best;
+}
+
+drmModeModeInfo* ModePolicy::select_target_fps(drmModeConnector* connector) const
+{
+    drmModeModeInfo* best(0);
+
+    for (int m = 0; m < connector->count_modes; m++) {
+        drmModeModeInfo* mode = &connector->modes[m];
+        if (!mode_usable(mode) || refresh(mode) < refresh_ - REFRESH_TOLERANCE)
+            continue;
+
+        // Smallest area first, then the rate wasting the fewest vblanks
+        if (!best || mode_area(mode) < mode_area(best) ||
+            (mode_area(mode) == mode_area(best) && refresh(mode) < refresh(best)))
+            best = mode;
+    }
+
+    // A display too slow for the target is best served at its fastest
+    if (!best)
+        best = select_max_refresh(connector);
+
+    return best;
+}
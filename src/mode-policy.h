@@ -0,0 +1,68 @@
+#ifndef MODE_POLICY_H_
+#define MODE_POLICY_H_
+
+#include <string>
+#include <xf86drmMode.h>
+
+/**
+ * How the display mode of a connector is chosen.
+ *
+ * Parsed from one of:
+ *   preferred     the mode the display marks as preferred (default)
+ *   largest       the mode with the largest area
+ *   max-refresh   the highest refresh rate, at the largest area
+ *   WxH[@Hz]      an explicit size and optionally refresh rate
+ *   fps=N         the lowest resolution refreshing at least N times a second
+ *
+ * Every policy falls back to another mode if no mode matches, so an
+ * output is never lost to a policy.
+ */
+class ModePolicy
+{
+public:
+    enum Type {
+        Preferred,
+        Largest,
+        MaxRefresh,
+        Explicit,
+        TargetFps
+    };
+
+    ModePolicy() :
+        type_(Preferred), width_(0), height_(0), refresh_(0.0), valid_(true) {}
+    ModePolicy(const std::string &s);
+
+    /**
+     * Whether the policy string could be parsed.
+     */
+    bool valid() const { return valid_; }
+
+    /**
+     * Selects a mode of a connector.
+     *
+     * @return the mode, or 0 if the connector has no usable mode
+     */
+    drmModeModeInfo* select(drmModeConnector* connector) const;
+
+    /**
+     * Gets the exact refresh rate of a mode, which vrefresh only has
+     * rounded to whole Hz.
+     */
+    static double refresh(const drmModeModeInfo* mode);
+
+private:
+    drmModeModeInfo* select_preferred(drmModeConnector* connector) const;
+    drmModeModeInfo* select_largest(drmModeConnector* connector) const;
+    drmModeModeInfo* select_max_refresh(drmModeConnector* connector) const;
+    drmModeModeInfo* select_explicit(drmModeConnector* connector) const;
+    drmModeModeInfo* select_target_fps(drmModeConnector* connector) const;
+
+    Type type_;
+    int width_;
+    int height_;
+    // Requested refresh rate in Hz, 0 if any
+    double refresh_;
+    bool valid_;
+};
+
+#endif /* MODE_POLICY_H_ */
@@ -1,5 +1,27 @@
 #include "native-state-drm.h"
 #include "log.h"
+#include "trace.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <time.h>
+#include <algorithm>
+
+/* How many vblanks of an output pass between two pacing reports */
+#define PACER_REPORT_INTERVAL 600
+
+/* How long an output waits to try again after a failed flip, in seconds */
+#define FLIP_RETRY_INTERVAL 0.1
+
+static double now_seconds()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
 
 bool NativeStateDRM::init_display()
 {
@@ -26,10 +48,12 @@ bool NativeStateDRM::create_window(WindowProperties const& /*properties*/)
 
 void* NativeStateDRM::window(WindowProperties& properties)
 {
-    properties = WindowProperties(mode_->hdisplay,
-                                  mode_->vdisplay,
-                                  true, 0);
-    return static_cast<void*>(surface_);
+    if (outputs_.empty())
+        return 0;
+
+    DRMOutput* output = outputs_[current_];
+    properties = WindowProperties(output->width, output->height, true, 0);
+    return static_cast<void*>(output->surface);
 }
 
 void NativeStateDRM::visible(bool /*visible*/)
@@ -46,57 +70,138 @@ int NativeStateDRM::get_fd()
     return fd_;
 }
 
-void NativeStateDRM::flip()
+int NativeStateDRM::get_render_fd()
 {
-    gbm_bo* next = gbm_surface_lock_front_buffer(surface_);
-    fb_ = fb_get_from_bo(next);
-    unsigned int waiting(1);
+    return render_fd_;
+}
 
-    if (!crtc_set_) {
-        int status = drmModeSetCrtc(fd_, encoder_->crtc_id, fb_->fb_id, 0, 0,
-                                    &connector_->connector_id, 1, mode_);
-        if (status >= 0) {
-            crtc_set_ = true;
-            bo_ = next;
-        } else {
+bool NativeStateDRM::flip()
+{
+    TRACE_SCOPE("flip");
+
+    DRMOutput* output = outputs_[current_];
+    gbm_bo* next = gbm_surface_lock_front_buffer(output->surface);
+    DRMFBState* fb = fb_get_from_bo(next);
+
+    if (!fb) {
+        gbm_surface_release_buffer(output->surface, next);
+        output->retry_at = now_seconds() + FLIP_RETRY_INTERVAL;
+        return false;
+    }
+
+    if (!output->crtc_set) {
+        int status = drmModeSetCrtc(fd_, output->crtc_id, fb->fb_id, 0, 0,
+                                    &output->connector->connector_id, 1,
+                                    output->mode);
+        if (status < 0) {
             Log::error("Failed to set crtc: %d\n", status);
+            gbm_surface_release_buffer(output->surface, next);
+            output->retry_at = now_seconds() + FLIP_RETRY_INTERVAL;
+            return false;
         }
-        return;
+
+        output->crtc_set = true;
+        output->bo = next;
+        return true;
     }
 
-    int status = drmModePageFlip(fd_, encoder_->crtc_id, fb_->fb_id,
-                                 DRM_MODE_PAGE_FLIP_EVENT, &waiting);
+    // Queue the flip and return; the buffer that is currently on screen is
+    // released from page_flip_handler() once the new one has replaced it.
+    int status = drmModePageFlip(fd_, output->crtc_id, fb->fb_id,
+                                 DRM_MODE_PAGE_FLIP_EVENT, output);
     if (status < 0) {
         Log::error("Failed to enqueue page flip: %d\n", status);
-        return;
+        gbm_surface_release_buffer(output->surface, next);
+        output->retry_at = now_seconds() + FLIP_RETRY_INTERVAL;
+        return false;
     }
 
-    fd_set fds;
-    FD_ZERO(&fds);
-    FD_SET(fd_, &fds);
-    drmEventContext evCtx;
-    evCtx.version = DRM_EVENT_CONTEXT_VERSION;
-    evCtx.page_flip_handler = page_flip_handler;
+    output->pending_bo = next;
+    output->flip_pending = true;
+    output->pacer.frame_submitted(now_seconds());
 
-    while (waiting) {
-        status = select(fd_ + 1, &fds, 0, 0, 0);
-        if (status < 0) {
-            // Most of the time, select() will return an error because the
-            // user pressed Ctrl-C.  So, only print out a message in debug
-            // mode, and just check for the likely condition and release
-            // the current buffer object before getting out.
-            Log::debug("Error in select\n");
-            if (should_quit()) {
-                gbm_surface_release_buffer(surface_, bo_);
-                bo_ = next;
-            }
+    return true;
+}
+
+unsigned int NativeStateDRM::outputs()
+{
+    return outputs_.size();
+}
+
+void NativeStateDRM::select_output(unsigned int output)
+{
+    if (output < outputs_.size() && !outputs_[output]->flip_pending)
+        outputs_[output]->pacer.render_started(now_seconds());
+
+    if (output < outputs_.size())
+        current_ = output;
+}
+
+void NativeStateDRM::output_size(unsigned int output, int &width, int &height)
+{
+    width = output < outputs_.size() ? outputs_[output]->width : 0;
+    height = output < outputs_.size() ? outputs_[output]->height : 0;
+}
+
+bool NativeStateDRM::output_ready(unsigned int output)
+{
+    if (output >= outputs_.size() || outputs_[output]->flip_pending)
+        return false;
+
+    DRMOutput* o = outputs_[output];
+    double now = now_seconds();
+    if (now < o->retry_at)
+        return false;
+
+    return !paced(o) || o->pacer.render_start(now) <= now;
+}
+
+void NativeStateDRM::wait_for_output(const std::vector<bool> &outputs, int fd, double timeout)
+{
+    double deadline = timeout < 0.0 ? -1.0 : now_seconds() + timeout;
+
+    for (;;) {
+        double now = now_seconds();
+        double wake = deadline;
+        bool readable = false;
+
+        if (deadline >= 0.0 && now >= deadline)
             return;
+
+        // Wake up for the earliest render start of the outputs without a
+        // pending flip, for the next flip event or for @fd
+        for (unsigned int o = 0; o < outputs_.size() && o < outputs.size(); o++) {
+            DRMOutput* output = outputs_[o];
+            if (!outputs[o] || output->flip_pending)
+                continue;
+
+            double start = paced(output) ? output->pacer.render_start(now) : now;
+            start = std::max(start, output->retry_at);
+            if (start <= now)
+                return;
+            if (wake < 0.0 || start < wake)
+                wake = start;
         }
-        drmHandleEvent(fd_, &evCtx);
+
+        if (!handle_events(wake < 0.0 ? -1.0 : wake - now, fd, &readable) || readable)
+            return;
     }
+}
+
+double NativeStateDRM::refresh_period(unsigned int output)
+{
+    if (output >= outputs_.size())
+        return NativeState::refresh_period(output);
+
+    return outputs_[output]->pacer.period();
+}
+
+unsigned int NativeStateDRM::dropped_frames(unsigned int output)
+{
+    if (output >= outputs_.size())
+        return 0;
 
-    gbm_surface_release_buffer(surface_, bo_);
-    bo_ = next;
+    return outputs_[output]->pacer.missed();
 }
 
 /*******************
@@ -141,114 +246,536 @@ NativeStateDRM::DRMFBState* NativeStateDRM::fb_get_from_bo(gbm_bo* bo)
     return fb;
 }
 
-bool NativeStateDRM::init_gbm()
+bool NativeStateDRM::crtc_in_use(uint32_t crtc_id)
 {
-    dev_ = gbm_create_device(fd_);
-    if (!dev_) {
-        Log::error("Failed to create GBM device\n");
+    for (unsigned int o = 0; o < outputs_.size(); o++) {
+        if (outputs_[o]->crtc_id == crtc_id)
+            return true;
+    }
+
+    return false;
+}
+
+uint32_t NativeStateDRM::find_crtc(drmModeConnector* connector)
+{
+    // Prefer the CRTC that is already driving the connector
+    if (connector->encoder_id) {
+        drmModeEncoder* encoder = drmModeGetEncoder(fd_, connector->encoder_id);
+        if (encoder) {
+            uint32_t crtc_id = encoder->crtc_id;
+            drmModeFreeEncoder(encoder);
+            if (crtc_id && !crtc_in_use(crtc_id))
+                return crtc_id;
+        }
+    }
+
+    // Otherwise take the first free CRTC any of its encoders can drive
+    for (int e = 0; e < connector->count_encoders; e++) {
+        drmModeEncoder* encoder = drmModeGetEncoder(fd_, connector->encoders[e]);
+        if (!encoder)
+            continue;
+
+        for (int c = 0; c < resources_->count_crtcs; c++) {
+            uint32_t crtc_id = resources_->crtcs[c];
+            if ((encoder->possible_crtcs & (1 << c)) && !crtc_in_use(crtc_id)) {
+                drmModeFreeEncoder(encoder);
+                return crtc_id;
+            }
+        }
+        drmModeFreeEncoder(encoder);
+    }
+
+    return 0;
+}
+
+uint32_t NativeStateDRM::find_property(uint32_t object_id, uint32_t object_type,
+                                       const char* name, uint64_t* value)
+{
+    drmModeObjectPropertiesPtr props = drmModeObjectGetProperties(fd_, object_id,
+                                                                  object_type);
+    uint32_t prop_id(0);
+
+    if (!props)
+        return 0;
+
+    for (uint32_t p = 0; p < props->count_props && !prop_id; p++) {
+        drmModePropertyPtr prop = drmModeGetProperty(fd_, props->props[p]);
+        if (!prop)
+            continue;
+
+        if (!strcmp(prop->name, name)) {
+            prop_id = prop->prop_id;
+            if (value)
+                *value = props->prop_values[p];
+        }
+        drmModeFreeProperty(prop);
+    }
+
+    drmModeFreeObjectProperties(props);
+
+    return prop_id;
+}
+
+void NativeStateDRM::enable_vrr(DRMOutput* output)
+{
+    uint64_t capable(0);
+    uint32_t connector_id = output->connector->connector_id;
+
+    if (!find_property(connector_id, DRM_MODE_OBJECT_CONNECTOR, "vrr_capable",
+                       &capable) || !capable) {
+        Log::info("Connector %u doesn't support variable refresh rate\n",
+                  connector_id);
+        return;
+    }
+
+    uint32_t prop_id = find_property(output->crtc_id, DRM_MODE_OBJECT_CRTC,
+                                     "VRR_ENABLED", 0);
+    if (!prop_id ||
+        drmModeObjectSetProperty(fd_, output->crtc_id, DRM_MODE_OBJECT_CRTC,
+                                 prop_id, 1) < 0) {
+        Log::info("Failed to enable variable refresh rate on CRTC %u\n",
+                  output->crtc_id);
+        return;
+    }
+
+    output->vrr_prop = prop_id;
+    Log::debug("Enabled variable refresh rate on CRTC %u\n", output->crtc_id);
+}
+
+bool NativeStateDRM::create_dumb_fb(uint32_t width, uint32_t height, DRMDumbFB& fb)
+{
+    struct drm_mode_create_dumb create_arg;
+
+    memset(&create_arg, 0, sizeof(create_arg));
+    create_arg.bpp = 32;
+    create_arg.width = width;
+    create_arg.height = height;
+    if (drmIoctl(fd_, DRM_IOCTL_MODE_CREATE_DUMB, &create_arg)) {
+        Log::error("Failed to create %ux%u dumb buffer\n", width, height);
         return false;
     }
 
-    surface_ = gbm_surface_create(dev_, mode_->hdisplay, mode_->vdisplay,
-                                  GBM_FORMAT_XRGB8888,
-                                  GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING);
-    if (!surface_) {
-        Log::error("Failed to create GBM surface\n");
+    fb.handle = create_arg.handle;
+    if (drmModeAddFB(fd_, width, height, 24, 32, create_arg.pitch,
+                     create_arg.handle, &fb.fb_id) < 0) {
+        Log::error("Failed to create FB for %ux%u dumb buffer\n", width, height);
+        fb.fb_id = 0;
+        destroy_dumb_fb(fb);
         return false;
     }
 
     return true;
 }
 
-bool NativeStateDRM::init()
+void NativeStateDRM::destroy_dumb_fb(DRMDumbFB& fb)
+{
+    if (fb.fb_id)
+        drmModeRmFB(fd_, fb.fb_id);
+
+    if (fb.handle) {
+        struct drm_mode_destroy_dumb destroy_arg;
+        memset(&destroy_arg, 0, sizeof(destroy_arg));
+        destroy_arg.handle = fb.handle;
+        drmIoctl(fd_, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy_arg);
+    }
+
+    fb = DRMDumbFB();
+}
+
+/*
+ * Finds the primary plane of a CRTC, if it can show XRGB8888 frames.
+ */
+uint32_t NativeStateDRM::find_primary_plane(uint32_t crtc_id)
 {
-    // TODO: Replace this with something that explicitly probes for the loaded
-    // driver (udev?).
-    static const char* drm_modules[] = {
-        "rockchip",
-        "i915",
-        "nouveau",
-        "radeon",
-        "vmgfx",
-        "omapdrm",
-        "exynos"
-    };
-
-    unsigned int num_modules(sizeof(drm_modules)/sizeof(drm_modules[0]));
-    for (unsigned int m = 0; m < num_modules; m++) {
-        fd_ = drmOpen(drm_modules[m], 0);
-        if (fd_ < 0) {
-            Log::debug("Failed to open DRM module '%s'\n", drm_modules[m]);
+    int crtc_index(-1);
+    for (int c = 0; c < resources_->count_crtcs; c++) {
+        if (resources_->crtcs[c] == crtc_id)
+            crtc_index = c;
+    }
+
+    drmModePlaneResPtr planes = drmModeGetPlaneResources(fd_);
+    uint32_t plane_id(0);
+
+    if (!planes || crtc_index < 0) {
+        if (planes)
+            drmModeFreePlaneResources(planes);
+        return 0;
+    }
+
+    for (uint32_t p = 0; p < planes->count_planes && !plane_id; p++) {
+        drmModePlanePtr plane = drmModeGetPlane(fd_, planes->planes[p]);
+        uint64_t type(0);
+
+        if (!plane)
             continue;
+
+        if ((plane->possible_crtcs & (1 << crtc_index)) &&
+            find_property(plane->plane_id, DRM_MODE_OBJECT_PLANE, "type", &type) &&
+            type == DRM_PLANE_TYPE_PRIMARY) {
+            for (uint32_t f = 0; f < plane->count_formats && !plane_id; f++) {
+                if (plane->formats[f] == GBM_FORMAT_XRGB8888)
+                    plane_id = plane->plane_id;
+            }
         }
-        Log::debug("Opened DRM module '%s'\n", drm_modules[m]);
-        break;
+        drmModeFreePlane(plane);
     }
 
-    if (fd_ < 0) {
-        Log::error("Failed to find a suitable DRM device\n");
+    drmModeFreePlaneResources(planes);
+
+    return plane_id;
+}
+
+/*
+ * Sets up an output to render frames of the scanout size, which the
+ * primary plane stretches to the mode. Drivers only tell whether their
+ * plane can scale by trying it, so this lights up the CRTC with a blank
+ * frame of the mode size and then puts a blank frame of the scanout size
+ * on the plane, scaled. Page flips keep the plane's scaling from there on.
+ */
+bool NativeStateDRM::init_plane_scaling(DRMOutput* output)
+{
+    uint32_t width = scanout_width_;
+    uint32_t height = scanout_height_;
+
+    uint32_t plane_id = find_primary_plane(output->crtc_id);
+    if (!plane_id) {
+        Log::info("No primary plane found for CRTC %u, rendering at the mode size\n",
+                  output->crtc_id);
         return false;
     }
 
-    resources_ = drmModeGetResources(fd_);
-    if (!resources_) {
-        Log::error("drmModeGetResources failed\n");
+    DRMDumbFB full;
+    if (!create_dumb_fb(output->mode->hdisplay, output->mode->vdisplay, full))
+        return false;
+    if (!create_dumb_fb(width, height, output->blank)) {
+        destroy_dumb_fb(full);
         return false;
     }
 
-    // Find a connected connector
-    for (int c = 0; c < resources_->count_connectors; c++) {
-        connector_ = drmModeGetConnector(fd_, resources_->connectors[c]);
-        if (DRM_MODE_CONNECTED == connector_->connection) {
-            break;
+    int status = drmModeSetCrtc(fd_, output->crtc_id, full.fb_id, 0, 0,
+                                &output->connector->connector_id, 1,
+                                output->mode);
+    if (status >= 0) {
+        // Source coordinates are 16.16 fixed point
+        status = drmModeSetPlane(fd_, plane_id, output->crtc_id,
+                                 output->blank.fb_id, 0,
+                                 0, 0, output->mode->hdisplay, output->mode->vdisplay,
+                                 0, 0, width << 16, height << 16);
+    }
+
+    // The mode sized frame is off the screen either way, and a CRTC left
+    // without a frame is set up by the first flip
+    destroy_dumb_fb(full);
+
+    if (status < 0) {
+        Log::info("CRTC %u can't scale %ux%u frames to %ux%u, rendering at the mode size\n",
+                  output->crtc_id, width, height,
+                  output->mode->hdisplay, output->mode->vdisplay);
+        destroy_dumb_fb(output->blank);
+        return false;
+    }
+
+    output->plane_id = plane_id;
+    output->width = width;
+    output->height = height;
+    output->crtc_set = true;
+
+    Log::debug("Plane %u scales %ux%u frames to %ux%u on CRTC %u\n", plane_id,
+               width, height, output->mode->hdisplay, output->mode->vdisplay,
+               output->crtc_id);
+
+    return true;
+}
+
+/*
+ * Waits for DRM events and handles them. A negative @timeout (in seconds)
+ * waits for as long as it takes. If @fd isn't -1 the wait also ends when
+ * it becomes readable, which is stored in @readable.
+ */
+bool NativeStateDRM::handle_events(double timeout, int fd, bool *readable)
+{
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(fd_, &fds);
+    if (fd >= 0)
+        FD_SET(fd, &fds);
+    drmEventContext evCtx;
+    memset(&evCtx, 0, sizeof(evCtx));
+    evCtx.version = DRM_EVENT_CONTEXT_VERSION;
+    evCtx.page_flip_handler = page_flip_handler;
+
+    struct timeval tv;
+    if (timeout >= 0.0) {
+        tv.tv_sec = static_cast<time_t>(timeout);
+        tv.tv_usec = static_cast<suseconds_t>((timeout - tv.tv_sec) * 1000000.0);
+    }
+
+    int status = select((fd > fd_ ? fd : fd_) + 1, &fds, 0, 0, timeout >= 0.0 ? &tv : 0);
+    if (status < 0) {
+        // Most of the time, select() will return an error because the
+        // user pressed Ctrl-C.  So, only print out a message in debug
+        // mode and let the caller check for the likely condition.
+        Log::debug("Error in select\n");
+        return false;
+    }
+    if (status > 0 && FD_ISSET(fd_, &fds))
+        drmHandleEvent(fd_, &evCtx);
+    if (status > 0 && fd >= 0 && FD_ISSET(fd, &fds) && readable)
+        *readable = true;
+
+    return true;
+}
+
+/*
+ * Whether an output renders late. Outputs with variable refresh rate have
+ * no fixed vblank to aim at.
+ */
+bool NativeStateDRM::paced(DRMOutput* output)
+{
+    return pacing_ && !output->vrr_prop;
+}
+
+bool NativeStateDRM::init_gbm()
+{
+    dev_ = gbm_create_device(fd_);
+    if (!dev_) {
+        Log::error("Failed to create GBM device\n");
+        return false;
+    }
+
+    // Primary planes are only exposed to clients that handle all planes
+    bool scaling = scanout_width_ > 0 && scanout_height_ > 0;
+    if (scaling && drmSetClientCap(fd_, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) < 0) {
+        Log::info("DRM device doesn't expose its planes, rendering at the mode size\n");
+        scaling = false;
+    }
+
+    for (unsigned int o = 0; o < outputs_.size(); o++) {
+        DRMOutput* output = outputs_[o];
+
+        // Only worth it for frames smaller than the mode
+        if (scaling &&
+            scanout_width_ <= output->mode->hdisplay &&
+            scanout_height_ <= output->mode->vdisplay &&
+            (scanout_width_ < output->mode->hdisplay ||
+             scanout_height_ < output->mode->vdisplay)) {
+            init_plane_scaling(output);
+        }
+
+        output->surface = gbm_surface_create(dev_, output->width, output->height,
+                                             GBM_FORMAT_XRGB8888,
+                                             GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING);
+        if (!output->surface) {
+            Log::error("Failed to create GBM surface\n");
+            return false;
         }
-        drmModeFreeConnector(connector_);
-        connector_ = 0;
     }
 
-    if (!connector_) {
-        Log::error("Failed to find a suitable connector\n");
+    return true;
+}
+
+/*
+ * Gets the bus ID of a device the way drmGetBusid() spells it, e.g.
+ * "pci:0000:01:00.0", or the platform device name.
+ */
+static std::string device_bus_id(drmDevicePtr device)
+{
+    char busid[64];
+
+    switch (device->bustype) {
+    case DRM_BUS_PCI:
+        snprintf(busid, sizeof(busid), "pci:%04x:%02x:%02x.%u",
+                 device->businfo.pci->domain, device->businfo.pci->bus,
+                 device->businfo.pci->dev, device->businfo.pci->func);
+        return busid;
+    case DRM_BUS_PLATFORM:
+        return device->businfo.platform->fullname;
+    default:
+        return std::string();
+    }
+}
+
+/*
+ * Whether a device can drive a display, and has one connected.
+ */
+static bool device_has_display(int fd, bool& connected)
+{
+    drmModeRes* resources = drmModeGetResources(fd);
+    bool kms = resources && resources->count_crtcs > 0 &&
+               resources->count_connectors > 0;
+
+    connected = false;
+    for (int c = 0; kms && !connected && c < resources->count_connectors; c++) {
+        drmModeConnector* connector = drmModeGetConnector(fd, resources->connectors[c]);
+        if (connector) {
+            connected = connector->connection == DRM_MODE_CONNECTED &&
+                        connector->count_modes > 0;
+            drmModeFreeConnector(connector);
+        }
+    }
+
+    if (resources)
+        drmModeFreeResources(resources);
+
+    return kms;
+}
+
+bool NativeStateDRM::open_device()
+{
+    int count = drmGetDevices2(0, NULL, 0);
+    if (count <= 0) {
+        Log::error("No DRM devices found\n");
+        return false;
+    }
+
+    std::vector<drmDevicePtr> devices(count);
+    count = drmGetDevices2(0, &devices[0], count);
+    if (count <= 0) {
+        Log::error("Failed to enumerate DRM devices\n");
         return false;
     }
 
-    // Find the best resolution (we will always operate full-screen).
-    unsigned int bestArea(0);
-    for (int m = 0; m < connector_->count_modes; m++) {
-        drmModeModeInfo* curMode = &connector_->modes[m];
-        unsigned int curArea = curMode->hdisplay * curMode->vdisplay;
-        if (curArea > bestArea) {
-            mode_ = curMode;
-            bestArea = curArea;
+    int chosen = -1;
+    bool chosen_connected = false;
+
+    for (int d = 0; d < count; d++) {
+        drmDevicePtr device = devices[d];
+        if (!(device->available_nodes & (1 << DRM_NODE_PRIMARY)))
+            continue;
+
+        const char* node = device->nodes[DRM_NODE_PRIMARY];
+        int fd = open(node, O_RDWR | O_CLOEXEC);
+        if (fd < 0) {
+            Log::debug("Failed to open %s\n", node);
+            continue;
+        }
+
+        drmVersionPtr version = drmGetVersion(fd);
+        std::string driver(version ? version->name : "");
+        std::string busid(device_bus_id(device));
+        if (version)
+            drmFreeVersion(version);
+
+        bool connected;
+        bool kms = device_has_display(fd, connected);
+        bool requested = !device_.empty() &&
+                         (device_ == driver || device_ == busid || device_ == node);
+
+        Log::debug("DRM device %s: driver '%s', bus ID '%s'%s%s\n", node,
+                   driver.c_str(), busid.c_str(), kms ? ", KMS" : "",
+                   connected ? ", connected" : "");
+
+        // A requested device wins; otherwise prefer a connected display
+        bool better = device_.empty() ? kms && (chosen < 0 || (connected && !chosen_connected))
+                                      : requested && chosen < 0;
+        if (better) {
+            if (chosen >= 0)
+                close(fd_);
+            fd_ = fd;
+            chosen = d;
+            chosen_connected = connected;
+        } else {
+            close(fd);
         }
     }
 
-    if (!mode_) {
-        Log::error("Failed to find a suitable mode\n");
+    if (chosen < 0) {
+        if (device_.empty())
+            Log::error("Failed to find a DRM device with display support\n");
+        else
+            Log::error("Failed to find DRM device '%s'\n", device_.c_str());
+        fd_ = 0;
+        drmFreeDevices(&devices[0], count);
         return false;
     }
 
-    // Find a suitable encoder
-    for (int e = 0; e < resources_->count_encoders; e++) {
-        encoder_ = drmModeGetEncoder(fd_, resources_->encoders[e]);
-        if (encoder_ && encoder_->encoder_id == connector_->encoder_id) {
-            break;
+    Log::debug("Displaying on %s\n", devices[chosen]->nodes[DRM_NODE_PRIMARY]);
+
+    /*
+     * Buffers are allocated on a render node, which needs no master
+     * rights. Display-only controllers (vkms, rockchip, ...) have none
+     * themselves, and which other GPU's buffers they can import can't be
+     * told from here, so they allocate on their own primary node unless
+     * a render node is given.
+     */
+    std::string render(render_node_);
+    if (render.empty() && (devices[chosen]->available_nodes & (1 << DRM_NODE_RENDER)))
+        render = devices[chosen]->nodes[DRM_NODE_RENDER];
+
+    if (!render.empty()) {
+        render_fd_ = open(render.c_str(), O_RDWR | O_CLOEXEC);
+        if (render_fd_ < 0 && !render_node_.empty()) {
+            Log::error("Failed to open render node %s\n", render.c_str());
+            drmFreeDevices(&devices[0], count);
+            return false;
         }
-        drmModeFreeEncoder(encoder_);
-        encoder_ = 0;
     }
 
-    if (!encoder_) {
-        Log::error("Failed to find a suitable encoder\n");
+    Log::debug("Allocating buffers on %s\n",
+               render_fd_ >= 0 ? render.c_str() : devices[chosen]->nodes[DRM_NODE_PRIMARY]);
+
+    drmFreeDevices(&devices[0], count);
+
+    return true;
+}
+
+bool NativeStateDRM::init()
+{
+    if (!open_device())
+        return false;
+
+    resources_ = drmModeGetResources(fd_);
+    if (!resources_) {
+        Log::error("drmModeGetResources failed\n");
         return false;
     }
 
-    if (!init_gbm()) {
+    // Set up an output for every connected connector we can find a CRTC for
+    for (int c = 0; c < resources_->count_connectors; c++) {
+        drmModeConnector* connector = drmModeGetConnector(fd_, resources_->connectors[c]);
+        if (!connector)
+            continue;
+
+        if (DRM_MODE_CONNECTED != connector->connection || !connector->count_modes) {
+            drmModeFreeConnector(connector);
+            continue;
+        }
+
+        // Pick the mode by policy (we will always operate full-screen).
+        drmModeModeInfo* mode = mode_policy_.select(connector);
+
+        uint32_t crtc_id = find_crtc(connector);
+        if (!mode || !crtc_id) {
+            Log::debug("No mode or CRTC available for connector %u\n",
+                       connector->connector_id);
+            drmModeFreeConnector(connector);
+            continue;
+        }
+
+        DRMOutput* output = new DRMOutput();
+        output->connector = connector;
+        output->crtc_id = crtc_id;
+        output->mode = mode;
+        output->width = mode->hdisplay;
+        output->height = mode->vdisplay;
+        output->saved_crtc = drmModeGetCrtc(fd_, crtc_id);
+        outputs_.push_back(output);
+
+        if (vrr_)
+            enable_vrr(output);
+        output->pacer.refresh(ModePolicy::refresh(mode));
+
+        Log::debug("Output %u: connector %u, CRTC %u, mode %ux%u@%.2f\n",
+                   outputs_.size() - 1, connector->connector_id, crtc_id,
+                   mode->hdisplay, mode->vdisplay, ModePolicy::refresh(mode));
+    }
+
+    if (outputs_.empty()) {
+        Log::error("Failed to find a suitable connector\n");
         return false;
     }
 
-    crtc_ = drmModeGetCrtc(fd_, encoder_->crtc_id);
-    if (!crtc_) {
-        Log::error("Failed to get current CRTC\n");
+    if (!init_gbm()) {
         return false;
     }
 
@@ -264,48 +791,77 @@ void NativeStateDRM::quit_handler(int /*signo*/)
     should_quit_ = true;
 }
 
-void NativeStateDRM::page_flip_handler(int/*  fd */, unsigned int /* frame */, unsigned int /* sec */, unsigned int /* usec */, void* data)
+void NativeStateDRM::page_flip_handler(int/*  fd */, unsigned int frame, unsigned int sec, unsigned int usec, void* data)
 {
-    unsigned int* waiting = reinterpret_cast<unsigned int*>(data);
-    *waiting = 0;
+    DRMOutput* output = reinterpret_cast<DRMOutput*>(data);
+
+    // The timestamps are CLOCK_MONOTONIC, like now_seconds()
+    output->pacer.vblank(frame, sec + usec / 1000000.0);
+    if (frame % PACER_REPORT_INTERVAL == 0) {
+        Log::debug("CRTC %u: %.2f Hz, render budget %.2f ms, %u missed vblanks\n",
+                   output->crtc_id, 1.0 / output->pacer.period(),
+                   output->pacer.budget() * 1000.0, output->pacer.missed());
+    }
+
+    if (output->bo)
+        gbm_surface_release_buffer(output->surface, output->bo);
+    output->bo = output->pending_bo;
+    output->pending_bo = 0;
+    output->flip_pending = false;
 }
 
 void NativeStateDRM::cleanup()
 {
-    // Restore CRTC state if necessary
-    if (crtc_) {
-        int status = drmModeSetCrtc(fd_, crtc_->crtc_id, crtc_->buffer_id,
-                                    crtc_->x, crtc_->y, &connector_->connector_id,
-                                    1, &crtc_->mode);
-        if (status < 0) {
-            Log::error("Failed to restore original CRTC: %d\n", status);
-        }
-        drmModeFreeCrtc(crtc_);
-        crtc_ = 0;
+    // Let queued flips complete before touching the CRTCs
+    for (unsigned int o = 0; o < outputs_.size(); o++) {
+        while (outputs_[o]->flip_pending && handle_events())
+            ;
     }
-    if (surface_) {
-        gbm_surface_destroy(surface_);
-        surface_ = 0;
+
+    for (unsigned int o = 0; o < outputs_.size(); o++) {
+        DRMOutput* output = outputs_[o];
+
+        if (output->vrr_prop) {
+            drmModeObjectSetProperty(fd_, output->crtc_id, DRM_MODE_OBJECT_CRTC,
+                                     output->vrr_prop, 0);
+        }
+
+        // Restore CRTC state if necessary
+        if (output->saved_crtc) {
+            drmModeCrtcPtr crtc = output->saved_crtc;
+            int status = drmModeSetCrtc(fd_, crtc->crtc_id, crtc->buffer_id,
+                                        crtc->x, crtc->y,
+                                        &output->connector->connector_id,
+                                        1, &crtc->mode);
+            if (status < 0) {
+                Log::error("Failed to restore original CRTC: %d\n", status);
+            }
+            drmModeFreeCrtc(crtc);
+        }
+        destroy_dumb_fb(output->blank);
+        if (output->surface) {
+            gbm_surface_destroy(output->surface);
+        }
+        drmModeFreeConnector(output->connector);
+        delete output;
     }
+    outputs_.clear();
+    current_ = 0;
+
     if (dev_) {
         gbm_device_destroy(dev_);
         dev_ = 0;
     }
-    if (connector_) {
-        drmModeFreeConnector(connector_);
-        connector_ = 0;
-    }
-    if (encoder_) {
-        drmModeFreeEncoder(encoder_);
-        encoder_ = 0;
-    }
     if (resources_) {
         drmModeFreeResources(resources_);
         resources_ = 0;
     }
+    if (render_fd_ >= 0) {
+        close(render_fd_);
+        render_fd_ = -1;
+    }
     if (fd_ > 0) {
-        drmClose(fd_);
+        close(fd_);
     }
     fd_ = 0;
-    mode_ = 0;
 }
@@ -2,8 +2,12 @@
 #define NATIVE_STATE_DRM_H_
 
 #include "native-state.h"
+#include "mode-policy.h"
+#include "frame-pacer.h"
 #include <csignal>
 #include <cstring>
+#include <string>
+#include <vector>
 #include <gbm.h>
 #include <drm.h>
 #include <xf86drm.h>
@@ -12,17 +16,37 @@
 class NativeStateDRM : public NativeState
 {
 public:
-    NativeStateDRM() :
+    /*
+     * @device selects the DRM device to display on: a driver name (e.g.
+     * "vkms"), a bus ID (e.g. "pci:0000:01:00.0" or the platform device
+     * name) or a device node. By default the first device with a
+     * connected display is used. @mode_policy picks the mode of every
+     * output, and @vrr enables variable refresh rate where the display
+     * supports it. With @pacing, outputs only become ready to render
+     * once just their render budget is left before the next vblank.
+     * A @scanout_width x @scanout_height smaller than the mode has the
+     * outputs render frames of that size, which the primary plane of the
+     * CRTC stretches to the mode where the display hardware can scale.
+     * Buffers are allocated on @render_node, by default the render node
+     * of the display device or, without one, the display device itself.
+     */
+    NativeStateDRM(const std::string& device = std::string(),
+                   const ModePolicy& mode_policy = ModePolicy(),
+                   bool vrr = false, bool pacing = false,
+                   int scanout_width = 0, int scanout_height = 0,
+                   const std::string& render_node = std::string()) :
+        device_(device),
+        render_node_(render_node),
+        mode_policy_(mode_policy),
+        vrr_(vrr),
+        pacing_(pacing),
+        scanout_width_(scanout_width),
+        scanout_height_(scanout_height),
         fd_(0),
+        render_fd_(-1),
         resources_(0),
-        connector_(0),
-        encoder_(0),
-        mode_(0),
         dev_(0),
-        surface_(0),
-        bo_(0),
-        fb_(0),
-        crtc_set_(false) {}
+        current_(0) {}
     ~NativeStateDRM() { cleanup(); }
 
     bool init_display();
@@ -31,9 +55,18 @@ public:
     void* window(WindowProperties& properties);
     void visible(bool v);
     bool should_quit();
-    void flip();
+    bool flip();
+    unsigned int outputs();
+    void select_output(unsigned int output);
+    void output_size(unsigned int output, int &width, int &height);
+    bool output_ready(unsigned int output);
+    void wait_for_output(const std::vector<bool> &outputs, int fd, double timeout);
+    double refresh_period(unsigned int output);
+    unsigned int dropped_frames(unsigned int output);
 
     int get_fd();
+    // Render node for allocating buffers, or -1 if there is none
+    int get_render_fd();
 
 private:
     struct DRMFBState
@@ -43,6 +76,61 @@ private:
         uint32_t fb_id;
     };
 
+    /* A blank dumb buffer framebuffer */
+    struct DRMDumbFB
+    {
+        DRMDumbFB() : handle(0), fb_id(0) {}
+
+        uint32_t handle;
+        uint32_t fb_id;
+    };
+
+    /*
+     * A connector together with the CRTC scanning it out. Every output
+     * renders into its own GBM surface and tracks its own page flips, so
+     * a slow output never holds back the others.
+     */
+    struct DRMOutput
+    {
+        DRMOutput() :
+            connector(0),
+            crtc_id(0),
+            saved_crtc(0),
+            mode(0),
+            width(0),
+            height(0),
+            plane_id(0),
+            surface(0),
+            bo(0),
+            pending_bo(0),
+            vrr_prop(0),
+            crtc_set(false),
+            flip_pending(false),
+            retry_at(0.0) {}
+
+        drmModeConnector* connector;
+        uint32_t crtc_id;
+        drmModeCrtcPtr saved_crtc;
+        drmModeModeInfo* mode;
+        // Size of the rendered frames, smaller than the mode if the
+        // primary plane scales them
+        uint32_t width;
+        uint32_t height;
+        uint32_t plane_id;
+        // Shown by the scaling plane until the first frame is flipped in
+        DRMDumbFB blank;
+        gbm_surface* surface;
+        gbm_bo* bo;
+        gbm_bo* pending_bo;
+        // VRR_ENABLED property of the CRTC if VRR was turned on
+        uint32_t vrr_prop;
+        bool crtc_set;
+        bool flip_pending;
+        // After a failed flip, when the output may try again
+        double retry_at;
+        FramePacer pacer;
+    };
+
     static void page_flip_handler(int fd, unsigned int frame, unsigned int sec,
                                   unsigned int usec, void* data);
     static void fb_destroy_callback(gbm_bo* bo, void* data);
@@ -50,21 +138,35 @@ private:
     static volatile std::sig_atomic_t should_quit_;
 
     DRMFBState* fb_get_from_bo(gbm_bo* bo);
+    uint32_t find_crtc(drmModeConnector* connector);
+    bool crtc_in_use(uint32_t crtc_id);
+    uint32_t find_property(uint32_t object_id, uint32_t object_type,
+                           const char* name, uint64_t* value);
+    void enable_vrr(DRMOutput* output);
+    bool create_dumb_fb(uint32_t width, uint32_t height, DRMDumbFB& fb);
+    void destroy_dumb_fb(DRMDumbFB& fb);
+    uint32_t find_primary_plane(uint32_t crtc_id);
+    bool init_plane_scaling(DRMOutput* output);
+    bool handle_events(double timeout = -1.0, int fd = -1, bool *readable = 0);
+    bool paced(DRMOutput* output);
+    bool open_device();
     bool init_gbm();
     bool init();
     void cleanup();
 
+    std::string device_;
+    std::string render_node_;
+    ModePolicy mode_policy_;
+    bool vrr_;
+    bool pacing_;
+    int scanout_width_;
+    int scanout_height_;
     int fd_;
+    int render_fd_;
     drmModeRes* resources_;
-    drmModeConnector* connector_;
-    drmModeEncoder* encoder_;
-    drmModeCrtcPtr crtc_;
-    drmModeModeInfo* mode_;
     gbm_device* dev_;
-    gbm_surface* surface_;
-    gbm_bo* bo_;
-    DRMFBState* fb_;
-    bool crtc_set_;
+    std::vector<DRMOutput*> outputs_;
+    unsigned int current_;
 };
 
 #endif /* NATIVE_STATE_DRM_H_ */
@@ -1,6 +1,8 @@
 #ifndef NATIVE_STATE_H_
 #define NATIVE_STATE_H_
 
+#include <vector>
+
 class NativeState
 {
 public:
@@ -40,8 +42,41 @@ public:
     /* Whether the user has requested an exit */
     virtual bool should_quit() = 0;
 
-    /* Flips the display */
-    virtual void flip() = 0;
+    /* Flips the display, returns whether the frame is going to be shown */
+    virtual bool flip() = 0;
+
+    /* Gets the number of outputs (displays) driven by the native state */
+    virtual unsigned int outputs() { return 1; }
+
+    /* Selects the output that window() and flip() refer to */
+    virtual void select_output(unsigned int output) { static_cast<void>(output); }
+
+    /* Gets the size of an output without selecting it */
+    virtual void output_size(unsigned int output, int &width, int &height)
+    {
+        static_cast<void>(output);
+        WindowProperties properties;
+        window(properties);
+        width = properties.width;
+        height = properties.height;
+    }
+
+    /* Whether an output can accept a new frame (no flip is pending on it) */
+    virtual bool output_ready(unsigned int output) { static_cast<void>(output); return true; }
+
+    /* Waits until one of the given outputs can accept a new frame, @fd
+     * (unless -1) becomes readable or @timeout seconds (unless negative)
+     * have passed */
+    virtual void wait_for_output(const std::vector<bool> &outputs, int fd, double timeout)
+    {
+        static_cast<void>(outputs); static_cast<void>(fd); static_cast<void>(timeout);
+    }
+
+    /* Gets the time between two frames of an output in seconds */
+    virtual double refresh_period(unsigned int output) { static_cast<void>(output); return 1.0 / 60.0; }
+
+    /* Gets the number of frames of an output that missed their vblank */
+    virtual unsigned int dropped_frames(unsigned int output) { static_cast<void>(output); return 0; }
 };
 
 #endif /* NATIVE_STATE_H_ */
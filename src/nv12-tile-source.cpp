@@ -0,0 +1,129 @@
+#include "nv12-tile-source.h"
+#include "color-convert.h"
+#include "log.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+Nv12TileSource::Nv12TileSource(const std::string &path, unsigned int width,
+                               unsigned int height) :
+    path_(path),
+    width_(width),
+    height_(height),
+    data_(0),
+    size_(0)
+{
+}
+
+Nv12TileSource::~Nv12TileSource()
+{
+    if (data_)
+        munmap(const_cast<uint8_t *>(data_), size_);
+}
+
+bool Nv12TileSource::init()
+{
+    struct stat st;
+    size_t size = static_cast<size_t>(width_) * height_ * 3 / 2;
+
+    int fd = open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        Log::error("Open source file '%s' failed\n", path_.c_str());
+        return false;
+    }
+
+    if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < size) {
+        Log::error("'%s' is too small for a %ux%u NV12 image\n", path_.c_str(),
+                   width_, height_);
+        close(fd);
+        return false;
+    }
+
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        Log::error("Failed to map '%s'\n", path_.c_str());
+        return false;
+    }
+
+    data_ = static_cast<const uint8_t *>(data);
+    size_ = size;
+
+    return true;
+}
+
+bool Nv12TileSource::read_tile(unsigned int level, unsigned int x, unsigned int y,
+                               uint8_t *rgba)
+{
+    if (!data_)
+        return false;
+
+    const uint8_t *luma = data_;
+    const uint8_t *chroma = data_ + static_cast<size_t>(width_) * height_;
+    int scale = 1 << level;
+    // Offsets of the two samples per direction inside a pixel's area
+    int first = scale / 4;
+    int second = 3 * scale / 4;
+
+    // Full resolution tiles inside the image are a plain conversion,
+    // done from the chroma pair the first pixel is in
+    int left = static_cast<int>(x * TILE_SIZE) - static_cast<int>(TILE_BORDER);
+    int top = static_cast<int>(y * TILE_SIZE) - static_cast<int>(TILE_BORDER);
+    int start = left & ~1;
+    if (level == 0 && start >= 0 && top >= 0 &&
+        start + TILE_SLOT + 1 <= width_ && top + TILE_SLOT <= height_) {
+        uint8_t converted[(TILE_SLOT + 1) * 4];
+
+        for (unsigned int row = 0; row < TILE_SLOT; row++) {
+            size_t sy = top + row;
+
+            nv12_to_rgba(luma + sy * width_ + start, width_,
+                         chroma + sy / 2 * width_ + start, width_,
+                         converted, 0, left - start + TILE_SLOT, 1);
+            memcpy(rgba + row * TILE_SLOT * 4, converted + (left - start) * 4, TILE_SLOT * 4);
+        }
+
+        return true;
+    }
+
+    for (unsigned int row = 0; row < TILE_SLOT; row++) {
+        int py = static_cast<int>(y * TILE_SIZE + row) - TILE_BORDER;
+        int sy[2] = { py * scale + first, py * scale + second };
+
+        for (int i = 0; i < 2; i++)
+            sy[i] = sy[i] < 0 ? 0 : (sy[i] >= static_cast<int>(height_) ? height_ - 1 : sy[i]);
+
+        uint8_t *out = rgba + row * TILE_SLOT * 4;
+
+        for (unsigned int col = 0; col < TILE_SLOT; col++) {
+            int px = static_cast<int>(x * TILE_SIZE + col) - TILE_BORDER;
+            int sx[2] = { px * scale + first, px * scale + second };
+            int ys = 0, us = 0, vs = 0;
+
+            // The panorama wraps around horizontally
+            for (int i = 0; i < 2; i++) {
+                sx[i] %= static_cast<int>(width_);
+                if (sx[i] < 0)
+                    sx[i] += width_;
+            }
+
+            for (int j = 0; j < 2; j++) {
+                const uint8_t *l = luma + static_cast<size_t>(sy[j]) * width_;
+                const uint8_t *c = chroma + static_cast<size_t>(sy[j] / 2) * width_;
+
+                for (int i = 0; i < 2; i++) {
+                    ys += l[sx[i]];
+                    us += c[sx[i] & ~1];
+                    vs += c[sx[i] | 1];
+                }
+            }
+
+            yuv_to_rgba((ys + 2) / 4, (us + 2) / 4, (vs + 2) / 4, out + col * 4);
+        }
+    }
+
+    return true;
+}
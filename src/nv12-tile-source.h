@@ -0,0 +1,37 @@
+#ifndef NV12_TILE_SOURCE_H_
+#define NV12_TILE_SOURCE_H_
+
+#include "tile-source.h"
+
+#include <string>
+#include <stddef.h>
+
+/**
+ * Tiles cut from a raw NV12 panorama on the fly.
+ *
+ * The file is mapped rather than read, so only the parts of it that tiles
+ * are cut from are ever paged in. Tiles of the coarser levels are filtered
+ * down from four samples of the area every pixel covers, which costs the
+ * same for every level but aliases fine detail; pre-filtered pyramids are
+ * better for images with a lot of it.
+ */
+class Nv12TileSource : public TileSource
+{
+public:
+    Nv12TileSource(const std::string &path, unsigned int width, unsigned int height);
+    ~Nv12TileSource();
+
+    bool init();
+    bool read_tile(unsigned int level, unsigned int x, unsigned int y, uint8_t *rgba);
+    unsigned int width() const { return width_; }
+    unsigned int height() const { return height_; }
+
+private:
+    std::string path_;
+    unsigned int width_;
+    unsigned int height_;
+    const uint8_t *data_;
+    size_t size_;
+};
+
+#endif /* NV12_TILE_SOURCE_H_ */
@@ -0,0 +1,285 @@
+#include <cstdio>
+#include <getopt.h>
+#include <cstring>
+
+#include "options.h"
+#include "util.h"
+#include "mode-policy.h"
+
+std::string Options::image("/mnt/1920x1080_nv12.bin");
+int Options::width(1920);
+int Options::height(1080);
+std::vector<std::string> Options::cameras;
+std::string Options::fisheye;
+std::string Options::warp;
+int Options::lut_width(2048);
+int Options::lut_height(1024);
+std::string Options::v4l2;
+std::string Options::ingest;
+std::string Options::drm_device;
+std::string Options::render_node;
+std::string Options::mode("preferred");
+bool Options::vrr(false);
+bool Options::pacing(true);
+bool Options::dynamic_resolution(false);
+int Options::scanout_width(0);
+int Options::scanout_height(0);
+bool Options::tiled(false);
+int Options::tile_budget(64);
+std::string Options::trace;
+bool Options::trace_marker(false);
+std::string Options::metrics;
+std::string Options::yuv_matrix("bt601");
+std::string Options::yuv_range("limited");
+bool Options::planar_yuv(false);
+bool Options::verify(false);
+bool Options::show_debug(false);
+bool Options::show_help(false);
+
+static struct option long_options[] = {
+    {"image", 1, 0, 0},
+    {"size", 1, 0, 0},
+    {"camera", 1, 0, 0},
+    {"fisheye", 1, 0, 0},
+    {"warp", 1, 0, 0},
+    {"lut-size", 1, 0, 0},
+    {"v4l2", 1, 0, 0},
+    {"ingest", 1, 0, 0},
+    {"drm-device", 1, 0, 0},
+    {"render-node", 1, 0, 0},
+    {"mode", 1, 0, 0},
+    {"vrr", 0, 0, 0},
+    {"no-pacing", 0, 0, 0},
+    {"dynamic-resolution", 0, 0, 0},
+    {"scanout-size", 1, 0, 0},
+    {"tiled", 0, 0, 0},
+    {"tile-budget", 1, 0, 0},
+    {"trace", 1, 0, 0},
+    {"trace-marker", 0, 0, 0},
+    {"metrics", 1, 0, 0},
+    {"yuv-matrix", 1, 0, 0},
+    {"yuv-range", 1, 0, 0},
+    {"planar-yuv", 0, 0, 0},
+    {"verify", 0, 0, 0},
+    {"debug", 0, 0, 0},
+    {"help", 0, 0, 0},
+    {0, 0, 0, 0}
+};
+
+/**
+ * Parses a size string of the form WxH.
+ *
+ * @param str the string to parse
+ * @param width the parsed width
+ * @param height the parsed height
+ *
+ * @return whether the string could be parsed
+ */
+bool Options::parse_size(const std::string &str, int &width, int &height)
+{
+    std::vector<std::string> d;
+    Util::split(str, 'x', d, Util::SplitModeNormal);
+
+    if (d.size() != 2)
+        return false;
+
+    width = Util::fromString<int>(d[0]);
+    height = Util::fromString<int>(d[1]);
+
+    return width > 0 && height > 0;
+}
+
+void Options::print_help()
+{
+    printf("A panorama image display demo using EGL zero-copy import\n"
+           "\n"
+           "Options:\n"
+           "  -i, --image PATH       The NV12 panorama to display, or a tiled or KTX\n"
+           "                         compressed panorama file (default: %s)\n"
+           "  -s, --size WxH         Size of the panorama image (default: %dx%d)\n"
+           "  -c, --camera CAMERA    Stitch the panorama from a camera image:\n"
+           "                         'file=PATH:size=WxH(:opt=val)*' with the\n"
+           "                         options yaw, pitch, roll and fov in degrees.\n"
+           "                         Give once per camera of the rig.\n"
+           "  -f, --fisheye LENS     The image is a dual-fisheye frame: '(opt=val)(:opt=val)*'\n"
+           "                         with the options fov (degrees), cx0, cy0, cx1,\n"
+           "                         cy1 (lens centers) and radius, all as fractions\n"
+           "                         of the image width (e.g. 'fov=190')\n"
+           "  -w, --warp LENS        Dewarp the image of an arbitrary lens through a\n"
+           "                         lookup table: 'size=WxH(:opt=val)*' with the\n"
+           "                         options fx, fy, cx, cy (pixels), k1-k4 (lens\n"
+           "                         polynomial), fov, yaw, pitch and roll (degrees)\n"
+           "      --lut-size WxH     Size of the warp lookup table (default: %dx%d)\n"
+           "      --v4l2 DEVICE      Display live NV12 frames of a V4L2 capture device\n"
+           "                         of the --size instead of the image\n"
+           "      --ingest SOCKET    Display dma-buf frames another process passes over\n"
+           "                         the Unix socket at SOCKET (see ingest-protocol.h)\n"
+           "      --drm-device DEV   The DRM device to display on: a driver name (e.g.\n"
+           "                         'vkms'), a bus ID or a device node (default: the\n"
+           "                         first device with a connected display)\n"
+           "      --render-node NODE The DRM render node to allocate image buffers on\n"
+           "                         (default: the one of the display device, or the\n"
+           "                         display device itself)\n"
+           "  -m, --mode POLICY      How the display mode is chosen: preferred,\n"
+           "                         largest, max-refresh, WxH[@Hz], or fps=N for the\n"
+           "                         lowest resolution refreshing at least N times a\n"
+           "                         second (default: %s)\n"
+           "      --vrr              Enable variable refresh rate where supported\n"
+           "      --no-pacing        Render right after each flip instead of as late\n"
+           "                         before the next vblank as the frame time allows\n"
+           "      --dynamic-resolution\n"
+           "                         Render the panorama at a lower resolution while\n"
+           "                         the GPU cannot keep up with the display, and scale\n"
+           "                         it up to the output\n"
+           "      --scanout-size WxH Render frames of this size and let the display\n"
+           "                         hardware stretch them to the mode, where it can\n"
+           "                         (default: the mode size)\n"
+           "      --tiled            Stream the image to the GPU in tiles of a mip\n"
+           "                         pyramid as they become visible, for panoramas of\n"
+           "                         any size (implied for tiled panorama files)\n"
+           "      --tile-budget MB   GPU memory for the tiles of --tiled (default: %d)\n"
+           "      --trace FILE       Write the trace events of the run to FILE as a\n"
+           "                         Chrome trace (needs a PANORAMA_TRACING build)\n"
+           "      --trace-marker     Write the trace events to the ftrace marker as\n"
+           "                         they happen (needs a PANORAMA_TRACING build)\n"
+           "      --metrics NAME     Publish live metrics in the shared memory object\n"
+           "                         /NAME, for pano_metrics (see metrics-shm.h)\n"
+           "      --yuv-matrix M     The colors of YUV frames: bt601 or bt709\n"
+           "                         (default: %s)\n"
+           "      --yuv-range R      The value range of YUV frames: limited or full\n"
+           "                         (default: %s)\n"
+           "      --planar-yuv       Sample the Y and UV planes of frames as separate\n"
+           "                         textures, as done when the driver can't import\n"
+           "                         them for samplerExternalOES\n"
+           "      --verify           Compare the first frame of every output with the\n"
+           "                         CPU reference renderer (equirectangular images)\n"
+           "  -d, --debug            Display debug messages\n"
+           "  -h, --help             Display help\n",
+           image.c_str(), width, height, lut_width, lut_height, mode.c_str(),
+           tile_budget, yuv_matrix.c_str(), yuv_range.c_str());
+}
+
+bool Options::parse_args(int argc, char **argv)
+{
+    while (1) {
+        int option_index = -1;
+        int c;
+        const char *optname = "";
+
+        c = getopt_long(argc, argv, "i:s:c:f:w:m:dh",
+                        long_options, &option_index);
+        if (c == -1)
+            break;
+        if (c == ':' || c == '?')
+            return false;
+
+        if (option_index != -1)
+            optname = long_options[option_index].name;
+
+        if (c == 'i' || !strcmp(optname, "image")) {
+            Options::image = optarg;
+        }
+        else if (c == 's' || !strcmp(optname, "size")) {
+            if (!parse_size(optarg, Options::width, Options::height)) {
+                fprintf(stderr, "Invalid size '%s'\n", optarg);
+                return false;
+            }
+        }
+        else if (c == 'c' || !strcmp(optname, "camera")) {
+            Options::cameras.push_back(optarg);
+        }
+        else if (c == 'f' || !strcmp(optname, "fisheye")) {
+            Options::fisheye = optarg;
+        }
+        else if (c == 'w' || !strcmp(optname, "warp")) {
+            Options::warp = optarg;
+        }
+        else if (!strcmp(optname, "lut-size")) {
+            if (!parse_size(optarg, Options::lut_width, Options::lut_height)) {
+                fprintf(stderr, "Invalid lookup table size '%s'\n", optarg);
+                return false;
+            }
+        }
+        else if (!strcmp(optname, "v4l2")) {
+            Options::v4l2 = optarg;
+        }
+        else if (!strcmp(optname, "ingest")) {
+            Options::ingest = optarg;
+        }
+        else if (!strcmp(optname, "drm-device")) {
+            Options::drm_device = optarg;
+        }
+        else if (!strcmp(optname, "render-node")) {
+            Options::render_node = optarg;
+        }
+        else if (c == 'm' || !strcmp(optname, "mode")) {
+            if (!ModePolicy(optarg).valid()) {
+                fprintf(stderr, "Invalid mode policy '%s'\n", optarg);
+                return false;
+            }
+            Options::mode = optarg;
+        }
+        else if (!strcmp(optname, "vrr")) {
+            Options::vrr = true;
+        }
+        else if (!strcmp(optname, "no-pacing")) {
+            Options::pacing = false;
+        }
+        else if (!strcmp(optname, "dynamic-resolution")) {
+            Options::dynamic_resolution = true;
+        }
+        else if (!strcmp(optname, "tiled")) {
+            Options::tiled = true;
+        }
+        else if (!strcmp(optname, "tile-budget")) {
+            Options::tile_budget = Util::fromString<int>(optarg);
+            if (Options::tile_budget <= 0) {
+                fprintf(stderr, "Invalid tile budget '%s'\n", optarg);
+                return false;
+            }
+        }
+        else if (!strcmp(optname, "trace")) {
+            Options::trace = optarg;
+        }
+        else if (!strcmp(optname, "trace-marker")) {
+            Options::trace_marker = true;
+        }
+        else if (!strcmp(optname, "metrics")) {
+            Options::metrics = optarg;
+        }
+        else if (!strcmp(optname, "yuv-matrix")) {
+            if (strcmp(optarg, "bt601") && strcmp(optarg, "bt709")) {
+                fprintf(stderr, "Invalid YUV matrix '%s'\n", optarg);
+                return false;
+            }
+            Options::yuv_matrix = optarg;
+        }
+        else if (!strcmp(optname, "yuv-range")) {
+            if (strcmp(optarg, "limited") && strcmp(optarg, "full")) {
+                fprintf(stderr, "Invalid YUV range '%s'\n", optarg);
+                return false;
+            }
+            Options::yuv_range = optarg;
+        }
+        else if (!strcmp(optname, "planar-yuv")) {
+            Options::planar_yuv = true;
+        }
+        else if (!strcmp(optname, "verify")) {
+            Options::verify = true;
+        }
+        else if (!strcmp(optname, "scanout-size")) {
+            if (!parse_size(optarg, Options::scanout_width, Options::scanout_height)) {
+                fprintf(stderr, "Invalid scanout size '%s'\n", optarg);
+                return false;
+            }
+        }
+        else if (c == 'd' || !strcmp(optname, "debug")) {
+            Options::show_debug = true;
+        }
+        else if (c == 'h' || !strcmp(optname, "help")) {
+            Options::show_help = true;
+        }
+    }
+
+    return true;
+}
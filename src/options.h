@@ -0,0 +1,43 @@
+#ifndef OPTIONS_H_
+#define OPTIONS_H_
+
+#include <string>
+#include <vector>
+
+struct Options {
+    static bool parse_args(int argc, char **argv);
+    static void print_help();
+    static bool parse_size(const std::string &str, int &width, int &height);
+
+    static std::string image;
+    static int width;
+    static int height;
+    static std::vector<std::string> cameras;
+    static std::string fisheye;
+    static std::string warp;
+    static int lut_width;
+    static int lut_height;
+    static std::string v4l2;
+    static std::string ingest;
+    static std::string drm_device;
+    static std::string render_node;
+    static std::string mode;
+    static bool vrr;
+    static bool pacing;
+    static bool dynamic_resolution;
+    static int scanout_width;
+    static int scanout_height;
+    static bool tiled;
+    static int tile_budget;
+    static std::string trace;
+    static bool trace_marker;
+    static std::string metrics;
+    static std::string yuv_matrix;
+    static std::string yuv_range;
+    static bool planar_yuv;
+    static bool verify;
+    static bool show_debug;
+    static bool show_help;
+};
+
+#endif /* OPTIONS_H_ */
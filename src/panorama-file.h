@@ -0,0 +1,77 @@
+#ifndef PANORAMA_FILE_H_
+#define PANORAMA_FILE_H_
+
+#include <stdint.h>
+
+/*
+ * The tiled panorama container.
+ *
+ * A file holds the mip pyramid of a panorama as described by TileSource:
+ * square tiles of tile_size pixels plus tile_border pixels on every side,
+ * level after level. It starts with a pano_header, followed by a
+ * pano_level per level and a pano_tile per tile, all little-endian. The
+ * tiles of a level are indexed row by row, from the level's first_tile
+ * on. Every tile payload starts at a multiple of PANO_ALIGNMENT, so the
+ * file can be mapped as a whole and the pages of a tile are only read
+ * once it is used, with nothing to parse but the index.
+ *
+ * The header checksum covers the header (with the checksum field zeroed),
+ * the level table and the tile index; every tile carries the checksum of
+ * its payload. Both are 64-bit FNV-1a, as computed by Util::hash().
+ *
+ * The structures are used in place in the mapped file: their fields have
+ * fixed widths and natural alignment with explicit reserved padding, so
+ * they have the same layout for every compiler that writes or reads them.
+ */
+
+#define PANO_MAGIC 0x4f4e4150 /* 'PANO' */
+#define PANO_VERSION 1
+
+/* Tile payloads start at multiples of this */
+#define PANO_ALIGNMENT 4096
+
+enum pano_format {
+    /* tile_slot^2 luma bytes, then tile_slot^2 / 2 bytes of interleaved
+     * CbCr at half resolution, where tile_slot = tile_size + 2 * tile_border */
+    PANO_FORMAT_NV12 = 1,
+    /* GL_COMPRESSED_RGB8_ETC2 blocks of the RGB tile */
+    PANO_FORMAT_ETC2_RGB8 = 2,
+    /* GL_COMPRESSED_RGBA_ASTC_4x4_KHR blocks of the RGBA tile */
+    PANO_FORMAT_ASTC_4X4 = 3,
+};
+
+struct pano_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;       /* sizeof(struct pano_header) */
+    uint32_t format;            /* enum pano_format */
+    uint32_t width;             /* of level 0, in pixels */
+    uint32_t height;
+    uint32_t tile_size;
+    uint32_t tile_border;
+    uint32_t levels;
+    uint32_t tiles;             /* entries of the tile index */
+    uint32_t reserved;
+    uint64_t levels_offset;     /* of the level table, from the file start */
+    uint64_t index_offset;      /* of the tile index */
+    uint64_t file_size;
+    uint64_t checksum;
+};
+
+struct pano_level {
+    uint32_t width;             /* in pixels, rounded up */
+    uint32_t height;
+    uint32_t columns;           /* tiles per row */
+    uint32_t rows;
+    uint32_t first_tile;        /* index of the level's tile (0, 0) */
+    uint32_t reserved;
+};
+
+struct pano_tile {
+    uint64_t offset;            /* of the payload, from the file start */
+    uint32_t size;              /* of the payload in bytes */
+    uint32_t reserved;
+    uint64_t checksum;          /* of the payload */
+};
+
+#endif /* PANORAMA_FILE_H_ */
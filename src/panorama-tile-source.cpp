@@ -0,0 +1,169 @@
+#include "panorama-tile-source.h"
+#include "color-convert.h"
+#include "util.h"
+#include "log.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+PanoramaTileSource::PanoramaTileSource(const std::string &path) :
+    path_(path),
+    data_(0),
+    size_(0),
+    header_(0),
+    levels_(0),
+    tiles_(0)
+{
+}
+
+PanoramaTileSource::~PanoramaTileSource()
+{
+    if (data_)
+        munmap(const_cast<uint8_t *>(data_), size_);
+}
+
+bool PanoramaTileSource::probe(const std::string &path)
+{
+    uint32_t magic = 0;
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    bool container = read(fd, &magic, sizeof(magic)) == sizeof(magic) &&
+                     magic == PANO_MAGIC;
+    close(fd);
+
+    return container;
+}
+
+bool PanoramaTileSource::init()
+{
+    struct stat st;
+
+    int fd = open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        Log::error("Open source file '%s' failed\n", path_.c_str());
+        return false;
+    }
+
+    if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(struct pano_header)) {
+        Log::error("'%s' is not a tiled panorama\n", path_.c_str());
+        close(fd);
+        return false;
+    }
+
+    size_t size = st.st_size;
+    void *data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        Log::error("Failed to map '%s'\n", path_.c_str());
+        return false;
+    }
+
+    // Tiles are read in the order they become visible
+    madvise(data, size, MADV_RANDOM);
+
+    data_ = static_cast<const uint8_t *>(data);
+    size_ = size;
+    header_ = reinterpret_cast<const struct pano_header *>(data_);
+
+    if (!validate()) {
+        Log::error("'%s' is not a valid tiled panorama\n", path_.c_str());
+        header_ = 0;
+        return false;
+    }
+
+    Log::debug("Tiled panorama '%s': %ux%u, %u levels, %u tiles\n", path_.c_str(),
+               header_->width, header_->height, header_->levels, header_->tiles);
+
+    return true;
+}
+
+bool PanoramaTileSource::read_tile(unsigned int level, unsigned int x, unsigned int y,
+                                   uint8_t *rgba)
+{
+    if (!header_ || level >= header_->levels ||
+        x >= levels_[level].columns || y >= levels_[level].rows)
+        return false;
+
+    const struct pano_tile &tile = tiles_[levels_[level].first_tile +
+                                          y * levels_[level].columns + x];
+    const uint8_t *payload = data_ + tile.offset;
+
+    if (Util::hash(payload, tile.size) != tile.checksum) {
+        Log::debug("Tile %u,%u of level %u is corrupt\n", x, y, level);
+        return false;
+    }
+
+    nv12_to_rgba(payload, TILE_SLOT, payload + TILE_SLOT * TILE_SLOT, TILE_SLOT,
+                 rgba, TILE_SLOT * 4, TILE_SLOT, TILE_SLOT);
+
+    return true;
+}
+
+/*******************
+ * Private methods *
+ *******************/
+
+/*
+ * Checks that the header describes the pyramid the renderer expects and
+ * that everything it points to lies within the file.
+ */
+bool PanoramaTileSource::validate()
+{
+    const struct pano_header &h = *header_;
+
+    if (h.magic != PANO_MAGIC || h.version != PANO_VERSION ||
+        h.header_size != sizeof(struct pano_header) || h.file_size != size_)
+        return false;
+
+    if (h.format != PANO_FORMAT_NV12) {
+        Log::error("Only NV12 tiles can be streamed\n");
+        return false;
+    }
+
+    if (h.tile_size != TILE_SIZE || h.tile_border != TILE_BORDER ||
+        !h.width || !h.height || h.levels != levels()) {
+        Log::error("The tiles are not laid out as %u pixels with a border of %u\n",
+                   TILE_SIZE, TILE_BORDER);
+        return false;
+    }
+
+    uint64_t levels_size = static_cast<uint64_t>(h.levels) * sizeof(struct pano_level);
+    uint64_t index_size = static_cast<uint64_t>(h.tiles) * sizeof(struct pano_tile);
+    if (h.levels_offset % 8 || h.index_offset % 8 ||
+        h.levels_offset > size_ || levels_size > size_ - h.levels_offset ||
+        h.index_offset > size_ || index_size > size_ - h.index_offset)
+        return false;
+
+    levels_ = reinterpret_cast<const struct pano_level *>(data_ + h.levels_offset);
+    tiles_ = reinterpret_cast<const struct pano_tile *>(data_ + h.index_offset);
+
+    struct pano_header zeroed = h;
+    zeroed.checksum = 0;
+    uint64_t checksum = Util::hash(&zeroed, sizeof(zeroed));
+    checksum = Util::hash(levels_, levels_size, checksum);
+    checksum = Util::hash(tiles_, index_size, checksum);
+    if (checksum != h.checksum)
+        return false;
+
+    const uint32_t tile_bytes = TILE_SLOT * TILE_SLOT * 3 / 2;
+    for (unsigned int l = 0; l < h.levels; l++) {
+        const struct pano_level &level = levels_[l];
+        if (level.columns != columns(l) || level.rows != rows(l) ||
+            static_cast<uint64_t>(level.first_tile) + level.columns * level.rows > h.tiles)
+            return false;
+    }
+
+    for (unsigned int t = 0; t < h.tiles; t++) {
+        const struct pano_tile &tile = tiles_[t];
+        if (tile.offset % PANO_ALIGNMENT || tile.size != tile_bytes ||
+            tile.offset > size_ || tile.size > size_ - tile.offset)
+            return false;
+    }
+
+    return true;
+}
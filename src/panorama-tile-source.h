@@ -0,0 +1,48 @@
+#ifndef PANORAMA_TILE_SOURCE_H_
+#define PANORAMA_TILE_SOURCE_H_
+
+#include "tile-source.h"
+#include "panorama-file.h"
+
+#include <string>
+#include <stddef.h>
+
+/**
+ * Tiles read from a tiled panorama container (see panorama-file.h).
+ *
+ * The file is mapped as a whole; init() only validates the header and
+ * the index, and the payload of a tile is paged in when it is read.
+ * Tiles whose checksum doesn't match are not used.
+ */
+class PanoramaTileSource : public TileSource
+{
+public:
+    PanoramaTileSource(const std::string &path);
+    ~PanoramaTileSource();
+
+    /**
+     * Whether a file is a tiled panorama container.
+     *
+     * @param path the file to check
+     *
+     * @return true if the file starts like a container
+     */
+    static bool probe(const std::string &path);
+
+    bool init();
+    bool read_tile(unsigned int level, unsigned int x, unsigned int y, uint8_t *rgba);
+    unsigned int width() const { return header_ ? header_->width : 0; }
+    unsigned int height() const { return header_ ? header_->height : 0; }
+
+private:
+    bool validate();
+
+    std::string path_;
+    const uint8_t *data_;
+    size_t size_;
+    const struct pano_header *header_;
+    const struct pano_level *levels_;
+    const struct pano_tile *tiles_;
+};
+
+#endif /* PANORAMA_TILE_SOURCE_H_ */
@@ -0,0 +1,208 @@
+#include "program-cache.h"
+#include "gl-state-cache.h"
+#include "log.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <EGL/egl.h>
+
+/* Bump when the layout of the cache files changes */
+#define PROGRAM_CACHE_VERSION 1
+
+struct ProgramCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t format;
+    uint32_t length;
+    uint64_t hash;
+};
+
+static PFNGLGETPROGRAMBINARYOESPROC glGetProgramBinaryOESProc;
+static PFNGLPROGRAMBINARYOESPROC glProgramBinaryOESProc;
+
+static unsigned int loadedPrograms;
+static unsigned int compiledPrograms;
+static double loadedMs;
+static double compiledMs;
+
+/**
+ * Whether program binaries can be used; resolved once per process.
+ */
+static bool program_binary_supported()
+{
+    static int supported = -1;
+
+    if (supported < 0) {
+        GLint formats = 0;
+
+        supported = 0;
+        if (GLExtensions::support("GL_OES_get_program_binary")) {
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &formats);
+            glGetProgramBinaryOESProc =
+                (PFNGLGETPROGRAMBINARYOESPROC)eglGetProcAddress("glGetProgramBinaryOES");
+            glProgramBinaryOESProc =
+                (PFNGLPROGRAMBINARYOESPROC)eglGetProcAddress("glProgramBinaryOES");
+            supported = formats > 0 && glGetProgramBinaryOESProc &&
+                        glProgramBinaryOESProc;
+        }
+
+        Log::debug("Program binary cache %s\n", supported ? "enabled" : "unavailable");
+    }
+
+    return supported;
+}
+
+static uint64_t program_hash(const char *vertexSource, const char *fragmentSource)
+{
+    const char *renderer = reinterpret_cast<const char *>(glGetString(GL_RENDERER));
+    const char *version = reinterpret_cast<const char *>(glGetString(GL_VERSION));
+    uint64_t hash;
+
+    // Hash the terminating zeros too so the strings can't run into each other
+    hash = Util::hash(vertexSource, strlen(vertexSource) + 1);
+    hash = Util::hash(fragmentSource, strlen(fragmentSource) + 1, hash);
+    if (renderer)
+        hash = Util::hash(renderer, strlen(renderer) + 1, hash);
+    if (version)
+        hash = Util::hash(version, strlen(version) + 1, hash);
+
+    return hash;
+}
+
+static std::string program_path(uint64_t hash)
+{
+    char name[64];
+
+    snprintf(name, sizeof(name), "program-%016llx.bin",
+             static_cast<unsigned long long>(hash));
+
+    return Util::cache_path(name);
+}
+
+GLuint ProgramCache::load(const char *vertexSource, const char *fragmentSource)
+{
+    if (!program_binary_supported())
+        return 0;
+
+    uint64_t hash = program_hash(vertexSource, fragmentSource);
+    std::string path(program_path(hash));
+    if (path.empty())
+        return 0;
+
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp)
+        return 0;
+
+    ProgramCacheHeader header;
+    std::vector<char> binary;
+    bool ok = fread(&header, sizeof(header), 1, fp) == 1 &&
+              memcmp(header.magic, "PBIN", 4) == 0 &&
+              header.version == PROGRAM_CACHE_VERSION &&
+              header.hash == hash && header.length > 0;
+
+    if (ok) {
+        binary.resize(header.length);
+        ok = fread(&binary[0], 1, binary.size(), fp) == binary.size();
+    }
+
+    fclose(fp);
+
+    if (!ok)
+        return 0;
+
+    GLuint program = glCreateProgram();
+    GLint linkStatus = GL_FALSE;
+
+    glProgramBinaryOESProc(program, header.format, &binary[0], binary.size());
+    glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
+
+    // The driver may reject binaries of other builds, compile then
+    if (linkStatus != GL_TRUE) {
+        Log::debug("Rejected program binary %s\n", path.c_str());
+        GLStateCache::delete_program(program);
+        remove(path.c_str());
+        return 0;
+    }
+
+    return program;
+}
+
+void ProgramCache::save(GLuint program, const char *vertexSource,
+                        const char *fragmentSource)
+{
+    if (!program_binary_supported())
+        return;
+
+    uint64_t hash = program_hash(vertexSource, fragmentSource);
+    std::string path(program_path(hash));
+    if (path.empty())
+        return;
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+    if (length <= 0)
+        return;
+
+    ProgramCacheHeader header;
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    GLsizei written = 0;
+
+    glGetProgramBinaryOESProc(program, length, &written, &format, &binary[0]);
+    if (written <= 0)
+        return;
+
+    memcpy(header.magic, "PBIN", 4);
+    header.version = PROGRAM_CACHE_VERSION;
+    header.format = format;
+    header.length = written;
+    header.hash = hash;
+
+    // Write to a temporary file first so readers never see a partial binary
+    std::string tmp(path + ".tmp");
+    FILE *fp = fopen(tmp.c_str(), "wb");
+    if (!fp) {
+        Log::debug("Could not write program binary to %s\n", tmp.c_str());
+        return;
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+              fwrite(&binary[0], 1, written, fp) == static_cast<size_t>(written);
+    ok = (fclose(fp) == 0) && ok;
+
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        Log::debug("Could not write program binary to %s\n", path.c_str());
+        remove(tmp.c_str());
+    }
+}
+
+void ProgramCache::account(bool cached, double ms)
+{
+    if (cached) {
+        loadedPrograms++;
+        loadedMs += ms;
+    } else {
+        compiledPrograms++;
+        compiledMs += ms;
+    }
+}
+
+unsigned int ProgramCache::hits()
+{
+    return loadedPrograms;
+}
+
+unsigned int ProgramCache::misses()
+{
+    return compiledPrograms;
+}
+
+void ProgramCache::report()
+{
+    Log::info("Shader programs: %u loaded from cache in %.1f ms, "
+              "%u compiled in %.1f ms\n",
+              loadedPrograms, loadedMs, compiledPrograms, compiledMs);
+}
@@ -0,0 +1,49 @@
+#ifndef PROGRAM_CACHE_H_
+#define PROGRAM_CACHE_H_
+
+#include "gl-headers.h"
+
+/**
+ * On-disk cache of linked shader programs.
+ *
+ * Uses GL_OES_get_program_binary to store the driver's binary of every
+ * linked program in the application cache, keyed by a hash of the shader
+ * sources and the GL_RENDERER and GL_VERSION strings, so a driver update
+ * or a different GPU never picks up a stale binary. Without the extension
+ * every lookup misses and nothing is stored.
+ */
+struct ProgramCache {
+    /**
+     * Creates a program from the binary cached for the shader sources.
+     *
+     * @return the linked program, or 0 if there is no usable binary
+     */
+    static GLuint load(const char *vertexSource, const char *fragmentSource);
+
+    /**
+     * Stores the binary of a freshly linked program.
+     */
+    static void save(GLuint program, const char *vertexSource,
+                     const char *fragmentSource);
+
+    /**
+     * Accounts the time it took to get a program ready.
+     *
+     * @param cached whether the program came from the cache
+     * @param ms the time in milliseconds
+     */
+    static void account(bool cached, double ms);
+
+    /**
+     * Gets how many programs were loaded from the cache and compiled.
+     */
+    static unsigned int hits();
+    static unsigned int misses();
+
+    /**
+     * Logs how many programs were loaded and compiled, and how long it took.
+     */
+    static void report();
+};
+
+#endif /* PROGRAM_CACHE_H_ */
@@ -0,0 +1,210 @@
+#include "reference-renderer.h"
+#include "color-convert.h"
+#include "util.h"
+
+#include <math.h>
+
+#define PI (3.14159265f)
+
+/* Output pixels per side of the tiles that are rendered in one go */
+#define RENDER_TILE 32
+
+/*
+ * The rows of a camera matrix that give a position on the sphere its
+ * place on the output. The vertex shader divides by the depth rather than
+ * by w (gl_Position.xyzz), so x, y and the depth are all that matter.
+ */
+struct ReferenceRenderer::Projection
+{
+    float row[3][3];
+    float offset[3];
+    int width;
+    int height;
+};
+
+static void cross(const float *a, const float *b, float *out)
+{
+    out[0] = a[1] * b[2] - a[2] * b[1];
+    out[1] = a[2] * b[0] - a[0] * b[2];
+    out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+static float dot(const float *a, const float *b)
+{
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+/*
+ * Finds the texture coordinates of the point of the unit sphere that lands
+ * on (@x, @y) in normalized device coordinates, or returns false if no
+ * point in front of the camera does.
+ *
+ * The points that land there lie on the line where the planes
+ * (row0 - x * row2) . p = x * offset2 - offset0 and the same for y meet;
+ * it meets the sphere twice, once behind the camera.
+ */
+static bool sphere_coords(const float (*row)[3], const float *offset, float x, float y,
+                          float *u, float *v)
+{
+    float a[3], b[3], line[3], ab[3], bl[3], la[3], p[3];
+
+    for (int i = 0; i < 3; i++) {
+        a[i] = row[0][i] - x * row[2][i];
+        b[i] = row[1][i] - y * row[2][i];
+    }
+    float da = x * offset[2] - offset[0];
+    float db = y * offset[2] - offset[1];
+
+    cross(a, b, line);
+    float length2 = dot(line, line);
+    if (length2 <= 0.0f)
+        return false;
+
+    // The point of the line closest to the origin, and its unit direction
+    cross(b, line, bl);
+    cross(line, a, la);
+    float scale = 1.0f / sqrtf(length2);
+    for (int i = 0; i < 3; i++) {
+        ab[i] = (da * bl[i] + db * la[i]) / length2;
+        line[i] *= scale;
+    }
+
+    float k = dot(ab, line);
+    float disc = k * k - (dot(ab, ab) - 1.0f);
+    if (disc < 0.0f)
+        return false;
+
+    float root = sqrtf(disc);
+    for (int side = 0; side < 2; side++) {
+        float s = side ? -k - root : -k + root;
+
+        for (int i = 0; i < 3; i++)
+            p[i] = ab[i] + s * line[i];
+        if (dot(row[2], p) + offset[2] > 0.0f)
+            break;
+        if (side)
+            return false;
+    }
+
+    // Inverse of the texture coordinates egl_general_sphere() gives
+    // the vertex (sin(t) cos(f), cos(t), sin(t) sin(f))
+    float f = atan2f(p[2], p[0]) / (2.0f * PI);
+    *u = f < 0.0f ? f + 1.0f : f;
+    *v = acosf(p[1] < -1.0f ? -1.0f : (p[1] > 1.0f ? 1.0f : p[1])) / PI;
+
+    return true;
+}
+
+void ReferenceRenderer::render(const float *mvp, int width, int height, uint8_t *rgba) const
+{
+    Projection projection;
+
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 3; c++)
+            projection.row[r][c] = mvp[c * 4 + r];
+        projection.offset[r] = mvp[12 + r];
+    }
+    projection.width = width;
+    projection.height = height;
+
+    unsigned int columns = (width + RENDER_TILE - 1) / RENDER_TILE;
+    unsigned int rows = (height + RENDER_TILE - 1) / RENDER_TILE;
+
+    Util::parallel_for(columns * rows, [&](unsigned int begin, unsigned int end) {
+        for (unsigned int tile = begin; tile < end; tile++) {
+            int left = (tile % columns) * RENDER_TILE;
+            int top = (tile / columns) * RENDER_TILE;
+            int count = width - left < RENDER_TILE ? width - left : RENDER_TILE;
+
+            for (int row = top; row < top + RENDER_TILE && row < height; row++) {
+                render_row(projection, row, left, count,
+                           rgba + (static_cast<size_t>(row) * width + left) * 4);
+            }
+        }
+    });
+}
+
+void ReferenceRenderer::pixel(const float *mvp, int width, int height, int x, int y,
+                              uint8_t *rgba) const
+{
+    Projection projection;
+
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 3; c++)
+            projection.row[r][c] = mvp[c * 4 + r];
+        projection.offset[r] = mvp[12 + r];
+    }
+    projection.width = width;
+    projection.height = height;
+
+    render_row(projection, height - 1 - y, x, 1, rgba);
+}
+
+/*******************
+ * Private methods *
+ *******************/
+
+/* Samples the image at texture coordinates, as GL_LINEAR with clamped edges does */
+void ReferenceRenderer::sample(float u, float v, uint8_t *rgba) const
+{
+    float tx = u * width_ - 0.5f;
+    float ty = v * height_ - 0.5f;
+    float x0f = floorf(tx);
+    float y0f = floorf(ty);
+    float fx = tx - x0f;
+    float fy = ty - y0f;
+    int xs[2] = { static_cast<int>(x0f), static_cast<int>(x0f) + 1 };
+    int ys[2] = { static_cast<int>(y0f), static_cast<int>(y0f) + 1 };
+    uint8_t texels[2][2][4];
+
+    for (int i = 0; i < 2; i++) {
+        xs[i] = xs[i] < 0 ? 0 : (xs[i] >= width_ ? width_ - 1 : xs[i]);
+        ys[i] = ys[i] < 0 ? 0 : (ys[i] >= height_ ? height_ - 1 : ys[i]);
+    }
+
+    for (int j = 0; j < 2; j++) {
+        const uint8_t *luma = y_ + static_cast<size_t>(ys[j]) * y_stride_;
+        const uint8_t *chroma = uv_ + static_cast<size_t>(ys[j] / 2) * uv_stride_;
+
+        for (int i = 0; i < 2; i++)
+            yuv_to_rgba(luma[xs[i]], chroma[xs[i] & ~1], chroma[xs[i] | 1], texels[j][i]);
+    }
+
+    for (int c = 0; c < 4; c++) {
+        float top = texels[0][0][c] + (texels[0][1][c] - texels[0][0][c]) * fx;
+        float bottom = texels[1][0][c] + (texels[1][1][c] - texels[1][0][c]) * fx;
+
+        rgba[c] = static_cast<uint8_t>(top + (bottom - top) * fy + 0.5f);
+    }
+}
+
+/*
+ * Renders @count pixels of a row of the output from column @first. The
+ * coordinates of all pixels are found before any is sampled, which keeps
+ * the arithmetic and the memory accesses in separate loops.
+ */
+void ReferenceRenderer::render_row(const Projection &projection, int row, int first,
+                                   int count, uint8_t *rgba) const
+{
+    float us[RENDER_TILE];
+    float vs[RENDER_TILE];
+    bool hits[RENDER_TILE];
+    float y = 1.0f - 2.0f * (row + 0.5f) / projection.height;
+
+    for (int i = 0; i < count; i++) {
+        float x = 2.0f * (first + i + 0.5f) / projection.width - 1.0f;
+        hits[i] = sphere_coords(projection.row, projection.offset, x, y, &us[i], &vs[i]);
+    }
+
+    for (int i = 0; i < count; i++) {
+        uint8_t *out = rgba + i * 4;
+
+        if (hits[i]) {
+            sample(us[i], vs[i], out);
+        } else {
+            // The clear color of the canvas
+            out[0] = out[1] = out[2] = 0;
+            out[3] = 255;
+        }
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef REFERENCE_RENDERER_H_
+#define REFERENCE_RENDERER_H_
+
+#include <stdint.h>
+
+/**
+ * Draws the view of egl_draw_texture() on the CPU.
+ *
+ * For every pixel of the output the renderer inverts the projection of the
+ * camera, finds where the line of sight meets the panorama sphere and
+ * samples the NV12 image there bilinearly, with the edges clamped as for
+ * the external texture. Outputs are rendered in tiles on all CPUs.
+ *
+ * Without a GPU it renders thumbnails and dewarps views in batches; with
+ * one it tells what CanvasGeneric::read_pixel() should see. The GPU draws
+ * the sphere as flat triangles in mediump precision, so its pixels are a
+ * few levels off, mostly near the poles.
+ */
+class ReferenceRenderer
+{
+public:
+    /**
+     * Creates a renderer of an NV12 image, which must outlive it.
+     *
+     * @param y the luma plane
+     * @param y_stride the bytes between two rows of the luma plane
+     * @param uv the interleaved chroma plane at half resolution
+     * @param uv_stride the bytes between two rows of the chroma plane
+     * @param width the width of the image in pixels
+     * @param height the height of the image in pixels
+     */
+    ReferenceRenderer(const uint8_t *y, int y_stride, const uint8_t *uv, int uv_stride,
+                      int width, int height) :
+        y_(y), uv_(uv), y_stride_(y_stride), uv_stride_(uv_stride),
+        width_(width), height_(height) {}
+
+    /**
+     * Renders the view of a camera.
+     *
+     * @param mvp the 16 element column-major matrix of Camera::mvp()
+     * @param width the width of the output in pixels
+     * @param height the height of the output in pixels
+     * @param rgba the output to fill, width * 4 bytes per row with the top
+     *             row first
+     */
+    void render(const float *mvp, int width, int height, uint8_t *rgba) const;
+
+    /**
+     * Renders a single pixel of the view of a camera.
+     *
+     * @param mvp the 16 element column-major matrix of Camera::mvp()
+     * @param width the width of the output in pixels
+     * @param height the height of the output in pixels
+     * @param x the column of the pixel
+     * @param y the row of the pixel, counted from the bottom as for
+     *          CanvasGeneric::read_pixel()
+     * @param rgba the four bytes to fill
+     */
+    void pixel(const float *mvp, int width, int height, int x, int y, uint8_t *rgba) const;
+
+private:
+    struct Projection;
+
+    void sample(float u, float v, uint8_t *rgba) const;
+    void render_row(const Projection &projection, int row, int first, int count,
+                    uint8_t *rgba) const;
+
+    const uint8_t *y_;
+    const uint8_t *uv_;
+    int y_stride_;
+    int uv_stride_;
+    int width_;
+    int height_;
+};
+
+#endif /* REFERENCE_RENDERER_H_ */
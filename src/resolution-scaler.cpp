@@ -0,0 +1,42 @@
+#include "resolution-scaler.h"
+
+#include <cmath>
+
+/* Frames under this fraction of the budget let the scale grow */
+static const double GROW_THRESHOLD = 0.8;
+/* Dropping aims this far below the budget to leave headroom */
+static const double DROP_MARGIN = 0.9;
+/* Share of the way to the ideal scale taken per fast frame */
+static const double GROW_RATE = 0.1;
+
+ResolutionScaler::ResolutionScaler(float min_scale, float max_scale) :
+    min_scale_(min_scale),
+    max_scale_(max_scale),
+    scale_(max_scale)
+{
+}
+
+void ResolutionScaler::frame_time(double time, float scale, double budget)
+{
+    if (time <= 0.0 || budget <= 0.0)
+        return;
+
+    /* the scale at which the frame would have just fit the budget */
+    double ideal = scale * std::sqrt(budget / time);
+
+    if (time > budget) {
+        /* an earlier drop may already have gone further */
+        double drop = ideal * std::sqrt(DROP_MARGIN);
+        if (drop < scale_)
+            scale_ = drop;
+    } else if (time < budget * GROW_THRESHOLD) {
+        double grow = ideal * std::sqrt(GROW_THRESHOLD);
+        if (grow > scale_)
+            scale_ += (grow - scale_) * GROW_RATE;
+    }
+
+    if (scale_ < min_scale_)
+        scale_ = min_scale_;
+    else if (scale_ > max_scale_)
+        scale_ = max_scale_;
+}
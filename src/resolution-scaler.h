@@ -0,0 +1,35 @@
+#ifndef RESOLUTION_SCALER_H_
+#define RESOLUTION_SCALER_H_
+
+/**
+ * Chooses the resolution an output renders at from its GPU frame times.
+ *
+ * The scale applies to both dimensions, so the pixel count and roughly the
+ * fragment work go with its square. A frame over the budget drops the scale
+ * at once to where the next frame should fit, while frames well under it
+ * raise the scale slowly, so it does not oscillate around the budget.
+ */
+class ResolutionScaler
+{
+public:
+    ResolutionScaler(float min_scale = 0.5f, float max_scale = 1.0f);
+
+    /**
+     * Records the GPU time of a frame. GPU times arrive a few frames late,
+     * so the frame may have been rendered at an earlier scale.
+     *
+     * @param time the GPU time of the frame in seconds
+     * @param scale the scale the frame was rendered at
+     * @param budget the GPU time a frame may take in seconds
+     */
+    void frame_time(double time, float scale, double budget);
+
+    float scale() const { return scale_; }
+
+private:
+    float min_scale_;
+    float max_scale_;
+    float scale_;
+};
+
+#endif /* RESOLUTION_SCALER_H_ */
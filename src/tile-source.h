@@ -0,0 +1,83 @@
+#ifndef TILE_SOURCE_H_
+#define TILE_SOURCE_H_
+
+#include <stdint.h>
+
+/**
+ * A panorama split into a mip pyramid of square tiles.
+ *
+ * Level 0 is the full resolution image, and every following level halves
+ * both dimensions, up to the first level that fits a single tile. Level L
+ * is treated as exactly (width / 2^L) x (height / 2^L) pixels, so tile
+ * (x, y) of level L covers the level 0 tiles (x << L, y << L) up to
+ * ((x + 1) << L, (y + 1) << L) and the tile grid of each level follows
+ * from that of level 0 by shifting.
+ *
+ * Tiles are RGBA8 with a border of TILE_BORDER pixels copied from their
+ * neighbours, so they can be filtered bilinearly right up to their edges.
+ * The image wraps around horizontally, like an equirectangular panorama
+ * does, and is clamped vertically.
+ */
+class TileSource
+{
+public:
+    /* Image pixels per tile side, and the size of a tile with its border */
+    static const unsigned int TILE_SIZE = 254;
+    static const unsigned int TILE_BORDER = 1;
+    static const unsigned int TILE_SLOT = TILE_SIZE + 2 * TILE_BORDER;
+
+    virtual ~TileSource() {}
+
+    /**
+     * Opens the image.
+     *
+     * @return whether the tiles can be read
+     */
+    virtual bool init() = 0;
+
+    /**
+     * Reads a tile.
+     *
+     * This is called from a background thread, and has to be safe to call
+     * concurrently with itself.
+     *
+     * @param level the pyramid level
+     * @param x the column of the tile in its level
+     * @param y the row of the tile in its level
+     * @param rgba TILE_SLOT x TILE_SLOT pixels to fill
+     *
+     * @return whether the tile could be read
+     */
+    virtual bool read_tile(unsigned int level, unsigned int x, unsigned int y,
+                           uint8_t *rgba) = 0;
+
+    /* Size of level 0 in pixels */
+    virtual unsigned int width() const = 0;
+    virtual unsigned int height() const = 0;
+
+    /**
+     * Gets the number of levels of the pyramid.
+     */
+    unsigned int levels() const
+    {
+        unsigned int levels = 1;
+
+        while ((width() >> (levels - 1)) > TILE_SIZE ||
+               (height() >> (levels - 1)) > TILE_SIZE)
+            levels++;
+
+        return levels;
+    }
+
+    /* Number of tile columns and rows of a level */
+    unsigned int columns(unsigned int level) const
+    {
+        return (((width() + TILE_SIZE - 1) / TILE_SIZE) + (1 << level) - 1) >> level;
+    }
+    unsigned int rows(unsigned int level) const
+    {
+        return (((height() + TILE_SIZE - 1) / TILE_SIZE) + (1 << level) - 1) >> level;
+    }
+};
+
+#endif /* TILE_SOURCE_H_ */
@@ -0,0 +1,192 @@
+#include "trace.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+/* Events a thread can record before further ones are dropped */
+#define TRACE_EVENTS_PER_THREAD 65536
+
+std::atomic<bool> Trace::enabled_(false);
+
+struct TraceEvent
+{
+    const char *name;
+    uint64_t begin;
+    uint64_t end;
+};
+
+/*
+ * The events of one thread. Only the thread appends to it; the count is
+ * published after the event so finish() can read it at any time.
+ */
+struct TraceBuffer
+{
+    pid_t tid;
+    std::atomic<unsigned int> count;
+    std::atomic<unsigned int> dropped;
+    TraceEvent events[TRACE_EVENTS_PER_THREAD];
+};
+
+static std::string trace_path;
+static int marker_fd = -1;
+static std::mutex buffers_mutex;
+static std::vector<TraceBuffer *> buffers;
+static thread_local TraceBuffer *local_buffer = 0;
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * Writes the atrace style "B|pid|name" and "E|pid" lines that Perfetto
+ * and systrace turn into slices. A lost marker only costs a slice.
+ */
+static void marker_write(const char *buf, int len)
+{
+    ssize_t written = write(marker_fd, buf, len);
+    static_cast<void>(written);
+}
+
+/* The buffer of the calling thread, registered on its first event */
+static TraceBuffer *thread_buffer()
+{
+    if (!local_buffer) {
+        local_buffer = new TraceBuffer();
+        local_buffer->tid = syscall(SYS_gettid);
+        local_buffer->count = 0;
+        local_buffer->dropped = 0;
+
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        buffers.push_back(local_buffer);
+    }
+
+    return local_buffer;
+}
+
+bool Trace::init(const std::string &path, bool marker)
+{
+#ifndef PANORAMA_TRACING
+    static_cast<void>(path);
+    static_cast<void>(marker);
+    Log::error("Tracing needs a build configured with -DPANORAMA_TRACING=ON\n");
+    return false;
+#else
+    if (marker) {
+        static const char *markers[] = {
+            "/sys/kernel/tracing/trace_marker",
+            "/sys/kernel/debug/tracing/trace_marker",
+        };
+        for (unsigned int i = 0; i < 2 && marker_fd < 0; i++)
+            marker_fd = open(markers[i], O_WRONLY | O_CLOEXEC);
+        if (marker_fd < 0) {
+            Log::error("Could not open the ftrace marker, is tracefs mounted?\n");
+            return false;
+        }
+    }
+
+    trace_path = path;
+    enabled_ = true;
+    atexit(finish);
+
+    return true;
+#endif
+}
+
+void Trace::finish()
+{
+    if (!enabled_.exchange(false))
+        return;
+
+    // The marker stays open, other threads may still be leaving a scope
+    if (trace_path.empty())
+        return;
+
+    FILE *fp = fopen(trace_path.c_str(), "w");
+    if (!fp) {
+        Log::error("Failed to write the trace to '%s'\n", trace_path.c_str());
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    pid_t pid = getpid();
+    unsigned int events = 0;
+    unsigned int dropped = 0;
+    const char *separator = "";
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (unsigned int b = 0; b < buffers.size(); b++) {
+        const TraceBuffer *buffer = buffers[b];
+        unsigned int count = buffer->count.load(std::memory_order_acquire);
+
+        for (unsigned int e = 0; e < count; e++) {
+            const TraceEvent &event = buffer->events[e];
+            fprintf(fp, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                    "\"pid\":%d,\"tid\":%d}", separator, event.name, event.begin / 1000.0,
+                    (event.end - event.begin) / 1000.0, pid, buffer->tid);
+            separator = ",";
+        }
+        events += count;
+        dropped += buffer->dropped.load(std::memory_order_relaxed);
+    }
+    fprintf(fp, "\n]}\n");
+
+    if (fclose(fp) != 0)
+        Log::error("Failed to write the trace to '%s'\n", trace_path.c_str());
+    else
+        Log::info("Wrote %u trace events to '%s'\n", events, trace_path.c_str());
+
+    if (dropped)
+        Log::info("%u trace events did not fit into the buffers\n", dropped);
+}
+
+/*******************
+ * Private methods *
+ *******************/
+
+uint64_t Trace::begin(const char *name)
+{
+    if (marker_fd >= 0) {
+        char buf[128];
+        int len = snprintf(buf, sizeof(buf), "B|%d|%s", getpid(), name);
+        marker_write(buf, len);
+    }
+
+    return now_ns();
+}
+
+void Trace::end(const char *name, uint64_t begin)
+{
+    uint64_t end = now_ns();
+
+    if (marker_fd >= 0) {
+        char buf[32];
+        int len = snprintf(buf, sizeof(buf), "E|%d", getpid());
+        marker_write(buf, len);
+    }
+
+    TraceBuffer *buffer = thread_buffer();
+    unsigned int count = buffer->count.load(std::memory_order_relaxed);
+    if (count >= TRACE_EVENTS_PER_THREAD) {
+        buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    TraceEvent &event = buffer->events[count];
+    event.name = name;
+    event.begin = begin;
+    event.end = end;
+    buffer->count.store(count + 1, std::memory_order_release);
+}
@@ -0,0 +1,80 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <string>
+#include <atomic>
+#include <stdint.h>
+
+/*
+ * Scoped trace events for profiling with Perfetto, chrome://tracing or
+ * the kernel's ftrace.
+ *
+ * TRACE_SCOPE("name") records an event from where it is declared to the
+ * end of the enclosing scope. The name must be a string literal. Events
+ * go into a buffer of the emitting thread, without locks, and are written
+ * as Chrome trace JSON when the program exits. With trace_marker output
+ * the begin and end of every event are also written to the ftrace marker
+ * as they happen, so they line up with the DRM vblank and dma-fence
+ * tracepoints of the same trace.
+ *
+ * Trace points only exist in builds configured with -DPANORAMA_TRACING=ON;
+ * otherwise TRACE_SCOPE() compiles to nothing.
+ */
+class Trace
+{
+public:
+    /**
+     * Starts recording events.
+     *
+     * @param path the file to write the Chrome trace to at exit, or empty
+     * @param marker whether to write the events to the ftrace marker live
+     *
+     * @return whether tracing could be started
+     */
+    static bool init(const std::string &path, bool marker);
+
+    /**
+     * Stops recording and writes the recorded events. Called at exit.
+     */
+    static void finish();
+
+    /**
+     * An event that lasts as long as the object.
+     */
+    class Scope
+    {
+    public:
+        Scope(const char *name) :
+            name_(enabled_.load(std::memory_order_relaxed) ? name : 0), begin_(0)
+        {
+            if (name_)
+                begin_ = Trace::begin(name_);
+        }
+        ~Scope()
+        {
+            if (name_)
+                Trace::end(name_, begin_);
+        }
+
+    private:
+        const char *name_;
+        uint64_t begin_;
+    };
+
+private:
+    static uint64_t begin(const char *name);
+    static void end(const char *name, uint64_t begin);
+
+    // Whether events are recorded, read by every trace point
+    static std::atomic<bool> enabled_;
+};
+
+#ifdef PANORAMA_TRACING
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) Trace::Scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#else
+#define TRACE_SCOPE(name) do {} while (0)
+#endif
+
+#endif /* TRACE_H_ */
@@ -1,6 +1,11 @@
 #include <sstream>
 #include <fstream>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+#include <cerrno>
 #include <sys/time.h>
+#include <sys/stat.h>
 #include <dirent.h>
 
 #include "log.h"
@@ -163,3 +168,78 @@ void Util::split(const string& src, char delim, vector<string>& elementVec,
         break;
     }
 }
+
+void Util::parallel_for(unsigned int count,
+                        const std::function<void(unsigned int, unsigned int)> &func)
+{
+    unsigned int nthreads = std::thread::hardware_concurrency();
+
+    if (nthreads == 0)
+        nthreads = 1;
+    if (nthreads > count)
+        nthreads = count;
+
+    if (nthreads <= 1) {
+        if (count)
+            func(0, count);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    unsigned int chunk = (count + nthreads - 1) / nthreads;
+
+    // The calling thread takes the first sub-range itself
+    for (unsigned int begin = chunk; begin < count; begin += chunk) {
+        unsigned int end = begin + chunk < count ? begin + chunk : count;
+        threads.push_back(std::thread(func, begin, end));
+    }
+    func(0, chunk);
+
+    for (std::vector<std::thread>::iterator iter = threads.begin();
+         iter != threads.end();
+         iter++)
+        iter->join();
+}
+
+static bool make_dir(const string &path)
+{
+    return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+string Util::cache_path(const string &name)
+{
+    string dir;
+    const char *xdg_cache = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+
+    if (xdg_cache && xdg_cache[0])
+        dir = xdg_cache;
+    else if (home && home[0])
+        dir = string(home) + "/.cache";
+    else
+        return string();
+
+    if (!make_dir(dir))
+        return string();
+
+    dir += "/panoram_image";
+    if (!make_dir(dir)) {
+        Log::debug("Could not create cache directory %s\n", dir.c_str());
+        return string();
+    }
+
+    return dir + "/" + name;
+}
+
+uint64_t Util::hash(const void *data, size_t size, uint64_t seed)
+{
+    const unsigned char *bytes = static_cast<const unsigned char*>(data);
+    uint64_t h = seed;
+
+    for (size_t i = 0; i < size; i++) {
+        h ^= bytes[i];
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
@@ -5,7 +5,9 @@
 #include <vector>
 #include <istream>
 #include <sstream>
+#include <functional>
 #include <stdint.h>
+#include <stddef.h>
 
 struct Util {
 
@@ -38,6 +40,39 @@ struct Util {
                       std::vector<std::string>& elems,
                       Util::SplitMode mode);
 
+    /**
+     * parallel_for() - Runs a function over a range split across threads
+     *
+     * @count:      the number of items in the range
+     * @func:       called as func(begin, end) for each sub-range
+     *
+     * Splits [0, @count) into one consecutive sub-range per available CPU
+     * and processes them concurrently. Returns when all sub-ranges are done.
+     */
+    static void parallel_for(unsigned int count,
+                             const std::function<void(unsigned int, unsigned int)> &func);
+
+    /**
+     * cache_path() - Gets the path of a file in the application cache
+     *
+     * @name:       the name of the file inside the cache directory
+     *
+     * The cache lives in $XDG_CACHE_HOME/panoram_image, falling back to
+     * $HOME/.cache/panoram_image, and is created as needed. Returns an
+     * empty string if no cache directory is available.
+     */
+    static std::string cache_path(const std::string &name);
+
+    /**
+     * hash() - Computes the 64-bit FNV-1a hash of a block of memory
+     *
+     * @data:       the memory to hash
+     * @size:       the size of the memory in bytes
+     * @seed:       the hash to continue from, for hashing several blocks
+     */
+    static uint64_t hash(const void *data, size_t size,
+                         uint64_t seed = 14695981039346656037ULL);
+
     /**
      * toString() - Converts a string to a plain-old-data type.
      *
@@ -0,0 +1,294 @@
+#include "v4l2-source.h"
+#include "log.h"
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+/* Number of capture buffers; one on screen, one being sampled, the rest queued */
+#define V4L2_SOURCE_BUFFERS 4
+
+static int xioctl(int fd, unsigned long request, void *arg)
+{
+    int ret;
+
+    do {
+        ret = ioctl(fd, request, arg);
+    } while (ret < 0 && errno == EINTR);
+
+    return ret;
+}
+
+V4L2Source::~V4L2Source()
+{
+    if (streaming_) {
+        int type = type_;
+        xioctl(fd_, VIDIOC_STREAMOFF, &type);
+    }
+
+    // The exported dma-bufs are closed with the buffers
+    buffers_.clear();
+
+    if (fd_ >= 0) {
+        struct v4l2_requestbuffers req;
+        memset(&req, 0, sizeof(req));
+        req.count = 0;
+        req.type = type_;
+        req.memory = V4L2_MEMORY_MMAP;
+        xioctl(fd_, VIDIOC_REQBUFS, &req);
+
+        close(fd_);
+    }
+}
+
+bool V4L2Source::init()
+{
+    struct v4l2_capability cap;
+
+    fd_ = open(device_.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd_ < 0) {
+        Log::error("Failed to open V4L2 device %s: %s\n",
+                   device_.c_str(), strerror(errno));
+        return false;
+    }
+
+    memset(&cap, 0, sizeof(cap));
+    if (xioctl(fd_, VIDIOC_QUERYCAP, &cap) < 0) {
+        Log::error("%s is not a V4L2 device\n", device_.c_str());
+        return false;
+    }
+
+    uint32_t caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ?
+                    cap.device_caps : cap.capabilities;
+    if (caps & V4L2_CAP_VIDEO_CAPTURE_MPLANE) {
+        type_ = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    } else if (caps & V4L2_CAP_VIDEO_CAPTURE) {
+        type_ = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    } else {
+        Log::error("%s can't capture video\n", device_.c_str());
+        return false;
+    }
+
+    if (!(caps & V4L2_CAP_STREAMING)) {
+        Log::error("%s doesn't support streaming I/O\n", device_.c_str());
+        return false;
+    }
+
+    if (!set_format() || !request_buffers())
+        return false;
+
+    for (unsigned int i = 0; i < buffers_.size(); i++) {
+        if (!queue(i))
+            return false;
+    }
+
+    int type = type_;
+    if (xioctl(fd_, VIDIOC_STREAMON, &type) < 0) {
+        Log::error("Failed to start streaming on %s: %s\n",
+                   device_.c_str(), strerror(errno));
+        return false;
+    }
+    streaming_ = true;
+
+    Log::debug("Capturing %dx%d NV12 from %s (%s) into %u dma-bufs\n",
+               width_, height_, device_.c_str(), cap.card, buffers_.size());
+
+    return true;
+}
+
+int V4L2Source::fd()
+{
+    return fd_;
+}
+
+int V4L2Source::acquire()
+{
+    int newest = -1;
+    int index;
+
+    // Only the newest frame is of interest, recycle the others right away
+    while ((index = dequeue()) >= 0) {
+        if (newest >= 0)
+            queue(newest);
+        newest = index;
+    }
+
+    return newest;
+}
+
+void V4L2Source::release(int index)
+{
+    queue(index);
+}
+
+unsigned int V4L2Source::buffers()
+{
+    return buffers_.size();
+}
+
+DmaBuffer *V4L2Source::buffer(int index)
+{
+    return &buffers_[index];
+}
+
+unsigned int V4L2Source::generation(int index)
+{
+    return generations_[index];
+}
+
+/*******************
+ * Private methods *
+ *******************/
+
+bool V4L2Source::set_format()
+{
+    struct v4l2_format fmt;
+
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = type_;
+
+    if (type_ == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        fmt.fmt.pix_mp.width = width_;
+        fmt.fmt.pix_mp.height = height_;
+        fmt.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_NV12;
+        fmt.fmt.pix_mp.field = V4L2_FIELD_NONE;
+        fmt.fmt.pix_mp.num_planes = 1;
+    } else {
+        fmt.fmt.pix.width = width_;
+        fmt.fmt.pix.height = height_;
+        fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_NV12;
+        fmt.fmt.pix.field = V4L2_FIELD_NONE;
+    }
+
+    if (xioctl(fd_, VIDIOC_S_FMT, &fmt) < 0) {
+        Log::error("Failed to set the capture format: %s\n", strerror(errno));
+        return false;
+    }
+
+    // The driver may have adjusted the request
+    if (type_ == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        if (fmt.fmt.pix_mp.pixelformat != V4L2_PIX_FMT_NV12 ||
+            fmt.fmt.pix_mp.num_planes != 1) {
+            Log::error("%s doesn't capture contiguous NV12\n", device_.c_str());
+            return false;
+        }
+        width_ = fmt.fmt.pix_mp.width;
+        height_ = fmt.fmt.pix_mp.height;
+        stride_ = fmt.fmt.pix_mp.plane_fmt[0].bytesperline;
+    } else {
+        if (fmt.fmt.pix.pixelformat != V4L2_PIX_FMT_NV12) {
+            Log::error("%s doesn't capture NV12\n", device_.c_str());
+            return false;
+        }
+        width_ = fmt.fmt.pix.width;
+        height_ = fmt.fmt.pix.height;
+        stride_ = fmt.fmt.pix.bytesperline;
+    }
+
+    if (!stride_)
+        stride_ = width_;
+
+    return true;
+}
+
+bool V4L2Source::request_buffers()
+{
+    struct v4l2_requestbuffers req;
+
+    memset(&req, 0, sizeof(req));
+    req.count = V4L2_SOURCE_BUFFERS;
+    req.type = type_;
+    req.memory = V4L2_MEMORY_MMAP;
+
+    if (xioctl(fd_, VIDIOC_REQBUFS, &req) < 0 || req.count < 2) {
+        Log::error("Failed to allocate capture buffers on %s\n", device_.c_str());
+        return false;
+    }
+
+    buffers_.resize(req.count);
+    generations_.assign(req.count, 0);
+
+    for (unsigned int i = 0; i < req.count; i++) {
+        struct v4l2_exportbuffer expbuf;
+        DmaBuffer &buffer = buffers_[i];
+
+        buffer = DmaBuffer();
+        buffer.width = width_;
+        buffer.height = height_;
+        buffer.stride = stride_;
+
+        memset(&expbuf, 0, sizeof(expbuf));
+        expbuf.type = type_;
+        expbuf.index = i;
+        expbuf.plane = 0;
+        expbuf.flags = O_RDONLY | O_CLOEXEC;
+
+        if (xioctl(fd_, VIDIOC_EXPBUF, &expbuf) < 0) {
+            Log::error("Failed to export capture buffer %u as dma-buf: %s\n",
+                       i, strerror(errno));
+            return false;
+        }
+
+        buffer.owned_fd.reset(expbuf.fd);
+        buffer.dma_fd = expbuf.fd;
+    }
+
+    return true;
+}
+
+bool V4L2Source::queue(int index)
+{
+    struct v4l2_buffer buf;
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+
+    memset(&buf, 0, sizeof(buf));
+    memset(planes, 0, sizeof(planes));
+    buf.type = type_;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+    if (type_ == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        buf.m.planes = planes;
+        buf.length = 1;
+    }
+
+    if (xioctl(fd_, VIDIOC_QBUF, &buf) < 0) {
+        Log::error("Failed to queue capture buffer %d: %s\n",
+                   index, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+int V4L2Source::dequeue()
+{
+    struct v4l2_buffer buf;
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+
+    memset(&buf, 0, sizeof(buf));
+    memset(planes, 0, sizeof(planes));
+    buf.type = type_;
+    buf.memory = V4L2_MEMORY_MMAP;
+    if (type_ == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        buf.m.planes = planes;
+        buf.length = VIDEO_MAX_PLANES;
+    }
+
+    if (xioctl(fd_, VIDIOC_DQBUF, &buf) < 0) {
+        if (errno != EAGAIN)
+            Log::debug("Failed to dequeue a capture buffer: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // The payload may start at an offset into the exported buffer. The
+    // image imported at the old offset is stale when it moves.
+    if (type_ == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE &&
+        buffers_[buf.index].offset != planes[0].data_offset) {
+        buffers_[buf.index].offset = planes[0].data_offset;
+        generations_[buf.index]++;
+    }
+
+    return buf.index;
+}
@@ -0,0 +1,51 @@
+#ifndef V4L2_SOURCE_H_
+#define V4L2_SOURCE_H_
+
+#include "frame-source.h"
+
+#include <string>
+#include <vector>
+#include <linux/videodev2.h>
+
+/**
+ * Captures NV12 frames from a V4L2 device.
+ *
+ * The driver allocates the capture buffers (MMAP) and every buffer is
+ * exported as a dma-buf with VIDIOC_EXPBUF, so frames go from the camera
+ * to the GPU without a copy. Works with single- and multi-planar capture
+ * devices, e.g. the vivid virtual driver.
+ */
+class V4L2Source : public FrameSource
+{
+public:
+    V4L2Source(const std::string &device, int width, int height) :
+        device_(device), width_(width), height_(height), fd_(-1),
+        type_(V4L2_BUF_TYPE_VIDEO_CAPTURE), streaming_(false) {}
+    ~V4L2Source();
+
+    bool init();
+    int fd();
+    int acquire();
+    void release(int index);
+    unsigned int buffers();
+    DmaBuffer *buffer(int index);
+    unsigned int generation(int index);
+
+private:
+    bool set_format();
+    bool request_buffers();
+    bool queue(int index);
+    int dequeue();
+
+    std::string device_;
+    int width_;
+    int height_;
+    int fd_;
+    v4l2_buf_type type_;
+    unsigned int stride_;
+    std::vector<DmaBuffer> buffers_;
+    std::vector<unsigned int> generations_;
+    bool streaming_;
+};
+
+#endif /* V4L2_SOURCE_H_ */
@@ -0,0 +1,495 @@
+#include "virtual-texture.h"
+#include "camera.h"
+#include "gl-state-cache.h"
+#include "log.h"
+
+#include <math.h>
+#include <utility>
+
+/* Most tiles uploaded per update(), to bound the time it takes */
+#define MAX_UPLOADS 8
+
+/* Points per side of the grid the views are sampled with */
+#define VIEW_GRID 16
+
+#define PI 3.14159265358979
+
+VirtualTexture::VirtualTexture(TileSource &source, size_t budget) :
+    source_(source),
+    budget_(budget),
+    levels_(0),
+    columns_(0),
+    rows_(0),
+    slots_per_row_(0),
+    atlas_(0),
+    indirection_(0),
+    frame_(0),
+    counted_(0),
+    hits_(0),
+    misses_(0),
+    dirty_(true),
+    quit_(false)
+{
+}
+
+VirtualTexture::~VirtualTexture()
+{
+    if (thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            quit_ = true;
+        }
+        cond_.notify_one();
+        thread_.join();
+    }
+
+    if (atlas_)
+        GLStateCache::delete_texture(atlas_);
+    if (indirection_)
+        GLStateCache::delete_texture(indirection_);
+}
+
+bool VirtualTexture::init()
+{
+    const size_t slot_bytes = TileSource::TILE_SLOT * TileSource::TILE_SLOT * 4;
+    GLint max_size = 0;
+
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+
+    levels_ = source_.levels();
+    columns_ = source_.columns(0);
+    rows_ = source_.rows(0);
+
+    if (columns_ > static_cast<unsigned int>(max_size) ||
+        rows_ > static_cast<unsigned int>(max_size)) {
+        Log::error("%ux%u tiles are too many for the indirection texture\n",
+                   columns_, rows_);
+        return false;
+    }
+
+    // A square atlas of as many slots as the budget allows; slot positions
+    // are stored in 8 bits in the indirection texture
+    slots_per_row_ = static_cast<unsigned int>(sqrt(static_cast<double>(budget_ / slot_bytes)));
+    if (slots_per_row_ > max_size / TileSource::TILE_SLOT)
+        slots_per_row_ = static_cast<unsigned int>(max_size) / TileSource::TILE_SLOT;
+    if (slots_per_row_ > 255)
+        slots_per_row_ = 255;
+
+    unsigned int coarsest = levels_ - 1;
+    unsigned int pinned = source_.columns(coarsest) * source_.rows(coarsest);
+    if (slots_per_row_ * slots_per_row_ <= pinned) {
+        Log::error("A tile budget of %u MiB is too small\n",
+                   static_cast<unsigned int>(budget_ >> 20));
+        return false;
+    }
+
+    slots_.resize(slots_per_row_ * slots_per_row_);
+
+    glGenTextures(1, &atlas_);
+    GLStateCache::bind_texture(GL_TEXTURE_2D, atlas_);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, atlas_size(), atlas_size(), 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    texels_.resize(columns_ * rows_ * 4);
+    glGenTextures(1, &indirection_);
+    GLStateCache::bind_texture(GL_TEXTURE_2D, indirection_);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, columns_, rows_, 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    if (glGetError() != GL_NO_ERROR) {
+        Log::error("Failed to create the %ux%u tile atlas\n", atlas_size(), atlas_size());
+        return false;
+    }
+
+    // Whatever is not streamed in yet shows the coarsest level
+    for (unsigned int y = 0; y < source_.rows(coarsest); y++) {
+        for (unsigned int x = 0; x < source_.columns(coarsest); x++) {
+            Tile tile;
+            tile.key = tile_key(coarsest, x, y);
+            tile.rgba.resize(slot_bytes);
+            if (!source_.read_tile(coarsest, x, y, &tile.rgba[0]) || !upload(tile, true)) {
+                Log::error("Failed to load tile %u,%u of level %u\n", x, y, coarsest);
+                return false;
+            }
+        }
+    }
+
+    begin_frame();
+    update();
+
+    Log::debug("Virtual texture: %ux%u, %u levels, %u tile slots\n",
+               source_.width(), source_.height(), levels_,
+               static_cast<unsigned int>(slots_.size()));
+
+    thread_ = std::thread(&VirtualTexture::fetch, this);
+
+    return true;
+}
+
+void VirtualTexture::begin_frame()
+{
+    frame_++;
+    wanted_.clear();
+    desired_.assign(columns_ * rows_, levels_ - 1);
+    dirty_ = true;
+}
+
+void VirtualTexture::view(const Camera &camera, int width, int height)
+{
+    const int points = VIEW_GRID + 1;
+    std::vector<double> u(points * points);
+    std::vector<double> v(points * points);
+
+    // Where on the image the points of a grid over the output are
+    for (int j = 0; j < points; j++) {
+        for (int i = 0; i < points; i++) {
+            float d[3];
+            camera.ray(-1.0f + 2.0f * i / VIEW_GRID, -1.0f + 2.0f * j / VIEW_GRID, d);
+
+            // As the sphere is textured: the azimuth along the width and
+            // the polar angle from the top along the height
+            double phi = atan2(d[2], d[0]);
+            u[j * points + i] = (phi < 0.0 ? phi + 2.0 * PI : phi) / (2.0 * PI);
+            v[j * points + i] = acos(d[1] < -1.0f ? -1.0 : (d[1] > 1.0f ? 1.0 : d[1])) / PI;
+        }
+    }
+
+    // A visible pole sees every azimuth around it
+    int pole_cell[2] = { -1, -1 };
+    float mvp[16];
+    camera.mvp(mvp);
+    for (int p = 0; p < 2; p++) {
+        float y = p ? -1.0f : 1.0f;
+        float x = mvp[4] * y + mvp[12];
+        float yc = mvp[5] * y + mvp[13];
+        float w = mvp[7] * y + mvp[15];
+        if (w > 0.0f && fabsf(x) <= w && fabsf(yc) <= w) {
+            int ci = static_cast<int>((x / w + 1.0f) / 2.0f * VIEW_GRID);
+            int cj = static_cast<int>((yc / w + 1.0f) / 2.0f * VIEW_GRID);
+            pole_cell[p] = (cj < VIEW_GRID ? cj : VIEW_GRID - 1) * VIEW_GRID +
+                           (ci < VIEW_GRID ? ci : VIEW_GRID - 1);
+        }
+    }
+
+    double cell_width = static_cast<double>(width) / VIEW_GRID;
+    double cell_height = static_cast<double>(height) / VIEW_GRID;
+
+    for (int j = 0; j < VIEW_GRID; j++) {
+        for (int i = 0; i < VIEW_GRID; i++) {
+            const int corners[4] = {
+                j * points + i, j * points + i + 1,
+                (j + 1) * points + i, (j + 1) * points + i + 1
+            };
+            double cu[4];
+            double u0, u1, v0, v1;
+
+            // Unwrap the azimuths around the first corner
+            for (int c = 0; c < 4; c++) {
+                cu[c] = u[corners[c]];
+                cu[c] += floor(cu[0] - cu[c] + 0.5);
+            }
+
+            u0 = u1 = cu[0];
+            v0 = v1 = v[corners[0]];
+            for (int c = 1; c < 4; c++) {
+                u0 = cu[c] < u0 ? cu[c] : u0;
+                u1 = cu[c] > u1 ? cu[c] : u1;
+                v0 = v[corners[c]] < v0 ? v[corners[c]] : v0;
+                v1 = v[corners[c]] > v1 ? v[corners[c]] : v1;
+            }
+
+            // Level 0 pixels per output pixel along both cell edges
+            double ux = (cu[1] - cu[0]) * source_.width();
+            double vx = (v[corners[1]] - v[corners[0]]) * source_.height();
+            double uy = (cu[2] - cu[0]) * source_.width();
+            double vy = (v[corners[2]] - v[corners[0]]) * source_.height();
+            double footprint = sqrt(ux * ux + vx * vx) / cell_width;
+            double footprint_y = sqrt(uy * uy + vy * vy) / cell_height;
+            if (footprint_y > footprint)
+                footprint = footprint_y;
+
+            unsigned int level = 0;
+            while (level + 1 < levels_ && footprint >= 2.0) {
+                footprint /= 2.0;
+                level++;
+            }
+
+            int cell = j * VIEW_GRID + i;
+            if (cell == pole_cell[0] || cell == pole_cell[1]) {
+                u0 = 0.0;
+                u1 = 1.0;
+                v0 = cell == pole_cell[0] ? 0.0 : v0;
+                v1 = cell == pole_cell[1] ? 1.0 : v1;
+            }
+
+            want_area(level, u0, u1, v0, v1);
+        }
+    }
+}
+
+bool VirtualTexture::update()
+{
+    std::vector<Tile> arrived;
+    unsigned int uploaded = 0;
+
+    // Moving the view may make room for the tiles that found none
+    if (wanted_ != unplaced_for_) {
+        unplaced_.clear();
+        unplaced_for_ = wanted_;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        while (!fetched_.empty() && arrived.size() < MAX_UPLOADS) {
+            fetching_.erase(fetched_.front().key);
+            arrived.push_back(std::move(fetched_.front()));
+            fetched_.pop_front();
+        }
+
+        // The missing tiles replace the requests of earlier frames, coarser
+        // levels first so the image sharpens progressively
+        requests_.clear();
+        for (std::set<uint64_t>::reverse_iterator iter = wanted_.rbegin();
+             iter != wanted_.rend();
+             iter++) {
+            if (!slot_of_.count(*iter) && !fetching_.count(*iter) &&
+                !failed_.count(*iter) && !unplaced_.count(*iter))
+                requests_.push_back(*iter);
+        }
+    }
+    cond_.notify_one();
+
+    // Visible tiles are kept from eviction. An extra update() in a frame
+    // doesn't count them again, so the hit rate isn't skewed.
+    bool count = counted_ != frame_;
+    counted_ = frame_;
+    for (std::set<uint64_t>::iterator iter = wanted_.begin();
+         iter != wanted_.end();
+         iter++) {
+        std::map<uint64_t, unsigned int>::iterator slot = slot_of_.find(*iter);
+        if (slot != slot_of_.end()) {
+            Slot &s = slots_[slot->second];
+            s.used = frame_;
+            lru_.splice(lru_.begin(), lru_, s.lru);
+            if (count)
+                hits_++;
+        } else if (count) {
+            misses_++;
+        }
+    }
+
+    for (unsigned int t = 0; t < arrived.size(); t++) {
+        if (!wanted_.count(arrived[t].key) || slot_of_.count(arrived[t].key))
+            continue;
+        if (upload(arrived[t], false))
+            uploaded++;
+        else
+            unplaced_.insert(arrived[t].key);
+    }
+
+    if (dirty_) {
+        build_indirection();
+        GLStateCache::bind_texture(GL_TEXTURE_2D, indirection_);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, columns_, rows_,
+                        GL_RGBA, GL_UNSIGNED_BYTE, &texels_[0]);
+        dirty_ = false;
+    }
+
+    return uploaded > 0;
+}
+
+unsigned int VirtualTexture::pending()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    return static_cast<unsigned int>(requests_.size() + fetching_.size());
+}
+
+/*******************
+ * Private methods *
+ *******************/
+
+uint64_t VirtualTexture::tile_key(unsigned int level, unsigned int x, unsigned int y)
+{
+    // Keys order by level, so the coarsest tiles sort last
+    return (static_cast<uint64_t>(level) << 48) |
+           (static_cast<uint64_t>(y) << 24) | x;
+}
+
+void VirtualTexture::key_tile(uint64_t key, unsigned int &level, unsigned int &x,
+                              unsigned int &y)
+{
+    level = key >> 48;
+    y = (key >> 24) & 0xffffff;
+    x = key & 0xffffff;
+}
+
+void VirtualTexture::want(unsigned int level, unsigned int x, unsigned int y)
+{
+    if (!wanted_.insert(tile_key(level, x, y)).second)
+        return;
+
+    // The level 0 tiles the tile covers should show it, or a finer one
+    unsigned int x1 = (x + 1) << level;
+    unsigned int y1 = (y + 1) << level;
+    for (unsigned int j = y << level; j < y1 && j < rows_; j++) {
+        for (unsigned int i = x << level; i < x1 && i < columns_; i++) {
+            if (desired_[j * columns_ + i] > level)
+                desired_[j * columns_ + i] = level;
+        }
+    }
+
+    dirty_ = true;
+}
+
+void VirtualTexture::want_area(unsigned int level, double u0, double u1,
+                               double v0, double v1)
+{
+    double tile_size = static_cast<double>(TileSource::TILE_SIZE << level);
+    int columns = source_.columns(level);
+    int rows = source_.rows(level);
+
+    int x0 = static_cast<int>(floor(u0 * source_.width() / tile_size));
+    int x1 = static_cast<int>(floor(u1 * source_.width() / tile_size));
+    int y0 = static_cast<int>(floor(v0 * source_.height() / tile_size));
+    int y1 = static_cast<int>(floor(v1 * source_.height() / tile_size));
+
+    if (x1 - x0 >= columns)
+        x1 = x0 + columns - 1;
+    y0 = y0 < 0 ? 0 : (y0 >= rows ? rows - 1 : y0);
+    y1 = y1 < 0 ? 0 : (y1 >= rows ? rows - 1 : y1);
+
+    for (int y = y0; y <= y1; y++) {
+        for (int x = x0; x <= x1; x++) {
+            // Azimuths wrap around
+            int column = ((x % columns) + columns) % columns;
+            want(level, column, y);
+        }
+    }
+}
+
+int VirtualTexture::allocate_slot()
+{
+    for (unsigned int s = 0; s < slots_.size(); s++) {
+        if (slots_[s].free)
+            return s;
+    }
+
+    // Evict the least recently used tile that is not visible
+    for (std::list<unsigned int>::reverse_iterator iter = lru_.rbegin();
+         iter != lru_.rend();
+         iter++) {
+        Slot &slot = slots_[*iter];
+        if (slot.pinned || slot.used == frame_)
+            continue;
+
+        unsigned int s = *iter;
+        slot_of_.erase(slot.key);
+        lru_.erase(slot.lru);
+        slot.free = true;
+        dirty_ = true;
+        return s;
+    }
+
+    return -1;
+}
+
+bool VirtualTexture::upload(const Tile &tile, bool pinned)
+{
+    int s = allocate_slot();
+    if (s < 0)
+        return false;
+
+    GLStateCache::bind_texture(GL_TEXTURE_2D, atlas_);
+    glTexSubImage2D(GL_TEXTURE_2D, 0,
+                    (s % slots_per_row_) * TileSource::TILE_SLOT,
+                    (s / slots_per_row_) * TileSource::TILE_SLOT,
+                    TileSource::TILE_SLOT, TileSource::TILE_SLOT,
+                    GL_RGBA, GL_UNSIGNED_BYTE, &tile.rgba[0]);
+
+    Slot &slot = slots_[s];
+    slot.key = tile.key;
+    slot.used = frame_;
+    slot.pinned = pinned;
+    slot.free = false;
+    lru_.push_front(s);
+    slot.lru = lru_.begin();
+    slot_of_[tile.key] = s;
+    dirty_ = true;
+
+    return true;
+}
+
+/*
+ * Points every level 0 tile at the slot of the tile it should show: the
+ * desired level if that tile is on the GPU, or else the finest coarser one.
+ * Texels hold the slot column and row, and the level.
+ */
+void VirtualTexture::build_indirection()
+{
+    for (unsigned int j = 0; j < rows_; j++) {
+        for (unsigned int i = 0; i < columns_; i++) {
+            uint8_t *texel = &texels_[(j * columns_ + i) * 4];
+
+            for (unsigned int level = desired_[j * columns_ + i]; level < levels_; level++) {
+                std::map<uint64_t, unsigned int>::iterator slot =
+                        slot_of_.find(tile_key(level, i >> level, j >> level));
+                if (slot == slot_of_.end())
+                    continue;
+
+                texel[0] = slot->second % slots_per_row_;
+                texel[1] = slot->second / slots_per_row_;
+                texel[2] = level;
+                texel[3] = 255;
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * The background thread: reads the requested tiles one at a time, the
+ * first request first.
+ */
+void VirtualTexture::fetch()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (!quit_) {
+        if (requests_.empty()) {
+            cond_.wait(lock);
+            continue;
+        }
+
+        Tile tile;
+        unsigned int level, x, y;
+
+        tile.key = requests_.front();
+        requests_.pop_front();
+        fetching_.insert(tile.key);
+        lock.unlock();
+
+        key_tile(tile.key, level, x, y);
+        tile.rgba.resize(TileSource::TILE_SLOT * TileSource::TILE_SLOT * 4);
+        bool ok = source_.read_tile(level, x, y, &tile.rgba[0]);
+
+        lock.lock();
+        // A tile that can't be read is not requested over and over again
+        if (ok) {
+            fetched_.push_back(std::move(tile));
+        } else {
+            Log::debug("Failed to read tile %u,%u of level %u\n", x, y, level);
+            fetching_.erase(tile.key);
+            failed_.insert(tile.key);
+        }
+    }
+}
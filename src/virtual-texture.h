@@ -0,0 +1,166 @@
+#ifndef VIRTUAL_TEXTURE_H_
+#define VIRTUAL_TEXTURE_H_
+
+#include "gl-headers.h"
+#include "tile-source.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+class Camera;
+
+/**
+ * Displays panoramas of any size through a cache of tiles on the GPU.
+ *
+ * The tiles of a TileSource pyramid that the cameras see are streamed
+ * into slots of a single atlas texture by a background thread, at the
+ * level that matches their size on the screen. An indirection texture
+ * with a texel per level 0 tile tells the shader which atlas slot and
+ * level to sample for every part of the image; parts whose tile has not
+ * arrived yet fall back to the finest coarser tile that has. The coarsest
+ * level is loaded up front and never evicted, so there always is one.
+ *
+ * The atlas holds as many tiles as the memory budget allows. When it is
+ * full, the tile that was used least recently makes room, unless it is
+ * still visible. Memory use thus follows the screen size rather than the
+ * image size.
+ */
+class VirtualTexture
+{
+public:
+    /**
+     * @param source the tiles to display
+     * @param budget the GPU memory the atlas may use, in bytes
+     */
+    VirtualTexture(TileSource &source, size_t budget);
+    ~VirtualTexture();
+
+    /**
+     * Creates the textures, loads the coarsest level and starts fetching.
+     *
+     * @return whether the texture can be displayed
+     */
+    bool init();
+
+    /**
+     * Starts a new frame; the tiles that views of the previous frames
+     * requested are no longer protected from eviction.
+     */
+    void begin_frame();
+
+    /**
+     * Requests the tiles a camera sees. All views of a frame are given
+     * before its update().
+     *
+     * @param camera the camera
+     * @param width the width of its output in pixels
+     * @param height the height of its output in pixels
+     */
+    void view(const Camera &camera, int width, int height);
+
+    /**
+     * Uploads the tiles that have arrived and updates the indirection
+     * texture, to be called once per frame before drawing.
+     *
+     * @return whether tiles were uploaded, which sharpens the outputs
+     */
+    bool update();
+
+    GLuint atlas() const { return atlas_; }
+    GLuint indirection() const { return indirection_; }
+    // Size of the atlas in pixels, and level 0 of the image in tiles
+    unsigned int atlas_size() const { return slots_per_row_ * TileSource::TILE_SLOT; }
+    unsigned int columns() const { return columns_; }
+    unsigned int rows() const { return rows_; }
+    const TileSource &source() const { return source_; }
+
+    /* Number of tiles on the GPU and waiting to be fetched; tiles that
+     * can't be read or found no room in the atlas don't wait */
+    unsigned int resident() const { return slot_of_.size(); }
+    unsigned int pending();
+    /* Number of tiles the atlas can hold */
+    unsigned int capacity() const { return slots_.size(); }
+    /* Visible tiles that were on the GPU when drawn, and those that weren't,
+     * counted once per frame */
+    unsigned int hits() const { return hits_; }
+    unsigned int misses() const { return misses_; }
+
+private:
+    struct Tile
+    {
+        uint64_t key;
+        std::vector<uint8_t> rgba;
+    };
+
+    struct Slot
+    {
+        Slot() : key(0), used(0), pinned(false), free(true) {}
+
+        uint64_t key;
+        // Frame the tile was last wanted in
+        unsigned int used;
+        bool pinned;
+        bool free;
+        std::list<unsigned int>::iterator lru;
+    };
+
+    static uint64_t tile_key(unsigned int level, unsigned int x, unsigned int y);
+    static void key_tile(uint64_t key, unsigned int &level, unsigned int &x,
+                         unsigned int &y);
+
+    void want(unsigned int level, unsigned int x, unsigned int y);
+    void want_area(unsigned int level, double u0, double u1, double v0, double v1);
+    int allocate_slot();
+    bool upload(const Tile &tile, bool pinned);
+    void build_indirection();
+    void fetch();
+
+    TileSource &source_;
+    size_t budget_;
+    unsigned int levels_;
+    unsigned int columns_;
+    unsigned int rows_;
+    unsigned int slots_per_row_;
+    GLuint atlas_;
+    GLuint indirection_;
+    unsigned int frame_;
+    // The last frame whose visible tiles were counted
+    unsigned int counted_;
+    unsigned int hits_;
+    unsigned int misses_;
+
+    std::vector<Slot> slots_;
+    // Slots by how recently they were used, most recent first
+    std::list<unsigned int> lru_;
+    std::map<uint64_t, unsigned int> slot_of_;
+    // The level every level 0 tile should be displayed at this frame
+    std::vector<uint8_t> desired_;
+    std::set<uint64_t> wanted_;
+    // Tiles that arrived while the atlas was full of visible ones, not
+    // requested again until the visible tiles change
+    std::set<uint64_t> unplaced_;
+    std::set<uint64_t> unplaced_for_;
+    std::vector<uint8_t> texels_;
+    bool dirty_;
+
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    // Protected by mutex_
+    std::deque<uint64_t> requests_;
+    std::set<uint64_t> fetching_;
+    std::deque<Tile> fetched_;
+    // Tiles that can't be read, never requested again
+    std::set<uint64_t> failed_;
+    bool quit_;
+};
+
+#endif /* VIRTUAL_TEXTURE_H_ */
@@ -0,0 +1,230 @@
+#include "warp-lut.h"
+#include "log.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#define PI (3.14159265f)
+
+/* Bump whenever the table layout or the lens model changes */
+#define WARP_LUT_VERSION 2
+
+struct WarpLutHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint64_t hash;
+};
+
+static double now_ms()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static uint16_t float_to_half(float f)
+{
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+
+    uint32_t sign = (x >> 16) & 0x8000;
+    int32_t exp = static_cast<int32_t>((x >> 23) & 0xff) - 127 + 15;
+    uint32_t mant = x & 0x7fffff;
+
+    if (exp <= 0) {
+        // Too small for a normal half: flush to a denormal or zero
+        if (exp < -10)
+            return sign;
+        mant |= 0x800000;
+        uint32_t shift = 14 - exp;
+        uint32_t half = mant >> shift;
+        if ((mant >> (shift - 1)) & 1)
+            half++;
+        return sign | half;
+    }
+
+    if (exp >= 31)
+        return sign | 0x7c00;
+
+    uint32_t half = sign | (exp << 10) | (mant >> 13);
+    if (mant & 0x1000)
+        half++;
+
+    return half;
+}
+
+WarpLut::WarpLut(const LensCalibration &lens, int width, int height) :
+    lens_(lens), width_(width), height_(height), hash_(0)
+{
+    std::string id(lens_.id());
+    uint32_t layout[3] = { WARP_LUT_VERSION,
+                           static_cast<uint32_t>(width_),
+                           static_cast<uint32_t>(height_) };
+
+    hash_ = Util::hash(id.data(), id.size());
+    hash_ = Util::hash(layout, sizeof(layout), hash_);
+}
+
+bool WarpLut::init()
+{
+    char name[64];
+
+    if (width_ <= 0 || height_ <= 0 || lens_.width <= 0 || lens_.height <= 0) {
+        Log::error("Warp table needs a lens and a table size\n");
+        return false;
+    }
+
+    snprintf(name, sizeof(name), "warp-%016llx.lut",
+             static_cast<unsigned long long>(hash_));
+    std::string path(Util::cache_path(name));
+
+    if (!path.empty() && load(path)) {
+        Log::debug("Loaded warp table from %s\n", path.c_str());
+        return true;
+    }
+
+    double start = now_ms();
+    generate();
+    Log::debug("Generated %dx%d warp table in %.1f ms\n",
+               width_, height_, now_ms() - start);
+
+    if (!path.empty())
+        save(path);
+
+    return true;
+}
+
+void WarpLut::pack_half(std::vector<uint16_t> &out) const
+{
+    size_t texels = data_.size() / 3;
+
+    out.resize(texels * 4);
+
+    for (size_t i = 0; i < texels; i++) {
+        out[i * 4 + 0] = float_to_half(data_[i * 3] - 0.5f);
+        out[i * 4 + 1] = float_to_half(data_[i * 3 + 1] - 0.5f);
+        out[i * 4 + 2] = float_to_half(data_[i * 3 + 2]);
+        out[i * 4 + 3] = 0;
+    }
+}
+
+void WarpLut::pack_rgba8(std::vector<uint8_t> &out) const
+{
+    size_t texels = data_.size() / 3;
+
+    out.resize(texels * 4);
+
+    for (size_t i = 0; i < texels; i++) {
+        unsigned int u12 = static_cast<unsigned int>(data_[i * 3] * 4095.0f + 0.5f);
+        unsigned int v12 = static_cast<unsigned int>(data_[i * 3 + 1] * 4095.0f + 0.5f);
+        bool valid = data_[i * 3 + 2] > 0.5f;
+
+        out[i * 4 + 0] = u12 >> 4;
+        out[i * 4 + 1] = v12 >> 4;
+        out[i * 4 + 2] = ((u12 & 0xf) << 4) | (v12 & 0xf);
+        out[i * 4 + 3] = valid ? 255 : 0;
+    }
+}
+
+/*******************
+ * Private methods *
+ *******************/
+
+bool WarpLut::load(const std::string &path)
+{
+    WarpLutHeader header;
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp)
+        return false;
+
+    bool ok = fread(&header, sizeof(header), 1, fp) == 1 &&
+              memcmp(header.magic, "PLUT", 4) == 0 &&
+              header.version == WARP_LUT_VERSION &&
+              header.width == static_cast<uint32_t>(width_) &&
+              header.height == static_cast<uint32_t>(height_) &&
+              header.hash == hash_;
+
+    if (ok) {
+        data_.resize(static_cast<size_t>(width_) * height_ * 3);
+        ok = fread(&data_[0], sizeof(float), data_.size(), fp) == data_.size();
+        if (!ok)
+            data_.clear();
+    }
+
+    fclose(fp);
+
+    return ok;
+}
+
+void WarpLut::save(const std::string &path) const
+{
+    WarpLutHeader header;
+    memcpy(header.magic, "PLUT", 4);
+    header.version = WARP_LUT_VERSION;
+    header.width = width_;
+    header.height = height_;
+    header.hash = hash_;
+
+    // Write to a temporary file first so readers never see a partial table
+    std::string tmp(path + ".tmp");
+    FILE *fp = fopen(tmp.c_str(), "wb");
+    if (!fp) {
+        Log::debug("Could not write warp table to %s\n", tmp.c_str());
+        return;
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+              fwrite(&data_[0], sizeof(float), data_.size(), fp) == data_.size();
+    ok = (fclose(fp) == 0) && ok;
+
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        Log::debug("Could not write warp table to %s\n", path.c_str());
+        remove(tmp.c_str());
+    }
+}
+
+void WarpLut::generate()
+{
+    float rotation[9];
+
+    lens_.rotation(rotation);
+    data_.resize(static_cast<size_t>(width_) * height_ * 3);
+
+    Util::parallel_for(height_, [&](unsigned int begin, unsigned int end) {
+        for (unsigned int row = begin; row < end; row++) {
+            // Texel centers, matching the sphere texture coordinates
+            float theta = PI * (row + 0.5f) / height_;
+            float *out = &data_[static_cast<size_t>(row) * width_ * 3];
+
+            for (int col = 0; col < width_; col++) {
+                float phi = 2.0f * PI * (col + 0.5f) / width_;
+                float d[3] = {
+                    sinf(theta) * cosf(phi),
+                    cosf(theta),
+                    sinf(theta) * sinf(phi)
+                };
+                float l[3];
+                float u, v;
+
+                for (int i = 0; i < 3; i++) {
+                    l[i] = rotation[0 * 3 + i] * d[0] +
+                           rotation[1 * 3 + i] * d[1] +
+                           rotation[2 * 3 + i] * d[2];
+                }
+
+                bool seen = lens_.project(l, u, v);
+                out[col * 3] = u;
+                out[col * 3 + 1] = v;
+                out[col * 3 + 2] = seen ? 1.0f : 0.0f;
+            }
+        }
+    });
+}
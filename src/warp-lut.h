@@ -0,0 +1,69 @@
+#ifndef WARP_LUT_H_
+#define WARP_LUT_H_
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "camera-calibration.h"
+
+/**
+ * Lookup table that maps sphere texture coordinates to coordinates in the
+ * image of an arbitrarily calibrated lens.
+ *
+ * The table is laid out like the sphere texture coordinates (azimuth along
+ * the width, polar angle along the height), so the renderer needs one
+ * lookup plus one image fetch per pixel instead of evaluating the lens
+ * polynomial. Evaluating the table is expensive, so it is generated on all
+ * CPUs once and cached on disk, keyed by a hash of the calibration.
+ */
+class WarpLut
+{
+public:
+    WarpLut(const LensCalibration &lens, int width, int height);
+
+    /**
+     * Loads the table from the cache, or generates and caches it.
+     *
+     * @return whether the table is available
+     */
+    bool init();
+
+    /**
+     * Gets the table as RGBA 16-bit half floats: u - 0.5 and v - 0.5 in R
+     * and G, whether the lens sees the direction (0 or 1) in B. Centering
+     * the coordinates on 0 halves the step of the half floats to 2^-12,
+     * as fine as the 12 bits of pack_rgba8().
+     *
+     * @param out the vector to fill
+     */
+    void pack_half(std::vector<uint16_t> &out) const;
+
+    /**
+     * Gets the table as RGBA8 texels, for GPUs without half float textures.
+     * Each coordinate is stored with 12 bits: the high 8 bits of u and v in
+     * R and G, the low 4 bits of both in B, and whether the lens sees the
+     * direction in A.
+     *
+     * @param out the vector to fill
+     */
+    void pack_rgba8(std::vector<uint8_t> &out) const;
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+
+private:
+    bool load(const std::string &path);
+    void save(const std::string &path) const;
+    void generate();
+
+    LensCalibration lens_;
+    int width_;
+    int height_;
+    uint64_t hash_;
+    // (u, v, seen) per texel. Directions the lens doesn't see keep the
+    // coordinates of the rim, so filtering across it stays in the image.
+    std::vector<float> data_;
+};
+
+#endif /* WARP_LUT_H_ */
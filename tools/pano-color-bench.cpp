@@ -0,0 +1,169 @@
+/*
+ * Checks the NV12 to RGBA kernels of src/color-convert.h against the
+ * scalar reference and measures their throughput, on one CPU and in row
+ * bands on all of them.
+ *
+ * The image is a raw NV12 file or, without one, a pattern that covers all
+ * combinations of luma and chroma values the kernels can see.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <vector>
+
+#include "color-convert.h"
+#include "log.h"
+
+static double now_seconds()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+/* Fills @nv12 with pseudo-random samples, the same for every run */
+static void fill_pattern(std::vector<uint8_t> &nv12)
+{
+    uint32_t state = 0x12345678;
+
+    for (size_t i = 0; i < nv12.size(); i++) {
+        state = state * 1664525 + 1013904223;
+        nv12[i] = state >> 24;
+    }
+}
+
+/* Converts the image @iterations times, returns the seconds per image */
+static double measure(ColorKernel kernel, bool parallel, const std::vector<uint8_t> &nv12,
+                      std::vector<uint8_t> &rgba, unsigned int width, unsigned int height,
+                      unsigned int iterations)
+{
+    const uint8_t *y = &nv12[0];
+    const uint8_t *uv = y + static_cast<size_t>(width) * height;
+    double start = now_seconds();
+
+    for (unsigned int i = 0; i < iterations; i++) {
+        if (parallel)
+            nv12_to_rgba_parallel(y, width, uv, width, &rgba[0], width * 4, width, height);
+        else
+            nv12_to_rgba_with(kernel, y, width, uv, width, &rgba[0], width * 4, width, height);
+    }
+
+    return (now_seconds() - start) / iterations;
+}
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [OPTIONS] [INPUT]\n"
+           "\n"
+           "Compares the NV12 to RGBA kernels this CPU supports with the scalar\n"
+           "reference and prints their throughput, for the raw NV12 image INPUT\n"
+           "or a generated one.\n"
+           "\n"
+           "Options:\n"
+           "  -s, --size WxH         Size of the image (default: 3840x1920)\n"
+           "  -n, --iterations N     Conversions timed per kernel (default: 20)\n"
+           "  -h, --help             Display help\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    static struct option long_options[] = {
+        {"size", 1, 0, 's'},
+        {"iterations", 1, 0, 'n'},
+        {"help", 0, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+    unsigned int width = 3840;
+    unsigned int height = 1920;
+    int iterations = 20;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "s:n:h", long_options, NULL)) != -1) {
+        if (c == 's') {
+            if (sscanf(optarg, "%ux%u", &width, &height) != 2 || width < 2 || height < 2) {
+                fprintf(stderr, "Invalid size '%s'\n", optarg);
+                return 1;
+            }
+        } else if (c == 'n') {
+            iterations = atoi(optarg);
+            if (iterations <= 0) {
+                fprintf(stderr, "Invalid iterations '%s'\n", optarg);
+                return 1;
+            }
+        } else if (c == 'h') {
+            usage(argv[0]);
+            return 0;
+        } else {
+            return 1;
+        }
+    }
+
+    if (optind + 1 < argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Log::init("pano_color_bench", false);
+
+    // The chroma plane has a row for every two luma rows, rounding up
+    size_t size = static_cast<size_t>(width) * (height + (height + 1) / 2);
+    std::vector<uint8_t> nv12(size);
+
+    if (optind < argc) {
+        FILE *fp = fopen(argv[optind], "rb");
+        if (!fp || fread(&nv12[0], size, 1, fp) != 1) {
+            Log::error("'%s' is not a %ux%u NV12 image\n", argv[optind], width, height);
+            if (fp)
+                fclose(fp);
+            return 1;
+        }
+        fclose(fp);
+    } else {
+        fill_pattern(nv12);
+    }
+
+    size_t pixels = static_cast<size_t>(width) * height;
+    std::vector<uint8_t> reference(pixels * 4);
+    std::vector<uint8_t> rgba(pixels * 4);
+    double scalar = measure(COLOR_KERNEL_SCALAR, false, nv12, reference, width, height,
+                            iterations);
+    bool matching = true;
+
+    printf("%ux%u, %d iterations, %s is used by default\n", width, height, iterations,
+           color_kernel_name(color_kernel()));
+    printf("%-8s %10s %10s %8s %10s\n", "kernel", "ms/image", "Mpixel/s", "speedup",
+           "mismatches");
+
+    for (int k = COLOR_KERNEL_SCALAR; k <= COLOR_KERNEL_COUNT; k++) {
+        // The last round is the parallel conversion with the default kernel
+        bool parallel = k == COLOR_KERNEL_COUNT;
+        ColorKernel kernel = parallel ? color_kernel() : static_cast<ColorKernel>(k);
+        if (!color_kernel_supported(kernel))
+            continue;
+
+        memset(&rgba[0], 0, rgba.size());
+        double seconds = k == COLOR_KERNEL_SCALAR ? scalar :
+                         measure(kernel, parallel, nv12, rgba, width, height, iterations);
+        const std::vector<uint8_t> &out = k == COLOR_KERNEL_SCALAR ? reference : rgba;
+
+        size_t mismatches = 0;
+        for (size_t i = 0; i < pixels; i++) {
+            if (memcmp(&out[i * 4], &reference[i * 4], 4))
+                mismatches++;
+        }
+        if (mismatches)
+            matching = false;
+
+        std::string name(color_kernel_name(kernel));
+        if (parallel)
+            name += "-mt";
+        printf("%-8s %10.2f %10.1f %7.1fx %10zu\n", name.c_str(), seconds * 1000.0,
+               pixels / seconds / 1000000.0, scalar / seconds, mismatches);
+    }
+
+    return matching ? 0 : 1;
+}
@@ -0,0 +1,371 @@
+/*
+ * Compresses a raw NV12 panorama into an ETC2 texture with a full mip
+ * chain, stored as a KTX file (see src/ktx-file.h) that panoram_image
+ * uploads without decoding anything.
+ *
+ * Blocks are encoded in the individual and differential modes that ETC2
+ * shares with ETC1, so the result is also valid ETC1 data. The image is
+ * converted, filtered and encoded on all CPUs.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+
+#include "ktx-file.h"
+#include "color-convert.h"
+#include "tool-util.h"
+#include "util.h"
+#include "log.h"
+
+#define GL_RGB 0x1907
+
+/* An RGBA mip level */
+struct Level
+{
+    unsigned int width;
+    unsigned int height;
+    std::vector<uint8_t> rgba;
+};
+
+/* The intensity modifiers of the 8 ETC tables, the negatives are implied */
+static const int etc_modifiers[8][2] = {
+    { 2, 8 }, { 5, 17 }, { 9, 29 }, { 13, 42 },
+    { 18, 60 }, { 24, 80 }, { 33, 106 }, { 47, 183 },
+};
+
+/* An encoding of one half of a block */
+struct HalfFit
+{
+    unsigned int error;
+    unsigned int table;
+    uint8_t selectors[16];
+};
+
+/* Averages the 2x2 blocks of @in into the next mip level */
+static void downsample(const Level &in, Level &out)
+{
+    out.width = in.width > 1 ? in.width / 2 : 1;
+    out.height = in.height > 1 ? in.height / 2 : 1;
+    out.rgba.resize(static_cast<size_t>(out.width) * out.height * 4);
+
+    downsample_2x2(&in.rgba[0], in.width, in.height, in.width * 4,
+                   &out.rgba[0], out.width, out.height, out.width * 4, 4);
+}
+
+/*
+ * Finds the table and the selectors that represent the pixels of @block
+ * that @half marks with the least squared error around @base. Selectors
+ * 0-3 stand for +small, +large, -small and -large, as in the bitstream.
+ */
+static void fit_half(const int block[16][3], const bool half[16], const int base[3],
+                     HalfFit &fit)
+{
+    fit.error = ~0u;
+
+    for (unsigned int t = 0; t < 8; t++) {
+        const int offsets[4] = { etc_modifiers[t][0], etc_modifiers[t][1],
+                                 -etc_modifiers[t][0], -etc_modifiers[t][1] };
+        uint8_t selectors[16];
+        unsigned int error = 0;
+
+        for (unsigned int i = 0; i < 16 && error < fit.error; i++) {
+            if (!half[i])
+                continue;
+
+            unsigned int best = ~0u;
+            for (unsigned int s = 0; s < 4; s++) {
+                unsigned int e = 0;
+                for (unsigned int k = 0; k < 3; k++) {
+                    int d = color_clamp(base[k] + offsets[s]) - block[i][k];
+                    e += d * d;
+                }
+                if (e < best) {
+                    best = e;
+                    selectors[i] = s;
+                }
+            }
+            error += best;
+        }
+
+        if (error < fit.error) {
+            fit.error = error;
+            fit.table = t;
+            memcpy(fit.selectors, selectors, sizeof(selectors));
+        }
+    }
+}
+
+/*
+ * Fits both halves around the averages quantized to @bits, also trying
+ * the averages a step darker and brighter since the modifiers rarely sit
+ * symmetrically around the pixels. Quantized colors are returned in @q.
+ */
+static unsigned int fit_halves(const int block[16][3], const bool halves[2][16],
+                               const int avg[2][3], unsigned int bits, bool differential,
+                               int q[2][3], HalfFit fits[2])
+{
+    int max = (1 << bits) - 1;
+    unsigned int error = 0;
+
+    for (unsigned int h = 0; h < 2; h++) {
+        fits[h].error = ~0u;
+        for (int shift = -1; shift <= 1; shift++) {
+            int cq[3];
+            int base[3];
+            HalfFit fit;
+
+            for (unsigned int k = 0; k < 3; k++) {
+                int v = (avg[h][k] * max + 127) / 255 + shift;
+                cq[k] = v < 0 ? 0 : (v > max ? max : v);
+                base[k] = bits == 5 ? (cq[k] << 3) | (cq[k] >> 2) : cq[k] * 17;
+            }
+
+            // The second color is a small delta from the first one
+            if (differential && h == 1) {
+                bool reachable = true;
+                for (unsigned int k = 0; k < 3; k++)
+                    reachable = reachable && cq[k] - q[0][k] >= -4 && cq[k] - q[0][k] <= 3;
+                if (!reachable)
+                    continue;
+            }
+
+            fit_half(block, halves[h], base, fit);
+            if (fit.error < fits[h].error) {
+                fits[h] = fit;
+                memcpy(q[h], cq, sizeof(cq));
+            }
+        }
+
+        if (fits[h].error == ~0u)
+            return ~0u;
+        error += fits[h].error;
+    }
+
+    return error;
+}
+
+/* Encodes the 4x4 pixels of @block, indexed column by column, into @out */
+static void encode_block(const int block[16][3], uint8_t *out)
+{
+    unsigned int best = ~0u;
+    uint32_t high = 0;
+    uint32_t low = 0;
+
+    for (unsigned int flip = 0; flip < 2; flip++) {
+        bool halves[2][16];
+        int avg[2][3] = { { 0, 0, 0 }, { 0, 0, 0 } };
+
+        // Without flip the halves are 2x4 side by side, with it 4x2 on top of each other
+        for (unsigned int i = 0; i < 16; i++) {
+            unsigned int h = flip ? (i & 3) >= 2 : i >= 8;
+            halves[h][i] = true;
+            halves[!h][i] = false;
+            for (unsigned int k = 0; k < 3; k++)
+                avg[h][k] += block[i][k];
+        }
+        for (unsigned int h = 0; h < 2; h++) {
+            for (unsigned int k = 0; k < 3; k++)
+                avg[h][k] = (avg[h][k] + 4) / 8;
+        }
+
+        for (unsigned int differential = 0; differential < 2; differential++) {
+            int q[2][3];
+            HalfFit fits[2];
+            unsigned int error = fit_halves(block, halves, avg, differential ? 5 : 4,
+                                            differential, q, fits);
+            if (error >= best)
+                continue;
+
+            best = error;
+            high = 0;
+            for (unsigned int k = 0; k < 3; k++) {
+                uint32_t first = q[0][k];
+                uint32_t second = differential ? (q[1][k] - q[0][k]) & 7 : q[1][k];
+                high |= first << (differential ? 27 - 8 * k : 28 - 8 * k) | second << (24 - 8 * k);
+            }
+            high |= fits[0].table << 5 | fits[1].table << 2 | differential << 1 | flip;
+
+            low = 0;
+            for (unsigned int i = 0; i < 16; i++) {
+                unsigned int s = fits[halves[0][i] ? 0 : 1].selectors[i];
+                low |= (s >> 1) << (16 + i) | (s & 1) << i;
+            }
+        }
+    }
+
+    for (unsigned int b = 0; b < 4; b++) {
+        out[b] = high >> (24 - 8 * b);
+        out[4 + b] = low >> (24 - 8 * b);
+    }
+}
+
+/* Encodes a level into ETC blocks, row of blocks by row of blocks */
+static void encode_level(const Level &level, std::vector<uint8_t> &blocks)
+{
+    unsigned int columns = (level.width + 3) / 4;
+    unsigned int rows = (level.height + 3) / 4;
+
+    blocks.resize(static_cast<size_t>(columns) * rows * 8);
+
+    Util::parallel_for(rows, [&](unsigned int begin, unsigned int end) {
+        int block[16][3];
+
+        for (unsigned int by = begin; by < end; by++) {
+            for (unsigned int bx = 0; bx < columns; bx++) {
+                // Blocks over the edge repeat the last pixels
+                for (unsigned int i = 0; i < 16; i++) {
+                    unsigned int x = bx * 4 + i / 4;
+                    unsigned int y = by * 4 + i % 4;
+                    x = x < level.width ? x : level.width - 1;
+                    y = y < level.height ? y : level.height - 1;
+                    const uint8_t *p = &level.rgba[(static_cast<size_t>(y) * level.width + x) * 4];
+                    for (unsigned int k = 0; k < 3; k++)
+                        block[i][k] = p[k];
+                }
+                encode_block(block, &blocks[(static_cast<size_t>(by) * columns + bx) * 8]);
+            }
+        }
+    });
+}
+
+static void usage(const char *name)
+{
+    printf("Usage: %s -s WxH INPUT OUTPUT\n"
+           "\n"
+           "Compresses the raw NV12 panorama INPUT of the given size into the ETC2\n"
+           "texture OUTPUT, a KTX file with all mip levels.\n"
+           "\n"
+           "Options:\n"
+           "  -s, --size WxH         Size of the input image\n"
+           "      --no-mipmaps       Only store the full resolution level\n"
+           "  -d, --debug            Display debug messages\n"
+           "  -h, --help             Display help\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    static struct option long_options[] = {
+        {"size", 1, 0, 's'},
+        {"no-mipmaps", 0, 0, 'n'},
+        {"debug", 0, 0, 'd'},
+        {"help", 0, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+    unsigned int width = 0;
+    unsigned int height = 0;
+    bool mipmaps = true;
+    bool debug = false;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "s:dh", long_options, NULL)) != -1) {
+        if (c == 's') {
+            if (sscanf(optarg, "%ux%u", &width, &height) != 2) {
+                fprintf(stderr, "Invalid size '%s'\n", optarg);
+                return 1;
+            }
+        } else if (c == 'n') {
+            mipmaps = false;
+        } else if (c == 'd') {
+            debug = true;
+        } else if (c == 'h') {
+            usage(argv[0]);
+            return 0;
+        } else {
+            return 1;
+        }
+    }
+
+    if (optind + 2 != argc || width < 2 || height < 2 || (width | height) & 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Log::init("pano_compress", debug);
+
+    std::string input(argv[optind]);
+    std::string output(argv[optind + 1]);
+    size_t input_size = static_cast<size_t>(width) * height * 3 / 2;
+    struct stat st;
+
+    int in = open(input.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0 || fstat(in, &st) < 0 || static_cast<size_t>(st.st_size) < input_size) {
+        Log::error("'%s' is not a %ux%u NV12 image\n", input.c_str(), width, height);
+        return 1;
+    }
+
+    void *mapped = mmap(NULL, input_size, PROT_READ, MAP_PRIVATE, in, 0);
+    close(in);
+    if (mapped == MAP_FAILED) {
+        Log::error("Failed to map '%s'\n", input.c_str());
+        return 1;
+    }
+
+    Level level;
+    level.width = width;
+    level.height = height;
+    level.rgba.resize(static_cast<size_t>(width) * height * 4);
+
+    const uint8_t *y = static_cast<const uint8_t *>(mapped);
+    const uint8_t *uv = y + static_cast<size_t>(width) * height;
+    nv12_to_rgba_parallel(y, width, uv, width, &level.rgba[0], width * 4, width, height);
+    munmap(mapped, input_size);
+
+    int out = create_output(output);
+    if (out < 0)
+        return 1;
+
+    struct ktx_header header;
+    const uint8_t identifier[] = KTX_IDENTIFIER;
+    unsigned int levels = 1;
+    if (mipmaps) {
+        while ((width >> levels) || (height >> levels))
+            levels++;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.identifier, identifier, sizeof(identifier));
+    header.endianness = KTX_ENDIANNESS;
+    header.gl_type_size = 1;
+    header.gl_internal_format = KTX_ETC2_RGB8;
+    header.gl_base_internal_format = GL_RGB;
+    header.pixel_width = width;
+    header.pixel_height = height;
+    header.number_of_faces = 1;
+    header.number_of_mipmap_levels = levels;
+
+    bool ok = write_all(out, &header, sizeof(header), 0);
+    uint64_t offset = sizeof(header);
+    std::vector<uint8_t> blocks;
+
+    for (unsigned int l = 0; l < levels && ok; l++) {
+        if (l > 0) {
+            Level next;
+            downsample(level, next);
+            level.width = next.width;
+            level.height = next.height;
+            level.rgba.swap(next.rgba);
+        }
+
+        encode_level(level, blocks);
+
+        // Blocks are 8 bytes, so no level needs padding
+        uint32_t image_size = blocks.size();
+        ok = write_all(out, &image_size, sizeof(image_size), offset) &&
+             write_all(out, &blocks[0], blocks.size(), offset + sizeof(image_size));
+        offset += sizeof(image_size) + blocks.size();
+
+        Log::debug("Level %u: %ux%u, %u bytes\n", l, level.width, level.height, image_size);
+    }
+
+    if (!finish_output(output, out, ok))
+        return 1;
+
+    return 0;
+}
@@ -0,0 +1,260 @@
+/*
+ * Converts a raw NV12 panorama into a tiled panorama container (see
+ * src/panorama-file.h) that --tiled streams from.
+ *
+ * The levels of the mip pyramid are box filtered from one another, and
+ * the tiles of every level are cut and written on all CPUs.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "panorama-file.h"
+#include "tile-source.h"
+#include "tool-util.h"
+#include "util.h"
+#include "log.h"
+
+static const unsigned int TILE_SIZE = TileSource::TILE_SIZE;
+static const unsigned int TILE_BORDER = TileSource::TILE_BORDER;
+static const unsigned int TILE_SLOT = TileSource::TILE_SLOT;
+static const unsigned int TILE_BYTES = TILE_SLOT * TILE_SLOT * 3 / 2;
+
+/* An NV12 image whose chroma plane is rounded up to whole pixel pairs */
+struct Level
+{
+    unsigned int width;
+    unsigned int height;
+    const uint8_t *y;
+    const uint8_t *uv;
+    std::vector<uint8_t> data;
+
+    unsigned int chroma_width() const { return (width + 1) / 2; }
+    unsigned int chroma_height() const { return (height + 1) / 2; }
+};
+
+static uint64_t align(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+/* Averages the 2x2 blocks of @in, clamping at odd edges */
+static void downsample(const Level &in, Level &out)
+{
+    out.width = (in.width + 1) / 2;
+    out.height = (in.height + 1) / 2;
+    out.data.resize(static_cast<size_t>(out.width) * out.height +
+                    static_cast<size_t>(out.chroma_width()) * out.chroma_height() * 2);
+    out.y = &out.data[0];
+    out.uv = out.y + static_cast<size_t>(out.width) * out.height;
+
+    uint8_t *y = &out.data[0];
+    uint8_t *uv = y + static_cast<size_t>(out.width) * out.height;
+
+    downsample_2x2(in.y, in.width, in.height, in.width, y, out.width, out.height, out.width, 1);
+    downsample_2x2(in.uv, in.chroma_width(), in.chroma_height(), in.chroma_width() * 2,
+                   uv, out.chroma_width(), out.chroma_height(), out.chroma_width() * 2, 2);
+}
+
+/*
+ * Cuts a tile with its border out of a level. The panorama wraps around
+ * horizontally and is clamped vertically; the chroma of every pixel pair
+ * of the tile is that of its first pixel.
+ */
+static void cut_tile(const Level &level, unsigned int tx, unsigned int ty, uint8_t *tile)
+{
+    int x0 = static_cast<int>(tx * TILE_SIZE) - TILE_BORDER;
+    int y0 = static_cast<int>(ty * TILE_SIZE) - TILE_BORDER;
+    int width = level.width;
+    int height = level.height;
+    unsigned int pitch = level.chroma_width() * 2;
+    uint8_t *uv = tile + TILE_SLOT * TILE_SLOT;
+
+    for (unsigned int r = 0; r < TILE_SLOT; r++) {
+        int sy = y0 + static_cast<int>(r);
+        sy = sy < 0 ? 0 : (sy >= height ? height - 1 : sy);
+
+        for (unsigned int c = 0; c < TILE_SLOT; c++) {
+            int sx = ((x0 + static_cast<int>(c)) % width + width) % width;
+
+            tile[r * TILE_SLOT + c] = level.y[static_cast<size_t>(sy) * width + sx];
+            if (!(r & 1) && !(c & 1)) {
+                // The pair of the source that covers sx, even where the
+                // border puts an odd column at the start of the tile
+                const uint8_t *s = level.uv + static_cast<size_t>(sy / 2) * pitch + (sx & ~1);
+                uv[(r / 2) * TILE_SLOT + c] = s[0];
+                uv[(r / 2) * TILE_SLOT + c + 1] = s[1];
+            }
+        }
+    }
+}
+
+static void usage(const char *name)
+{
+    printf("Usage: %s -s WxH INPUT OUTPUT\n"
+           "\n"
+           "Converts the raw NV12 panorama INPUT of the given size into the tiled\n"
+           "panorama container OUTPUT.\n"
+           "\n"
+           "Options:\n"
+           "  -s, --size WxH         Size of the input image\n"
+           "  -d, --debug            Display debug messages\n"
+           "  -h, --help             Display help\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    static struct option long_options[] = {
+        {"size", 1, 0, 's'},
+        {"debug", 0, 0, 'd'},
+        {"help", 0, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+    unsigned int width = 0;
+    unsigned int height = 0;
+    bool debug = false;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "s:dh", long_options, NULL)) != -1) {
+        if (c == 's') {
+            if (sscanf(optarg, "%ux%u", &width, &height) != 2) {
+                fprintf(stderr, "Invalid size '%s'\n", optarg);
+                return 1;
+            }
+        } else if (c == 'd') {
+            debug = true;
+        } else if (c == 'h') {
+            usage(argv[0]);
+            return 0;
+        } else {
+            return 1;
+        }
+    }
+
+    if (optind + 2 != argc || width < 2 || height < 2 || (width | height) & 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Log::init("pano_convert", debug);
+
+    std::string input(argv[optind]);
+    std::string output(argv[optind + 1]);
+    size_t input_size = static_cast<size_t>(width) * height * 3 / 2;
+    struct stat st;
+
+    int in = open(input.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0 || fstat(in, &st) < 0 || static_cast<size_t>(st.st_size) < input_size) {
+        Log::error("'%s' is not a %ux%u NV12 image\n", input.c_str(), width, height);
+        return 1;
+    }
+
+    void *mapped = mmap(NULL, input_size, PROT_READ, MAP_PRIVATE, in, 0);
+    close(in);
+    if (mapped == MAP_FAILED) {
+        Log::error("Failed to map '%s'\n", input.c_str());
+        return 1;
+    }
+
+    // The same pyramid as TileSource: down to the first level of one tile
+    std::vector<Level> levels(1);
+    levels[0].width = width;
+    levels[0].height = height;
+    levels[0].y = static_cast<const uint8_t *>(mapped);
+    levels[0].uv = levels[0].y + static_cast<size_t>(width) * height;
+    while ((width >> (levels.size() - 1)) > TILE_SIZE ||
+           (height >> (levels.size() - 1)) > TILE_SIZE) {
+        levels.push_back(Level());
+        downsample(levels[levels.size() - 2], levels.back());
+    }
+
+    struct pano_header header;
+    std::vector<struct pano_level> level_table(levels.size());
+    unsigned int tiles = 0;
+    unsigned int columns0 = (width + TILE_SIZE - 1) / TILE_SIZE;
+    unsigned int rows0 = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+    memset(&level_table[0], 0, level_table.size() * sizeof(struct pano_level));
+    for (unsigned int l = 0; l < levels.size(); l++) {
+        level_table[l].width = levels[l].width;
+        level_table[l].height = levels[l].height;
+        level_table[l].columns = (columns0 + (1 << l) - 1) >> l;
+        level_table[l].rows = (rows0 + (1 << l) - 1) >> l;
+        level_table[l].first_tile = tiles;
+        tiles += level_table[l].columns * level_table[l].rows;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = PANO_MAGIC;
+    header.version = PANO_VERSION;
+    header.header_size = sizeof(header);
+    header.format = PANO_FORMAT_NV12;
+    header.width = width;
+    header.height = height;
+    header.tile_size = TILE_SIZE;
+    header.tile_border = TILE_BORDER;
+    header.levels = levels.size();
+    header.tiles = tiles;
+    header.levels_offset = sizeof(header);
+    header.index_offset = header.levels_offset + level_table.size() * sizeof(struct pano_level);
+
+    std::vector<struct pano_tile> index(tiles);
+    uint64_t payloads = align(header.index_offset + tiles * sizeof(struct pano_tile),
+                              PANO_ALIGNMENT);
+    memset(&index[0], 0, index.size() * sizeof(struct pano_tile));
+    for (unsigned int t = 0; t < tiles; t++) {
+        index[t].offset = payloads + t * align(TILE_BYTES, PANO_ALIGNMENT);
+        index[t].size = TILE_BYTES;
+    }
+    header.file_size = payloads + tiles * align(TILE_BYTES, PANO_ALIGNMENT);
+
+    int out = create_output(output, header.file_size);
+    if (out < 0)
+        return 1;
+
+    std::atomic<bool> ok(true);
+    for (unsigned int l = 0; l < levels.size(); l++) {
+        const struct pano_level &level = level_table[l];
+
+        Util::parallel_for(level.columns * level.rows, [&](unsigned int begin, unsigned int end) {
+            std::vector<uint8_t> tile(TILE_BYTES);
+            for (unsigned int t = begin; t < end; t++) {
+                struct pano_tile &entry = index[level.first_tile + t];
+                cut_tile(levels[l], t % level.columns, t / level.columns, &tile[0]);
+                entry.checksum = Util::hash(&tile[0], TILE_BYTES);
+                if (!write_all(out, &tile[0], TILE_BYTES, entry.offset))
+                    ok = false;
+            }
+        });
+
+        Log::info("Level %u: %ux%u, %u tiles\n", l, level.width, level.height,
+                  level.columns * level.rows);
+    }
+
+    header.checksum = Util::hash(&header, sizeof(header));
+    header.checksum = Util::hash(&level_table[0], level_table.size() * sizeof(struct pano_level),
+                                 header.checksum);
+    header.checksum = Util::hash(&index[0], index.size() * sizeof(struct pano_tile),
+                                 header.checksum);
+
+    ok = ok.load() && write_all(out, &header, sizeof(header), 0) &&
+         write_all(out, &level_table[0], level_table.size() * sizeof(struct pano_level),
+                   header.levels_offset) &&
+         write_all(out, &index[0], index.size() * sizeof(struct pano_tile),
+                   header.index_offset);
+
+    if (!finish_output(output, out, ok))
+        return 1;
+
+    munmap(mapped, input_size);
+
+    return 0;
+}
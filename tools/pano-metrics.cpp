@@ -0,0 +1,251 @@
+/*
+ * Reads the live metrics that panoram_image publishes with --metrics NAME
+ * (see src/metrics-shm.h), prints them and optionally writes them in the
+ * Prometheus text format, for the textfile collector of node_exporter.
+ *
+ * The reader only maps the page read-only, so it can watch the display
+ * without slowing it down.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <string>
+
+#include "metrics-shm.h"
+#include "log.h"
+
+/* Copies the page, retrying while the display is updating it */
+static void read_page(const struct metrics_page *page, struct metrics_page *copy)
+{
+    uint32_t begin, end;
+
+    do {
+        begin = __atomic_load_n(&page->sequence, __ATOMIC_ACQUIRE);
+        memcpy(copy, page, sizeof(*copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        end = __atomic_load_n(&page->sequence, __ATOMIC_RELAXED);
+    } while ((begin & 1) || begin != end);
+}
+
+/* The share of @hits in all lookups, in percent */
+static double hit_rate(uint64_t hits, uint64_t misses)
+{
+    return hits + misses ? 100.0 * hits / (hits + misses) : 0.0;
+}
+
+static void print_page(const struct metrics_page &page)
+{
+    printf("Uptime %.1f s, pid %d\n", page.uptime, page.pid);
+    for (unsigned int o = 0; o < page.outputs; o++) {
+        const struct metrics_output &out = page.output[o];
+        printf("Output %u: %.1f fps, frame time p50 %.2f p90 %.2f p99 %.2f max %.2f ms, "
+               "%llu frames, %llu dropped, render scale %.2f\n", o, out.fps,
+               out.frame_time_p50, out.frame_time_p90, out.frame_time_p99,
+               out.frame_time_max, static_cast<unsigned long long>(out.frames),
+               static_cast<unsigned long long>(out.dropped), out.render_scale);
+    }
+    if (page.pool_buffers) {
+        printf("Source: %llu frames, %llu imports, %.1f%% reused, %u of %u buffers held\n",
+               static_cast<unsigned long long>(page.frames_received),
+               static_cast<unsigned long long>(page.imports),
+               hit_rate(page.import_reuses, page.imports), page.pool_in_use,
+               page.pool_buffers);
+    }
+    printf("Program cache: %llu hits, %llu misses, %.1f%% hit rate\n",
+           static_cast<unsigned long long>(page.program_hits),
+           static_cast<unsigned long long>(page.program_misses),
+           hit_rate(page.program_hits, page.program_misses));
+    if (page.tiles_capacity) {
+        printf("Tiles: %u of %u resident, %.1f%% hit rate\n", page.tiles_resident,
+               page.tiles_capacity, hit_rate(page.tile_hits, page.tile_misses));
+    }
+}
+
+static void write_output_metric(FILE *fp, const struct metrics_page &page, const char *name,
+                                const char *type, const char *help,
+                                double (*value)(const struct metrics_output &))
+{
+    fprintf(fp, "# HELP panorama_%s %s\n# TYPE panorama_%s %s\n", name, help, name, type);
+    for (unsigned int o = 0; o < page.outputs; o++)
+        fprintf(fp, "panorama_%s{output=\"%u\"} %g\n", name, o, value(page.output[o]));
+}
+
+static void write_metric(FILE *fp, const char *name, const char *type, const char *help,
+                         double value)
+{
+    fprintf(fp, "# HELP panorama_%s %s\n# TYPE panorama_%s %s\npanorama_%s %g\n",
+            name, help, name, type, name, value);
+}
+
+/*
+ * Writes the page in the Prometheus text exposition format. The file is
+ * written next to @path and renamed, so a scrape never sees half of it.
+ */
+static bool write_prometheus(const std::string &path, const struct metrics_page &page)
+{
+    std::string tmp(path + ".tmp");
+    FILE *fp = fopen(tmp.c_str(), "w");
+    if (!fp) {
+        Log::error("Failed to write '%s'\n", tmp.c_str());
+        return false;
+    }
+
+    write_metric(fp, "uptime_seconds", "gauge", "Seconds since the display started",
+                 page.uptime);
+    write_output_metric(fp, page, "frames_total", "counter", "Frames presented",
+        [](const struct metrics_output &o) { return static_cast<double>(o.frames); });
+    write_output_metric(fp, page, "dropped_frames_total", "counter",
+                        "Frames that missed their vblank",
+        [](const struct metrics_output &o) { return static_cast<double>(o.dropped); });
+    write_output_metric(fp, page, "fps", "gauge", "Frames presented per second",
+        [](const struct metrics_output &o) { return o.fps; });
+    write_output_metric(fp, page, "frame_time_p50_ms", "gauge", "Median frame time",
+        [](const struct metrics_output &o) { return o.frame_time_p50; });
+    write_output_metric(fp, page, "frame_time_p90_ms", "gauge", "90th percentile frame time",
+        [](const struct metrics_output &o) { return o.frame_time_p90; });
+    write_output_metric(fp, page, "frame_time_p99_ms", "gauge", "99th percentile frame time",
+        [](const struct metrics_output &o) { return o.frame_time_p99; });
+    write_output_metric(fp, page, "frame_time_max_ms", "gauge", "Longest frame time",
+        [](const struct metrics_output &o) { return o.frame_time_max; });
+    write_output_metric(fp, page, "render_scale", "gauge", "Dynamic resolution scale",
+        [](const struct metrics_output &o) { return o.render_scale; });
+    write_metric(fp, "source_frames_total", "counter", "Frames of the live source",
+                 page.frames_received);
+    write_metric(fp, "imports_total", "counter", "Dma-buf imports of the live source",
+                 page.imports);
+    write_metric(fp, "import_reuses_total", "counter",
+                 "Frames whose buffer was already imported", page.import_reuses);
+    write_metric(fp, "pool_buffers", "gauge", "Buffers of the live source", page.pool_buffers);
+    write_metric(fp, "pool_in_use", "gauge", "Buffers held for drawing", page.pool_in_use);
+    write_metric(fp, "program_cache_hits_total", "counter",
+                 "Shader programs loaded from the cache", page.program_hits);
+    write_metric(fp, "program_cache_misses_total", "counter", "Shader programs compiled",
+                 page.program_misses);
+    write_metric(fp, "tile_hits_total", "counter", "Visible tiles that were on the GPU",
+                 page.tile_hits);
+    write_metric(fp, "tile_misses_total", "counter", "Visible tiles that were still missing",
+                 page.tile_misses);
+    write_metric(fp, "tiles_resident", "gauge", "Tiles in the atlas", page.tiles_resident);
+    write_metric(fp, "tiles_capacity", "gauge", "Tiles the atlas holds", page.tiles_capacity);
+
+    if (fclose(fp) != 0 || rename(tmp.c_str(), path.c_str()) < 0) {
+        Log::error("Failed to write '%s'\n", path.c_str());
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [OPTIONS] NAME\n"
+           "\n"
+           "Prints the live metrics that panoram_image --metrics NAME publishes.\n"
+           "\n"
+           "Options:\n"
+           "  -p, --prometheus FILE  Also write the metrics to FILE in the Prometheus\n"
+           "                         text format\n"
+           "  -i, --interval SECONDS Keep reading every SECONDS until the display exits\n"
+           "  -h, --help             Display help\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    static struct option long_options[] = {
+        {"prometheus", 1, 0, 'p'},
+        {"interval", 1, 0, 'i'},
+        {"help", 0, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+    std::string prometheus;
+    double interval = 0.0;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "p:i:h", long_options, NULL)) != -1) {
+        if (c == 'p') {
+            prometheus = optarg;
+        } else if (c == 'i') {
+            interval = atof(optarg);
+            if (interval <= 0.0) {
+                fprintf(stderr, "Invalid interval '%s'\n", optarg);
+                return 1;
+            }
+        } else if (c == 'h') {
+            usage(argv[0]);
+            return 0;
+        } else {
+            return 1;
+        }
+    }
+
+    if (optind + 1 != argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Log::init("pano_metrics", false);
+
+    std::string name(std::string("/") + argv[optind]);
+    int fd = shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        Log::error("No metrics are published as '%s'\n", argv[optind]);
+        return 1;
+    }
+
+    void *mapped = mmap(NULL, sizeof(struct metrics_page), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        Log::error("Failed to map '%s'\n", name.c_str());
+        return 1;
+    }
+
+    const struct metrics_page *page = static_cast<const struct metrics_page *>(mapped);
+    if (page->magic != METRICS_MAGIC || page->version != METRICS_VERSION) {
+        Log::error("'%s' does not hold version %d metrics\n", name.c_str(), METRICS_VERSION);
+        munmap(mapped, sizeof(struct metrics_page));
+        return 1;
+    }
+
+    int ret = 0;
+    for (;;) {
+        struct metrics_page copy;
+
+        read_page(page, &copy);
+        if (copy.outputs > METRICS_MAX_OUTPUTS)
+            copy.outputs = METRICS_MAX_OUTPUTS;
+
+        print_page(copy);
+        if (!prometheus.empty() && !write_prometheus(prometheus, copy)) {
+            ret = 1;
+            break;
+        }
+
+        // A display that crashed leaves its page behind
+        if (kill(copy.pid, 0) < 0 && errno == ESRCH) {
+            Log::info("The display (pid %d) has exited\n", copy.pid);
+            break;
+        }
+        if (interval <= 0.0)
+            break;
+
+        printf("\n");
+        fflush(stdout);
+
+        struct timespec ts;
+        ts.tv_sec = static_cast<time_t>(interval);
+        ts.tv_nsec = static_cast<long>((interval - ts.tv_sec) * 1000000000.0);
+        nanosleep(&ts, NULL);
+    }
+
+    munmap(mapped, sizeof(struct metrics_page));
+
+    return ret;
+}
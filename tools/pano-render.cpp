@@ -0,0 +1,177 @@
+/*
+ * Renders views of a raw NV12 panorama on the CPU, with the projection
+ * panoram_image uses, e.g. for thumbnails or for dewarping a batch of
+ * views on machines without a GPU.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+
+#include "reference-renderer.h"
+#include "camera.h"
+#include "log.h"
+
+/* Writes @rgba as a binary PPM, dropping alpha */
+static bool write_ppm(const std::string &path, const std::vector<uint8_t> &rgba,
+                      unsigned int width, unsigned int height)
+{
+    std::vector<uint8_t> rgb(static_cast<size_t>(width) * height * 3);
+
+    for (size_t i = 0; i < static_cast<size_t>(width) * height; i++) {
+        rgb[i * 3] = rgba[i * 4];
+        rgb[i * 3 + 1] = rgba[i * 4 + 1];
+        rgb[i * 3 + 2] = rgba[i * 4 + 2];
+    }
+
+    FILE *out = fopen(path.c_str(), "wb");
+    if (!out) {
+        Log::error("Failed to create '%s'\n", path.c_str());
+        return false;
+    }
+
+    fprintf(out, "P6\n%u %u\n255\n", width, height);
+    bool written = fwrite(&rgb[0], rgb.size(), 1, out) == 1;
+    if (fclose(out) != 0 || !written) {
+        Log::error("Failed to write '%s'\n", path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+static void usage(const char *name)
+{
+    printf("Usage: %s -s WxH [OPTIONS] INPUT PREFIX\n"
+           "\n"
+           "Renders views of the raw NV12 panorama INPUT of the given size as\n"
+           "panoram_image shows them, into the PPM images PREFIX-N.ppm.\n"
+           "\n"
+           "Options:\n"
+           "  -s, --size WxH         Size of the input image\n"
+           "  -o, --output-size WxH  Size of the views (default: 1280x720)\n"
+           "  -y, --yaw DEGREES      Render a view in this direction; give once\n"
+           "                         per view\n"
+           "  -n, --views N          Render N views evenly spaced around the\n"
+           "                         panorama, as the outputs of panoram_image\n"
+           "                         look (default: 1)\n"
+           "  -p, --pitch DEGREES    Look up or down in all views (default: 0)\n"
+           "  -d, --debug            Display debug messages\n"
+           "  -h, --help             Display help\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    static struct option long_options[] = {
+        {"size", 1, 0, 's'},
+        {"output-size", 1, 0, 'o'},
+        {"yaw", 1, 0, 'y'},
+        {"views", 1, 0, 'n'},
+        {"pitch", 1, 0, 'p'},
+        {"debug", 0, 0, 'd'},
+        {"help", 0, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+    unsigned int width = 0;
+    unsigned int height = 0;
+    unsigned int view_width = 1280;
+    unsigned int view_height = 720;
+    std::vector<float> yaws;
+    int views = 1;
+    float pitch = 0.0f;
+    bool debug = false;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "s:o:y:n:p:dh", long_options, NULL)) != -1) {
+        if (c == 's') {
+            if (sscanf(optarg, "%ux%u", &width, &height) != 2) {
+                fprintf(stderr, "Invalid size '%s'\n", optarg);
+                return 1;
+            }
+        } else if (c == 'o') {
+            if (sscanf(optarg, "%ux%u", &view_width, &view_height) != 2 ||
+                !view_width || !view_height) {
+                fprintf(stderr, "Invalid output size '%s'\n", optarg);
+                return 1;
+            }
+        } else if (c == 'y') {
+            yaws.push_back(atof(optarg));
+        } else if (c == 'n') {
+            views = atoi(optarg);
+            if (views <= 0) {
+                fprintf(stderr, "Invalid number of views '%s'\n", optarg);
+                return 1;
+            }
+        } else if (c == 'p') {
+            pitch = atof(optarg);
+        } else if (c == 'd') {
+            debug = true;
+        } else if (c == 'h') {
+            usage(argv[0]);
+            return 0;
+        } else {
+            return 1;
+        }
+    }
+
+    if (optind + 2 != argc || width < 2 || height < 2 || (width | height) & 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Log::init("pano_render", debug);
+
+    std::string input(argv[optind]);
+    std::string prefix(argv[optind + 1]);
+    size_t input_size = static_cast<size_t>(width) * height * 3 / 2;
+    struct stat st;
+
+    int in = open(input.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0 || fstat(in, &st) < 0 || static_cast<size_t>(st.st_size) < input_size) {
+        Log::error("'%s' is not a %ux%u NV12 image\n", input.c_str(), width, height);
+        return 1;
+    }
+
+    void *mapped = mmap(NULL, input_size, PROT_READ, MAP_PRIVATE, in, 0);
+    close(in);
+    if (mapped == MAP_FAILED) {
+        Log::error("Failed to map '%s'\n", input.c_str());
+        return 1;
+    }
+
+    const uint8_t *y = static_cast<const uint8_t *>(mapped);
+    ReferenceRenderer renderer(y, width, y + static_cast<size_t>(width) * height, width,
+                               width, height);
+    std::vector<uint8_t> rgba(static_cast<size_t>(view_width) * view_height * 4);
+
+    if (yaws.empty()) {
+        for (int i = 0; i < views; i++)
+            yaws.push_back(360.0f * i / views);
+    }
+
+    int ret = 0;
+    for (unsigned int i = 0; i < yaws.size(); i++) {
+        Camera camera(yaws[i], pitch);
+        float mvp[16];
+        char path[32];
+
+        camera.mvp(mvp);
+        renderer.render(mvp, view_width, view_height, &rgba[0]);
+
+        snprintf(path, sizeof(path), "-%u.ppm", i);
+        if (!write_ppm(prefix + path, rgba, view_width, view_height)) {
+            ret = 1;
+            break;
+        }
+        Log::debug("Rendered the view at %.1f degrees\n", yaws[i]);
+    }
+
+    munmap(mapped, input_size);
+
+    return ret;
+}
@@ -0,0 +1,78 @@
+#include "tool-util.h"
+#include "util.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+void downsample_2x2(const uint8_t *in, unsigned int in_width, unsigned int in_height,
+                    size_t in_pitch, uint8_t *out, unsigned int out_width,
+                    unsigned int out_height, size_t out_pitch, unsigned int channels)
+{
+    Util::parallel_for(out_height, [&](unsigned int begin, unsigned int end) {
+        for (unsigned int r = begin; r < end; r++) {
+            unsigned int r0 = 2 * r < in_height ? 2 * r : in_height - 1;
+            unsigned int r1 = 2 * r + 1 < in_height ? 2 * r + 1 : r0;
+            const uint8_t *s0 = in + r0 * in_pitch;
+            const uint8_t *s1 = in + r1 * in_pitch;
+            uint8_t *d = out + r * out_pitch;
+
+            for (unsigned int c = 0; c < out_width; c++) {
+                unsigned int c0 = 2 * c < in_width ? 2 * c : in_width - 1;
+                unsigned int c1 = 2 * c + 1 < in_width ? 2 * c + 1 : c0;
+                for (unsigned int k = 0; k < channels; k++) {
+                    d[c * channels + k] = (s0[c0 * channels + k] + s0[c1 * channels + k] +
+                                           s1[c0 * channels + k] + s1[c1 * channels + k] +
+                                           2) / 4;
+                }
+            }
+        }
+    });
+}
+
+int create_output(const std::string &path, uint64_t size)
+{
+    std::string tmp(path + ".tmp");
+
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd >= 0 && size > 0 && ftruncate(fd, size) < 0) {
+        close(fd);
+        unlink(tmp.c_str());
+        fd = -1;
+    }
+
+    if (fd < 0)
+        Log::error("Failed to create '%s'\n", tmp.c_str());
+
+    return fd;
+}
+
+bool finish_output(const std::string &path, int fd, bool ok)
+{
+    std::string tmp(path + ".tmp");
+
+    if (close(fd) < 0 || !ok || rename(tmp.c_str(), path.c_str()) < 0) {
+        Log::error("Failed to write '%s'\n", path.c_str());
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool write_all(int fd, const void *data, size_t size, uint64_t offset)
+{
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+
+    while (size > 0) {
+        ssize_t written = pwrite(fd, bytes, size, offset);
+        if (written <= 0)
+            return false;
+        bytes += written;
+        size -= written;
+        offset += written;
+    }
+
+    return true;
+}
@@ -0,0 +1,58 @@
+#ifndef TOOL_UTIL_H_
+#define TOOL_UTIL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+/*
+ * Helpers the offline converters in tools/ share: box filtering of mip
+ * levels and writing their output files.
+ */
+
+/**
+ * Averages the 2x2 blocks of an image of interleaved 8-bit samples, on
+ * all CPUs. Blocks that reach past an odd right or bottom edge repeat its
+ * last column or row.
+ *
+ * @param in the source image
+ * @param in_width the width of the source in samples of @channels
+ * @param in_height the height of the source in rows
+ * @param in_pitch the bytes between two rows of the source
+ * @param out the image to fill
+ * @param out_width the width of the output, at most (in_width + 1) / 2
+ * @param out_height the height of the output, at most (in_height + 1) / 2
+ * @param out_pitch the bytes between two rows of the output
+ * @param channels the interleaved samples per pixel, e.g. 2 for NV12 chroma
+ */
+void downsample_2x2(const uint8_t *in, unsigned int in_width, unsigned int in_height,
+                    size_t in_pitch, uint8_t *out, unsigned int out_width,
+                    unsigned int out_height, size_t out_pitch, unsigned int channels);
+
+/**
+ * Creates a temporary file next to @path, which finish_output() renames
+ * to @path once it is complete, so no half written output is ever left.
+ *
+ * @param path the path of the output
+ * @param size the size to extend the file to, or 0
+ *
+ * @return the file descriptor of the temporary file, or -1
+ */
+int create_output(const std::string &path, uint64_t size = 0);
+
+/**
+ * Closes the temporary file of create_output() and moves it to @path, or
+ * removes it if @ok is false or anything fails.
+ *
+ * @return whether @path now holds the output
+ */
+bool finish_output(const std::string &path, int fd, bool ok);
+
+/**
+ * Writes all of @data at @offset of @fd, from any thread.
+ *
+ * @return whether everything was written
+ */
+bool write_all(int fd, const void *data, size_t size, uint64_t offset);
+
+#endif /* TOOL_UTIL_H_ */